@@ -0,0 +1,397 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "blas_build_scheduler.h"
+
+#include <donut/core/log.h>
+#include <nvrhi/utils.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+
+#ifdef DONUT_WITH_DX12
+#include <d3d12.h>
+#endif
+
+#ifdef DONUT_WITH_VULKAN
+#ifndef VULKAN_HPP_DISPATCH_LOADER_DYNAMIC
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#endif
+#include <vulkan/vulkan.hpp>
+#endif
+
+using namespace donut;
+
+// Smallest scratch size assumed for a build, which covers the fixed overhead of tiny builds
+static const uint64_t c_MinScratchPerBuild = 64 * 1024;
+static const size_t c_ScratchChunkSize = 16 << 20;
+
+bool ParseBlasScratchBudget(const char* value, uint64_t& budget)
+{
+    if (!value)
+    {
+        log::error("Missing value for -blasScratchBudget, expected a number of megabytes");
+        return false;
+    }
+
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long megabytes = std::strtoull(value, &end, 10);
+    if (end == value || *end != 0 || errno == ERANGE || value[0] == '-' || megabytes == 0 || megabytes > (~0ull >> 20))
+    {
+        log::error("Invalid value '%s' for -blasScratchBudget, expected a positive number of megabytes", value);
+        return false;
+    }
+
+    budget = uint64_t(megabytes) << 20;
+    return true;
+}
+
+BlasBuildScheduler::BlasBuildScheduler(nvrhi::IDevice* device, uint64_t scratchBudget)
+    : m_Device(device)
+    , m_ScratchBudget(scratchBudget)
+{
+    m_TimerQuery = m_Device->createTimerQuery();
+}
+
+nvrhi::rt::AccelStructHandle BlasBuildScheduler::Enqueue(const nvrhi::rt::AccelStructDesc& desc)
+{
+    PendingBuild build;
+    build.accelStruct = m_Device->createAccelStruct(desc);
+    build.desc = desc;
+
+    if (build.accelStruct)
+    {
+        bool fromDriver = false;
+        build.scratchSize = GetScratchSize(build, fromDriver);
+        if (fromDriver)
+            ++m_Statistics.numDriverScratchSizes;
+
+        m_PendingBuilds.push_back(build);
+    }
+
+    return build.accelStruct;
+}
+
+// nvrhi's geometry and build flags use the same bit values as the D3D12 and Vulkan flags, except for
+// PerformUpdate which is not a flag of the build inputs
+static uint32_t GetNativeBuildFlags(nvrhi::rt::AccelStructBuildFlags flags)
+{
+    return uint32_t(flags) & ~uint32_t(nvrhi::rt::AccelStructBuildFlags::PerformUpdate);
+}
+
+#ifdef DONUT_WITH_DX12
+static DXGI_FORMAT GetDxgiGeometryFormat(nvrhi::Format format)
+{
+    switch (format)
+    {
+    case nvrhi::Format::R16_UINT:    return DXGI_FORMAT_R16_UINT;
+    case nvrhi::Format::R32_UINT:    return DXGI_FORMAT_R32_UINT;
+    case nvrhi::Format::RG16_FLOAT:  return DXGI_FORMAT_R16G16_FLOAT;
+    case nvrhi::Format::RGBA16_FLOAT: return DXGI_FORMAT_R16G16B16A16_FLOAT;
+    case nvrhi::Format::RG32_FLOAT:  return DXGI_FORMAT_R32G32_FLOAT;
+    case nvrhi::Format::RGB32_FLOAT: return DXGI_FORMAT_R32G32B32_FLOAT;
+    default:                         return DXGI_FORMAT_UNKNOWN;
+    }
+}
+
+static bool GetD3D12ScratchSize(nvrhi::IDevice* device, const nvrhi::rt::AccelStructDesc& desc, uint64_t& scratchSize)
+{
+    ID3D12Device* d3dDevice = device->getNativeObject(nvrhi::ObjectTypes::D3D12_Device);
+    if (!d3dDevice)
+        return false;
+
+    nvrhi::RefCountPtr<ID3D12Device5> d3dDevice5;
+    if (FAILED(d3dDevice->QueryInterface(IID_PPV_ARGS(&d3dDevice5))))
+        return false;
+
+    // The driver only looks at the counts and formats here, the buffer addresses can stay null
+    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs;
+    for (const auto& geometry : desc.bottomLevelGeometries)
+    {
+        D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
+        geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAGS(geometry.flags);
+
+        if (geometry.geometryType == nvrhi::rt::GeometryType::Triangles)
+        {
+            const auto& triangles = geometry.geometryData.triangles;
+            geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+            geometryDesc.Triangles.VertexFormat = GetDxgiGeometryFormat(triangles.vertexFormat);
+            geometryDesc.Triangles.VertexCount = triangles.vertexCount;
+            geometryDesc.Triangles.VertexBuffer.StrideInBytes = triangles.vertexStride;
+            if (triangles.indexFormat != nvrhi::Format::UNKNOWN)
+            {
+                geometryDesc.Triangles.IndexFormat = GetDxgiGeometryFormat(triangles.indexFormat);
+                geometryDesc.Triangles.IndexCount = triangles.indexCount;
+                if (geometryDesc.Triangles.IndexFormat == DXGI_FORMAT_UNKNOWN)
+                    return false;
+            }
+
+            if (geometryDesc.Triangles.VertexFormat == DXGI_FORMAT_UNKNOWN)
+                return false;
+        }
+        else
+        {
+            geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS;
+            geometryDesc.AABBs.AABBCount = geometry.geometryData.aabbs.count;
+            geometryDesc.AABBs.AABBs.StrideInBytes = geometry.geometryData.aabbs.stride;
+        }
+
+        geometryDescs.push_back(geometryDesc);
+    }
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
+    inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+    inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS(GetNativeBuildFlags(desc.buildFlags));
+    inputs.NumDescs = UINT(geometryDescs.size());
+    inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    inputs.pGeometryDescs = geometryDescs.data();
+
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+    d3dDevice5->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &prebuildInfo);
+
+    scratchSize = prebuildInfo.ScratchDataSizeInBytes;
+    return scratchSize != 0;
+}
+#endif
+
+#ifdef DONUT_WITH_VULKAN
+static VkFormat GetVkGeometryFormat(nvrhi::Format format)
+{
+    switch (format)
+    {
+    case nvrhi::Format::RG16_FLOAT:   return VK_FORMAT_R16G16_SFLOAT;
+    case nvrhi::Format::RGBA16_FLOAT: return VK_FORMAT_R16G16B16A16_SFLOAT;
+    case nvrhi::Format::RG32_FLOAT:   return VK_FORMAT_R32G32_SFLOAT;
+    case nvrhi::Format::RGB32_FLOAT:  return VK_FORMAT_R32G32B32_SFLOAT;
+    default:                          return VK_FORMAT_UNDEFINED;
+    }
+}
+
+static bool GetVulkanScratchSize(nvrhi::IDevice* device, const nvrhi::rt::AccelStructDesc& desc, uint64_t& scratchSize)
+{
+    VkDevice vkDevice = device->getNativeObject(nvrhi::ObjectTypes::VK_Device);
+    const PFN_vkGetAccelerationStructureBuildSizesKHR getBuildSizes =
+        VULKAN_HPP_DEFAULT_DISPATCHER.vkGetAccelerationStructureBuildSizesKHR;
+    if (!vkDevice || !getBuildSizes)
+        return false;
+
+    // As with D3D12, only the counts and formats matter for the size query
+    std::vector<VkAccelerationStructureGeometryKHR> geometries;
+    std::vector<uint32_t> maxPrimitiveCounts;
+    for (const auto& geometry : desc.bottomLevelGeometries)
+    {
+        VkAccelerationStructureGeometryKHR geometryInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+        geometryInfo.flags = VkGeometryFlagsKHR(geometry.flags);
+
+        if (geometry.geometryType == nvrhi::rt::GeometryType::Triangles)
+        {
+            const auto& triangles = geometry.geometryData.triangles;
+            auto& trianglesInfo = geometryInfo.geometry.triangles;
+            trianglesInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
+            geometryInfo.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+            trianglesInfo.vertexFormat = GetVkGeometryFormat(triangles.vertexFormat);
+            trianglesInfo.vertexStride = triangles.vertexStride;
+            trianglesInfo.maxVertex = std::max(triangles.vertexCount, 1u) - 1;
+
+            if (trianglesInfo.vertexFormat == VK_FORMAT_UNDEFINED)
+                return false;
+
+            switch (triangles.indexFormat)
+            {
+            case nvrhi::Format::R16_UINT: trianglesInfo.indexType = VK_INDEX_TYPE_UINT16; break;
+            case nvrhi::Format::R32_UINT: trianglesInfo.indexType = VK_INDEX_TYPE_UINT32; break;
+            case nvrhi::Format::UNKNOWN:  trianglesInfo.indexType = VK_INDEX_TYPE_NONE_KHR; break;
+            default: return false;
+            }
+
+            const uint32_t numIndices = triangles.indexFormat == nvrhi::Format::UNKNOWN ? triangles.vertexCount : triangles.indexCount;
+            maxPrimitiveCounts.push_back(numIndices / 3);
+        }
+        else
+        {
+            geometryInfo.geometryType = VK_GEOMETRY_TYPE_AABBS_KHR;
+            geometryInfo.geometry.aabbs = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR };
+            geometryInfo.geometry.aabbs.stride = geometry.geometryData.aabbs.stride;
+            maxPrimitiveCounts.push_back(geometry.geometryData.aabbs.count);
+        }
+
+        geometries.push_back(geometryInfo);
+    }
+
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+    buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    buildInfo.flags = VkBuildAccelerationStructureFlagsKHR(GetNativeBuildFlags(desc.buildFlags));
+    buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    buildInfo.geometryCount = uint32_t(geometries.size());
+    buildInfo.pGeometries = geometries.data();
+
+    VkAccelerationStructureBuildSizesInfoKHR buildSizes = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+    getBuildSizes(vkDevice, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, maxPrimitiveCounts.data(), &buildSizes);
+
+    scratchSize = buildSizes.buildScratchSize;
+    return scratchSize != 0;
+}
+#endif
+
+// nvrhi does not report the scratch size of a build, so it is queried from the native device with the same
+// geometry and flags that the build uses. When that is not possible, on other graphics APIs or with vertex
+// formats not handled above, the size of the acceleration structure itself stands in for it.
+uint64_t BlasBuildScheduler::GetScratchSize(const PendingBuild& build, bool& fromDriver) const
+{
+    uint64_t scratchSize = 0;
+    fromDriver = false;
+
+#ifdef DONUT_WITH_DX12
+    if (m_Device->getGraphicsAPI() == nvrhi::GraphicsAPI::D3D12)
+        fromDriver = GetD3D12ScratchSize(m_Device, build.desc, scratchSize);
+#endif
+#ifdef DONUT_WITH_VULKAN
+    if (m_Device->getGraphicsAPI() == nvrhi::GraphicsAPI::VULKAN)
+        fromDriver = GetVulkanScratchSize(m_Device, build.desc, scratchSize);
+#endif
+
+    if (!fromDriver)
+        scratchSize = m_Device->getAccelStructMemoryRequirements(build.accelStruct).size;
+
+    return std::max(scratchSize, c_MinScratchPerBuild);
+}
+
+double BlasBuildScheduler::SubmitAndWait()
+{
+    m_CommandList->endTimerQuery(m_TimerQuery);
+    m_CommandList->close();
+    m_Device->executeCommandList(m_CommandList);
+    m_Device->waitForIdle();
+
+    double seconds = double(m_Device->getTimerQueryTime(m_TimerQuery));
+    m_Device->resetTimerQuery(m_TimerQuery);
+    return seconds;
+}
+
+double BlasBuildScheduler::BuildBatch(const PendingBuild* builds, size_t count)
+{
+    m_CommandList->open();
+    m_CommandList->beginTimerQuery(m_TimerQuery);
+    m_CommandList->beginMarker("BLAS Build Batch");
+
+    for (size_t index = 0; index < count; index++)
+        nvrhi::utils::BuildBottomLevelAccelStruct(m_CommandList, builds[index].accelStruct, builds[index].desc);
+
+    m_CommandList->endMarker();
+
+    // Waiting here returns the scratch chunks used by this batch to the command list's pool,
+    // and makes the compacted sizes of the new acceleration structures available.
+    return SubmitAndWait();
+}
+
+double BlasBuildScheduler::CompactBatch()
+{
+    m_CommandList->open();
+    m_CommandList->beginTimerQuery(m_TimerQuery);
+    m_CommandList->beginMarker("BLAS Compaction");
+    m_CommandList->compactBottomLevelAccelStructs();
+    m_CommandList->endMarker();
+
+    return SubmitAndWait();
+}
+
+const BlasBuildStatistics& BlasBuildScheduler::Execute()
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Build the largest structures first. Their scratch chunks are allocated while the pool is still empty,
+    // and the smaller builds of the later batches reuse them instead of allocating more.
+    std::stable_sort(m_PendingBuilds.begin(), m_PendingBuilds.end(), [](const PendingBuild& a, const PendingBuild& b)
+    {
+        return a.scratchSize > b.scratchSize;
+    });
+
+    // The budget only decides how the builds are split into batches. The scratch pool itself is not capped by it,
+    // because a build that does not fit into the pool fails instead of waiting: partly used chunks and sizes that
+    // are only estimated can take a batch over the budget. The limit below is never reached, since even without
+    // any reuse between batches each build fits into its own chunks.
+    uint64_t scratchLimit = 0;
+    for (const auto& build : m_PendingBuilds)
+        scratchLimit += build.scratchSize + c_ScratchChunkSize;
+
+    m_CommandList = m_Device->createCommandList(nvrhi::CommandListParameters()
+        .setScratchChunkSize(c_ScratchChunkSize)
+        .setScratchMaxMemory(size_t(scratchLimit)));
+
+    for (const auto& build : m_PendingBuilds)
+        m_Statistics.sizeBeforeCompaction += m_Device->getAccelStructMemoryRequirements(build.accelStruct).size;
+
+    size_t batchStart = 0;
+    while (batchStart < m_PendingBuilds.size())
+    {
+        size_t batchEnd = batchStart;
+        uint64_t batchScratch = 0;
+        while (batchEnd < m_PendingBuilds.size() &&
+            (batchEnd == batchStart || batchScratch + m_PendingBuilds[batchEnd].scratchSize <= m_ScratchBudget))
+        {
+            batchScratch += m_PendingBuilds[batchEnd].scratchSize;
+            ++batchEnd;
+        }
+
+        m_Statistics.buildTimeSeconds += BuildBatch(m_PendingBuilds.data() + batchStart, batchEnd - batchStart);
+        m_Statistics.compactionTimeSeconds += CompactBatch();
+        m_Statistics.peakBatchScratchSize = std::max(m_Statistics.peakBatchScratchSize, batchScratch);
+        ++m_Statistics.numBatches;
+
+        batchStart = batchEnd;
+    }
+
+    for (const auto& build : m_PendingBuilds)
+    {
+        m_Statistics.sizeAfterCompaction += m_Device->getAccelStructMemoryRequirements(build.accelStruct).size;
+        if (build.accelStruct->isCompacted())
+            ++m_Statistics.numCompactedAccelStructs;
+    }
+
+    m_Statistics.numAccelStructs += m_PendingBuilds.size();
+    m_PendingBuilds.clear();
+    m_CommandList = nullptr;
+
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    m_Statistics.totalTimeSeconds += std::chrono::duration<double>(endTime - startTime).count();
+
+    return m_Statistics;
+}
+
+void BlasBuildScheduler::LogStatistics() const
+{
+    const double megabyte = 1024.0 * 1024.0;
+
+    log::info("Built %zu BLAS in %zu batches (scratch budget %.1f MB, largest batch %.1f MB, %zu scratch sizes from the driver)",
+        m_Statistics.numAccelStructs, m_Statistics.numBatches, double(m_ScratchBudget) / megabyte,
+        double(m_Statistics.peakBatchScratchSize) / megabyte, m_Statistics.numDriverScratchSizes);
+
+    log::info("BLAS memory: %.2f MB before compaction, %.2f MB after (%zu compacted)",
+        double(m_Statistics.sizeBeforeCompaction) / megabyte, double(m_Statistics.sizeAfterCompaction) / megabyte,
+        m_Statistics.numCompactedAccelStructs);
+
+    log::info("BLAS timing: build %.2f ms, compaction %.2f ms (GPU), total %.2f ms (CPU)",
+        m_Statistics.buildTimeSeconds * 1e3, m_Statistics.compactionTimeSeconds * 1e3, m_Statistics.totalTimeSeconds * 1e3);
+}
@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+#include <vector>
+
+// Builds the bottom-level acceleration structures of a scene at load time in batches, so that the transient
+// scratch memory used by the builds stays under a budget instead of growing with the size of the scene.
+// All batches are recorded into one command list, so the scratch chunks of a finished batch are reused by the next
+// one. Each batch is compacted as soon as it has completed. The scratch size of each build is queried from the
+// native D3D12 or Vulkan device, and estimated from the acceleration structure size where that is not possible.
+
+static const uint64_t c_DefaultBlasScratchBudget = 256ull << 20;
+
+// Parses the value of the -blasScratchBudget option, a positive number of megabytes, and logs an error if it is
+// missing (null) or invalid
+bool ParseBlasScratchBudget(const char* value, uint64_t& budget);
+
+struct BlasBuildStatistics
+{
+    size_t numAccelStructs = 0;
+    size_t numCompactedAccelStructs = 0;
+    size_t numBatches = 0;
+    uint64_t sizeBeforeCompaction = 0;
+    uint64_t sizeAfterCompaction = 0;
+    size_t numDriverScratchSizes = 0;   // builds whose scratch size came from the driver instead of an estimate
+    uint64_t peakBatchScratchSize = 0;
+    double buildTimeSeconds = 0.0;      // GPU time spent in the build batches
+    double compactionTimeSeconds = 0.0; // GPU time spent compacting
+    double totalTimeSeconds = 0.0;      // CPU wall clock time of Execute, including the waits
+};
+
+class BlasBuildScheduler
+{
+public:
+    BlasBuildScheduler(nvrhi::IDevice* device, uint64_t scratchBudget = c_DefaultBlasScratchBudget);
+
+    // Creates the acceleration structure and queues its build. The build happens in Execute.
+    nvrhi::rt::AccelStructHandle Enqueue(const nvrhi::rt::AccelStructDesc& desc);
+
+    // Builds and compacts all queued acceleration structures, waiting for the device between batches.
+    const BlasBuildStatistics& Execute();
+
+    [[nodiscard]] const BlasBuildStatistics& GetStatistics() const { return m_Statistics; }
+    void LogStatistics() const;
+
+private:
+    struct PendingBuild
+    {
+        nvrhi::rt::AccelStructHandle accelStruct;
+        nvrhi::rt::AccelStructDesc desc;
+        uint64_t scratchSize = 0;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    nvrhi::CommandListHandle m_CommandList;
+    nvrhi::TimerQueryHandle m_TimerQuery;
+    uint64_t m_ScratchBudget;
+    std::vector<PendingBuild> m_PendingBuilds;
+    BlasBuildStatistics m_Statistics;
+
+    uint64_t GetScratchSize(const PendingBuild& build, bool& fromDriver) const;
+    double BuildBatch(const PendingBuild* builds, size_t count);
+    double CompactBatch();
+    double SubmitAndWait();
+};
@@ -0,0 +1,248 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+
+#include "pipeline_cache.h"
+
+#include <donut/core/log.h>
+#include <chrono>
+#include <mutex>
+#include <type_traits>
+
+using namespace donut;
+
+namespace
+{
+    // Appends the fields of a desc to a byte string that is used as the map key
+    class KeyBuilder
+    {
+    public:
+        template<typename T>
+        KeyBuilder& Add(const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            m_Key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+            return *this;
+        }
+
+        KeyBuilder& Add(const std::string& value)
+        {
+            Add(uint32_t(value.size()));
+            m_Key.append(value);
+            return *this;
+        }
+
+        KeyBuilder& Add(const char* value)
+        {
+            return Add(std::string(value ? value : ""));
+        }
+
+        template<typename T>
+        KeyBuilder& Add(const nvrhi::RefCountPtr<T>& object)
+        {
+            return Add(static_cast<const void*>(object.Get()));
+        }
+
+        // Shaders are compared by their bytecode and entry point, because a shader library returns a new object for
+        // every getShader call. Shaders without bytecode of their own, like specializations, fall back to the object.
+        KeyBuilder& Add(const nvrhi::ShaderHandle& shader)
+        {
+            if (!shader)
+                return Add(static_cast<const void*>(nullptr));
+
+            const void* bytecode = nullptr;
+            size_t bytecodeSize = 0;
+            shader->getBytecode(&bytecode, &bytecodeSize);
+
+            const nvrhi::ShaderDesc& desc = shader->getDesc();
+            Add(bytecodeSize != 0 ? bytecode : static_cast<const void*>(shader.Get())).Add(bytecodeSize);
+            return Add(desc.shaderType).Add(desc.entryName);
+        }
+
+        template<typename Container>
+        KeyBuilder& AddEach(const Container& items)
+        {
+            Add(uint32_t(items.size()));
+            for (const auto& item : items)
+                Add(item);
+            return *this;
+        }
+
+        KeyBuilder& AddFramebufferFormats(const nvrhi::FramebufferInfo& info)
+        {
+            // Pipelines only depend on the framebuffer formats, not on its size
+            AddEach(info.colorFormats);
+            return Add(info.depthFormat).Add(info.sampleCount).Add(info.sampleQuality);
+        }
+
+        std::string& Get() { return m_Key; }
+
+    private:
+        std::string m_Key;
+    };
+
+    // The object is created outside of the lock, so that other threads are not blocked by the compiler.
+    // Two threads that miss on the same key both create it, and the first one to finish is kept.
+    template<typename Map, typename CreateFunc>
+    auto FindOrCreate(std::mutex& mutex, Map& map, std::string& key, uint32_t& hits, uint32_t& misses, double& createTimeSeconds, CreateFunc create)
+    {
+        std::unique_lock lock(mutex);
+
+        auto it = map.find(key);
+        if (it != map.end())
+        {
+            ++hits;
+            return it->second;
+        }
+
+        ++misses;
+        lock.unlock();
+
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        auto object = create();
+        const double createTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        lock.lock();
+        createTimeSeconds += createTime;
+
+        // Failures are not cached, so that a fixed shader is picked up on the next attempt
+        if (object)
+            object = map.emplace(std::move(key), object).first->second;
+
+        return object;
+    }
+}
+
+ShaderPipelineCache::ShaderPipelineCache(nvrhi::IDevice* device)
+    : m_Device(device)
+{
+}
+
+ShaderPipelineCache::~ShaderPipelineCache()
+{
+    if (m_Statistics.shaderHits + m_Statistics.shaderMisses + m_Statistics.pipelineHits + m_Statistics.pipelineMisses != 0)
+        LogStatistics();
+}
+
+nvrhi::ShaderHandle ShaderPipelineCache::CreateShader(engine::ShaderFactory& shaderFactory, const char* fileName, const char* entryName,
+    const std::vector<engine::ShaderMacro>* defines, nvrhi::ShaderType shaderType)
+{
+    KeyBuilder key;
+    key.Add(&shaderFactory).Add(fileName).Add(entryName).Add(shaderType);
+    if (defines)
+    {
+        for (const auto& define : *defines)
+            key.Add(define.name).Add(define.definition);
+    }
+
+    return FindOrCreate(m_Mutex, m_Shaders, key.Get(), m_Statistics.shaderHits, m_Statistics.shaderMisses, m_Statistics.shaderCreateTimeSeconds,
+        [&]() { return shaderFactory.CreateShader(fileName, entryName, defines, shaderType); });
+}
+
+nvrhi::ShaderLibraryHandle ShaderPipelineCache::CreateShaderLibrary(engine::ShaderFactory& shaderFactory, const char* fileName,
+    const std::vector<engine::ShaderMacro>* defines)
+{
+    KeyBuilder key;
+    key.Add(&shaderFactory).Add(fileName);
+    if (defines)
+    {
+        for (const auto& define : *defines)
+            key.Add(define.name).Add(define.definition);
+    }
+
+    return FindOrCreate(m_Mutex, m_ShaderLibraries, key.Get(), m_Statistics.shaderHits, m_Statistics.shaderMisses, m_Statistics.shaderCreateTimeSeconds,
+        [&]() { return shaderFactory.CreateShaderLibrary(fileName, defines); });
+}
+
+nvrhi::GraphicsPipelineHandle ShaderPipelineCache::CreateGraphicsPipeline(const nvrhi::GraphicsPipelineDesc& desc, nvrhi::IFramebuffer* framebuffer)
+{
+    KeyBuilder key;
+    key.Add(desc.primType).Add(desc.patchControlPoints).Add(desc.inputLayout)
+        .Add(desc.VS).Add(desc.HS).Add(desc.DS).Add(desc.GS).Add(desc.PS)
+        .Add(desc.renderState).Add(desc.shadingRateState)
+        .AddEach(desc.bindingLayouts)
+        .AddFramebufferFormats(framebuffer->getFramebufferInfo());
+
+    return FindOrCreate(m_Mutex, m_GraphicsPipelines, key.Get(), m_Statistics.pipelineHits, m_Statistics.pipelineMisses, m_Statistics.pipelineCreateTimeSeconds,
+        [&]() { return m_Device->createGraphicsPipeline(desc, framebuffer); });
+}
+
+nvrhi::MeshletPipelineHandle ShaderPipelineCache::CreateMeshletPipeline(const nvrhi::MeshletPipelineDesc& desc, nvrhi::IFramebuffer* framebuffer)
+{
+    KeyBuilder key;
+    key.Add(desc.primType).Add(desc.AS).Add(desc.MS).Add(desc.PS)
+        .Add(desc.renderState)
+        .AddEach(desc.bindingLayouts)
+        .AddFramebufferFormats(framebuffer->getFramebufferInfo());
+
+    return FindOrCreate(m_Mutex, m_MeshletPipelines, key.Get(), m_Statistics.pipelineHits, m_Statistics.pipelineMisses, m_Statistics.pipelineCreateTimeSeconds,
+        [&]() { return m_Device->createMeshletPipeline(desc, framebuffer); });
+}
+
+nvrhi::rt::PipelineHandle ShaderPipelineCache::CreateRayTracingPipeline(const nvrhi::rt::PipelineDesc& desc)
+{
+    KeyBuilder key;
+    key.Add(uint32_t(desc.shaders.size()));
+    for (const auto& shader : desc.shaders)
+        key.Add(shader.exportName).Add(shader.shader).Add(shader.bindingLayout);
+
+    key.Add(uint32_t(desc.hitGroups.size()));
+    for (const auto& hitGroup : desc.hitGroups)
+    {
+        key.Add(hitGroup.exportName).Add(hitGroup.closestHitShader).Add(hitGroup.anyHitShader).Add(hitGroup.intersectionShader)
+            .Add(hitGroup.bindingLayout).Add(hitGroup.isProceduralPrimitive);
+    }
+
+    key.AddEach(desc.globalBindingLayouts)
+        .Add(desc.maxPayloadSize).Add(desc.maxAttributeSize).Add(desc.maxRecursionDepth);
+
+    return FindOrCreate(m_Mutex, m_RayTracingPipelines, key.Get(), m_Statistics.pipelineHits, m_Statistics.pipelineMisses, m_Statistics.pipelineCreateTimeSeconds,
+        [&]() { return m_Device->createRayTracingPipeline(desc); });
+}
+
+void ShaderPipelineCache::Clear()
+{
+    std::lock_guard lock(m_Mutex);
+    m_Shaders.clear();
+    m_ShaderLibraries.clear();
+    m_GraphicsPipelines.clear();
+    m_MeshletPipelines.clear();
+    m_RayTracingPipelines.clear();
+}
+
+ShaderPipelineCacheStatistics ShaderPipelineCache::GetStatistics() const
+{
+    std::lock_guard lock(m_Mutex);
+    return m_Statistics;
+}
+
+void ShaderPipelineCache::LogStatistics() const
+{
+    std::lock_guard lock(m_Mutex);
+
+    log::info("Shader cache: %u hits, %u misses, %.2f ms creating shaders",
+        m_Statistics.shaderHits, m_Statistics.shaderMisses, m_Statistics.shaderCreateTimeSeconds * 1e3);
+
+    log::info("Pipeline cache: %u hits, %u misses, %.2f ms creating pipelines",
+        m_Statistics.pipelineHits, m_Statistics.pipelineMisses, m_Statistics.pipelineCreateTimeSeconds * 1e3);
+}
@@ -0,0 +1,84 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+
+#pragma once
+
+#include <donut/engine/ShaderFactory.h>
+#include <nvrhi/nvrhi.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Caches the shaders and pipelines of an example so that recreating them returns the existing objects.
+// Shaders are keyed by (file, entry point, defines, shader type). Graphics and meshlet pipelines are keyed by their
+// shaders, layouts and render state and by the framebuffer formats, so the pipelines that an example drops in
+// BackBufferResizing are found again after a resize that keeps the formats. Ray tracing pipelines are keyed by
+// their shaders, exports and layouts. Render and pipeline states are compared byte by byte, so two equal
+// states can at worst miss and create a second pipeline, never return a wrong one.
+// The cache can be used from several threads. The statistics are printed to the log when it is destroyed.
+
+struct ShaderPipelineCacheStatistics
+{
+    uint32_t shaderHits = 0;
+    uint32_t shaderMisses = 0;
+    uint32_t pipelineHits = 0;
+    uint32_t pipelineMisses = 0;
+    double shaderCreateTimeSeconds = 0.0;   // time spent in ShaderFactory on misses
+    double pipelineCreateTimeSeconds = 0.0; // time spent creating pipelines on misses
+};
+
+class ShaderPipelineCache
+{
+public:
+    explicit ShaderPipelineCache(nvrhi::IDevice* device);
+    ~ShaderPipelineCache();
+
+    // Same as ShaderFactory::CreateShader and CreateShaderLibrary, returning the cached object on repeated calls
+    nvrhi::ShaderHandle CreateShader(donut::engine::ShaderFactory& shaderFactory, const char* fileName, const char* entryName,
+        const std::vector<donut::engine::ShaderMacro>* defines, nvrhi::ShaderType shaderType);
+    nvrhi::ShaderLibraryHandle CreateShaderLibrary(donut::engine::ShaderFactory& shaderFactory, const char* fileName,
+        const std::vector<donut::engine::ShaderMacro>* defines);
+
+    // Same as the IDevice functions, returning the cached pipeline when one was created from an equal desc
+    nvrhi::GraphicsPipelineHandle CreateGraphicsPipeline(const nvrhi::GraphicsPipelineDesc& desc, nvrhi::IFramebuffer* framebuffer);
+    nvrhi::MeshletPipelineHandle CreateMeshletPipeline(const nvrhi::MeshletPipelineDesc& desc, nvrhi::IFramebuffer* framebuffer);
+    nvrhi::rt::PipelineHandle CreateRayTracingPipeline(const nvrhi::rt::PipelineDesc& desc);
+
+    // Drops all cached objects, e.g. before the shaders are reloaded
+    void Clear();
+
+    [[nodiscard]] ShaderPipelineCacheStatistics GetStatistics() const;
+    void LogStatistics() const;
+
+private:
+    nvrhi::DeviceHandle m_Device;
+    std::unordered_map<std::string, nvrhi::ShaderHandle> m_Shaders;
+    std::unordered_map<std::string, nvrhi::ShaderLibraryHandle> m_ShaderLibraries;
+    std::unordered_map<std::string, nvrhi::GraphicsPipelineHandle> m_GraphicsPipelines;
+    std::unordered_map<std::string, nvrhi::MeshletPipelineHandle> m_MeshletPipelines;
+    std::unordered_map<std::string, nvrhi::rt::PipelineHandle> m_RayTracingPipelines;
+    ShaderPipelineCacheStatistics m_Statistics;
+    mutable std::mutex m_Mutex;
+};
@@ -0,0 +1,952 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "scene_cache.h"
+
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/TextureCache.h>
+#include <donut/core/log.h>
+#include <donut/core/vfs/VFS.h>
+#include <donut/shaders/light_types.h>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+
+#ifdef DONUT_WITH_TASKFLOW
+#include <taskflow/taskflow.hpp>
+#endif
+
+using namespace donut;
+using namespace donut::math;
+using namespace donut::engine;
+
+namespace
+{
+    const uint32_t c_SceneCacheMagic = 0x43534e44; // "DNSC"
+    const uint32_t c_SceneCacheVersion = 3;
+    const size_t c_SceneCacheAlignment = 16;
+
+    enum class LeafType : uint8_t
+    {
+        None,
+        Mesh,
+        Light
+    };
+
+    // Material texture slots, in the order they are stored in the cache
+    const size_t c_NumMaterialTextures = 6;
+
+    void GetMaterialTextures(Material& material, std::shared_ptr<LoadedTexture>* textures[c_NumMaterialTextures])
+    {
+        textures[0] = &material.baseOrDiffuseTexture;
+        textures[1] = &material.metalRoughOrSpecularTexture;
+        textures[2] = &material.normalTexture;
+        textures[3] = &material.emissiveTexture;
+        textures[4] = &material.occlusionTexture;
+        textures[5] = &material.transmissionTexture;
+    }
+
+    // Same color space rules as the glTF importer: color textures are sRGB, data textures are linear
+    bool IsMaterialTextureSRGB(const Material& material, size_t slot)
+    {
+        switch (slot)
+        {
+        case 0: return true;
+        case 1: return material.useSpecularGlossModel;
+        case 3: return true;
+        default: return false;
+        }
+    }
+
+    class CacheWriter
+    {
+    public:
+        template<typename T>
+        void Write(const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+            m_Data.insert(m_Data.end(), bytes, bytes + sizeof(T));
+        }
+
+        void WriteString(const std::string& value)
+        {
+            Write(uint32_t(value.size()));
+            m_Data.insert(m_Data.end(), value.begin(), value.end());
+        }
+
+        // Arrays start at an aligned offset so that they can be used in place from a mapped file
+        template<typename T>
+        void WriteArray(const std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            Write(uint64_t(values.size()));
+            m_Data.resize((m_Data.size() + c_SceneCacheAlignment - 1) & ~(c_SceneCacheAlignment - 1), 0);
+            const auto* bytes = reinterpret_cast<const uint8_t*>(values.data());
+            m_Data.insert(m_Data.end(), bytes, bytes + values.size() * sizeof(T));
+        }
+
+        [[nodiscard]] const std::vector<uint8_t>& GetData() const { return m_Data; }
+
+    private:
+        std::vector<uint8_t> m_Data;
+    };
+
+    // Reads the data written by CacheWriter. Any read past the end of the data puts the reader into an error state
+    // and returns zeros, so the callers only need to check IsValid once they are done.
+    class CacheReader
+    {
+    public:
+        CacheReader(const uint8_t* data, size_t size)
+            : m_Data(data)
+            , m_Size(size)
+        { }
+
+        template<typename T>
+        T Read()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            T value{};
+            if (Require(sizeof(T)))
+            {
+                memcpy(&value, m_Data + m_Offset, sizeof(T));
+                m_Offset += sizeof(T);
+            }
+            return value;
+        }
+
+        std::string ReadString()
+        {
+            const uint32_t length = Read<uint32_t>();
+            if (!Require(length))
+                return std::string();
+
+            std::string value(reinterpret_cast<const char*>(m_Data + m_Offset), length);
+            m_Offset += length;
+            return value;
+        }
+
+        template<typename T>
+        void ReadArray(std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const uint64_t count = Read<uint64_t>();
+            m_Offset = (m_Offset + c_SceneCacheAlignment - 1) & ~(c_SceneCacheAlignment - 1);
+            if (count > m_Size / sizeof(T) || !Require(size_t(count) * sizeof(T)))
+            {
+                m_Valid = false;
+                values.clear();
+                return;
+            }
+
+            values.resize(size_t(count));
+            if (count != 0)
+                memcpy(values.data(), m_Data + m_Offset, size_t(count) * sizeof(T));
+            m_Offset += size_t(count) * sizeof(T);
+        }
+
+        // Reads an index into a table, checking it against the size of the table
+        int32_t ReadIndex(size_t tableSize)
+        {
+            const int32_t index = Read<int32_t>();
+            if (index < -1 || index >= int32_t(tableSize))
+                m_Valid = false;
+            return m_Valid ? index : -1;
+        }
+
+        [[nodiscard]] bool IsValid() const { return m_Valid; }
+
+    private:
+        const uint8_t* m_Data;
+        size_t m_Size;
+        size_t m_Offset = 0;
+        bool m_Valid = true;
+
+        bool Require(size_t bytes)
+        {
+            if (m_Valid && bytes <= m_Size - std::min(m_Offset, m_Size))
+                return true;
+
+            m_Valid = false;
+            return false;
+        }
+    };
+
+    struct SourceFileKey
+    {
+        std::string path;
+        uint64_t size = 0;
+        int64_t modificationTime = 0;
+        bool exists = true; // false for files that the scene would use if they appeared, with a zero size and time
+    };
+
+    bool GetSourceFileKey(const std::filesystem::path& fileName, SourceFileKey& key)
+    {
+        std::error_code error;
+        key.path = std::filesystem::absolute(fileName, error).generic_string();
+        key.size = uint64_t(std::filesystem::file_size(fileName, error));
+        if (error)
+            return false;
+
+        key.modificationTime = int64_t(std::filesystem::last_write_time(fileName, error).time_since_epoch().count());
+        return !error;
+    }
+
+    // Same as GetSourceFileKey, but a missing file is recorded as absent instead of failing
+    SourceFileKey GetOptionalSourceFileKey(const std::filesystem::path& fileName)
+    {
+        SourceFileKey key;
+        if (GetSourceFileKey(fileName, key))
+            return key;
+
+        std::error_code error;
+        key.path = std::filesystem::absolute(fileName, error).generic_string();
+        key.size = 0;
+        key.modificationTime = 0;
+        key.exists = false;
+        return key;
+    }
+
+    void WriteSourceFileKey(CacheWriter& writer, const SourceFileKey& key)
+    {
+        writer.WriteString(key.path);
+        writer.Write(key.size);
+        writer.Write(key.modificationTime);
+        writer.Write(uint8_t(key.exists ? 1 : 0));
+    }
+
+    SourceFileKey ReadSourceFileKey(CacheReader& reader)
+    {
+        SourceFileKey key;
+        key.path = reader.ReadString();
+        key.size = reader.Read<uint64_t>();
+        key.modificationTime = reader.Read<int64_t>();
+        key.exists = reader.Read<uint8_t>() != 0;
+        return key;
+    }
+
+    bool operator==(const SourceFileKey& a, const SourceFileKey& b)
+    {
+        return a.path == b.path && a.size == b.size && a.modificationTime == b.modificationTime && a.exists == b.exists;
+    }
+
+    // The header holds the key of the scene file, then the keys of all the other files the scene was built from
+    void WriteHeader(CacheWriter& writer, const SourceFileKey& key, const std::vector<SourceFileKey>& dependencies)
+    {
+        writer.Write(c_SceneCacheMagic);
+        writer.Write(c_SceneCacheVersion);
+        WriteSourceFileKey(writer, key);
+
+        writer.Write(uint32_t(dependencies.size()));
+        for (const SourceFileKey& dependency : dependencies)
+            WriteSourceFileKey(writer, dependency);
+    }
+
+    bool ReadHeader(CacheReader& reader, const SourceFileKey& key)
+    {
+        if (reader.Read<uint32_t>() != c_SceneCacheMagic || reader.Read<uint32_t>() != c_SceneCacheVersion)
+            return false;
+
+        if (!(ReadSourceFileKey(reader) == key) || !reader.IsValid())
+            return false;
+
+        const uint32_t numDependencies = reader.Read<uint32_t>();
+        for (uint32_t index = 0; index < numDependencies && reader.IsValid(); index++)
+        {
+            const SourceFileKey stored = ReadSourceFileKey(reader);
+
+            if (!reader.IsValid() || !(GetOptionalSourceFileKey(stored.path) == stored))
+            {
+                log::info("Scene cache is out of date, '%s' has changed", stored.path.c_str());
+                return false;
+            }
+        }
+
+        return reader.IsValid();
+    }
+
+    std::filesystem::path GetCacheFileName(const std::filesystem::path& cacheDirectory, const SourceFileKey& key)
+    {
+        char name[64];
+        snprintf(name, std::size(name), "%016llx.scenecache", (unsigned long long)std::hash<std::string>()(key.path));
+        return cacheDirectory / name;
+    }
+
+    // Returns the reason why the scene cannot be cached, or nullptr if it can
+    const char* FindUncacheableContent(const SceneGraph& sceneGraph)
+    {
+        if (!sceneGraph.GetAnimations().empty())
+            return "animations";
+
+        if (!sceneGraph.GetSkinnedMeshInstances().empty())
+            return "skinned meshes";
+
+        for (const auto& mesh : sceneGraph.GetMeshes())
+        {
+            if (!mesh->buffers || mesh->skinPrototype || !mesh->buffers->jointData.empty() || !mesh->buffers->weightData.empty())
+                return "skinned meshes";
+        }
+
+        if (!sceneGraph.GetCameras().empty())
+            return "cameras";
+
+        for (const auto& light : sceneGraph.GetLights())
+        {
+            const int lightType = light->GetLightType();
+            if (lightType != LightType_Directional && lightType != LightType_Point && lightType != LightType_Spot)
+                return "unsupported light types";
+        }
+
+        return nullptr;
+    }
+}
+
+// Forwards everything to the scene's file system and remembers the files that the importer read,
+// which are the sources of the scene together with its textures
+class CachedScene::RecordingFileSystem : public vfs::IFileSystem
+{
+public:
+    explicit RecordingFileSystem(std::shared_ptr<vfs::IFileSystem> fs)
+        : m_FileSystem(std::move(fs))
+    { }
+
+    bool folderExists(const std::filesystem::path& name) override
+    {
+        return m_FileSystem->folderExists(name);
+    }
+
+    bool fileExists(const std::filesystem::path& name) override
+    {
+        return m_FileSystem->fileExists(name);
+    }
+
+    std::shared_ptr<vfs::IBlob> readFile(const std::filesystem::path& name) override
+    {
+        std::shared_ptr<vfs::IBlob> blob = m_FileSystem->readFile(name);
+        if (blob)
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_ReadFiles.push_back(name);
+        }
+        return blob;
+    }
+
+    bool writeFile(const std::filesystem::path& name, const void* data, size_t size) override
+    {
+        return m_FileSystem->writeFile(name, data, size);
+    }
+
+    int enumerateFiles(const std::filesystem::path& path, const std::vector<std::string>& extensions, vfs::enumerate_callback_t callback, bool allowDuplicates) override
+    {
+        return m_FileSystem->enumerateFiles(path, extensions, callback, allowDuplicates);
+    }
+
+    int enumerateDirectories(const std::filesystem::path& path, vfs::enumerate_callback_t callback, bool allowDuplicates) override
+    {
+        return m_FileSystem->enumerateDirectories(path, callback, allowDuplicates);
+    }
+
+    void ClearReadFiles()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_ReadFiles.clear();
+    }
+
+    [[nodiscard]] std::vector<std::filesystem::path> GetReadFiles()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_ReadFiles;
+    }
+
+private:
+    std::shared_ptr<vfs::IFileSystem> m_FileSystem;
+    std::mutex m_Mutex;
+    std::vector<std::filesystem::path> m_ReadFiles;
+};
+
+CachedScene::CachedScene(
+    nvrhi::IDevice* device,
+    ShaderFactory& shaderFactory,
+    std::shared_ptr<vfs::IFileSystem> fs,
+    std::shared_ptr<TextureCache> textureCache,
+    std::shared_ptr<DescriptorTableManager> descriptorTable,
+    std::shared_ptr<SceneTypeFactory> sceneTypeFactory)
+    : CachedScene(std::make_shared<RecordingFileSystem>(std::move(fs)), device, shaderFactory,
+        std::move(textureCache), std::move(descriptorTable), std::move(sceneTypeFactory))
+{ }
+
+CachedScene::CachedScene(
+    std::shared_ptr<RecordingFileSystem> fs,
+    nvrhi::IDevice* device,
+    ShaderFactory& shaderFactory,
+    std::shared_ptr<TextureCache> textureCache,
+    std::shared_ptr<DescriptorTableManager> descriptorTable,
+    std::shared_ptr<SceneTypeFactory> sceneTypeFactory)
+    : Scene(device, shaderFactory, fs, std::move(textureCache), std::move(descriptorTable), std::move(sceneTypeFactory))
+    , m_RecordingFileSystem(std::move(fs))
+{ }
+
+bool CachedScene::LoadWithCache(
+    const std::filesystem::path& sceneFileName,
+    const std::filesystem::path& cacheDirectory,
+    const NativeFileNameFunc& getNativeFileName,
+    tf::Executor* executor)
+{
+    m_LoadedFromCache = false;
+
+    const std::filesystem::path nativeFileName = getNativeFileName ? getNativeFileName(sceneFileName) : sceneFileName;
+
+    SourceFileKey key;
+    if (nativeFileName.empty() || !GetSourceFileKey(nativeFileName, key))
+        return LoadWithExecutor(sceneFileName, executor);
+
+    const std::filesystem::path cacheFileName = GetCacheFileName(cacheDirectory, key);
+
+    if (ReadCache(cacheFileName, nativeFileName, executor))
+    {
+        log::info("Loaded scene '%s' from cache '%s'", key.path.c_str(), cacheFileName.generic_string().c_str());
+        m_LoadedFromCache = true;
+        return true;
+    }
+
+    m_RecordingFileSystem->ClearReadFiles();
+
+    if (!LoadWithExecutor(sceneFileName, executor))
+        return false;
+
+    if (const char* reason = FindUncacheableContent(*m_SceneGraph))
+    {
+        log::info("Scene '%s' is not cached because it contains %s", key.path.c_str(), reason);
+        return true;
+    }
+
+    if (WriteCache(cacheFileName, nativeFileName, getNativeFileName))
+        log::info("Wrote scene cache '%s'", cacheFileName.generic_string().c_str());
+
+    return true;
+}
+
+bool CachedScene::WriteCache(const std::filesystem::path& cacheFileName, const std::filesystem::path& nativeFileName, const NativeFileNameFunc& getNativeFileName) const
+{
+    SourceFileKey key;
+    if (!GetSourceFileKey(nativeFileName, key))
+        return false;
+
+    // Collect the tables referenced by the scene graph
+
+    std::vector<std::shared_ptr<MeshInfo>> meshes;
+    std::vector<std::shared_ptr<BufferGroup>> bufferGroups;
+    std::vector<std::shared_ptr<Material>> materials;
+    std::vector<std::shared_ptr<LoadedTexture>> textures;
+    std::vector<bool> textureSRGB;
+    std::unordered_map<const MeshInfo*, int32_t> meshIndices;
+    std::unordered_map<const BufferGroup*, int32_t> bufferGroupIndices;
+    std::unordered_map<const Material*, int32_t> materialIndices;
+    std::unordered_map<const LoadedTexture*, int32_t> textureIndices;
+
+    for (const auto& mesh : m_SceneGraph->GetMeshes())
+    {
+        meshIndices[mesh.get()] = int32_t(meshes.size());
+        meshes.push_back(mesh);
+
+        if (bufferGroupIndices.emplace(mesh->buffers.get(), int32_t(bufferGroups.size())).second)
+            bufferGroups.push_back(mesh->buffers);
+
+        for (const auto& geometry : mesh->geometries)
+        {
+            const auto& material = geometry->material;
+            if (!material || !materialIndices.emplace(material.get(), int32_t(materials.size())).second)
+                continue;
+
+            materials.push_back(material);
+
+            std::shared_ptr<LoadedTexture>* materialTextures[c_NumMaterialTextures];
+            GetMaterialTextures(*material, materialTextures);
+            for (size_t slot = 0; slot < c_NumMaterialTextures; slot++)
+            {
+                const auto& texture = *materialTextures[slot];
+                if (texture && textureIndices.emplace(texture.get(), int32_t(textures.size())).second)
+                {
+                    textures.push_back(texture);
+                    textureSRGB.push_back(IsMaterialTextureSRGB(*material, slot));
+                }
+            }
+        }
+    }
+
+    auto findIndex = [](const auto& indices, const auto* object)
+    {
+        auto it = indices.find(object);
+        return it != indices.end() ? it->second : -1;
+    };
+
+    // Every file that went into the scene becomes part of the key, so that editing any of them invalidates the cache
+
+    std::vector<std::filesystem::path> sourceFiles = m_RecordingFileSystem->GetReadFiles();
+    for (const auto& texture : textures)
+        sourceFiles.push_back(texture->path);
+
+    std::vector<SourceFileKey> dependencies;
+    std::set<std::string> dependencyPaths = { key.path };
+    for (const auto& sourceFile : sourceFiles)
+    {
+        const std::filesystem::path nativeSourceFile = getNativeFileName ? getNativeFileName(sourceFile) : sourceFile;
+
+        SourceFileKey dependency;
+        if (nativeSourceFile.empty() || !GetSourceFileKey(nativeSourceFile, dependency))
+        {
+            log::info("Scene '%s' is not cached because '%s' is not a file on the disk", key.path.c_str(), sourceFile.generic_string().c_str());
+            return false;
+        }
+
+        if (dependencyPaths.insert(dependency.path).second)
+            dependencies.push_back(dependency);
+    }
+
+    // File systems like the one in FeatureDemo load an image from the .dds file next to it when there is one, so
+    // the .dds sibling of every image that was decoded is recorded too, and creating it later invalidates the cache.
+    // The images that were redirected already have the .dds file as their path, and removing it fails its key.
+    for (const auto& texture : textures)
+    {
+        std::filesystem::path convertedFile = getNativeFileName ? getNativeFileName(texture->path) : std::filesystem::path(texture->path);
+        if (convertedFile.empty() || convertedFile.extension() == ".dds")
+            continue;
+
+        convertedFile.replace_extension(".dds");
+        SourceFileKey dependency = GetOptionalSourceFileKey(convertedFile);
+        if (dependencyPaths.insert(dependency.path).second)
+            dependencies.push_back(dependency);
+    }
+
+    CacheWriter writer;
+    WriteHeader(writer, key, dependencies);
+
+    writer.Write(uint32_t(textures.size()));
+    for (size_t index = 0; index < textures.size(); index++)
+    {
+        writer.WriteString(textures[index]->path);
+        writer.Write(uint8_t(textureSRGB[index]));
+    }
+
+    writer.Write(uint32_t(materials.size()));
+    for (const auto& material : materials)
+    {
+        writer.WriteString(material->name);
+        writer.Write(uint32_t(material->domain));
+
+        std::shared_ptr<LoadedTexture>* materialTextures[c_NumMaterialTextures];
+        GetMaterialTextures(*material, materialTextures);
+        for (size_t slot = 0; slot < c_NumMaterialTextures; slot++)
+            writer.Write(findIndex(textureIndices, materialTextures[slot]->get()));
+
+        writer.Write(material->baseOrDiffuseColor);
+        writer.Write(material->specularColor);
+        writer.Write(material->emissiveColor);
+        writer.Write(material->emissiveIntensity);
+        writer.Write(material->metalness);
+        writer.Write(material->roughness);
+        writer.Write(material->opacity);
+        writer.Write(material->alphaCutoff);
+        writer.Write(material->transmissionFactor);
+        writer.Write(material->normalTextureScale);
+        writer.Write(material->occlusionStrength);
+        writer.Write(uint8_t(material->useSpecularGlossModel));
+        writer.Write(uint8_t(material->doubleSided));
+    }
+
+    writer.Write(uint32_t(bufferGroups.size()));
+    for (const auto& buffers : bufferGroups)
+    {
+        writer.WriteArray(buffers->indexData);
+        writer.WriteArray(buffers->positionData);
+        writer.WriteArray(buffers->texcoord1Data);
+        writer.WriteArray(buffers->texcoord2Data);
+        writer.WriteArray(buffers->normalData);
+        writer.WriteArray(buffers->tangentData);
+    }
+
+    writer.Write(uint32_t(meshes.size()));
+    for (const auto& mesh : meshes)
+    {
+        writer.WriteString(mesh->name);
+        writer.Write(findIndex(bufferGroupIndices, mesh->buffers.get()));
+        writer.Write(mesh->indexOffset);
+        writer.Write(mesh->vertexOffset);
+        writer.Write(mesh->totalIndices);
+        writer.Write(mesh->totalVertices);
+        writer.Write(mesh->objectSpaceBounds);
+
+        writer.Write(uint32_t(mesh->geometries.size()));
+        for (const auto& geometry : mesh->geometries)
+        {
+            writer.Write(findIndex(materialIndices, geometry->material.get()));
+            writer.Write(geometry->indexOffsetInMesh);
+            writer.Write(geometry->vertexOffsetInMesh);
+            writer.Write(geometry->numIndices);
+            writer.Write(geometry->numVertices);
+            writer.Write(geometry->objectSpaceBounds);
+        }
+    }
+
+    // Nodes are stored in depth-first order, so every parent comes before its children
+
+    std::vector<const SceneGraphNode*> nodes;
+    std::vector<int32_t> parentIndices;
+    std::function<void(const SceneGraphNode*, int32_t)> collectNodes = [&](const SceneGraphNode* node, int32_t parentIndex)
+    {
+        const int32_t nodeIndex = int32_t(nodes.size());
+        nodes.push_back(node);
+        parentIndices.push_back(parentIndex);
+
+        for (const SceneGraphNode* child = node->GetFirstChild(); child; child = child->GetNextSibling())
+            collectNodes(child, nodeIndex);
+    };
+
+    if (m_SceneGraph->GetRootNode())
+        collectNodes(m_SceneGraph->GetRootNode().get(), -1);
+
+    writer.Write(uint32_t(nodes.size()));
+    for (size_t index = 0; index < nodes.size(); index++)
+    {
+        const SceneGraphNode* node = nodes[index];
+        writer.Write(parentIndices[index]);
+        writer.WriteString(node->GetName());
+        writer.Write(node->GetTranslation());
+        writer.Write(node->GetRotation());
+        writer.Write(node->GetScaling());
+
+        const auto& leaf = node->GetLeaf();
+        if (auto meshInstance = std::dynamic_pointer_cast<MeshInstance>(leaf))
+        {
+            writer.Write(LeafType::Mesh);
+            writer.Write(findIndex(meshIndices, meshInstance->GetMesh().get()));
+        }
+        else if (auto light = std::dynamic_pointer_cast<Light>(leaf))
+        {
+            std::array<float, 5> parameters = {};
+            switch (light->GetLightType())
+            {
+            case LightType_Directional: {
+                const auto& directional = static_cast<const DirectionalLight&>(*light);
+                parameters[0] = directional.irradiance;
+                parameters[1] = directional.angularSize;
+                break;
+            }
+            case LightType_Point: {
+                const auto& point = static_cast<const PointLight&>(*light);
+                parameters[0] = point.intensity;
+                parameters[1] = point.radius;
+                parameters[2] = point.range;
+                break;
+            }
+            case LightType_Spot: {
+                const auto& spot = static_cast<const SpotLight&>(*light);
+                parameters[0] = spot.intensity;
+                parameters[1] = spot.radius;
+                parameters[2] = spot.range;
+                parameters[3] = spot.innerAngle;
+                parameters[4] = spot.outerAngle;
+                break;
+            }
+            default:
+                return false;
+            }
+
+            writer.Write(LeafType::Light);
+            writer.Write(int32_t(light->GetLightType()));
+            writer.Write(light->color);
+            writer.Write(parameters);
+        }
+        else if (leaf)
+        {
+            return false;
+        }
+        else
+        {
+            writer.Write(LeafType::None);
+        }
+    }
+
+    // Write into a temporary file first, so that an interrupted write never leaves a truncated cache behind
+
+    std::error_code error;
+    std::filesystem::create_directories(cacheFileName.parent_path(), error);
+
+    std::filesystem::path temporaryFileName = cacheFileName;
+    temporaryFileName += ".tmp";
+
+    {
+        std::ofstream file(temporaryFileName, std::ios::binary);
+        if (!file.is_open())
+        {
+            log::warning("Cannot open scene cache file '%s' for writing", temporaryFileName.generic_string().c_str());
+            return false;
+        }
+
+        const auto& data = writer.GetData();
+        file.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+        if (!file.good())
+            return false;
+    }
+
+    std::filesystem::rename(temporaryFileName, cacheFileName, error);
+    return !error;
+}
+
+bool CachedScene::ReadCache(const std::filesystem::path& cacheFileName, const std::filesystem::path& nativeFileName, tf::Executor* executor)
+{
+    SourceFileKey key;
+    if (!GetSourceFileKey(nativeFileName, key))
+        return false;
+
+    std::ifstream file(cacheFileName, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+
+    std::vector<uint8_t> data(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(data.data()), std::streamsize(data.size()));
+    if (!file.good())
+        return false;
+
+    CacheReader reader(data.data(), data.size());
+    if (!ReadHeader(reader, key))
+        return false;
+
+    // Textures are only referenced here, their loading goes through the texture cache as usual
+
+    struct TextureReference
+    {
+        std::string path;
+        bool sRGB = false;
+    };
+
+    std::vector<TextureReference> textureReferences(reader.Read<uint32_t>());
+    for (auto& texture : textureReferences)
+    {
+        texture.path = reader.ReadString();
+        texture.sRGB = reader.Read<uint8_t>() != 0;
+    }
+
+    std::vector<std::shared_ptr<Material>> materials(reader.Read<uint32_t>());
+    std::vector<std::array<int32_t, c_NumMaterialTextures>> materialTextureIndices(materials.size());
+    for (size_t index = 0; index < materials.size() && reader.IsValid(); index++)
+    {
+        auto material = std::make_shared<Material>();
+        material->name = reader.ReadString();
+        material->domain = MaterialDomain(reader.Read<uint32_t>());
+
+        for (size_t slot = 0; slot < c_NumMaterialTextures; slot++)
+            materialTextureIndices[index][slot] = reader.ReadIndex(textureReferences.size());
+
+        material->baseOrDiffuseColor = reader.Read<decltype(material->baseOrDiffuseColor)>();
+        material->specularColor = reader.Read<decltype(material->specularColor)>();
+        material->emissiveColor = reader.Read<decltype(material->emissiveColor)>();
+        material->emissiveIntensity = reader.Read<float>();
+        material->metalness = reader.Read<float>();
+        material->roughness = reader.Read<float>();
+        material->opacity = reader.Read<float>();
+        material->alphaCutoff = reader.Read<float>();
+        material->transmissionFactor = reader.Read<float>();
+        material->normalTextureScale = reader.Read<float>();
+        material->occlusionStrength = reader.Read<float>();
+        material->useSpecularGlossModel = reader.Read<uint8_t>() != 0;
+        material->doubleSided = reader.Read<uint8_t>() != 0;
+        material->materialID = int(index);
+        materials[index] = material;
+    }
+
+    std::vector<std::shared_ptr<BufferGroup>> bufferGroups(reader.Read<uint32_t>());
+    for (auto& buffers : bufferGroups)
+    {
+        buffers = std::make_shared<BufferGroup>();
+        reader.ReadArray(buffers->indexData);
+        reader.ReadArray(buffers->positionData);
+        reader.ReadArray(buffers->texcoord1Data);
+        reader.ReadArray(buffers->texcoord2Data);
+        reader.ReadArray(buffers->normalData);
+        reader.ReadArray(buffers->tangentData);
+        if (!reader.IsValid())
+            return false;
+    }
+
+    std::vector<std::shared_ptr<MeshInfo>> meshes(reader.Read<uint32_t>());
+    for (auto& mesh : meshes)
+    {
+        mesh = std::make_shared<MeshInfo>();
+        mesh->name = reader.ReadString();
+
+        const int32_t bufferGroupIndex = reader.ReadIndex(bufferGroups.size());
+        mesh->buffers = bufferGroupIndex >= 0 ? bufferGroups[bufferGroupIndex] : nullptr;
+        mesh->indexOffset = reader.Read<decltype(mesh->indexOffset)>();
+        mesh->vertexOffset = reader.Read<decltype(mesh->vertexOffset)>();
+        mesh->totalIndices = reader.Read<decltype(mesh->totalIndices)>();
+        mesh->totalVertices = reader.Read<decltype(mesh->totalVertices)>();
+        mesh->objectSpaceBounds = reader.Read<decltype(mesh->objectSpaceBounds)>();
+
+        const uint32_t numGeometries = reader.Read<uint32_t>();
+        for (uint32_t geometryIndex = 0; geometryIndex < numGeometries && reader.IsValid(); geometryIndex++)
+        {
+            auto geometry = std::make_shared<MeshGeometry>();
+            const int32_t materialIndex = reader.ReadIndex(materials.size());
+            geometry->material = materialIndex >= 0 ? materials[materialIndex] : nullptr;
+            geometry->indexOffsetInMesh = reader.Read<decltype(geometry->indexOffsetInMesh)>();
+            geometry->vertexOffsetInMesh = reader.Read<decltype(geometry->vertexOffsetInMesh)>();
+            geometry->numIndices = reader.Read<decltype(geometry->numIndices)>();
+            geometry->numVertices = reader.Read<decltype(geometry->numVertices)>();
+            geometry->objectSpaceBounds = reader.Read<decltype(geometry->objectSpaceBounds)>();
+            mesh->geometries.push_back(geometry);
+        }
+
+        if (!reader.IsValid() || !mesh->buffers)
+            return false;
+    }
+
+    struct NodeRecord
+    {
+        int32_t parentIndex = -1;
+        std::shared_ptr<SceneGraphNode> node;
+    };
+
+    std::vector<NodeRecord> nodes(reader.Read<uint32_t>());
+    for (size_t index = 0; index < nodes.size() && reader.IsValid(); index++)
+    {
+        NodeRecord& record = nodes[index];
+        record.parentIndex = reader.ReadIndex(index);
+        record.node = std::make_shared<SceneGraphNode>();
+        record.node->SetName(reader.ReadString());
+
+        const auto translation = reader.Read<std::decay_t<decltype(record.node->GetTranslation())>>();
+        const auto rotation = reader.Read<std::decay_t<decltype(record.node->GetRotation())>>();
+        const auto scaling = reader.Read<std::decay_t<decltype(record.node->GetScaling())>>();
+        record.node->SetTransform(&translation, &rotation, &scaling);
+
+        switch (reader.Read<LeafType>())
+        {
+        case LeafType::None:
+            break;
+
+        case LeafType::Mesh: {
+            const int32_t meshIndex = reader.ReadIndex(meshes.size());
+            if (meshIndex >= 0)
+                record.node->SetLeaf(std::make_shared<MeshInstance>(meshes[meshIndex]));
+            break;
+        }
+
+        case LeafType::Light: {
+            const int32_t lightType = reader.Read<int32_t>();
+            const auto color = reader.Read<float3>();
+            const auto parameters = reader.Read<std::array<float, 5>>();
+
+            std::shared_ptr<Light> light;
+            if (lightType == LightType_Directional)
+            {
+                auto directional = std::make_shared<DirectionalLight>();
+                directional->irradiance = parameters[0];
+                directional->angularSize = parameters[1];
+                light = directional;
+            }
+            else if (lightType == LightType_Point)
+            {
+                auto point = std::make_shared<PointLight>();
+                point->intensity = parameters[0];
+                point->radius = parameters[1];
+                point->range = parameters[2];
+                light = point;
+            }
+            else if (lightType == LightType_Spot)
+            {
+                auto spot = std::make_shared<SpotLight>();
+                spot->intensity = parameters[0];
+                spot->radius = parameters[1];
+                spot->range = parameters[2];
+                spot->innerAngle = parameters[3];
+                spot->outerAngle = parameters[4];
+                light = spot;
+            }
+            else
+            {
+                return false;
+            }
+
+            light->color = color;
+            record.node->SetLeaf(light);
+            break;
+        }
+
+        default:
+            return false;
+        }
+
+        if ((index == 0) != (record.parentIndex < 0))
+            return false;
+    }
+
+    if (!reader.IsValid() || nodes.empty())
+        return false;
+
+    if (!m_TextureCache && !textureReferences.empty())
+        return false;
+
+    // Everything was read successfully, now request the textures and assemble the scene graph
+
+    std::vector<std::shared_ptr<LoadedTexture>> textures;
+    textures.reserve(textureReferences.size());
+    for (const auto& texture : textureReferences)
+    {
+#ifdef DONUT_WITH_TASKFLOW
+        if (executor)
+        {
+            textures.push_back(m_TextureCache->LoadTextureFromFileAsync(texture.path, texture.sRGB, *executor));
+            continue;
+        }
+#else
+        (void)executor;
+#endif
+        textures.push_back(m_TextureCache->LoadTextureFromFileDeferred(texture.path, texture.sRGB));
+    }
+
+    for (size_t index = 0; index < materials.size(); index++)
+    {
+        std::shared_ptr<LoadedTexture>* materialTextures[c_NumMaterialTextures];
+        GetMaterialTextures(*materials[index], materialTextures);
+        for (size_t slot = 0; slot < c_NumMaterialTextures; slot++)
+        {
+            const int32_t textureIndex = materialTextureIndices[index][slot];
+            if (textureIndex >= 0)
+                *materialTextures[slot] = textures[textureIndex];
+        }
+    }
+
+    m_SceneGraph = std::make_shared<SceneGraph>();
+    m_SceneGraph->SetRootNode(nodes[0].node);
+    for (size_t index = 1; index < nodes.size(); index++)
+        m_SceneGraph->Attach(nodes[nodes[index].parentIndex].node, nodes[index].node);
+
+    return true;
+}
@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/engine/Scene.h>
+#include <filesystem>
+#include <functional>
+#include <memory>
+
+namespace tf
+{
+    class Executor;
+}
+
+// Scene that keeps a binary copy of its contents on disk, so that later launches can skip parsing the source file.
+//
+// The cache file is keyed by the path, size and modification time of the scene file and of every other file
+// the scene depends on: the files the importer read through the file system (buffers, referenced glTF files)
+// and the textures of the materials. The cache is rejected when any of them changed. It stores the vertex
+// streams and index buffers exactly as donut keeps them in memory, together with the mesh and geometry tables,
+// material constants, texture references, lights and the node hierarchy. Every array is 16-byte aligned in the
+// file, so the file can be memory-mapped and its streams copied or uploaded without any conversion.
+//
+// Scenes with animations, skinned meshes or cameras are not cached and always load from the source file,
+// and so are scenes that depend on files that are not on the disk.
+class CachedScene : public donut::engine::Scene
+{
+public:
+    // Maps a path in the scene's file system to the file on the disk, or returns an empty path if there is none
+    typedef std::function<std::filesystem::path(const std::filesystem::path&)> NativeFileNameFunc;
+
+    CachedScene(
+        nvrhi::IDevice* device,
+        donut::engine::ShaderFactory& shaderFactory,
+        std::shared_ptr<donut::vfs::IFileSystem> fs,
+        std::shared_ptr<donut::engine::TextureCache> textureCache,
+        std::shared_ptr<donut::engine::DescriptorTableManager> descriptorTable,
+        std::shared_ptr<donut::engine::SceneTypeFactory> sceneTypeFactory);
+
+    // Loads the scene from the cache in cacheDirectory when it is up to date with the source files.
+    // Otherwise, loads the scene from sceneFileName and writes a new cache file.
+    // getNativeFileName locates the source files on the disk; without it, the paths in the file system are used as is.
+    bool LoadWithCache(
+        const std::filesystem::path& sceneFileName,
+        const std::filesystem::path& cacheDirectory,
+        const NativeFileNameFunc& getNativeFileName = nullptr,
+        tf::Executor* executor = nullptr);
+
+    [[nodiscard]] bool IsLoadedFromCache() const { return m_LoadedFromCache; }
+
+private:
+    class RecordingFileSystem;
+
+    std::shared_ptr<RecordingFileSystem> m_RecordingFileSystem;
+    bool m_LoadedFromCache = false;
+
+    CachedScene(
+        std::shared_ptr<RecordingFileSystem> fs,
+        nvrhi::IDevice* device,
+        donut::engine::ShaderFactory& shaderFactory,
+        std::shared_ptr<donut::engine::TextureCache> textureCache,
+        std::shared_ptr<donut::engine::DescriptorTableManager> descriptorTable,
+        std::shared_ptr<donut::engine::SceneTypeFactory> sceneTypeFactory);
+
+    bool ReadCache(const std::filesystem::path& cacheFileName, const std::filesystem::path& nativeFileName, tf::Executor* executor);
+    bool WriteCache(const std::filesystem::path& cacheFileName, const std::filesystem::path& nativeFileName, const NativeFileNameFunc& getNativeFileName) const;
+};
@@ -27,6 +27,8 @@
 #include <donut/core/vfs/VFS.h>
 #include <nvrhi/utils.h>
 
+#include "pipeline_cache.h"
+
 using namespace donut;
 
 static const char* g_WindowTitle = "Donut Example: Basic Triangle";
@@ -38,6 +40,7 @@ private:
     nvrhi::ShaderHandle m_PixelShader;
     nvrhi::GraphicsPipelineHandle m_Pipeline;
     nvrhi::CommandListHandle m_CommandList;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
 
 public:
     using IRenderPass::IRenderPass;
@@ -48,9 +51,10 @@ public:
         
         auto nativeFS = std::make_shared<vfs::NativeFileSystem>();
         engine::ShaderFactory shaderFactory(GetDevice(), nativeFS, appShaderPath);
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
 
-        m_VertexShader = shaderFactory.CreateShader("shaders.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
-        m_PixelShader = shaderFactory.CreateShader("shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
+        m_VertexShader = m_PipelineCache->CreateShader(shaderFactory, "shaders.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
+        m_PixelShader = m_PipelineCache->CreateShader(shaderFactory, "shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
 
         if (!m_VertexShader || !m_PixelShader)
         {
@@ -82,7 +86,7 @@ public:
             psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
             psoDesc.renderState.depthStencilState.depthTestEnable = false;
 
-            m_Pipeline = GetDevice()->createGraphicsPipeline(psoDesc, framebuffer);
+            m_Pipeline = m_PipelineCache->CreateGraphicsPipeline(psoDesc, framebuffer);
         }
 
         m_CommandList->open();
@@ -31,8 +31,14 @@
 #include <GLFW/glfw3.h>
 #include <set>
 #include <fstream>
+#include <chrono>
+#include <unordered_map>
+#include <string_view>
+#include <cstring>
 #include <donut/core/math/math.h>
 #include <iostream>
+#include "memory_allocator.h"
+#include "upload_manager.h"
 #if defined(_WIN32)
 #include <vulkan/vulkan_win32.h>
 #endif
@@ -374,16 +380,51 @@ public:
 
 	// Vertex buffer and attributes
 	struct {
-		VkDeviceMemory memory; // Handle to the device memory for this buffer
-		VkBuffer buffer;       // Handle to the Vulkan buffer object that the memory is bound to
+		MemoryAllocation memory; // Range of device memory for this buffer, sub-allocated by the memory allocator
+		VkBuffer buffer;         // Handle to the Vulkan buffer object that the memory is bound to
 	} vertices;
 
 	// Index buffer
 	struct {
-		VkDeviceMemory memory;
+		MemoryAllocation memory;
 		VkBuffer buffer;
 		uint32_t count;
 	} indices;
+
+	// Size of the linear upload buffer owned by every frame in flight
+	static constexpr VkDeviceSize c_FrameUploadBufferSize = 4 << 20;
+
+	// Everything the CPU needs to record and submit one frame while the GPU may still execute the previous ones
+	struct FrameContext {
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		// Signaled when the GPU has finished the frame's submission, guards reuse of all the other members
+		VkFence fence = VK_NULL_HANDLE;
+		// Swap chain image presentation
+		VkSemaphore presentComplete = VK_NULL_HANDLE;
+		// Command buffer submission and execution
+		VkSemaphore renderComplete = VK_NULL_HANDLE;
+		// Host visible buffer that upload data is linearly sub-allocated from, rewound when the frame is reused
+		VkBuffer uploadBuffer = VK_NULL_HANDLE;
+		MemoryAllocation uploadMemory;
+		uint8_t* uploadMapped = nullptr;
+		VkDeviceSize uploadOffset = 0;
+		// Number of copies recorded since the last barrier, see barrierUploads()
+		uint32_t uploadCopyCount = 0;
+		// Staging buffers of the uploads that did not fit into the upload buffer, destroyed when the frame is reused
+		struct OverflowBuffer {
+			VkBuffer buffer;
+			MemoryAllocation memory;
+		};
+		std::vector<OverflowBuffer> overflowBuffers;
+	};
+
+	// A range of a frame's upload buffer returned by allocateUpload()
+	struct UploadAllocation {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		uint8_t* mapped;
+	};
 public:
 	bool initVulkan()
 	{
@@ -451,7 +492,29 @@ public:
 			}
 		}
 
-		err = createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain);
+		// The upload manager signals completion with a timeline semaphore, which is core in Vulkan 1.2
+		VkPhysicalDeviceVulkan12Features supportedVulkan12Features{};
+		supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		VkPhysicalDeviceFeatures2 supportedFeatures2{};
+		supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		supportedFeatures2.pNext = &supportedVulkan12Features;
+		if (deviceProperties.apiVersion >= VK_API_VERSION_1_2)
+		{
+			vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+		}
+		if (!supportedVulkan12Features.timelineSemaphore)
+		{
+			std::cerr << "The device does not support timeline semaphores" << std::endl;
+			return false;
+		}
+		enabledVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+		enabledVulkan12Features.timelineSemaphore = VK_TRUE;
+		enabledVulkan12Features.pNext = deviceCreatepNextChain;
+		deviceCreatepNextChain = &enabledVulkan12Features;
+
+		// Also request a transfer queue, which is a separate queue family on devices with dedicated copy engines
+		err = createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain, true,
+			VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
 		if (err) {
 			std::cerr << "Could not create Vulkan device: " << std::endl;
 			return false;
@@ -460,6 +523,27 @@ public:
 		// Get a graphics queue from the device
 		vkGetDeviceQueue(logicalDevice, queueFamilyIndices.graphics, 0, &queue);
 
+		// All buffer and image memory is sub-allocated from large blocks, with the memory type selection of getMemoryType()
+		MemoryAllocatorCallbacks allocatorCallbacks = createVulkanMemoryAllocatorCallbacks(logicalDevice, deviceMemoryProperties);
+		allocatorCallbacks.getMemoryType = [this](uint32_t typeBits, VkMemoryPropertyFlags properties, VkBool32* memTypeFound)
+		{
+			return getMemoryType(typeBits, properties, memTypeFound);
+		};
+		memoryAllocator = std::make_unique<MemoryAllocator>(allocatorCallbacks, deviceProperties.limits.bufferImageGranularity);
+
+		// Static data is uploaded on the transfer queue, when the device has no dedicated one this is the graphics queue
+		vkGetDeviceQueue(logicalDevice, queueFamilyIndices.transfer, 0, &transferQueue);
+
+		UploadManagerDesc uploadManagerDesc;
+		uploadManagerDesc.device = logicalDevice;
+		uploadManagerDesc.queue = transferQueue;
+		uploadManagerDesc.queueFamily = queueFamilyIndices.transfer;
+		uploadManagerDesc.consumerQueueFamily = queueFamilyIndices.graphics;
+		uploadManager = std::make_unique<UploadManager>(uploadManagerDesc, *memoryAllocator);
+
+		donut::log::info("Uploads use queue family %u%s", queueFamilyIndices.transfer,
+			queueFamilyIndices.transfer != queueFamilyIndices.graphics ? " (dedicated transfer queue)" : " (shared with graphics)");
+
 		swapChain.connect(instance, physicalDevice, logicalDevice);
 
 
@@ -497,43 +581,246 @@ public:
 		}
 	}
 
-	void createCommandBuffers()
+	// Creates the resources owned by every frame in flight: a command pool with one command buffer, the fence and semaphores
+	// that synchronize the frame with the GPU and the presentation engine, and a persistently mapped linear upload buffer
+	// None of these are touched by the CPU again before the fence of their frame has signaled, see beginFrame()
+	void createFrameContexts()
 	{
-		// All command buffers are allocated from a command pool
-		VkCommandPoolCreateInfo commandPoolCI{};
-		commandPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		commandPoolCI.queueFamilyIndex = swapChain.queueNodeIndex;
-		commandPoolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(logicalDevice, &commandPoolCI, nullptr, &commandPool));
-
-		// Allocate one command buffer per max. concurrent frame from above pool
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
-		cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		cmdBufAllocateInfo.commandPool = commandPool;
-		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		cmdBufAllocateInfo.commandBufferCount = MAX_CONCURRENT_FRAMES;
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(logicalDevice, &cmdBufAllocateInfo, commandBuffers.data()));
-	}
-
-	void createSynchronizationPrimitives()
-	{
-		for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; ++i)
+		for (FrameContext& frame : frames)
 		{
+			// The pool is reset as a whole at the start of the frame, so the command buffer does not need to be resettable on its own
+			frame.commandPool = createCommandPool(swapChain.queueNodeIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+			VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+			cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cmdBufAllocateInfo.commandPool = frame.commandPool;
+			cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			cmdBufAllocateInfo.commandBufferCount = 1;
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(logicalDevice, &cmdBufAllocateInfo, &frame.commandBuffer));
+
 			// Semaphores (Used for correct command ordering)
 			VkSemaphoreCreateInfo semaphoreCI{};
 			semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 			// Semaphore used to ensure that image presentation is complete before starting to submit again
-			VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreCI, nullptr, &presentCompleteSemaphores[i]));
+			VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreCI, nullptr, &frame.presentComplete));
 			// Semaphore used to ensure that all commands submitted have been finished before submitting the image to the queue
-			VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreCI, nullptr, &renderCompleteSemaphores[i]));
+			VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreCI, nullptr, &frame.renderComplete));
 
 			// Fences (Used to check draw command buffer completion)
 			VkFenceCreateInfo fenceCI{};
 			fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 			// Create in signaled state so we don't wait on first render of each command buffer
 			fenceCI.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-			VK_CHECK_RESULT(vkCreateFence(logicalDevice, &fenceCI, nullptr, &waitFences[i]));
+			VK_CHECK_RESULT(vkCreateFence(logicalDevice, &fenceCI, nullptr, &frame.fence));
+
+			// Upload buffer, mapped once for the lifetime of the frame context
+			// Host coherent memory is used so that writes don't need to be flushed before the copies are submitted
+			VkBufferCreateInfo bufferCI{};
+			bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferCI.size = c_FrameUploadBufferSize;
+			bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCI, nullptr, &frame.uploadBuffer));
+
+			// The upload buffers of all frames live and die together, so they are packed into a linear block
+			allocateBufferMemory(frame.uploadBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				MemoryAllocationType::Linear, frame.uploadMemory);
+			frame.uploadMapped = frame.uploadMemory.mapped;
+		}
+	}
+
+	void destroyFrameContexts()
+	{
+		for (FrameContext& frame : frames)
+		{
+			releaseOverflowBuffers(frame);
+			vkDestroyBuffer(logicalDevice, frame.uploadBuffer, nullptr);
+			memoryAllocator->free(frame.uploadMemory);
+			vkDestroyFence(logicalDevice, frame.fence, nullptr);
+			vkDestroySemaphore(logicalDevice, frame.presentComplete, nullptr);
+			vkDestroySemaphore(logicalDevice, frame.renderComplete, nullptr);
+			// Destroying the pool also frees the command buffer, even if it is still in the recording state
+			vkDestroyCommandPool(logicalDevice, frame.commandPool, nullptr);
+			frame = FrameContext{};
+		}
+	}
+
+	// Opens the current frame for recording
+	// This is the only place where the CPU waits for the GPU: the fence belongs to the submission MAX_CONCURRENT_FRAMES frames ago,
+	// so recording this frame overlaps with the GPU still executing the previous one
+	void beginFrame()
+	{
+		FrameContext& frame = frames[currentFrame];
+
+		VK_CHECK_RESULT(vkWaitForFences(logicalDevice, 1, &frame.fence, VK_TRUE, UINT64_MAX));
+
+		// The GPU is done with everything this frame recorded and uploaded last time, so both can be recycled
+		VK_CHECK_RESULT(vkResetCommandPool(logicalDevice, frame.commandPool, 0));
+		frame.uploadOffset = 0;
+		frame.uploadCopyCount = 0;
+		releaseOverflowBuffers(frame);
+
+		VkCommandBufferBeginInfo cmdBufInfo{};
+		cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &cmdBufInfo));
+	}
+
+	// Closes the current frame, submits and presents it, then moves on to the next frame context and opens it
+	// A frame is always open between two calls to render(), so uploads issued at any time land in the next submission
+	// A non-zero uploadWaitValue makes the submission wait for that value of the upload manager's timeline semaphore
+	void endFrame(uint32_t imageIndex, uint64_t uploadWaitValue = 0)
+	{
+		FrameContext& frame = frames[currentFrame];
+
+		VK_CHECK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+
+		// Semaphores to wait upon before the submitted command buffer starts executing: the swap chain image,
+		// and the uploads used by this frame if there are any
+		// The value of the binary semaphore is ignored, the timeline semaphore waits for uploadWaitValue
+		VkSemaphore waitSemaphores[2] = { frame.presentComplete, uploadManager->getTimelineSemaphore() };
+		// Pipeline stages at which the queue submission will wait (via pWaitSemaphores)
+		VkPipelineStageFlags waitStageMasks[2] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, UploadManager::c_ConsumerStages };
+		uint64_t waitValues[2] = { 0, uploadWaitValue };
+
+		VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+		timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineSubmitInfo.waitSemaphoreValueCount = uploadWaitValue ? 2 : 1;
+		timelineSubmitInfo.pWaitSemaphoreValues = waitValues;
+
+		// The submit info structure specifies a command buffer queue submission batch
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineSubmitInfo;
+		submitInfo.pWaitDstStageMask = waitStageMasks;	// Pointer to the list of pipeline stages that the semaphore waits will occur at
+		submitInfo.waitSemaphoreCount = uploadWaitValue ? 2 : 1;
+		submitInfo.signalSemaphoreCount = 1;			// One signal semaphore
+		submitInfo.pCommandBuffers = &frame.commandBuffer;	// Command buffers(s) to execute in this batch (submission)
+		submitInfo.commandBufferCount = 1;		// One cummand buffer
+
+		submitInfo.pWaitSemaphores = waitSemaphores;
+		// Semaphore to be signaled when command buffers have completed
+		submitInfo.pSignalSemaphores = &frame.renderComplete;
+
+		// Submit to the graphics queue passing a wait fence
+		VK_CHECK_RESULT(vkResetFences(logicalDevice, 1, &frame.fence));
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, frame.fence));
+
+		// Present the current frame buffer to the swap chain
+		// Pass the semaphore signaled by the command buffer submission from the submit info as the wait semaphore for swap chain presentation
+		// This ensures that the image is not presented to the windowing system until all commands have been submitted
+
+		VkPresentInfoKHR presentInfo{};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &frame.renderComplete;
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &swapChain.swapChain;
+		presentInfo.pImageIndices = &imageIndex;
+		VkResult result = vkQueuePresentKHR(queue, &presentInfo);
+
+		if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR))
+		{
+			//windowResize();
+		}
+		else if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Could not present the image to the swap chain!");
+		}
+
+		currentFrame = (currentFrame + 1) % MAX_CONCURRENT_FRAMES;
+		beginFrame();
+	}
+
+	// Sub-allocates host visible memory from the upload buffer of the current frame
+	// The memory stays valid until the frame has been executed by the GPU, no staging buffer has to be created or waited on
+	UploadAllocation allocateUpload(VkDeviceSize size, VkDeviceSize alignment = 16)
+	{
+		FrameContext& frame = frames[currentFrame];
+
+		const VkDeviceSize offset = (frame.uploadOffset + alignment - 1) & ~(alignment - 1);
+		if (offset + size > c_FrameUploadBufferSize)
+		{
+			return allocateOverflowUpload(size);
 		}
+		frame.uploadOffset = offset + size;
+
+		UploadAllocation allocation;
+		allocation.buffer = frame.uploadBuffer;
+		allocation.offset = offset;
+		allocation.mapped = frame.uploadMapped + offset;
+		return allocation;
+	}
+
+	// Fallback for uploads that don't fit into what is left of the frame's upload buffer: a staging buffer of their own,
+	// released together with the rest of the frame's uploads once its fence has signaled, so overflowing costs an
+	// allocation but never blocks or fails
+	UploadAllocation allocateOverflowUpload(VkDeviceSize size)
+	{
+		FrameContext& frame = frames[currentFrame];
+
+		VkBufferCreateInfo bufferCI{};
+		bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferCI.size = size;
+		bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		FrameContext::OverflowBuffer overflow{};
+		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCI, nullptr, &overflow.buffer));
+		allocateBufferMemory(overflow.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			MemoryAllocationType::Block, overflow.memory);
+		frame.overflowBuffers.push_back(overflow);
+		++uploadOverflowCount;
+
+		UploadAllocation allocation;
+		allocation.buffer = overflow.buffer;
+		allocation.offset = 0;
+		allocation.mapped = overflow.memory.mapped;
+		return allocation;
+	}
+
+	void releaseOverflowBuffers(FrameContext& frame)
+	{
+		for (FrameContext::OverflowBuffer& overflow : frame.overflowBuffers)
+		{
+			vkDestroyBuffer(logicalDevice, overflow.buffer, nullptr);
+			memoryAllocator->free(overflow.memory);
+		}
+		frame.overflowBuffers.clear();
+	}
+
+	// Number of uploads that went to an overflow buffer, reported at shutdown
+	uint64_t uploadOverflowCount = 0;
+
+	// Copies data into a device local buffer through the upload buffer of the current frame
+	// The copy is recorded into the frame's command buffer and executes ahead of the frame's draws, the call never blocks
+	void uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+	{
+		UploadAllocation upload = allocateUpload(size);
+		memcpy(upload.mapped, data, size);
+
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = upload.offset;
+		copyRegion.dstOffset = dstOffset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(frames[currentFrame].commandBuffer, upload.buffer, dstBuffer, 1, &copyRegion);
+
+		++frames[currentFrame].uploadCopyCount;
+	}
+
+	// Makes the copies recorded by uploadBuffer() visible to the vertex input and shader stages of the following draws
+	void barrierUploads(VkCommandBuffer commandBuffer)
+	{
+		if (frames[currentFrame].uploadCopyCount == 0)
+			return;
+
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		frames[currentFrame].uploadCopyCount = 0;
 	}
 
 	// Command buffer pool
@@ -578,12 +865,205 @@ public:
 	}
 
 	// Pipeline cache object
-	VkPipelineCache pipelineCache;
+	// The cache contents are persisted to disk between runs so that the driver can skip compiling pipelines it has seen before
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+	// Header written in front of the driver's pipeline cache data. The driver validates its own header (vendor, device and cache UUID),
+	// but not the driver version, and some drivers crash on stale data instead of rejecting it, so everything is checked here before use
+	struct PipelineCacheFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint32_t reserved; // keeps the 64-bit fields aligned without implicit padding, the header is compared with memcmp
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	static constexpr uint32_t c_PipelineCacheMagic = 0x43505644; // 'DVPC'
+	static constexpr uint32_t c_PipelineCacheVersion = 2;
+
+	// Startup statistics for the shader blob cache and the pipeline cache
+	struct {
+		uint32_t shaderCacheHits = 0;
+		uint32_t shaderCacheMisses = 0;
+		bool pipelineCacheLoaded = false;
+		size_t pipelineCacheLoadedSize = 0;
+		uint32_t pipelinesCreated = 0;
+		double pipelineCompileTimeMs = 0.0;
+	} cacheStats;
+
+	PipelineCacheFileHeader getPipelineCacheFileHeader(size_t dataSize, const void* data)
+	{
+		PipelineCacheFileHeader header{};
+		header.magic = c_PipelineCacheMagic;
+		header.version = c_PipelineCacheVersion;
+		header.vendorID = deviceProperties.vendorID;
+		header.deviceID = deviceProperties.deviceID;
+		header.driverVersion = deviceProperties.driverVersion;
+		memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+		header.dataSize = dataSize;
+		header.dataHash = data ? getPipelineCacheDataHash(data, dataSize) : 0;
+		return header;
+	}
+
+	// 64-bit FNV-1a of the driver data. std::hash is not used because its result may change between
+	// standard library versions and builds, which would reject every cache file written by another build.
+	static uint64_t getPipelineCacheDataHash(const void* data, size_t size)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= static_cast<const uint8_t*>(data)[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	// The file name includes the device and driver identity, so switching GPUs or updating the driver starts a new cache
+	// instead of overwriting the one for the other configuration
+	std::filesystem::path getPipelineCachePath()
+	{
+		char uuid[VK_UUID_SIZE * 2 + 1];
+		for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+			snprintf(uuid + i * 2, 3, "%02x", deviceProperties.pipelineCacheUUID[i]);
+
+		char fileName[128];
+		snprintf(fileName, sizeof(fileName), "%s_%04x_%04x_%08x_%s.pipelinecache", name.c_str(),
+			deviceProperties.vendorID, deviceProperties.deviceID, deviceProperties.driverVersion, uuid);
+
+		return donut::app::GetDirectoryWithExecutable() / fileName;
+	}
+
+	std::vector<char> loadPipelineCacheData()
+	{
+		std::ifstream is(getPipelineCachePath(), std::ios::binary);
+		if (!is.is_open())
+			return {};
+
+		PipelineCacheFileHeader fileHeader{};
+		is.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+		if (!is || fileHeader.dataSize > (256ull << 20))
+			return {};
+
+		std::vector<char> data(fileHeader.dataSize);
+		is.read(data.data(), data.size());
+		if (!is)
+			return {};
+
+		PipelineCacheFileHeader expectedHeader = getPipelineCacheFileHeader(data.size(), data.data());
+		if (memcmp(&fileHeader, &expectedHeader, sizeof(fileHeader)) != 0)
+		{
+			std::cerr << "Pipeline cache file does not match the current device or driver, ignoring it" << std::endl;
+			return {};
+		}
+
+		return data;
+	}
+
 	void createPipelineCache()
 	{
+		std::vector<char> initialData = loadPipelineCacheData();
+
 		VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
 		pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-		VK_CHECK_RESULT(vkCreatePipelineCache(logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+		pipelineCacheCreateInfo.initialDataSize = initialData.size();
+		pipelineCacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+		VkResult result = vkCreatePipelineCache(logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+		if (result != VK_SUCCESS && !initialData.empty())
+		{
+			// The driver rejected the data, start with an empty cache
+			pipelineCacheCreateInfo.initialDataSize = 0;
+			pipelineCacheCreateInfo.pInitialData = nullptr;
+			initialData.clear();
+			result = vkCreatePipelineCache(logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+		}
+		VK_CHECK_RESULT(result);
+
+		cacheStats.pipelineCacheLoaded = !initialData.empty();
+		cacheStats.pipelineCacheLoadedSize = initialData.size();
+	}
+
+	// Writes the pipeline cache to disk, through a temporary file so that an interrupted write never leaves a truncated cache behind
+	void savePipelineCache()
+	{
+		if (pipelineCache == VK_NULL_HANDLE)
+			return;
+
+		size_t dataSize = 0;
+		VK_CHECK_RESULT(vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, nullptr));
+		if (dataSize == 0)
+			return;
+
+		std::vector<char> data(dataSize);
+		VK_CHECK_RESULT(vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, data.data()));
+		data.resize(dataSize);
+
+		const std::filesystem::path cachePath = getPipelineCachePath();
+		std::filesystem::path tempPath = cachePath;
+		tempPath += ".tmp";
+
+		{
+			std::ofstream os(tempPath, std::ios::binary | std::ios::trunc);
+			if (!os.is_open())
+			{
+				std::cerr << "Could not write the pipeline cache to \"" << tempPath.string() << "\"" << std::endl;
+				return;
+			}
+
+			PipelineCacheFileHeader fileHeader = getPipelineCacheFileHeader(data.size(), data.data());
+			os.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+			os.write(data.data(), data.size());
+			if (!os)
+			{
+				os.close();
+				std::error_code ec;
+				std::filesystem::remove(tempPath, ec);
+				return;
+			}
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tempPath, cachePath, ec);
+		if (ec)
+			std::filesystem::remove(tempPath, ec);
+	}
+
+	void destroyPipelineCache()
+	{
+		savePipelineCache();
+
+		if (pipelineCache != VK_NULL_HANDLE)
+		{
+			vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+			pipelineCache = VK_NULL_HANDLE;
+		}
+	}
+
+	void printCacheStatistics()
+	{
+		donut::log::info("Shader blob cache: %u hits, %u misses", cacheStats.shaderCacheHits, cacheStats.shaderCacheMisses);
+		if (cacheStats.pipelineCacheLoaded)
+			donut::log::info("Pipeline cache: loaded %zu bytes from '%s'", cacheStats.pipelineCacheLoadedSize, getPipelineCachePath().generic_string().c_str());
+		else
+			donut::log::info("Pipeline cache: no valid cache found, pipelines are compiled from scratch");
+		donut::log::info("Pipeline compilation: %u pipelines in %.2f ms", cacheStats.pipelinesCreated, cacheStats.pipelineCompileTimeMs);
+	}
+
+	// Creates graphics pipelines through the pipeline cache and accounts the time spent in the driver
+	VkResult createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& pipelineCI, VkPipeline* pPipeline)
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+		VkResult result = vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, pPipeline);
+		auto endTime = std::chrono::high_resolution_clock::now();
+
+		cacheStats.pipelineCompileTimeMs += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+		++cacheStats.pipelinesCreated;
+		return result;
 	}
 	void prepare()
 	{
@@ -601,13 +1081,14 @@ public:
 
 		setupRenderPass();
 
-		//createPipelineCache();
+		createPipelineCache();
 
 		setupFrameBuffer();
 
-		createSynchronizationPrimitives();
+		createFrameContexts();
 
-		createCommandBuffers();
+		// Open the first frame, so per-frame uploads issued before the first render() are recorded into its command buffer
+		beginFrame();
 
 		createVertexBuffer();
 
@@ -616,6 +1097,9 @@ public:
 		createDescriptorPool();
 		createDescriptorSets();
 		createPipelines();
+
+		printCacheStatistics();
+		printMemoryStatistics();
 	}
 
 	// Prepare vertex and index buffers for an indexed triangle
@@ -623,8 +1107,8 @@ public:
 	void createVertexBuffer()
 	{
 		// A note on memory management in Vulkan in general:
-		//	This is a very complex topic and while its' fine for an example application to small individual memory allocations that is not 
-		// what should be done a real-world application, where you should allocate large chunks of memory at once instead.
+		//	Allocating device memory per resource is slow and quickly runs into the maxMemoryAllocationCount limit,
+		// so resources get their memory from the MemoryAllocator, which sub-allocates large blocks (see allocateBufferMemory).
 
 		// Setup vertices
 		std::vector<Vertex> vertexBuffer{
@@ -644,144 +1128,42 @@ public:
 		// Static data like vertex and index buffer should be stored on the device memory for optimal
 		// (and fastest) access by the GPU
 		//
-		// To achieve this we use so-called "staging buffers" :
-		// - Create a buffer that's visible to the host (and can be mapped)
-		// - Copy the data to this buffer
-		// - Create another buffer that's local on the device (VRAM) with the same size
-		// - Copy the data from the host to the device using a command buffer
-		// - Delete the host visible (staging) buffer
-		// - Use the device local buffers for rendering
+		// To achieve this the data goes through the upload manager:
+		// - Create a buffer that's local on the device (VRAM) with the same size
+		// - Copy the data to the upload manager's staging ring, which is host visible and always mapped
+		// - The copies of all uploads are recorded into one command buffer that is submitted to the transfer queue by flush()
+		// - The first frame acquires the buffers and waits on the GPU for the timeline value of the batch before drawing
+		//
+		// Unlike a dedicated staging buffer with its own submit, this neither allocates memory nor waits for the GPU
 		//
 		// Note: On unified memory architectures where host (CPU) and GPU share the same memory, staging is not necessary
 		// To keep this sample easy to follow, there is no check for that in place
 
-		struct StagingBuffer
-		{
-			VkDeviceMemory memory;
-			VkBuffer buffer;
-		};
-
-		struct
-		{
-			StagingBuffer vertices;
-			StagingBuffer indices;
-		} stagingBuffers;
-
-		
-
 		// Vertex buffer
 		VkBufferCreateInfo vertexBufferInfoCI{};
 		vertexBufferInfoCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		vertexBufferInfoCI.size = vertexBufferSize;
-		// Buffer is used as the copy source
-		vertexBufferInfoCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &vertexBufferInfoCI, nullptr, &stagingBuffers.vertices.buffer));
-		VkMemoryAllocateInfo memAlloc{};
-		memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		VkMemoryRequirements memReqs;
-		vkGetBufferMemoryRequirements(logicalDevice, stagingBuffers.vertices.buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		// Request a host visible memory type that can be used to copy our data to
-		// Also request it to be coherent, so that writes are visible to the GPU right after unmapping the buffer
-		memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &stagingBuffers.vertices.memory));
-		void* data;
-		// Map and copy
-		VK_CHECK_RESULT(vkMapMemory(logicalDevice, stagingBuffers.vertices.memory, 0, memAlloc.allocationSize, 0, &data));
-		memcpy(data, vertexBuffer.data(), vertexBufferSize);
-		vkUnmapMemory(logicalDevice, stagingBuffers.vertices.memory);
-		VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, stagingBuffers.vertices.buffer,
-			stagingBuffers.vertices.memory, 0));
-
 		// Create a device local buffer to which the (host local) vertex data will be copied and which will be used for rendering
 		vertexBufferInfoCI.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &vertexBufferInfoCI, nullptr, &vertices.buffer));
-		vkGetBufferMemoryRequirements(logicalDevice, vertices.buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &vertices.memory));
-		VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, vertices.buffer, vertices.memory, 0));
+		allocateBufferMemory(vertices.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryAllocationType::Block, vertices.memory);
 
 		// Index buffer
 		VkBufferCreateInfo indexbufferCI{};
 		indexbufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		indexbufferCI.size = indexBufferSize;
-		indexbufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		// Copy index data to a buffer visible to the host (staging buffer)
-		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &indexbufferCI, nullptr, &stagingBuffers.indices.buffer));
-		vkGetBufferMemoryRequirements(logicalDevice, stagingBuffers.indices.buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &stagingBuffers.indices.memory));
-		VK_CHECK_RESULT(vkMapMemory(logicalDevice, stagingBuffers.indices.memory, 0, indexBufferSize, 0, &data));
-		memcpy(data, indexBuffer.data(), indexBufferSize);
-		vkUnmapMemory(logicalDevice, stagingBuffers.indices.memory);
-		VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, stagingBuffers.indices.buffer, stagingBuffers.indices.memory, 0));
-
 		// Create destination buffer with device only visibility
 		indexbufferCI.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &indexbufferCI, nullptr, &indices.buffer));
-		vkGetBufferMemoryRequirements(logicalDevice, indices.buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &indices.memory));
-		VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, indices.buffer, indices.memory, 0));
-
-		// Buffer copies have to be submitted to a queue, so we need a command buffer for them
-		// Note: Some devices offer a dedicated transfer queue (with only the transfer bit set) that may be faster when doing lots of copies
-		VkCommandBuffer copyCmd;
-
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
-		cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		cmdBufAllocateInfo.commandPool = commandPool;
-		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		cmdBufAllocateInfo.commandBufferCount = 1;
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(logicalDevice, &cmdBufAllocateInfo, &copyCmd));
+		allocateBufferMemory(indices.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryAllocationType::Block, indices.memory);
 
-		VkCommandBufferBeginInfo cmdBufInfo{};
-		cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-		// Put buffer region copies into command buffer
-		VkBufferCopy copyRegion{};
-		// Vertex buffer
-		copyRegion.size = vertexBufferSize;
-		vkCmdCopyBuffer(copyCmd, stagingBuffers.vertices.buffer, vertices.buffer, 1, &copyRegion);
-		// Index buffer
-		copyRegion.size = indexBufferSize;
-		vkCmdCopyBuffer(copyCmd, stagingBuffers.indices.buffer, indices.buffer, 1, &copyRegion);
-		VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
-
-		// Submit the command buffer to queue to finish the copy
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &copyCmd;
-
-		// Create fence to ensure that the command buffer has finished executing
-		VkFenceCreateInfo fenceCI{};
-		fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceCI.flags = 0;
-		VkFence fence;
-		VK_CHECK_RESULT(vkCreateFence(logicalDevice, &fenceCI, nullptr, &fence));
-
-		// Submit to the queue
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-		// Wait for the fence to signal the command buffer has finished executing
-		VK_CHECK_RESULT(vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, 100000000000));
-
-		vkDestroyFence(logicalDevice, fence, nullptr);
-		vkFreeCommandBuffers(logicalDevice, commandPool, 1, &copyCmd);
-
-		// Destroy staging buffers
-		// Note: Staging buffer must not be deleted before the copies have been submitted and executed
-		vkDestroyBuffer(logicalDevice, stagingBuffers.vertices.buffer, nullptr);
-		vkFreeMemory(logicalDevice, stagingBuffers.vertices.memory, nullptr);
-		vkDestroyBuffer(logicalDevice, stagingBuffers.indices.buffer, nullptr);
-		vkFreeMemory(logicalDevice, stagingBuffers.indices.memory, nullptr);
+		// Stage both buffers and submit their copies as one batch
+		if (!uploadManager->uploadBuffer(vertices.buffer, 0, vertexBuffer.data(), vertexBufferSize) ||
+			!uploadManager->uploadBuffer(indices.buffer, 0, indexBuffer.data(), indexBufferSize))
+		{
+			throw std::runtime_error("The vertex and index data do not fit into the staging ring");
+		}
+		uploadManager->flush();
 	}
 
 	// This function is used to request a device memory type that supports all the property flags we request (e.g. device local, host visible)
@@ -936,17 +1318,34 @@ public:
 		}
 	}
 
+	void shutdown()
+	{
+		// Wait for the device to go idle before reading back the pipeline cache
+		vkDeviceWaitIdle(logicalDevice);
+
+		destroyPipelineCache();
+		destroyFrameContexts();
+
+		const UploadStatistics& uploadStats = uploadManager->getStatistics();
+		donut::log::info("Uploads: %llu copies with %llu bytes in %llu batches, %llu retried", (unsigned long long)uploadStats.uploadCount,
+			(unsigned long long)uploadStats.uploadBytes, (unsigned long long)uploadStats.batchCount, (unsigned long long)uploadStats.rejectedCount);
+		donut::log::info("Per-frame uploads: %llu overflowed the %llu KB upload buffer", (unsigned long long)uploadOverflowCount,
+			(unsigned long long)(c_FrameUploadBufferSize >> 10));
+		uploadManager.reset();
+	}
+
 	void render()
 	{
-		// Use a fence to wait until the command buffer has finished execution before using it again
-		vkWaitForFences(logicalDevice, 1, &waitFences[currentFrame], VK_TRUE, UINT64_MAX);
+		// The current frame has been opened by beginFrame(), which already waited until the GPU was done with its resources
+		FrameContext& frame = frames[currentFrame];
+		VkCommandBuffer commandBuffer = frame.commandBuffer;
 
 		// Get the next swap chain image from the implementation
 		// Note that the implementation is free to return the images in any order, so we must use the acquire function and
 		// can't just cycle through the image
 		uint32_t imageIndex;
 		VkResult result = vkAcquireNextImageKHR(logicalDevice, swapChain.swapChain, UINT64_MAX,
-			presentCompleteSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+			frame.presentComplete, VK_NULL_HANDLE, &imageIndex);
 		if (result == VK_ERROR_OUT_OF_DATE_KHR)
 		{
 		}
@@ -964,22 +1363,20 @@ public:
 		shaderData.projectionMatrix = projMatrix;
 		shaderData.viewMatrix = donut::math::affineToHomogeneous(viewMatrix);
 
-		// Copy the current matrices to the current frame's uniform buffer
-		// Note: Since we requested a host coherent memory type for the uniform buffer,
-		// the write is instantly visible to the GPU 
-		memcpy(uniformBuffers[currentFrame].mapped, &shaderData, sizeof(ShaderData));
+		// Copy the current matrices to the current frame's uniform buffer through the frame's upload buffer
+		// The copy is recorded ahead of the draws and made visible to them by barrierUploads() below
+		uploadBuffer(uniformBuffers[currentFrame].buffer, 0, &shaderData, sizeof(ShaderData));
 
-		VK_CHECK_RESULT(vkResetFences(logicalDevice, 1, &waitFences[currentFrame]));
+		// Take ownership of the buffers uploaded on the transfer queue since the last frame
+		// The submission of this frame waits on the GPU for the returned timeline value, the CPU doesn't wait at all
+		const uint64_t uploadWaitValue = uploadManager->acquireSubmittedUploads(commandBuffer);
 
-		// Bind the command buffer
+		// The command buffer of the frame is already recording and may contain uploads issued since the last frame
 		// Unlike in OpenGL all rendering commands are recorded into command buffers that are then submitted to the queue
 		// This allows to generate work upfront in a separate thread
 		// For basic command buffers (like in this sample), recording is so fast that there is no need to offload
 		// this
-		vkResetCommandBuffer(commandBuffers[currentBuffer], 0);
-
-		VkCommandBufferBeginInfo cmdBufInfo{};
-		cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		barrierUploads(commandBuffer);
 
 		// Set clear values for all framebuffer attachements with loadOp set to clear
 		// We use two attachements (color and depth) that are cleared at the start of the subpass and 
@@ -999,18 +1396,17 @@ public:
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
 		renderPassBeginInfo.framebuffer = frameBuffers[imageIndex];
-		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffers[currentBuffer], &cmdBufInfo));
 
 		// Start the first sub pass specified in our default render pass setup by the base class
 		// This will clear the color and depth attachment
-		vkCmdBeginRenderPass(commandBuffers[currentBuffer], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 		// Update dynamic viewport state
 		VkViewport viewport{};
 		viewport.height = (float)height;
 		viewport.width = (float)width;
 		viewport.minDepth = (float)0.f;
 		viewport.maxDepth = (float)1.f;
-		vkCmdSetViewport(commandBuffers[currentBuffer], 0, 1, &viewport);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
 		// Update dynamic scissor state
 		VkRect2D scissor{};
@@ -1018,69 +1414,27 @@ public:
 		scissor.extent.height = height;
 		scissor.offset.x = 0;
 		scissor.offset.y = 0;
-		vkCmdSetScissor(commandBuffers[currentBuffer], 0, 1, &scissor);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 		// Bind descriptor set for the current frame's uniform buffer, so the shader uses the data from that buffer for this draw
-		vkCmdBindDescriptorSets(commandBuffers[currentBuffer], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, 
-			&uniformBuffers[currentBuffer].descriptorSet, 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, 
+			&uniformBuffers[currentFrame].descriptorSet, 0, nullptr);
 		// Bind the rendering pipeline
 		// The pipeline (state object) contains all states of the rendering pipeline, binding it will set all the states
 		// specified at pipeline creation time
-		vkCmdBindPipeline(commandBuffers[currentBuffer], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 		// Bind triangle vertex buffer (contains position and colors)
 		VkDeviceSize offsets[1]{ 0 };
-		vkCmdBindVertexBuffers(commandBuffers[currentBuffer], 0, 1, &vertices.buffer, offsets);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
 		// Bind triangle index buffer
-		vkCmdBindIndexBuffer(commandBuffers[currentBuffer], indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 		// Draw indexed triangle
-		vkCmdDrawIndexed(commandBuffers[currentBuffer], indices.count, 1, 0, 0, 1);
-		vkCmdEndRenderPass(commandBuffers[currentBuffer]);
+		vkCmdDrawIndexed(commandBuffer, indices.count, 1, 0, 0, 1);
+		vkCmdEndRenderPass(commandBuffer);
 		// Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to 
 		// VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presengint it to the windowing system
-		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffers[currentBuffer]));
 
-		// Submit the command buffer to the graphics queue
-
-		// Pipeline stage at which the queue submission will wait (via pWaitSemaphores)
-		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		// The submit info structure specifies a command buffer queue submission batch
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.pWaitDstStageMask = &waitStageMask;	// Pointer to the list of pipeline stages that the semaphore waits will occur at
-		submitInfo.waitSemaphoreCount = 1;				// One wait semaphore
-		submitInfo.signalSemaphoreCount = 1;			// One signal semaphore
-		submitInfo.pCommandBuffers = &commandBuffers[currentBuffer];	// Command buffers(s) to execute in this batch (submission)
-		submitInfo.commandBufferCount = 1;		// One cummand buffer
-
-		// Semaphore to wait upon before the submitted command buffer starts executing
-		submitInfo.pWaitSemaphores = &presentCompleteSemaphores[currentFrame];
-		// Semaphore to be signaled when command buffers have completed
-		submitInfo.pSignalSemaphores = &renderCompleteSemaphores[currentFrame];
-
-		// Submit to the graphics queue passing a wait fence
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[currentFrame]));
-
-		// Present the current frame buffer to the swap chain
-		// Pass the semaphore signaled by the command buffer submission from the submit info as the wait semaphore for swap chain presentation
-		// This ensures that the image is not presented to the windowing system until all commands have been submitted
-
-		VkPresentInfoKHR presentInfo{};
-		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-		presentInfo.waitSemaphoreCount = 1;
-		presentInfo.pWaitSemaphores = &renderCompleteSemaphores[currentFrame];
-		presentInfo.swapchainCount = 1;
-		presentInfo.pSwapchains = &swapChain.swapChain;
-		presentInfo.pImageIndices = &imageIndex;
-		presentInfo.pImageIndices = &imageIndex;
-		result = vkQueuePresentKHR(queue, &presentInfo);
-
-		if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR))
-		{
-			//windowResize();
-		}
-		else if (result != VK_SUCCESS)
-		{
-			throw std::runtime_error("Could not present the image to the swap chain!");
-		}
+		// Submit the frame, present it and open the next one
+		endFrame(imageIndex, uploadWaitValue);
 	}
 
 	//void getEnabledFeatures() {
@@ -1435,15 +1789,7 @@ public:
 		imageCI.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 
 		VK_CHECK_RESULT(vkCreateImage(logicalDevice, &imageCI, nullptr, &depthStencil.image));
-		VkMemoryRequirements memReqs{};
-		vkGetImageMemoryRequirements(logicalDevice, depthStencil.image, &memReqs);
-
-		VkMemoryAllocateInfo memAlloc{};
-		memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &depthStencil.mem));
-		VK_CHECK_RESULT(vkBindImageMemory(logicalDevice, depthStencil.image, depthStencil.mem, 0));
+		allocateImageMemory(depthStencil.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryAllocationType::Block, depthStencil.mem);
 
 		VkImageViewCreateInfo imageViewCI{};
 		imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1496,6 +1842,48 @@ public:
 		}
 	}
 
+	// Allocates memory for a buffer from the memory allocator and binds it
+	void allocateBufferMemory(VkBuffer buffer, VkMemoryPropertyFlags properties, MemoryAllocationType type, MemoryAllocation& allocation)
+	{
+		MemoryAllocationDesc allocationDesc;
+		vkGetBufferMemoryRequirements(logicalDevice, buffer, &allocationDesc.requirements);
+		allocationDesc.properties = properties;
+		allocationDesc.type = type;
+
+		if (!memoryAllocator->allocate(allocationDesc, allocation))
+		{
+			throw std::runtime_error("Could not allocate buffer memory");
+		}
+		VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, buffer, allocation.memory, allocation.offset));
+	}
+
+	// Allocates memory for an image with optimal tiling from the memory allocator and binds it
+	void allocateImageMemory(VkImage image, VkMemoryPropertyFlags properties, MemoryAllocationType type, MemoryAllocation& allocation)
+	{
+		MemoryAllocationDesc allocationDesc;
+		vkGetImageMemoryRequirements(logicalDevice, image, &allocationDesc.requirements);
+		allocationDesc.properties = properties;
+		allocationDesc.type = type;
+		allocationDesc.optimalImage = true;
+
+		if (!memoryAllocator->allocate(allocationDesc, allocation))
+		{
+			throw std::runtime_error("Could not allocate image memory");
+		}
+		VK_CHECK_RESULT(vkBindImageMemory(logicalDevice, image, allocation.memory, allocation.offset));
+	}
+
+	void printMemoryStatistics()
+	{
+		MemoryStatistics stats = memoryAllocator->getStatistics();
+		donut::log::info("Device memory: %u allocations in %u blocks (%.2f MB) and %u dedicated allocations (%.2f MB), %u vkAllocateMemory calls",
+			stats.allocationCount, stats.blockCount, double(stats.blockBytes) / (1024.0 * 1024.0),
+			stats.dedicatedCount, double(stats.dedicatedBytes) / (1024.0 * 1024.0), stats.deviceAllocationCount);
+		donut::log::info("Device memory blocks: %.2f MB used, %u free ranges, largest free range %.2f MB, fragmentation %.1f%%",
+			double(stats.usedBytes) / (1024.0 * 1024.0), stats.freeRangeCount, double(stats.largestFreeRange) / (1024.0 * 1024.0),
+			stats.fragmentation * 100.f);
+	}
+
 	void handleMessages(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 	{
 
@@ -1505,39 +1893,21 @@ public:
 	{
 		// Prepare and initialize the per-frame uniform buffer blocks containing shader uniforms
 		// Single uniforms like in OpenGL are no longer present in Vulkan. All Shader uniforms are passed via uniform buffer blocks
-		VkMemoryRequirements memReqs;
-
 		// Vertex shader uniform buffer block
 		VkBufferCreateInfo bufferInfo{};
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.pNext = nullptr;
-		allocInfo.allocationSize = 0;
-		allocInfo.allocationSize = 0;
-
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferInfo.size = sizeof(ShaderData);
-		// This buffer will be used as a uniform buffer
-		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+		// This buffer will be used as a uniform buffer, and is written by copies from the frame's upload buffer
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
 		// Create the buffers
 		for (uint32_t i = 0; i < MAX_CONCURRENT_FRAMES; ++i)
 		{
 			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &uniformBuffers[i].buffer));
-			// Get memory requirements including size, alignment and memory type
-			vkGetBufferMemoryRequirements(logicalDevice, uniformBuffers[i].buffer, &memReqs);
-			allocInfo.allocationSize = memReqs.size;
-			// Get the memory type index that supports host visible memory access
-			// Most implementations offer multiple memory types and selecting the correct one to allocate memory from is crucial
-			// We also want the buffer to be host coherent so we don't have to flush (or sync after every update.
-			// Note: This may affect performance so you might not want to do this in a real world application that updates buffers on a regular base
-			allocInfo.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			// Allocate memory for the uniform buffer
-			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &(uniformBuffers[i].memory)));
-			// Bind memory to buffer
-			VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, uniformBuffers[i].buffer, uniformBuffers[i].memory, 0));
-			// We map the buffer once, so we can update it without having to map it again
-			VK_CHECK_RESULT(vkMapMemory(logicalDevice, uniformBuffers[i].memory, 0, sizeof(ShaderData), 0, (void**)&uniformBuffers[i].mapped));
+			// The CPU never writes the buffer directly, the upload buffer of the frame is the only host visible memory involved
+			// The uniform buffers of all frames are created once and never freed on their own, so they are packed into a linear block
+			allocateBufferMemory(uniformBuffers[i].buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				MemoryAllocationType::Linear, uniformBuffers[i].memory);
 		}
 	}
 
@@ -1794,58 +2164,87 @@ public:
 		pipelineCI.pDynamicState = &dynamicStateCI;
 
 		// Create rendering pipeline using the specified states
-		VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &pipeline));
+		VK_CHECK_RESULT(createGraphicsPipeline(pipelineCI, &pipeline));
 
 		// Shader modules are no longer needed once the graphics pipeline has been created
 		vkDestroyShaderModule(logicalDevice, shaderStages[0].module, nullptr);
 		vkDestroyShaderModule(logicalDevice, shaderStages[1].module, nullptr);
 	}
 
-	// Vulkan loads its shaders from an immediate binary representation called SPIR-V
-// Shaders are compiled offline from e.g. GLSL using the reference glslang compiler
-// This function loads such a shader from a binary file and returns a shader module structure
-	VkShaderModule loadSPIRVShader(std::string filename)
+	// In-memory cache of shader binaries, keyed by (file, entry point, defines)
+	// Pipelines that are rebuilt (e.g. on resize or shader reload) reuse the blob instead of going back to the disk
+	std::unordered_map<std::string, std::vector<char>> shaderBlobCache;
+
+	static std::string getShaderBlobKey(const std::string& filename, const char* entryPoint, const std::vector<std::string>& defines)
+	{
+		std::string key = filename;
+		key += '|';
+		key += entryPoint;
+		for (const std::string& define : defines)
+		{
+			key += '|';
+			key += define;
+		}
+		return key;
+	}
+
+	const std::vector<char>* loadShaderBlob(const std::string& filename, const char* entryPoint, const std::vector<std::string>& defines)
 	{
-		size_t shaderSize;
-		char* shaderCode{ nullptr };
+		std::string key = getShaderBlobKey(filename, entryPoint, defines);
+
+		auto it = shaderBlobCache.find(key);
+		if (it != shaderBlobCache.end())
+		{
+			++cacheStats.shaderCacheHits;
+			return &it->second;
+		}
 
+		++cacheStats.shaderCacheMisses;
+
+		std::vector<char> shaderCode;
 #if defined(__ANDROID__)
 		// Load shader from compressed asset
 		AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
 		assert(asset);
-		shaderSize = AAsset_getLength(asset);
-		assert(shaderSize > 0);
-
-		shaderCode = new char[shaderSize];
-		AAsset_read(asset, shaderCode, shaderSize);
+		shaderCode.resize(AAsset_getLength(asset));
+		AAsset_read(asset, shaderCode.data(), shaderCode.size());
 		AAsset_close(asset);
 #else
 		std::ifstream is(filename, std::ios::binary | std::ios::in | std::ios::ate);
 
 		if (is.is_open())
 		{
-			shaderSize = is.tellg();
+			shaderCode.resize(size_t(is.tellg()));
 			is.seekg(0, std::ios::beg);
 			// Copy file contents into a buffer
-			shaderCode = new char[shaderSize];
-			is.read(shaderCode, shaderSize);
+			is.read(shaderCode.data(), shaderCode.size());
 			is.close();
-			assert(shaderSize > 0);
 		}
 #endif
+		if (shaderCode.empty())
+			return nullptr;
+
+		return &shaderBlobCache.emplace(std::move(key), std::move(shaderCode)).first->second;
+	}
+
+	// Vulkan loads its shaders from an immediate binary representation called SPIR-V
+// Shaders are compiled offline from e.g. GLSL using the reference glslang compiler
+// This function loads such a shader from a binary file and returns a shader module structure
+	VkShaderModule loadSPIRVShader(std::string filename, const char* entryPoint = "main", const std::vector<std::string>& defines = {})
+	{
+		const std::vector<char>* shaderCode = loadShaderBlob(filename, entryPoint, defines);
+
 		if (shaderCode)
 		{
 			// Create a new shader module that will be used for pipeline creation
 			VkShaderModuleCreateInfo shaderModuleCI{};
 			shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-			shaderModuleCI.codeSize = shaderSize;
-			shaderModuleCI.pCode = (uint32_t*)shaderCode;
+			shaderModuleCI.codeSize = shaderCode->size();
+			shaderModuleCI.pCode = (const uint32_t*)shaderCode->data();
 
 			VkShaderModule shaderModule;
 			VK_CHECK_RESULT(vkCreateShaderModule(logicalDevice, &shaderModuleCI, nullptr, &shaderModule));
 
-			delete[] shaderCode;
-
 			return shaderModule;
 		}
 		else
@@ -1866,11 +2265,8 @@ public:
 // Synchronization is an important concept of Vulkan that OpenGL mostly hid away. Getting this right is crucial to using Vulkan.
 
 // Semaphores are used to coordinate operations within the graphics queue and ensure correct command ordering
-	std::array<VkSemaphore, MAX_CONCURRENT_FRAMES> presentCompleteSemaphores;
-	std::array<VkSemaphore, MAX_CONCURRENT_FRAMES> renderCompleteSemaphores;
-
-	std::array<VkCommandBuffer, MAX_CONCURRENT_FRAMES> commandBuffers;
-	std::array<VkFence, MAX_CONCURRENT_FRAMES> waitFences;
+// Fences let the CPU know when the GPU is done with the resources of a frame, so they are kept per frame in flight
+	std::array<FrameContext, MAX_CONCURRENT_FRAMES> frames;
 
 	// List of available frame buffers (same as number of swap chain images)
 	std::vector<VkFramebuffer>frameBuffers;
@@ -1878,7 +2274,7 @@ public:
 	VkRenderPass renderPass = VK_NULL_HANDLE;
 	struct {
 		VkImage image;
-		VkDeviceMemory mem;
+		MemoryAllocation mem;
 		VkImageView view;
 	} depthStencil;
 	
@@ -1897,7 +2293,7 @@ public:
 	} settings;
 
 	std::string name = "HelloTriangle";
-	uint32_t apiVersion = VK_API_VERSION_1_0;
+	uint32_t apiVersion = VK_API_VERSION_1_2;
 
     std::vector<std::string> supportedInstanceExtensions;
 	/** @brief Set of device extensions to be enabled for this example (must be set in the derived constructor) */
@@ -1906,6 +2302,8 @@ public:
 
 	/** @brief Optional pNext structure for passing extension structures to device creation */
 	void* deviceCreatepNextChain = nullptr;
+	/** @brief Vulkan 1.2 features enabled on top of the pNext chain, timeline semaphores are required by the upload manager */
+	VkPhysicalDeviceVulkan12Features enabledVulkan12Features{};
 
 	// Vulkan instance, stores all per-application states
 	VkInstance instance;
@@ -1936,6 +2334,10 @@ public:
 	} queueFamilyIndices;
 	/** @brief Default command pool for the graphics queue family index */
 	VkCommandPool commandPool = VK_NULL_HANDLE;
+	/** @brief Sub-allocates the memory of all buffers and images */
+	std::unique_ptr<MemoryAllocator> memoryAllocator;
+	/** @brief Stages uploads of static data and copies them on the transfer queue */
+	std::unique_ptr<UploadManager> uploadManager;
 
 	VulkanSwapChain swapChain;
 
@@ -1972,13 +2374,11 @@ public:
 
 	// Uniform buffer block object
 	struct UniformBuffer {
-		VkDeviceMemory memory;
+		MemoryAllocation memory;
 		VkBuffer buffer;
 		// The descriptor set stores the resources bound to the binding points in a shader
 		// It connects the binding points of the different shaders with the buffers and images used for those bindings
 		VkDescriptorSet descriptorSet;
-		// We keep a pointer to the mapped buffer, so we can easily update it's contents via a memcpy
-		uint8_t* mapped{ nullptr };
 	};
 
 	// We use one UBO per frame, so we can have a frame overlap and make sure that uniforms aren't updated while still in use
@@ -1990,12 +2390,13 @@ public:
 	// Descriptor set pool
 	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 
+	// Index of the frame context that is currently being recorded
 	uint32_t currentFrame = 0;
-	// Active frame buffer index
-	uint32_t currentBuffer = 0;
 
 	// Handle to the device graphics queue that command buffers are submitted to
 	VkQueue queue;
+	// Handle to the queue that the upload manager submits copies to, the graphics queue if there is no separate transfer family
+	VkQueue transferQueue;
 
 	// Synchronization semaphores
 	struct {
@@ -2021,5 +2422,6 @@ int main(int __argc, const char** __argv)
 	deviceVulkan.createWindowSurface();
 	deviceVulkan.prepare();
 	deviceVulkan.renderLoop();
+	deviceVulkan.shutdown();
     return 0;
 }
@@ -0,0 +1,617 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "memory_allocator.h"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static uint32_t bitScanForward(uint64_t mask)
+{
+	assert(mask != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return uint32_t(index);
+#else
+	return uint32_t(__builtin_ctzll(mask));
+#endif
+}
+
+static uint32_t bitScanReverse(uint64_t mask)
+{
+	assert(mask != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, mask);
+	return uint32_t(index);
+#else
+	return uint32_t(63 - __builtin_clzll(mask));
+#endif
+}
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+TlsfAllocator::TlsfAllocator(uint64_t size)
+	: m_Size(size)
+{
+	for (auto& freeLists : m_FreeLists)
+		std::fill(std::begin(freeLists), std::end(freeLists), c_InvalidNode);
+
+	if (size > 0)
+	{
+		uint32_t node = createNode();
+		m_Nodes[node].size = size;
+		insertFree(node);
+	}
+}
+
+// Size classes: the first level is the power of two below the size, the second level splits it into c_SecondLevelCount
+// linear steps. Sizes below c_SecondLevelCount get one class per value.
+void TlsfAllocator::mapping(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel)
+{
+	firstLevel = bitScanReverse(size);
+	if (firstLevel < c_SecondLevelBits)
+		secondLevel = uint32_t(size - (1ull << firstLevel));
+	else
+		secondLevel = uint32_t(size >> (firstLevel - c_SecondLevelBits)) - c_SecondLevelCount;
+}
+
+// Good fit search: the size is rounded up to the next class, so that any range in the class that is found is large enough
+uint32_t TlsfAllocator::findFreeNode(uint64_t size) const
+{
+	uint32_t firstLevel = bitScanReverse(size);
+	if (firstLevel >= c_SecondLevelBits)
+	{
+		size += (1ull << (firstLevel - c_SecondLevelBits)) - 1;
+		if (size < (1ull << firstLevel))
+			return c_InvalidNode; // overflow
+	}
+
+	uint32_t secondLevel;
+	mapping(size, firstLevel, secondLevel);
+
+	uint32_t secondLevelMap = m_SecondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+	if (secondLevelMap == 0)
+	{
+		const uint64_t firstLevelMap = firstLevel + 1 < c_FirstLevelCount ? m_FirstLevelBitmap & (~0ull << (firstLevel + 1)) : 0;
+		if (firstLevelMap == 0)
+			return c_InvalidNode;
+
+		firstLevel = bitScanForward(firstLevelMap);
+		secondLevelMap = m_SecondLevelBitmaps[firstLevel];
+	}
+
+	return m_FreeLists[firstLevel][bitScanForward(secondLevelMap)];
+}
+
+uint32_t TlsfAllocator::createNode()
+{
+	if (!m_UnusedNodes.empty())
+	{
+		uint32_t node = m_UnusedNodes.back();
+		m_UnusedNodes.pop_back();
+		m_Nodes[node] = Node();
+		return node;
+	}
+
+	m_Nodes.emplace_back();
+	return uint32_t(m_Nodes.size() - 1);
+}
+
+void TlsfAllocator::releaseNode(uint32_t node)
+{
+	m_UnusedNodes.push_back(node);
+}
+
+void TlsfAllocator::insertFree(uint32_t node)
+{
+	uint32_t firstLevel, secondLevel;
+	mapping(m_Nodes[node].size, firstLevel, secondLevel);
+
+	uint32_t& head = m_FreeLists[firstLevel][secondLevel];
+	m_Nodes[node].free = true;
+	m_Nodes[node].prevFree = c_InvalidNode;
+	m_Nodes[node].nextFree = head;
+	if (head != c_InvalidNode)
+		m_Nodes[head].prevFree = node;
+	head = node;
+
+	m_FirstLevelBitmap |= 1ull << firstLevel;
+	m_SecondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+	++m_FreeRangeCount;
+}
+
+void TlsfAllocator::removeFree(uint32_t node)
+{
+	uint32_t firstLevel, secondLevel;
+	mapping(m_Nodes[node].size, firstLevel, secondLevel);
+
+	Node& n = m_Nodes[node];
+	if (n.prevFree != c_InvalidNode)
+		m_Nodes[n.prevFree].nextFree = n.nextFree;
+	else
+		m_FreeLists[firstLevel][secondLevel] = n.nextFree;
+	if (n.nextFree != c_InvalidNode)
+		m_Nodes[n.nextFree].prevFree = n.prevFree;
+
+	if (m_FreeLists[firstLevel][secondLevel] == c_InvalidNode)
+	{
+		m_SecondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+		if (m_SecondLevelBitmaps[firstLevel] == 0)
+			m_FirstLevelBitmap &= ~(1ull << firstLevel);
+	}
+
+	n.free = false;
+	n.prevFree = c_InvalidNode;
+	n.nextFree = c_InvalidNode;
+	--m_FreeRangeCount;
+}
+
+// Shrinks the node to size and returns a new node for the remainder, neither is put on a free list
+uint32_t TlsfAllocator::split(uint32_t node, uint64_t size)
+{
+	uint32_t rest = createNode();
+
+	Node& n = m_Nodes[node];
+	Node& r = m_Nodes[rest];
+	r.offset = n.offset + size;
+	r.size = n.size - size;
+	r.prevPhysical = node;
+	r.nextPhysical = n.nextPhysical;
+	if (n.nextPhysical != c_InvalidNode)
+		m_Nodes[n.nextPhysical].prevPhysical = rest;
+	n.nextPhysical = rest;
+	n.size = size;
+
+	return rest;
+}
+
+// Appends next to node, next must directly follow node and be off the free lists
+void TlsfAllocator::merge(uint32_t node, uint32_t next)
+{
+	Node& n = m_Nodes[node];
+	const Node& x = m_Nodes[next];
+	n.size += x.size;
+	n.nextPhysical = x.nextPhysical;
+	if (x.nextPhysical != c_InvalidNode)
+		m_Nodes[x.nextPhysical].prevPhysical = node;
+
+	releaseNode(next);
+}
+
+uint64_t TlsfAllocator::allocate(uint64_t size, uint64_t alignment, uint32_t& node)
+{
+	size = std::max<uint64_t>(size, 1);
+	alignment = std::max<uint64_t>(alignment, 1);
+
+	// Most ranges start at an aligned offset already, only ask for worst case padding when the first candidate doesn't fit
+	uint32_t candidate = findFreeNode(size);
+	if (candidate != c_InvalidNode && alignUp(m_Nodes[candidate].offset, alignment) + size > m_Nodes[candidate].offset + m_Nodes[candidate].size)
+		candidate = alignment > 1 ? findFreeNode(size + alignment - 1) : c_InvalidNode;
+
+	if (candidate == c_InvalidNode)
+		return c_InvalidOffset;
+
+	removeFree(candidate);
+
+	// The padding in front of the allocation stays available for smaller allocations
+	const uint64_t padding = alignUp(m_Nodes[candidate].offset, alignment) - m_Nodes[candidate].offset;
+	if (padding > 0)
+	{
+		uint32_t aligned = split(candidate, padding);
+		insertFree(candidate);
+		candidate = aligned;
+	}
+
+	if (m_Nodes[candidate].size > size)
+	{
+		uint32_t tail = split(candidate, size);
+		insertFree(tail);
+	}
+
+	m_UsedSize += size;
+	++m_AllocationCount;
+
+	node = candidate;
+	return m_Nodes[candidate].offset;
+}
+
+void TlsfAllocator::free(uint32_t node)
+{
+	assert(node < m_Nodes.size() && !m_Nodes[node].free);
+
+	m_UsedSize -= m_Nodes[node].size;
+	--m_AllocationCount;
+
+	const uint32_t prev = m_Nodes[node].prevPhysical;
+	if (prev != c_InvalidNode && m_Nodes[prev].free)
+	{
+		removeFree(prev);
+		merge(prev, node);
+		node = prev;
+	}
+
+	const uint32_t next = m_Nodes[node].nextPhysical;
+	if (next != c_InvalidNode && m_Nodes[next].free)
+	{
+		removeFree(next);
+		merge(node, next);
+	}
+
+	insertFree(node);
+}
+
+uint64_t TlsfAllocator::getLargestFreeRange() const
+{
+	if (m_FirstLevelBitmap == 0)
+		return 0;
+
+	// Only the highest non-empty class can contain the largest range, but its ranges are not sorted
+	const uint32_t firstLevel = bitScanReverse(m_FirstLevelBitmap);
+	const uint32_t secondLevel = bitScanReverse(m_SecondLevelBitmaps[firstLevel]);
+
+	uint64_t largest = 0;
+	for (uint32_t node = m_FreeLists[firstLevel][secondLevel]; node != c_InvalidNode; node = m_Nodes[node].nextFree)
+		largest = std::max(largest, m_Nodes[node].size);
+	return largest;
+}
+
+MemoryAllocatorCallbacks createVulkanMemoryAllocatorCallbacks(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties)
+{
+	MemoryAllocatorCallbacks callbacks;
+
+	callbacks.getMemoryType = [memoryProperties](uint32_t typeBits, VkMemoryPropertyFlags properties, VkBool32* memTypeFound)
+	{
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+		{
+			if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				if (memTypeFound)
+					*memTypeFound = VK_TRUE;
+				return i;
+			}
+		}
+
+		if (!memTypeFound)
+			throw std::runtime_error("Could not find a matching memory type");
+
+		*memTypeFound = VK_FALSE;
+		return 0u;
+	};
+
+	callbacks.getMemoryTypeProperties = [memoryProperties](uint32_t memoryType)
+	{
+		return memoryProperties.memoryTypes[memoryType].propertyFlags;
+	};
+
+	callbacks.allocateMemory = [device](uint32_t memoryType, VkDeviceSize size, VkDeviceMemory* memory)
+	{
+		VkMemoryAllocateInfo memAlloc{};
+		memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		memAlloc.allocationSize = size;
+		memAlloc.memoryTypeIndex = memoryType;
+		return vkAllocateMemory(device, &memAlloc, nullptr, memory);
+	};
+
+	callbacks.freeMemory = [device](VkDeviceMemory memory)
+	{
+		vkFreeMemory(device, memory, nullptr);
+	};
+
+	callbacks.mapMemory = [device](VkDeviceMemory memory, void** mapped)
+	{
+		return vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+	};
+
+	return callbacks;
+}
+
+MemoryAllocator::MemoryAllocator(const MemoryAllocatorCallbacks& callbacks, VkDeviceSize bufferImageGranularity, VkDeviceSize blockSize)
+	: m_Callbacks(callbacks)
+	, m_BufferImageGranularity(std::max<VkDeviceSize>(bufferImageGranularity, 1))
+	, m_BlockSize(blockSize)
+{
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+	// Freeing a block also unmaps it, allocations that are still alive become invalid
+	for (auto& block : m_Blocks)
+	{
+		if (block)
+			m_Callbacks.freeMemory(block->memory);
+	}
+}
+
+bool MemoryAllocator::allocate(const MemoryAllocationDesc& desc, MemoryAllocation& allocation)
+{
+	VkDeviceSize size = desc.requirements.size;
+	VkDeviceSize alignment = std::max<VkDeviceSize>(desc.requirements.alignment, 1);
+
+	// Optimal images own whole granularity pages, so a buffer next to them can never share one
+	if (desc.optimalImage && m_BufferImageGranularity > 1)
+	{
+		alignment = std::max(alignment, m_BufferImageGranularity);
+		size = alignUp(size, m_BufferImageGranularity);
+	}
+
+	MemoryAllocationType type = desc.type;
+	if (type != MemoryAllocationType::Dedicated && size > m_BlockSize / 2)
+		type = MemoryAllocationType::Dedicated;
+
+	uint32_t typeBits = desc.requirements.memoryTypeBits;
+	while (typeBits != 0)
+	{
+		VkBool32 memTypeFound = VK_FALSE;
+		const uint32_t memoryType = m_Callbacks.getMemoryType(typeBits, desc.properties, &memTypeFound);
+		if (!memTypeFound)
+			return false;
+
+		if (allocateFromMemoryType(memoryType, type, size, alignment, allocation))
+			return true;
+
+		// The heap of this memory type is exhausted, try the next type with the requested properties
+		typeBits &= ~(1u << memoryType);
+	}
+
+	return false;
+}
+
+bool MemoryAllocator::allocateFromMemoryType(uint32_t memoryType, MemoryAllocationType type, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation& allocation)
+{
+	if (type == MemoryAllocationType::Dedicated)
+		return allocateDedicated(memoryType, size, allocation);
+
+	for (uint32_t blockIndex = 0; blockIndex < uint32_t(m_Blocks.size()); blockIndex++)
+	{
+		const Block* block = m_Blocks[blockIndex].get();
+		if (block && block->memoryType == memoryType && block->type == type && allocateFromBlock(blockIndex, size, alignment, allocation))
+			return true;
+	}
+
+	// Start a new block, with smaller sizes if the device cannot provide a full one any more
+	for (VkDeviceSize blockSize = m_BlockSize; blockSize >= size; blockSize /= 2)
+	{
+		const uint32_t blockIndex = createBlock(memoryType, type, blockSize);
+		if (blockIndex != ~0u)
+			return allocateFromBlock(blockIndex, size, alignment, allocation);
+	}
+
+	return false;
+}
+
+bool MemoryAllocator::allocateDedicated(uint32_t memoryType, VkDeviceSize size, MemoryAllocation& allocation)
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	if (m_Callbacks.allocateMemory(memoryType, size, &memory) != VK_SUCCESS)
+		return false;
+	++m_DeviceAllocationCount;
+
+	uint8_t* mapped = nullptr;
+	if (!mapIfHostVisible(memoryType, memory, &mapped))
+	{
+		m_Callbacks.freeMemory(memory);
+		return false;
+	}
+
+	allocation = MemoryAllocation();
+	allocation.memory = memory;
+	allocation.size = size;
+	allocation.mapped = mapped;
+	allocation.memoryType = memoryType;
+	allocation.type = MemoryAllocationType::Dedicated;
+
+	++m_DedicatedCount;
+	m_DedicatedBytes += size;
+	return true;
+}
+
+bool MemoryAllocator::allocateFromBlock(uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation& allocation)
+{
+	Block& block = *m_Blocks[blockIndex];
+
+	VkDeviceSize offset;
+	uint32_t node = ~0u;
+	if (block.type == MemoryAllocationType::Linear)
+	{
+		offset = alignUp(block.linearOffset, alignment);
+		if (offset + size > block.size)
+			return false;
+
+		block.linearOffset = offset + size;
+		++block.linearAllocationCount;
+	}
+	else
+	{
+		offset = block.tlsf.allocate(size, alignment, node);
+		if (offset == TlsfAllocator::c_InvalidOffset)
+			return false;
+	}
+
+	allocation = MemoryAllocation();
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+	allocation.memoryType = block.memoryType;
+	allocation.type = block.type;
+	allocation.block = blockIndex;
+	allocation.node = node;
+	return true;
+}
+
+uint32_t MemoryAllocator::createBlock(uint32_t memoryType, MemoryAllocationType type, VkDeviceSize size)
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	if (m_Callbacks.allocateMemory(memoryType, size, &memory) != VK_SUCCESS)
+		return ~0u;
+	++m_DeviceAllocationCount;
+
+	uint8_t* mapped = nullptr;
+	if (!mapIfHostVisible(memoryType, memory, &mapped))
+	{
+		m_Callbacks.freeMemory(memory);
+		return ~0u;
+	}
+
+	auto block = std::make_unique<Block>(size);
+	block->memory = memory;
+	block->memoryType = memoryType;
+	block->type = type;
+	block->mapped = mapped;
+
+	// Reuse the slot of a released block, allocations refer to blocks by index
+	auto slot = std::find(m_Blocks.begin(), m_Blocks.end(), nullptr);
+	if (slot == m_Blocks.end())
+		slot = m_Blocks.insert(m_Blocks.end(), nullptr);
+	*slot = std::move(block);
+	return uint32_t(slot - m_Blocks.begin());
+}
+
+bool MemoryAllocator::mapIfHostVisible(uint32_t memoryType, VkDeviceMemory memory, uint8_t** mapped)
+{
+	*mapped = nullptr;
+	if ((m_Callbacks.getMemoryTypeProperties(memoryType) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
+		return true;
+
+	return m_Callbacks.mapMemory(memory, reinterpret_cast<void**>(mapped)) == VK_SUCCESS;
+}
+
+bool MemoryAllocator::isBlockEmpty(const Block& block)
+{
+	return block.type == MemoryAllocationType::Linear ? block.linearAllocationCount == 0 : block.tlsf.isEmpty();
+}
+
+// Keeps one empty block per memory type and allocation type around, so that a resource that is destroyed and
+// recreated every frame doesn't allocate and free a whole block each time
+void MemoryAllocator::releaseEmptyBlocks(uint32_t memoryType, MemoryAllocationType type)
+{
+	bool keptOne = false;
+	for (auto& block : m_Blocks)
+	{
+		if (!block || block->memoryType != memoryType || block->type != type || !isBlockEmpty(*block))
+			continue;
+
+		if (!keptOne)
+		{
+			keptOne = true;
+			continue;
+		}
+
+		m_Callbacks.freeMemory(block->memory);
+		block.reset();
+	}
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	if (allocation.type == MemoryAllocationType::Dedicated)
+	{
+		m_Callbacks.freeMemory(allocation.memory);
+		--m_DedicatedCount;
+		m_DedicatedBytes -= allocation.size;
+	}
+	else
+	{
+		Block& block = *m_Blocks[allocation.block];
+		assert(block.memory == allocation.memory);
+
+		if (block.type == MemoryAllocationType::Linear)
+		{
+			// Linear blocks are only rewound once nothing in them is alive any more
+			if (--block.linearAllocationCount == 0)
+				block.linearOffset = 0;
+		}
+		else
+		{
+			block.tlsf.free(allocation.node);
+		}
+
+		if (isBlockEmpty(block))
+			releaseEmptyBlocks(block.memoryType, block.type);
+	}
+
+	allocation = MemoryAllocation();
+}
+
+MemoryStatistics MemoryAllocator::getStatistics() const
+{
+	MemoryStatistics stats;
+	stats.dedicatedCount = m_DedicatedCount;
+	stats.dedicatedBytes = m_DedicatedBytes;
+	stats.allocationCount = m_DedicatedCount;
+	stats.deviceAllocationCount = m_DeviceAllocationCount;
+
+	VkDeviceSize totalFreeBytes = 0;
+	double weightedFragmentation = 0.0;
+
+	for (const auto& block : m_Blocks)
+	{
+		if (!block)
+			continue;
+
+		++stats.blockCount;
+		stats.blockBytes += block->size;
+
+		VkDeviceSize usedBytes, largestFreeRange;
+		uint32_t freeRangeCount;
+		if (block->type == MemoryAllocationType::Linear)
+		{
+			usedBytes = block->linearOffset;
+			largestFreeRange = block->size - block->linearOffset;
+			freeRangeCount = largestFreeRange > 0 ? 1 : 0;
+			stats.allocationCount += block->linearAllocationCount;
+		}
+		else
+		{
+			usedBytes = block->tlsf.getUsedSize();
+			largestFreeRange = block->tlsf.getLargestFreeRange();
+			freeRangeCount = block->tlsf.getFreeRangeCount();
+			stats.allocationCount += block->tlsf.getAllocationCount();
+		}
+
+		const VkDeviceSize freeBytes = block->size - usedBytes;
+		stats.usedBytes += usedBytes;
+		stats.freeRangeCount += freeRangeCount;
+		stats.largestFreeRange = std::max(stats.largestFreeRange, largestFreeRange);
+
+		if (freeBytes > 0)
+		{
+			totalFreeBytes += freeBytes;
+			weightedFragmentation += double(freeBytes - largestFreeRange);
+		}
+	}
+
+	stats.fragmentation = totalFreeBytes > 0 ? float(weightedFragmentation / double(totalFreeBytes)) : 0.f;
+	return stats;
+}
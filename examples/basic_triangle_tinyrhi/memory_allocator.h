@@ -0,0 +1,210 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Two-level segregated fit (TLSF) allocator for the offsets of one memory block
+// Free ranges are kept in size classes of 16 subdivisions per power of two, with one bitmap per level, so finding a
+// free range and releasing an allocation are constant time. Released ranges are merged with their free neighbours.
+// It only manages offsets and never touches the device, the Vulkan side lives in MemoryAllocator.
+class TlsfAllocator
+{
+public:
+	static constexpr uint64_t c_InvalidOffset = ~0ull;
+
+	explicit TlsfAllocator(uint64_t size);
+
+	// Returns the aligned offset of the new allocation, or c_InvalidOffset if no free range is large enough
+	// The node identifies the allocation for free()
+	uint64_t allocate(uint64_t size, uint64_t alignment, uint32_t& node);
+	void free(uint32_t node);
+
+	uint64_t getSize() const { return m_Size; }
+	uint64_t getUsedSize() const { return m_UsedSize; }
+	uint32_t getAllocationCount() const { return m_AllocationCount; }
+	uint32_t getFreeRangeCount() const { return m_FreeRangeCount; }
+	uint64_t getLargestFreeRange() const;
+	bool isEmpty() const { return m_AllocationCount == 0; }
+
+private:
+	static constexpr uint32_t c_SecondLevelBits = 4;
+	static constexpr uint32_t c_SecondLevelCount = 1 << c_SecondLevelBits;
+	static constexpr uint32_t c_FirstLevelCount = 64;
+	static constexpr uint32_t c_InvalidNode = ~0u;
+
+	struct Node
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint32_t prevPhysical = c_InvalidNode;
+		uint32_t nextPhysical = c_InvalidNode;
+		uint32_t prevFree = c_InvalidNode;
+		uint32_t nextFree = c_InvalidNode;
+		bool free = false;
+	};
+
+	static void mapping(uint64_t size, uint32_t& firstLevel, uint32_t& secondLevel);
+	uint32_t findFreeNode(uint64_t size) const;
+	uint32_t createNode();
+	void releaseNode(uint32_t node);
+	void insertFree(uint32_t node);
+	void removeFree(uint32_t node);
+	uint32_t split(uint32_t node, uint64_t size);
+	void merge(uint32_t node, uint32_t next);
+
+	uint64_t m_Size;
+	uint64_t m_UsedSize = 0;
+	uint32_t m_AllocationCount = 0;
+	uint32_t m_FreeRangeCount = 0;
+
+	std::vector<Node> m_Nodes;
+	std::vector<uint32_t> m_UnusedNodes;
+
+	uint64_t m_FirstLevelBitmap = 0;
+	uint32_t m_SecondLevelBitmaps[c_FirstLevelCount] = {};
+	uint32_t m_FreeLists[c_FirstLevelCount][c_SecondLevelCount];
+};
+
+// Device calls made by MemoryAllocator, replaceable so that the allocator can be exercised without a GPU
+struct MemoryAllocatorCallbacks
+{
+	// Same contract as DeviceManager_Vulkan::getMemoryType: with a non-null memTypeFound, a missing type is reported there instead of throwing
+	std::function<uint32_t(uint32_t typeBits, VkMemoryPropertyFlags properties, VkBool32* memTypeFound)> getMemoryType;
+	std::function<VkMemoryPropertyFlags(uint32_t memoryType)> getMemoryTypeProperties;
+	std::function<VkResult(uint32_t memoryType, VkDeviceSize size, VkDeviceMemory* memory)> allocateMemory;
+	std::function<void(VkDeviceMemory memory)> freeMemory;
+	// Maps the whole memory object, only called for host visible memory types
+	std::function<VkResult(VkDeviceMemory memory, void** mapped)> mapMemory;
+};
+
+// Fills in callbacks that forward to the Vulkan device
+MemoryAllocatorCallbacks createVulkanMemoryAllocatorCallbacks(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties);
+
+enum class MemoryAllocationType : uint8_t
+{
+	// Sub-allocated from a shared block with the TLSF allocator, the default for most resources
+	Block,
+	// Bump-allocated from a shared block that is only rewound once all its allocations have been freed,
+	// for resources that are created and destroyed together, e.g. everything owned by the frames in flight
+	Linear,
+	// Owns its VkDeviceMemory object, for resources that are too large to share a block
+	Dedicated
+};
+
+struct MemoryAllocationDesc
+{
+	VkMemoryRequirements requirements{};
+	VkMemoryPropertyFlags properties = 0;
+	MemoryAllocationType type = MemoryAllocationType::Block;
+	// Images with optimal tiling must not share a bufferImageGranularity page with buffers or linear images
+	bool optimalImage = false;
+};
+
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// Pointer to the allocation for host visible memory, blocks are mapped once when they are created
+	uint8_t* mapped = nullptr;
+	uint32_t memoryType = 0;
+	MemoryAllocationType type = MemoryAllocationType::Block;
+	uint32_t block = ~0u;
+	uint32_t node = ~0u;
+};
+
+struct MemoryStatistics
+{
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize blockBytes = 0;
+	VkDeviceSize dedicatedBytes = 0;
+	// Bytes of the blocks covered by allocations, including alignment padding
+	VkDeviceSize usedBytes = 0;
+	uint32_t freeRangeCount = 0;
+	VkDeviceSize largestFreeRange = 0;
+	// 1 - largest free range / total free bytes, 0 when all free memory of a block is in one range
+	// Computed per block and weighted by the block's free bytes, since ranges of different blocks can never be merged
+	float fragmentation = 0.f;
+	// Number of vkAllocateMemory calls, for comparison with one allocation per resource
+	uint32_t deviceAllocationCount = 0;
+};
+
+// Reserves large VkDeviceMemory blocks per memory type and sub-allocates resources from them,
+// which keeps the number of device allocations far below maxMemoryAllocationCount and makes creating resources cheap
+class MemoryAllocator
+{
+public:
+	static constexpr VkDeviceSize c_DefaultBlockSize = 64ull << 20;
+
+	MemoryAllocator(const MemoryAllocatorCallbacks& callbacks, VkDeviceSize bufferImageGranularity, VkDeviceSize blockSize = c_DefaultBlockSize);
+	~MemoryAllocator();
+
+	MemoryAllocator(const MemoryAllocator&) = delete;
+	MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+	// Returns false if no memory type matches or the device is out of memory
+	bool allocate(const MemoryAllocationDesc& desc, MemoryAllocation& allocation);
+	void free(MemoryAllocation& allocation);
+
+	MemoryStatistics getStatistics() const;
+
+private:
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint32_t memoryType = 0;
+		MemoryAllocationType type = MemoryAllocationType::Block;
+		VkDeviceSize size = 0;
+		uint8_t* mapped = nullptr;
+		TlsfAllocator tlsf;
+		// Linear blocks only: bump pointer and number of live allocations
+		VkDeviceSize linearOffset = 0;
+		uint32_t linearAllocationCount = 0;
+
+		explicit Block(VkDeviceSize size) : size(size), tlsf(size) { }
+	};
+
+	bool allocateFromMemoryType(uint32_t memoryType, MemoryAllocationType type, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation& allocation);
+	bool allocateDedicated(uint32_t memoryType, VkDeviceSize size, MemoryAllocation& allocation);
+	bool allocateFromBlock(uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation& allocation);
+	uint32_t createBlock(uint32_t memoryType, MemoryAllocationType type, VkDeviceSize size);
+	void releaseEmptyBlocks(uint32_t memoryType, MemoryAllocationType type);
+	bool mapIfHostVisible(uint32_t memoryType, VkDeviceMemory memory, uint8_t** mapped);
+	static bool isBlockEmpty(const Block& block);
+
+	MemoryAllocatorCallbacks m_Callbacks;
+	VkDeviceSize m_BufferImageGranularity;
+	VkDeviceSize m_BlockSize;
+
+	std::vector<std::unique_ptr<Block>> m_Blocks;
+	uint32_t m_DedicatedCount = 0;
+	VkDeviceSize m_DedicatedBytes = 0;
+	uint32_t m_DeviceAllocationCount = 0;
+};
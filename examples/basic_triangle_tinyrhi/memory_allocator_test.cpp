@@ -0,0 +1,393 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+
+// Standalone checks for memory_allocator.cpp that run without a GPU.
+// The TLSF part allocates and frees random ranges against a shadow copy of the live ranges, then verifies that
+// releasing everything merges the block back into one free range. The MemoryAllocator part replaces the device
+// with MemoryAllocatorCallbacks over a fake set of memory types and heaps.
+//
+// Usage: memory_allocator_test [-seed <n>] [-iterations <n>]
+
+#include "memory_allocator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace
+{
+	int g_FailureCount = 0;
+
+	void check(bool condition, const char* expression, int line)
+	{
+		if (!condition)
+		{
+			printf("    FAILED: %s (line %d)\n", expression, line);
+			++g_FailureCount;
+		}
+	}
+
+#define CHECK(expression) check(!!(expression), #expression, __LINE__)
+
+	void testTlsfRandom(uint32_t seed, int iterations)
+	{
+		printf("TLSF random alloc/free, %d iterations\n", iterations);
+
+		std::mt19937_64 random(seed);
+		const uint64_t blockSize = 16ull << 20;
+
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			TlsfAllocator tlsf(blockSize);
+
+			// Offset -> (size, node) of every live allocation
+			std::map<uint64_t, std::pair<uint64_t, uint32_t>> live;
+			uint64_t liveBytes = 0;
+
+			for (int op = 0; op < 20000; op++)
+			{
+				if (live.empty() || random() % 100 < 55)
+				{
+					const uint64_t size = 1 + random() % (random() % 4 == 0 ? 200000 : 3000);
+					const uint64_t alignment = 1ull << (random() % 12);
+
+					uint32_t node;
+					const uint64_t offset = tlsf.allocate(size, alignment, node);
+					if (offset == TlsfAllocator::c_InvalidOffset)
+						continue;
+
+					CHECK(offset % alignment == 0);
+					CHECK(offset + size <= blockSize);
+
+					// The new range must not overlap its neighbours
+					auto next = live.lower_bound(offset);
+					if (next != live.end())
+						CHECK(offset + size <= next->first);
+					if (next != live.begin())
+					{
+						auto prev = std::prev(next);
+						CHECK(prev->first + prev->second.first <= offset);
+					}
+
+					live[offset] = { size, node };
+					liveBytes += size;
+				}
+				else
+				{
+					auto it = live.begin();
+					std::advance(it, random() % live.size());
+					tlsf.free(it->second.second);
+					liveBytes -= it->second.first;
+					live.erase(it);
+				}
+
+				CHECK(tlsf.getUsedSize() == liveBytes);
+				CHECK(tlsf.getAllocationCount() == live.size());
+			}
+
+			for (auto& allocation : live)
+				tlsf.free(allocation.second.second);
+
+			// Every free range has been merged with its neighbours again
+			CHECK(tlsf.isEmpty());
+			CHECK(tlsf.getFreeRangeCount() == 1);
+			CHECK(tlsf.getLargestFreeRange() == blockSize);
+		}
+	}
+
+	void testTlsfMerge()
+	{
+		printf("TLSF exact fill and merge\n");
+
+		TlsfAllocator tlsf(1024);
+		uint32_t nodes[4];
+		for (uint32_t i = 0; i < 4; i++)
+			CHECK(tlsf.allocate(256, 256, nodes[i]) == i * 256);
+
+		uint32_t node;
+		CHECK(tlsf.allocate(1, 1, node) == TlsfAllocator::c_InvalidOffset);
+		CHECK(tlsf.getFreeRangeCount() == 0);
+
+		// Freeing two neighbours leaves one range that fits an allocation of both their sizes
+		tlsf.free(nodes[1]);
+		tlsf.free(nodes[2]);
+		CHECK(tlsf.getFreeRangeCount() == 1);
+		CHECK(tlsf.getLargestFreeRange() == 512);
+		CHECK(tlsf.allocate(512, 1, node) == 256);
+		tlsf.free(node);
+
+		// Merging with the previous and the next range at once
+		tlsf.free(nodes[0]);
+		CHECK(tlsf.getFreeRangeCount() == 1);
+		tlsf.free(nodes[3]);
+		CHECK(tlsf.getFreeRangeCount() == 1);
+		CHECK(tlsf.getLargestFreeRange() == 1024);
+		CHECK(tlsf.isEmpty());
+	}
+
+	// Memory types and heaps of the fake device: type 0 and type 2 are device local, type 1 is host visible
+	// Types 0 and 1 are backed by a heap with a budget, so that running out of memory can be simulated
+	struct FakeDevice
+	{
+		struct Memory
+		{
+			uint32_t memoryType = 0;
+			VkDeviceSize size = 0;
+			std::vector<uint8_t> data;
+		};
+
+		const VkMemoryPropertyFlags memoryTypes[3] = {
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+		};
+		VkDeviceSize deviceLocalBudget = 1ull << 30;
+		std::map<VkDeviceMemory, Memory> memories;
+		uint64_t nextHandle = 1;
+		uint32_t getMemoryTypeCalls = 0;
+
+		MemoryAllocatorCallbacks createCallbacks()
+		{
+			MemoryAllocatorCallbacks callbacks;
+
+			callbacks.getMemoryType = [this](uint32_t typeBits, VkMemoryPropertyFlags properties, VkBool32* memTypeFound)
+			{
+				++getMemoryTypeCalls;
+				for (uint32_t i = 0; i < 3; i++)
+				{
+					if ((typeBits & (1u << i)) && (memoryTypes[i] & properties) == properties)
+					{
+						*memTypeFound = VK_TRUE;
+						return i;
+					}
+				}
+				*memTypeFound = VK_FALSE;
+				return 0u;
+			};
+
+			callbacks.getMemoryTypeProperties = [this](uint32_t memoryType) { return memoryTypes[memoryType]; };
+
+			callbacks.allocateMemory = [this](uint32_t memoryType, VkDeviceSize size, VkDeviceMemory* memory)
+			{
+				if (memoryType == 0)
+				{
+					if (size > deviceLocalBudget)
+						return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+					deviceLocalBudget -= size;
+				}
+
+				*memory = (VkDeviceMemory)(uintptr_t)nextHandle++;
+				Memory& fake = memories[*memory];
+				fake.memoryType = memoryType;
+				fake.size = size;
+				return VK_SUCCESS;
+			};
+
+			callbacks.freeMemory = [this](VkDeviceMemory memory)
+			{
+				auto it = memories.find(memory);
+				CHECK(it != memories.end());
+				if (it == memories.end())
+					return;
+				if (it->second.memoryType == 0)
+					deviceLocalBudget += it->second.size;
+				memories.erase(it);
+			};
+
+			callbacks.mapMemory = [this](VkDeviceMemory memory, void** mapped)
+			{
+				Memory& fake = memories[memory];
+				CHECK((memoryTypes[fake.memoryType] & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0);
+				fake.data.resize(size_t(fake.size));
+				*mapped = fake.data.data();
+				return VK_SUCCESS;
+			};
+
+			return callbacks;
+		}
+	};
+
+	bool overlaps(const MemoryAllocation& a, const MemoryAllocation& b)
+	{
+		return a.memory == b.memory && a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+	}
+
+	void testMemoryAllocator()
+	{
+		printf("MemoryAllocator with a fake device\n");
+
+		const VkDeviceSize bufferImageGranularity = 1024;
+		const VkDeviceSize blockSize = 1 << 20;
+
+		FakeDevice device;
+		{
+			MemoryAllocator allocator(device.createCallbacks(), bufferImageGranularity, blockSize);
+
+			// Small resources share one block, every third one is an optimal image
+			std::vector<MemoryAllocation> allocations;
+			for (int i = 0; i < 100; i++)
+			{
+				MemoryAllocationDesc desc;
+				desc.requirements = { VkDeviceSize(100 + i * 37), 256, 0x7 };
+				desc.properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+				desc.optimalImage = (i % 3 == 0);
+
+				MemoryAllocation allocation;
+				CHECK(allocator.allocate(desc, allocation));
+				CHECK(allocation.memoryType == 0);
+				CHECK(allocation.offset % 256 == 0);
+				allocations.push_back(allocation);
+			}
+			CHECK(device.getMemoryTypeCalls > 0);
+
+			for (size_t i = 0; i < allocations.size(); i++)
+			{
+				for (size_t j = i + 1; j < allocations.size(); j++)
+				{
+					const MemoryAllocation& a = allocations[i];
+					const MemoryAllocation& b = allocations[j];
+					CHECK(!overlaps(a, b));
+
+					// Optimal images and buffers never share a bufferImageGranularity page
+					if (a.memory == b.memory && (i % 3 == 0) != (j % 3 == 0))
+					{
+						const MemoryAllocation& first = a.offset < b.offset ? a : b;
+						const MemoryAllocation& second = a.offset < b.offset ? b : a;
+						CHECK((first.offset + first.size - 1) / bufferImageGranularity < second.offset / bufferImageGranularity);
+					}
+				}
+			}
+
+			MemoryStatistics stats = allocator.getStatistics();
+			CHECK(stats.blockCount == 1);
+			CHECK(stats.allocationCount == 100);
+			CHECK(stats.deviceAllocationCount == 1);
+
+			// Freeing every other allocation fragments the block
+			for (size_t i = 0; i < allocations.size(); i += 2)
+				allocator.free(allocations[i]);
+			stats = allocator.getStatistics();
+			CHECK(stats.allocationCount == 50);
+			CHECK(stats.fragmentation > 0.f);
+
+			// Resources larger than half a block get their own device allocation
+			MemoryAllocationDesc largeDesc;
+			largeDesc.requirements = { 900 << 10, 256, 0x7 };
+			largeDesc.properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			MemoryAllocation large;
+			CHECK(allocator.allocate(largeDesc, large));
+			CHECK(large.type == MemoryAllocationType::Dedicated);
+			CHECK(large.offset == 0);
+
+			// Linear allocations are packed back to back and mapped, and the block rewinds once all of them are freed
+			MemoryAllocationDesc linearDesc;
+			linearDesc.requirements = { 4096, 64, 0x7 };
+			linearDesc.properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			linearDesc.type = MemoryAllocationType::Linear;
+			MemoryAllocation linear0, linear1;
+			CHECK(allocator.allocate(linearDesc, linear0));
+			CHECK(allocator.allocate(linearDesc, linear1));
+			CHECK(linear0.memoryType == 1);
+			CHECK(linear0.mapped != nullptr);
+			CHECK(linear1.offset == linear0.offset + 4096);
+			CHECK(linear1.mapped == linear0.mapped + 4096);
+			memset(linear1.mapped, 0xcd, 4096);
+			allocator.free(linear0);
+			allocator.free(linear1);
+			CHECK(allocator.allocate(linearDesc, linear0));
+			CHECK(linear0.offset == 0);
+			allocator.free(linear0);
+
+			// When the heap of the first matching type is exhausted, the next matching type is used
+			device.deviceLocalBudget = 0;
+			MemoryAllocationDesc fallbackDesc;
+			fallbackDesc.requirements = { 600 << 10, 256, 0x7 };
+			fallbackDesc.properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			MemoryAllocation fallback;
+			CHECK(allocator.allocate(fallbackDesc, fallback));
+			CHECK(fallback.memoryType == 2);
+
+			// No type matches at all
+			MemoryAllocationDesc unsupportedDesc;
+			unsupportedDesc.requirements = { 256, 256, 0x2 };
+			unsupportedDesc.properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			MemoryAllocation unsupported;
+			CHECK(!allocator.allocate(unsupportedDesc, unsupported));
+			device.deviceLocalBudget = 1ull << 30;
+
+			for (size_t i = 1; i < allocations.size(); i += 2)
+				allocator.free(allocations[i]);
+			allocator.free(large);
+			allocator.free(fallback);
+
+			stats = allocator.getStatistics();
+			CHECK(stats.allocationCount == 0);
+			CHECK(stats.usedBytes == 0);
+		}
+
+		// The allocator has returned every device allocation
+		CHECK(device.memories.empty());
+	}
+}
+
+int main(int argc, const char** argv)
+{
+	uint32_t seed = 1;
+	int iterations = 20;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+		{
+			seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (!strcmp(argv[i], "-iterations") && i + 1 < argc)
+		{
+			iterations = std::max(1, std::atoi(argv[++i]));
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-seed <n>] [-iterations <n>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	testTlsfRandom(seed, iterations);
+	testTlsfMerge();
+	testMemoryAllocator();
+
+	if (g_FailureCount)
+	{
+		printf("%d checks failed\n", g_FailureCount);
+		return 1;
+	}
+
+	printf("All checks passed\n");
+	return 0;
+}
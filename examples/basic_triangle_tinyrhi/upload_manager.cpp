@@ -0,0 +1,273 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "upload_manager.h"
+#include <cstring>
+#include <stdexcept>
+
+static constexpr VkDeviceSize c_StagingAlignment = 16;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+UploadManager::UploadManager(const UploadManagerDesc& desc, MemoryAllocator& memoryAllocator)
+	: m_Desc(desc)
+	, m_MemoryAllocator(memoryAllocator)
+{
+	VkBufferCreateInfo bufferCI{};
+	bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCI.size = m_Desc.stagingSize;
+	bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	if (vkCreateBuffer(m_Desc.device, &bufferCI, nullptr, &m_StagingBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Could not create the staging buffer");
+
+	// Host coherent memory, so that the copies see the CPU writes without flushing
+	MemoryAllocationDesc allocationDesc;
+	vkGetBufferMemoryRequirements(m_Desc.device, m_StagingBuffer, &allocationDesc.requirements);
+	allocationDesc.properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	if (!m_MemoryAllocator.allocate(allocationDesc, m_StagingMemory))
+		throw std::runtime_error("Could not allocate the staging buffer memory");
+	if (vkBindBufferMemory(m_Desc.device, m_StagingBuffer, m_StagingMemory.memory, m_StagingMemory.offset) != VK_SUCCESS)
+		throw std::runtime_error("Could not bind the staging buffer memory");
+
+	// Command buffers are reused once their batch has completed, beginning them again resets them
+	VkCommandPoolCreateInfo commandPoolCI{};
+	commandPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCI.queueFamilyIndex = m_Desc.queueFamily;
+	commandPoolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	if (vkCreateCommandPool(m_Desc.device, &commandPoolCI, nullptr, &m_CommandPool) != VK_SUCCESS)
+		throw std::runtime_error("Could not create the upload command pool");
+
+	VkSemaphoreTypeCreateInfo semaphoreTypeCI{};
+	semaphoreTypeCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	semaphoreTypeCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	semaphoreTypeCI.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreCI{};
+	semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreCI.pNext = &semaphoreTypeCI;
+	if (vkCreateSemaphore(m_Desc.device, &semaphoreCI, nullptr, &m_TimelineSemaphore) != VK_SUCCESS)
+		throw std::runtime_error("Could not create the upload timeline semaphore");
+}
+
+UploadManager::~UploadManager()
+{
+	// Staging memory and command buffers must outlive the batches that use them
+	wait(m_LastSubmittedValue);
+
+	vkDestroySemaphore(m_Desc.device, m_TimelineSemaphore, nullptr);
+	vkDestroyCommandPool(m_Desc.device, m_CommandPool, nullptr);
+	vkDestroyBuffer(m_Desc.device, m_StagingBuffer, nullptr);
+	m_MemoryAllocator.free(m_StagingMemory);
+}
+
+bool UploadManager::isComplete(uint64_t value) const
+{
+	uint64_t completedValue = 0;
+	vkGetSemaphoreCounterValue(m_Desc.device, m_TimelineSemaphore, &completedValue);
+	return completedValue >= value;
+}
+
+void UploadManager::wait(uint64_t value) const
+{
+	if (value == 0)
+		return;
+
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_TimelineSemaphore;
+	waitInfo.pValues = &value;
+	vkWaitSemaphores(m_Desc.device, &waitInfo, UINT64_MAX);
+}
+
+// Releases the staging memory and command buffers of the batches that have completed, without waiting for the others
+void UploadManager::retireCompletedBatches()
+{
+	if (m_InFlightBatches.empty())
+		return;
+
+	uint64_t completedValue = 0;
+	vkGetSemaphoreCounterValue(m_Desc.device, m_TimelineSemaphore, &completedValue);
+
+	while (!m_InFlightBatches.empty() && m_InFlightBatches.front().value <= completedValue)
+	{
+		m_RingTail = m_InFlightBatches.front().ringEnd;
+		m_FreeCommandBuffers.push_back(m_InFlightBatches.front().commandBuffer);
+		m_InFlightBatches.pop_front();
+	}
+}
+
+VkCommandBuffer UploadManager::getRecordingCommandBuffer()
+{
+	if (m_RecordingCommandBuffer != VK_NULL_HANDLE)
+		return m_RecordingCommandBuffer;
+
+	if (!m_FreeCommandBuffers.empty())
+	{
+		m_RecordingCommandBuffer = m_FreeCommandBuffers.back();
+		m_FreeCommandBuffers.pop_back();
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+		cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdBufAllocateInfo.commandPool = m_CommandPool;
+		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmdBufAllocateInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(m_Desc.device, &cmdBufAllocateInfo, &m_RecordingCommandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("Could not allocate an upload command buffer");
+	}
+
+	VkCommandBufferBeginInfo cmdBufInfo{};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(m_RecordingCommandBuffer, &cmdBufInfo);
+
+	return m_RecordingCommandBuffer;
+}
+
+bool UploadManager::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	if (size == 0)
+		return true;
+
+	if (size > m_Desc.stagingSize)
+	{
+		++m_Statistics.rejectedCount;
+		return false;
+	}
+
+	retireCompletedBatches();
+
+	// An upload never wraps around the end of the ring, it starts over at the beginning instead
+	uint64_t position = alignUp(m_RingHead, c_StagingAlignment);
+	if (position % m_Desc.stagingSize + size > m_Desc.stagingSize)
+		position = alignUp(position, m_Desc.stagingSize);
+
+	if (position + size - m_RingTail > m_Desc.stagingSize)
+	{
+		// Submit what is pending so that the ring drains, the caller retries once earlier batches have completed
+		flush();
+		++m_Statistics.rejectedCount;
+		return false;
+	}
+
+	m_RingHead = position + size;
+
+	const VkDeviceSize stagingOffset = position % m_Desc.stagingSize;
+	memcpy(m_StagingMemory.mapped + stagingOffset, data, size);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = stagingOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(getRecordingCommandBuffer(), m_StagingBuffer, dstBuffer, 1, &copyRegion);
+
+	// Exclusive resources change queue family with a release on this queue and an acquire on the consumer queue
+	if (m_Desc.queueFamily != m_Desc.consumerQueueFamily)
+	{
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = m_Desc.queueFamily;
+		barrier.dstQueueFamilyIndex = m_Desc.consumerQueueFamily;
+		barrier.buffer = dstBuffer;
+		barrier.offset = dstOffset;
+		barrier.size = size;
+		m_PendingReleases.push_back(barrier);
+	}
+
+	++m_Statistics.uploadCount;
+	m_Statistics.uploadBytes += size;
+	return true;
+}
+
+uint64_t UploadManager::flush()
+{
+	if (m_RecordingCommandBuffer == VK_NULL_HANDLE)
+		return m_LastSubmittedValue;
+
+	if (!m_PendingReleases.empty())
+	{
+		vkCmdPipelineBarrier(m_RecordingCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, uint32_t(m_PendingReleases.size()), m_PendingReleases.data(), 0, nullptr);
+
+		for (VkBufferMemoryBarrier barrier : m_PendingReleases)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+			m_PendingAcquires.push_back(barrier);
+		}
+		m_PendingReleases.clear();
+	}
+
+	vkEndCommandBuffer(m_RecordingCommandBuffer);
+
+	const uint64_t value = m_LastSubmittedValue + 1;
+
+	VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+	timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineSubmitInfo.signalSemaphoreValueCount = 1;
+	timelineSubmitInfo.pSignalSemaphoreValues = &value;
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineSubmitInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &m_RecordingCommandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &m_TimelineSemaphore;
+	if (vkQueueSubmit(m_Desc.queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		throw std::runtime_error("Could not submit the upload command buffer");
+
+	Batch batch;
+	batch.commandBuffer = m_RecordingCommandBuffer;
+	batch.value = value;
+	batch.ringEnd = m_RingHead;
+	m_InFlightBatches.push_back(batch);
+
+	m_RecordingCommandBuffer = VK_NULL_HANDLE;
+	m_LastSubmittedValue = value;
+	m_UnacquiredValue = value;
+	++m_Statistics.batchCount;
+	return value;
+}
+
+uint64_t UploadManager::acquireSubmittedUploads(VkCommandBuffer commandBuffer)
+{
+	if (!m_PendingAcquires.empty())
+	{
+		// The source stages chain with the timeline semaphore wait, which happens at the same stages
+		vkCmdPipelineBarrier(commandBuffer, c_ConsumerStages, c_ConsumerStages,
+			0, 0, nullptr, uint32_t(m_PendingAcquires.size()), m_PendingAcquires.data(), 0, nullptr);
+		m_PendingAcquires.clear();
+	}
+
+	const uint64_t value = m_UnacquiredValue;
+	m_UnacquiredValue = 0;
+	return value;
+}
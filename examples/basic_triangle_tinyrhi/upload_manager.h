@@ -0,0 +1,122 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "memory_allocator.h"
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <vector>
+
+struct UploadManagerDesc
+{
+	VkDevice device = VK_NULL_HANDLE;
+	// Queue the copies are submitted to, preferably a dedicated transfer queue
+	VkQueue queue = VK_NULL_HANDLE;
+	uint32_t queueFamily = 0;
+	// Queue family that uses the uploaded resources, ownership is transferred to it when the families differ
+	uint32_t consumerQueueFamily = 0;
+	VkDeviceSize stagingSize = 16ull << 20;
+};
+
+struct UploadStatistics
+{
+	uint64_t uploadCount = 0;
+	uint64_t uploadBytes = 0;
+	uint64_t batchCount = 0;
+	// Uploads that did not fit into the staging ring at the time and had to be retried by the caller
+	uint64_t rejectedCount = 0;
+};
+
+// Packs uploads into a persistently mapped staging ring and records their copies into one command buffer per batch
+// A batch is submitted by flush() and signals a timeline semaphore with its own value, so callers poll for completion
+// or let the GPU wait for it, and the CPU never blocks on an upload. Staging memory of a batch is reused once its value
+// has been reached, command buffers are recycled the same way.
+class UploadManager
+{
+public:
+	// Stages where the uploaded buffers are consumed, the consumer submission waits for the timeline value at these stages
+	static constexpr VkPipelineStageFlags c_ConsumerStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+	UploadManager(const UploadManagerDesc& desc, MemoryAllocator& memoryAllocator);
+	~UploadManager();
+
+	UploadManager(const UploadManager&) = delete;
+	UploadManager& operator=(const UploadManager&) = delete;
+
+	// Copies data into a range of dstBuffer, which must have been created with VK_BUFFER_USAGE_TRANSFER_DST_BIT
+	// Returns false without blocking when the staging ring is full, after submitting the pending copies so that space frees up
+	// once they complete. Uploads larger than the staging ring are always rejected.
+	bool uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+	// Submits the copies recorded since the last flush and returns the timeline value signaled when they have completed
+	// Returns the value of the previous batch if nothing was recorded
+	uint64_t flush();
+
+	bool isComplete(uint64_t value) const;
+	void wait(uint64_t value) const;
+
+	// Records the queue family ownership acquire of every submitted batch that has not been acquired yet into a command buffer
+	// for the consumer queue. Returns the timeline value that the submission of that command buffer has to wait for at
+	// c_ConsumerStages, or 0 if there is nothing to wait for.
+	uint64_t acquireSubmittedUploads(VkCommandBuffer commandBuffer);
+
+	VkSemaphore getTimelineSemaphore() const { return m_TimelineSemaphore; }
+	const UploadStatistics& getStatistics() const { return m_Statistics; }
+
+private:
+	struct Batch
+	{
+		VkCommandBuffer commandBuffer;
+		uint64_t value;
+		// Ring position after the last byte of the batch, the staging memory up to here is free once the batch completes
+		uint64_t ringEnd;
+	};
+
+	void retireCompletedBatches();
+	VkCommandBuffer getRecordingCommandBuffer();
+
+	UploadManagerDesc m_Desc;
+	MemoryAllocator& m_MemoryAllocator;
+
+	VkBuffer m_StagingBuffer = VK_NULL_HANDLE;
+	MemoryAllocation m_StagingMemory;
+	// Monotonic byte positions in the ring, the offset in the staging buffer is the position modulo its size
+	uint64_t m_RingHead = 0;
+	uint64_t m_RingTail = 0;
+
+	VkCommandPool m_CommandPool = VK_NULL_HANDLE;
+	VkCommandBuffer m_RecordingCommandBuffer = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> m_FreeCommandBuffers;
+	std::deque<Batch> m_InFlightBatches;
+
+	VkSemaphore m_TimelineSemaphore = VK_NULL_HANDLE;
+	uint64_t m_LastSubmittedValue = 0;
+	uint64_t m_UnacquiredValue = 0;
+
+	// Ownership release barriers of the batch being recorded, and the matching acquires of the submitted batches
+	std::vector<VkBufferMemoryBarrier> m_PendingReleases;
+	std::vector<VkBufferMemoryBarrier> m_PendingAcquires;
+
+	UploadStatistics m_Statistics;
+};
@@ -35,14 +35,35 @@
 #include <donut/core/vfs/VFS.h>
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
+#include <array>
+#include <string>
+
+#include "culling_reference.h"
+#include "pipeline_cache.h"
+#include "scene_cache.h"
 
 using namespace donut;
 using namespace donut::math;
 
 #include <donut/shaders/view_cb.h>
+#include "culling_cb.h"
 
 static const char* g_WindowTitle = "Donut Example: Bindless Rendering";
 
+// Number of frames between writing the visible draw count on the GPU and reading it on the CPU
+static const uint32_t c_NumDrawCountReadbacks = 3;
+
+// Layout of one record in the indirect argument buffer, matches D3D12_DRAW_ARGUMENTS and VkDrawIndirectCommand
+struct IndirectDrawArguments
+{
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t startVertexLocation;
+    uint32_t startInstanceLocation;
+};
+
+static_assert(sizeof(IndirectDrawArguments) == INDIRECT_ARGS_STRIDE);
+
 class BindlessRendering : public app::ApplicationBase
 {
 private:
@@ -53,8 +74,51 @@ private:
     nvrhi::BindingLayoutHandle m_BindlessLayout;
     nvrhi::BindingSetHandle m_BindingSet;
     nvrhi::ShaderHandle m_VertexShader;
+    nvrhi::ShaderHandle m_IndirectVertexShader;
     nvrhi::ShaderHandle m_PixelShader;
+    nvrhi::InputLayoutHandle m_IndirectInputLayout;
     nvrhi::GraphicsPipelineHandle m_GraphicsPipeline;
+    nvrhi::GraphicsPipelineHandle m_IndirectGraphicsPipeline;
+
+    // Persistent draw list for the indirect path: one record per (instance, geometry) pair,
+    // rebuilt only when the scene graph structure changes.
+    nvrhi::BufferHandle m_DrawDataBuffer;
+    nvrhi::BufferHandle m_DrawIndexBuffer;
+    nvrhi::BufferHandle m_IndirectArgsBuffer;
+    uint32_t m_NumIndirectDraws = 0;
+    bool m_UseIndirectDraws = true;
+
+    // Buffers referenced by m_BindingSet and m_CullingBindingSet. Scene::Refresh reallocates the instance
+    // and geometry buffers when they grow, and the draw buffers grow with the draw list, so the binding sets
+    // are recreated whenever one of these changes, see UpdateBindingSets.
+    std::array<nvrhi::BufferHandle, 4> m_BoundBuffers;
+
+    // GPU culling of the draw list against the view frustum and the previous frame's depth, see culling.hlsl
+    nvrhi::ShaderHandle m_CullingShader;
+    nvrhi::ShaderHandle m_HiZShader;
+    nvrhi::BindingLayoutHandle m_CullingBindingLayout;
+    nvrhi::BindingLayoutHandle m_HiZBindingLayout;
+    nvrhi::BindingSetHandle m_CullingBindingSet;
+    std::vector<nvrhi::BindingSetHandle> m_HiZBindingSets;
+    nvrhi::ComputePipelineHandle m_CullingPipeline;
+    nvrhi::ComputePipelineHandle m_HiZPipeline;
+    nvrhi::BufferHandle m_CullingConstants;
+    nvrhi::BufferHandle m_DrawBoundsBuffer;
+    nvrhi::BufferHandle m_CulledArgsBuffer;
+    nvrhi::BufferHandle m_DrawCountBuffer;
+    std::array<nvrhi::BufferHandle, c_NumDrawCountReadbacks> m_DrawCountReadback;
+    nvrhi::TextureHandle m_HiZTexture;
+    float4x4 m_PrevWorldToClip = float4x4::identity();
+    bool m_HiZValid = false;
+    bool m_EnableCulling = true;
+    bool m_EnableOcclusionCulling = true;
+    uint32_t m_CulledFrames = 0;
+    uint32_t m_VisibleDraws = 0;
+
+    // Set by the V key: the next culled frame runs the frustum test only, reads back the draws it kept
+    // and compares them one by one with CullDrawsReference for the same view and transforms
+    bool m_CullingCheckRequested = false;
+    nvrhi::BufferHandle m_CulledArgsReadback;
 
     nvrhi::BufferHandle m_ViewConstants;
     
@@ -66,6 +130,7 @@ private:
     std::unique_ptr<engine::Scene> m_Scene;
     std::shared_ptr<engine::DescriptorTableManager> m_DescriptorTableManager;
     std::unique_ptr<engine::BindingCache> m_BindingCache;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
 
     app::FirstPersonCamera m_Camera;
     engine::PlanarView m_View;
@@ -87,8 +152,55 @@ public:
 		m_CommonPasses = std::make_shared<engine::CommonRenderPasses>(GetDevice(), m_ShaderFactory);
         m_BindingCache = std::make_unique<engine::BindingCache>(GetDevice());
 
-        m_VertexShader = m_ShaderFactory->CreateShader("/shaders/app/bindless_rendering.hlsl", "vs_main", nullptr, nvrhi::ShaderType::Vertex);
-        m_PixelShader = m_ShaderFactory->CreateShader("/shaders/app/bindless_rendering.hlsl", "ps_main", nullptr, nvrhi::ShaderType::Pixel);
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
+        m_VertexShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/bindless_rendering.hlsl", "vs_main", nullptr, nvrhi::ShaderType::Vertex);
+        m_IndirectVertexShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/bindless_rendering.hlsl", "vs_main_indirect", nullptr, nvrhi::ShaderType::Vertex);
+        m_PixelShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/bindless_rendering.hlsl", "ps_main", nullptr, nvrhi::ShaderType::Pixel);
+
+        // The draw index is fetched as a per-instance attribute, see vs_main_indirect
+        nvrhi::VertexAttributeDesc drawIndexAttribute;
+        drawIndexAttribute.name = "DRAW_INDEX";
+        drawIndexAttribute.format = nvrhi::Format::R32_UINT;
+        drawIndexAttribute.bufferIndex = 0;
+        drawIndexAttribute.offset = 0;
+        drawIndexAttribute.elementStride = sizeof(uint32_t);
+        drawIndexAttribute.isInstanced = true;
+        m_IndirectInputLayout = GetDevice()->createInputLayout(&drawIndexAttribute, 1, m_IndirectVertexShader);
+
+        m_CullingShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/culling.hlsl", "cs_cull", nullptr, nvrhi::ShaderType::Compute);
+        m_HiZShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/hiz.hlsl", "cs_build_hiz", nullptr, nvrhi::ShaderType::Compute);
+
+        nvrhi::BindingLayoutDesc cullingLayoutDesc;
+        cullingLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+        cullingLayoutDesc.bindings = {
+            nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+            nvrhi::BindingLayoutItem::StructuredBuffer_SRV(0),
+            nvrhi::BindingLayoutItem::StructuredBuffer_SRV(1),
+            nvrhi::BindingLayoutItem::StructuredBuffer_SRV(2),
+            nvrhi::BindingLayoutItem::StructuredBuffer_SRV(3),
+            nvrhi::BindingLayoutItem::Texture_SRV(4),
+            nvrhi::BindingLayoutItem::RawBuffer_UAV(0),
+            nvrhi::BindingLayoutItem::RawBuffer_UAV(1)
+        };
+        m_CullingBindingLayout = GetDevice()->createBindingLayout(cullingLayoutDesc);
+
+        nvrhi::BindingLayoutDesc hizLayoutDesc;
+        hizLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+        hizLayoutDesc.bindings = {
+            nvrhi::BindingLayoutItem::PushConstants(0, sizeof(HiZConstants)),
+            nvrhi::BindingLayoutItem::Texture_SRV(0),
+            nvrhi::BindingLayoutItem::Texture_UAV(0)
+        };
+        m_HiZBindingLayout = GetDevice()->createBindingLayout(hizLayoutDesc);
+
+        nvrhi::ComputePipelineDesc computePipelineDesc;
+        computePipelineDesc.CS = m_CullingShader;
+        computePipelineDesc.bindingLayouts = { m_CullingBindingLayout };
+        m_CullingPipeline = GetDevice()->createComputePipeline(computePipelineDesc);
+
+        computePipelineDesc.CS = m_HiZShader;
+        computePipelineDesc.bindingLayouts = { m_HiZBindingLayout };
+        m_HiZPipeline = GetDevice()->createComputePipeline(computePipelineDesc);
 
         nvrhi::BindlessLayoutDesc bindlessLayoutDesc;
         bindlessLayoutDesc.visibility = nvrhi::ShaderType::All;
@@ -116,9 +228,61 @@ public:
         m_Camera.SetMoveSpeed(3.f);
 
         m_ViewConstants = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(PlanarViewConstants), "ViewConstants", engine::c_MaxRenderPassConstantBufferVersions));
+        m_CullingConstants = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(CullingConstants), "CullingConstants", engine::c_MaxRenderPassConstantBufferVersions));
+
+        nvrhi::BufferDesc drawCountDesc;
+        drawCountDesc.byteSize = sizeof(uint32_t);
+        drawCountDesc.canHaveUAVs = true;
+        drawCountDesc.canHaveRawViews = true;
+        drawCountDesc.debugName = "DrawCount";
+        drawCountDesc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+        drawCountDesc.keepInitialState = true;
+        m_DrawCountBuffer = GetDevice()->createBuffer(drawCountDesc);
+
+        drawCountDesc.canHaveUAVs = false;
+        drawCountDesc.canHaveRawViews = false;
+        drawCountDesc.cpuAccess = nvrhi::CpuAccessMode::Read;
+        drawCountDesc.debugName = "DrawCountReadback";
+        drawCountDesc.initialState = nvrhi::ResourceStates::CopyDest;
+        for (auto& readbackBuffer : m_DrawCountReadback)
+            readbackBuffer = GetDevice()->createBuffer(drawCountDesc);
         
+        m_CommandList->open();
+        BuildIndirectDraws(m_CommandList);
+        m_CommandList->close();
+        GetDevice()->executeCommandList(m_CommandList);
+
         GetDevice()->waitForIdle();
 
+        nvrhi::utils::CreateBindingSetAndLayout(GetDevice(), nvrhi::ShaderType::All, 0, GetBindingSetDesc(), m_BindingLayout, m_BindingSet);
+        m_BoundBuffers = GetBoundBuffers();
+
+        return true;
+    }
+
+    std::array<nvrhi::BufferHandle, 4> GetBoundBuffers() const
+    {
+        return { m_Scene->GetInstanceBuffer(), m_Scene->GetGeometryBuffer(), m_Scene->GetMaterialBuffer(), m_DrawDataBuffer };
+    }
+
+    void UpdateBindingSets()
+    {
+        const std::array<nvrhi::BufferHandle, 4> buffers = GetBoundBuffers();
+
+        bool changed = false;
+        for (size_t i = 0; i < buffers.size(); i++)
+            changed |= buffers[i].Get() != m_BoundBuffers[i].Get();
+
+        if (!changed)
+            return;
+
+        m_BindingSet = GetDevice()->createBindingSet(GetBindingSetDesc(), m_BindingLayout);
+        m_CullingBindingSet = nullptr;
+        m_BoundBuffers = buffers;
+    }
+
+    nvrhi::BindingSetDesc GetBindingSetDesc() const
+    {
         nvrhi::BindingSetDesc bindingSetDesc;
         bindingSetDesc.bindings = {
             nvrhi::BindingSetItem::ConstantBuffer(0, m_ViewConstants),
@@ -126,18 +290,103 @@ public:
             nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene->GetInstanceBuffer()),
             nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_Scene->GetGeometryBuffer()),
             nvrhi::BindingSetItem::StructuredBuffer_SRV(2, m_Scene->GetMaterialBuffer()),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_DrawDataBuffer),
             nvrhi::BindingSetItem::Sampler(0, m_CommonPasses->m_AnisotropicWrapSampler)
         };
-        nvrhi::utils::CreateBindingSetAndLayout(GetDevice(), nvrhi::ShaderType::All, 0, bindingSetDesc, m_BindingLayout, m_BindingSet);
+        return bindingSetDesc;
+    }
 
-        return true;
+    // Walks the scene graph once and fills the persistent draw buffers: the (instance, geometry) pairs
+    // read by vs_main_indirect, the draw index vertex stream, and the indirect arguments.
+    // The buffers are only reallocated when the draw count grows. They always hold at least one record,
+    // so that the binding sets never reference a null buffer, even for an empty scene.
+    void BuildIndirectDraws(nvrhi::ICommandList* commandList)
+    {
+        std::vector<uint2> drawData;
+        std::vector<DrawBounds> drawBounds;
+        std::vector<IndirectDrawArguments> drawArguments;
+
+        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        {
+            const auto& mesh = instance->GetMesh();
+
+            for (size_t i = 0; i < mesh->geometries.size(); i++)
+            {
+                IndirectDrawArguments args{};
+                args.vertexCount = mesh->geometries[i]->numIndices;
+                args.instanceCount = 1;
+                args.startInstanceLocation = uint32_t(drawArguments.size());
+
+                const box3& bounds = mesh->geometries[i]->objectSpaceBounds;
+                DrawBounds drawBox{};
+                drawBox.minimum = bounds.m_mins;
+                drawBox.maximum = bounds.m_maxs;
+
+                drawData.push_back(uint2(uint32_t(instance->GetInstanceIndex()), uint32_t(i)));
+                drawBounds.push_back(drawBox);
+                drawArguments.push_back(args);
+            }
+        }
+
+        m_NumIndirectDraws = uint32_t(drawArguments.size());
+
+        const uint32_t requiredCapacity = std::max(m_NumIndirectDraws, 1u);
+        const uint64_t capacity = m_DrawDataBuffer ? m_DrawDataBuffer->getDesc().byteSize / sizeof(uint2) : 0;
+        if (requiredCapacity > capacity)
+        {
+            nvrhi::BufferDesc bufferDesc;
+            bufferDesc.byteSize = sizeof(uint2) * requiredCapacity;
+            bufferDesc.structStride = sizeof(uint2);
+            bufferDesc.debugName = "DrawData";
+            bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+            bufferDesc.keepInitialState = true;
+            m_DrawDataBuffer = GetDevice()->createBuffer(bufferDesc);
+
+            bufferDesc.byteSize = sizeof(DrawBounds) * requiredCapacity;
+            bufferDesc.structStride = sizeof(DrawBounds);
+            bufferDesc.debugName = "DrawBounds";
+            m_DrawBoundsBuffer = GetDevice()->createBuffer(bufferDesc);
+
+            bufferDesc = nvrhi::BufferDesc();
+            bufferDesc.byteSize = sizeof(uint32_t) * requiredCapacity;
+            bufferDesc.isVertexBuffer = true;
+            bufferDesc.debugName = "DrawIndices";
+            bufferDesc.initialState = nvrhi::ResourceStates::VertexBuffer;
+            bufferDesc.keepInitialState = true;
+            m_DrawIndexBuffer = GetDevice()->createBuffer(bufferDesc);
+
+            bufferDesc = nvrhi::BufferDesc();
+            bufferDesc.byteSize = sizeof(IndirectDrawArguments) * requiredCapacity;
+            bufferDesc.isDrawIndirectArgs = true;
+            bufferDesc.debugName = "IndirectDrawArguments";
+            bufferDesc.initialState = nvrhi::ResourceStates::IndirectArgument;
+            bufferDesc.keepInitialState = true;
+            m_IndirectArgsBuffer = GetDevice()->createBuffer(bufferDesc);
+
+            bufferDesc.canHaveUAVs = true;
+            bufferDesc.canHaveRawViews = true;
+            bufferDesc.debugName = "CulledDrawArguments";
+            m_CulledArgsBuffer = GetDevice()->createBuffer(bufferDesc);
+
+            std::vector<uint32_t> drawIndices(requiredCapacity);
+            for (uint32_t i = 0; i < requiredCapacity; i++)
+                drawIndices[i] = i;
+            commandList->writeBuffer(m_DrawIndexBuffer, drawIndices.data(), drawIndices.size() * sizeof(uint32_t));
+        }
+
+        if (m_NumIndirectDraws == 0)
+            return;
+
+        commandList->writeBuffer(m_DrawDataBuffer, drawData.data(), drawData.size() * sizeof(uint2));
+        commandList->writeBuffer(m_DrawBoundsBuffer, drawBounds.data(), drawBounds.size() * sizeof(DrawBounds));
+        commandList->writeBuffer(m_IndirectArgsBuffer, drawArguments.data(), drawArguments.size() * sizeof(IndirectDrawArguments));
     }
 
     bool LoadScene(std::shared_ptr<vfs::IFileSystem> fs, const std::filesystem::path& sceneFileName) override 
     {
-        engine::Scene* scene = new engine::Scene(GetDevice(), *m_ShaderFactory, fs, m_TextureCache, m_DescriptorTableManager, nullptr);
+        CachedScene* scene = new CachedScene(GetDevice(), *m_ShaderFactory, fs, m_TextureCache, m_DescriptorTableManager, nullptr);
 
-        if (scene->Load(sceneFileName))
+        if (scene->LoadWithCache(sceneFileName, app::GetDirectoryWithExecutable() / "scene_cache"))
         {
             m_Scene = std::unique_ptr<engine::Scene>(scene);
             return true;
@@ -146,8 +395,253 @@ public:
         return false;
     }
 
+    void CreateCullingBindingSet()
+    {
+        nvrhi::BindingSetDesc bindingSetDesc;
+        bindingSetDesc.bindings = {
+            nvrhi::BindingSetItem::ConstantBuffer(0, m_CullingConstants),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene->GetInstanceBuffer()),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_Scene->GetGeometryBuffer()),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(2, m_DrawDataBuffer),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_DrawBoundsBuffer),
+            nvrhi::BindingSetItem::Texture_SRV(4, m_HiZTexture),
+            nvrhi::BindingSetItem::RawBuffer_UAV(0, m_CulledArgsBuffer),
+            nvrhi::BindingSetItem::RawBuffer_UAV(1, m_DrawCountBuffer)
+        };
+        m_CullingBindingSet = GetDevice()->createBindingSet(bindingSetDesc, m_CullingBindingLayout);
+    }
+
+    void CreateHiZ(uint32_t width, uint32_t height)
+    {
+        uint32_t mipLevels = 1;
+        while ((std::max(width, height) >> mipLevels) != 0)
+            ++mipLevels;
+
+        nvrhi::TextureDesc textureDesc;
+        textureDesc.format = nvrhi::Format::R32_FLOAT;
+        textureDesc.isUAV = true;
+        textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+        textureDesc.keepInitialState = true;
+        textureDesc.debugName = "HiZ";
+        textureDesc.width = width;
+        textureDesc.height = height;
+        textureDesc.mipLevels = mipLevels;
+        textureDesc.dimension = nvrhi::TextureDimension::Texture2D;
+        m_HiZTexture = GetDevice()->createTexture(textureDesc);
+
+        // Mip 0 is copied from the depth buffer, every other mip is reduced from the one above it
+        m_HiZBindingSets.clear();
+        for (uint32_t mip = 0; mip < mipLevels; mip++)
+        {
+            nvrhi::BindingSetDesc bindingSetDesc;
+            bindingSetDesc.bindings = {
+                nvrhi::BindingSetItem::PushConstants(0, sizeof(HiZConstants)),
+                mip == 0
+                    ? nvrhi::BindingSetItem::Texture_SRV(0, m_DepthBuffer)
+                    : nvrhi::BindingSetItem::Texture_SRV(0, m_HiZTexture, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip - 1, 1, 0, 1)),
+                nvrhi::BindingSetItem::Texture_UAV(0, m_HiZTexture, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mip, 1, 0, 1))
+            };
+            m_HiZBindingSets.push_back(GetDevice()->createBindingSet(bindingSetDesc, m_HiZBindingLayout));
+        }
+
+        m_CullingBindingSet = nullptr;
+        m_HiZValid = false;
+    }
+
+    // Fills m_CulledArgsBuffer with the draws that survive culling, packed at the front.
+    // There is no count-buffer variant of drawIndirect in NVRHI, so the buffer is cleared first
+    // and the draw call covers all records: the ones past the visible count are empty draws.
+    void CullDraws()
+    {
+        if (!m_CullingBindingSet)
+            CreateCullingBindingSet();
+
+        // Pick up the visible draw count written a few frames ago, that copy is complete by now
+        const uint32_t readbackIndex = m_CulledFrames % c_NumDrawCountReadbacks;
+        if (m_CulledFrames >= c_NumDrawCountReadbacks)
+        {
+            const uint32_t* drawCount = static_cast<const uint32_t*>(GetDevice()->mapBuffer(m_DrawCountReadback[readbackIndex], nvrhi::CpuAccessMode::Read));
+            if (drawCount)
+            {
+                m_VisibleDraws = *drawCount;
+                GetDevice()->unmapBuffer(m_DrawCountReadback[readbackIndex]);
+            }
+        }
+
+        const nvrhi::TextureDesc& hizDesc = m_HiZTexture->getDesc();
+
+        CullingConstants constants = {};
+        constants.matWorldToClip = m_View.GetViewProjectionMatrix();
+        constants.matPrevWorldToClip = m_PrevWorldToClip;
+        constants.hizSize = float2(float(hizDesc.width), float(hizDesc.height));
+        constants.hizMipLevels = hizDesc.mipLevels;
+        constants.numDraws = m_NumIndirectDraws;
+        constants.enableFrustumCulling = 1;
+        constants.enableOcclusionCulling = (m_EnableOcclusionCulling && m_HiZValid && !m_CullingCheckRequested) ? 1 : 0;
+        m_CommandList->writeBuffer(m_CullingConstants, &constants, sizeof(constants));
+
+        m_CommandList->clearBufferUInt(m_CulledArgsBuffer, 0);
+        m_CommandList->clearBufferUInt(m_DrawCountBuffer, 0);
+
+        nvrhi::ComputeState state;
+        state.pipeline = m_CullingPipeline;
+        state.bindings = { m_CullingBindingSet };
+        m_CommandList->setComputeState(state);
+        m_CommandList->dispatch((m_NumIndirectDraws + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE);
+
+        m_CommandList->copyBuffer(m_DrawCountReadback[readbackIndex], 0, m_DrawCountBuffer, 0, sizeof(uint32_t));
+        ++m_CulledFrames;
+
+        if (m_CullingCheckRequested)
+        {
+            const uint64_t argsSize = m_CulledArgsBuffer->getDesc().byteSize;
+            if (!m_CulledArgsReadback || m_CulledArgsReadback->getDesc().byteSize != argsSize)
+            {
+                nvrhi::BufferDesc readbackDesc;
+                readbackDesc.byteSize = argsSize;
+                readbackDesc.cpuAccess = nvrhi::CpuAccessMode::Read;
+                readbackDesc.debugName = "CulledDrawArgumentsReadback";
+                readbackDesc.initialState = nvrhi::ResourceStates::CopyDest;
+                readbackDesc.keepInitialState = true;
+                m_CulledArgsReadback = GetDevice()->createBuffer(readbackDesc);
+            }
+
+            m_CommandList->copyBuffer(m_CulledArgsReadback, 0, m_CulledArgsBuffer, 0, argsSize);
+        }
+    }
+
+    // Builds the depth pyramid that the next frame's occlusion test reads
+    void BuildHiZ()
+    {
+        const nvrhi::TextureDesc& hizDesc = m_HiZTexture->getDesc();
+
+        nvrhi::ComputeState state;
+        state.pipeline = m_HiZPipeline;
+
+        uint2 sourceSize = uint2(hizDesc.width, hizDesc.height);
+        for (uint32_t mip = 0; mip < hizDesc.mipLevels; mip++)
+        {
+            const uint2 destSize = max(uint2(hizDesc.width >> mip, hizDesc.height >> mip), uint2(1u));
+
+            state.bindings = { m_HiZBindingSets[mip] };
+            m_CommandList->setComputeState(state);
+
+            HiZConstants constants = {};
+            constants.sourceSize = sourceSize;
+            constants.destSize = destSize;
+            constants.scale = (mip == 0) ? 1 : 2;
+            m_CommandList->setPushConstants(&constants, sizeof(constants));
+
+            m_CommandList->dispatch((destSize.x + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (destSize.y + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE);
+
+            sourceSize = destSize;
+        }
+
+        m_PrevWorldToClip = m_View.GetViewProjectionMatrix();
+        m_HiZValid = true;
+    }
+
+    // Compares the draws kept by the culling shader in the frame that was just submitted with the CPU implementation.
+    // The frame ran without occlusion culling, the CPU has no copy of its depth pyramid, so both sides run
+    // the frustum test only, on the same view and the same transforms.
+    void CheckCullingAgainstReference()
+    {
+        GetDevice()->waitForIdle();
+
+        std::vector<CullingDraw> draws;
+        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        {
+            const affine3 transform = instance->GetNode()->GetLocalToWorldTransformFloat();
+
+            for (const auto& geometry : instance->GetMesh()->geometries)
+                draws.push_back({ transform, geometry->objectSpaceBounds });
+        }
+
+        CullingStatistics stats;
+        const std::vector<uint32_t> cpuVisible = CullDrawsReference(draws, m_View.GetViewProjectionMatrix(), m_PrevWorldToClip, nullptr, &stats);
+
+        // The shader appends the draws in any order, each one with its draw index in startInstanceLocation.
+        // The records past the visible count are still cleared to zero.
+        std::vector<bool> gpuVisible(draws.size(), false);
+        uint32_t gpuVisibleCount = 0;
+        const IndirectDrawArguments* args = static_cast<const IndirectDrawArguments*>(GetDevice()->mapBuffer(m_CulledArgsReadback, nvrhi::CpuAccessMode::Read));
+        if (!args)
+        {
+            log::warning("Culling reference: cannot map the culled draw arguments");
+            return;
+        }
+        for (uint32_t slot = 0; slot < m_NumIndirectDraws; slot++)
+        {
+            if (args[slot].instanceCount != 0 && args[slot].startInstanceLocation < gpuVisible.size())
+            {
+                gpuVisible[args[slot].startInstanceLocation] = true;
+                ++gpuVisibleCount;
+            }
+        }
+        GetDevice()->unmapBuffer(m_CulledArgsReadback);
+
+        std::vector<bool> cpuVisibleFlags(draws.size(), false);
+        for (uint32_t drawIndex : cpuVisible)
+            cpuVisibleFlags[drawIndex] = true;
+
+        // Log the first few draws that differ, by their index in the indirect draw buffer
+        uint32_t onlyCpu = 0;
+        uint32_t onlyGpu = 0;
+        std::string differentDraws;
+        for (size_t drawIndex = 0; drawIndex < draws.size(); drawIndex++)
+        {
+            if (cpuVisibleFlags[drawIndex] == gpuVisible[drawIndex])
+                continue;
+
+            if (cpuVisibleFlags[drawIndex])
+                ++onlyCpu;
+            else
+                ++onlyGpu;
+
+            if (onlyCpu + onlyGpu <= 8)
+                differentDraws += " " + std::to_string(drawIndex) + (cpuVisibleFlags[drawIndex] ? " (CPU)" : " (GPU)");
+        }
+
+        if (onlyCpu == 0 && onlyGpu == 0 && gpuVisibleCount == stats.visible)
+        {
+            log::info("Culling reference: the GPU and the CPU keep the same %u of %u draws", stats.visible, stats.tested);
+        }
+        else
+        {
+            log::warning("Culling reference: the CPU keeps %u of %u draws, the GPU %u; %u draws are only kept by the CPU, %u only by the GPU:%s",
+                stats.visible, stats.tested, gpuVisibleCount, onlyCpu, onlyGpu, differentDraws.c_str());
+        }
+    }
+
     bool KeyboardUpdate(int key, int scancode, int action, int mods) override
     {
+        if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+        {
+            m_UseIndirectDraws = !m_UseIndirectDraws;
+            return true;
+        }
+
+        if (key == GLFW_KEY_C && action == GLFW_PRESS)
+        {
+            m_EnableCulling = !m_EnableCulling;
+            return true;
+        }
+
+        if (key == GLFW_KEY_O && action == GLFW_PRESS)
+        {
+            m_EnableOcclusionCulling = !m_EnableOcclusionCulling;
+            return true;
+        }
+
+        if (key == GLFW_KEY_V && action == GLFW_PRESS)
+        {
+            if (m_UseIndirectDraws && m_EnableCulling)
+                m_CullingCheckRequested = true;
+            else
+                log::warning("Culling reference: enable indirect draws and culling first");
+            return true;
+        }
+
         m_Camera.KeyboardUpdate(key, scancode, action, mods);
         return true;
     }
@@ -167,7 +661,18 @@ public:
     void Animate(float fElapsedTimeSeconds) override
     {
         m_Camera.Animate(fElapsedTimeSeconds);
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+
+        std::string extraInfo = "- direct draws";
+        if (m_UseIndirectDraws && m_EnableCulling)
+        {
+            extraInfo = "- indirect draws, " + std::to_string(m_VisibleDraws) + " of " + std::to_string(m_NumIndirectDraws) + " visible";
+            if (!m_EnableOcclusionCulling)
+                extraInfo += " (frustum culling only)";
+        }
+        else if (m_UseIndirectDraws)
+            extraInfo = "- indirect draws, no culling";
+
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo.c_str());
     }
 
     void BackBufferResizing() override
@@ -175,7 +680,6 @@ public:
         m_DepthBuffer = nullptr;
         m_ColorBuffer = nullptr;
         m_Framebuffer = nullptr;
-        m_GraphicsPipeline = nullptr;
         m_BindingCache->Clear();
     }
 
@@ -183,7 +687,7 @@ public:
     {
         const auto& fbinfo = framebuffer->getFramebufferInfo();
 
-        if (!m_GraphicsPipeline)
+        if (!m_Framebuffer)
         {
             nvrhi::TextureDesc textureDesc;
             textureDesc.format = nvrhi::Format::SRGBA8_UNORM;
@@ -198,16 +702,25 @@ public:
             textureDesc.dimension = nvrhi::TextureDimension::Texture2D;
             m_ColorBuffer = GetDevice()->createTexture(textureDesc);
 
-            textureDesc.format = nvrhi::Format::D24S8;
+            // The depth buffer is read when building the HiZ pyramid, so it has to be sampleable
+            textureDesc.format = nvrhi::Format::D32;
+            textureDesc.isShaderResource = true;
             textureDesc.debugName = "DepthBuffer";
             textureDesc.initialState = nvrhi::ResourceStates::DepthWrite;
             m_DepthBuffer = GetDevice()->createTexture(textureDesc);
 
+            CreateHiZ(fbinfo.width, fbinfo.height);
+
             nvrhi::FramebufferDesc framebufferDesc;
             framebufferDesc.addColorAttachment(m_ColorBuffer, nvrhi::AllSubresources);
             framebufferDesc.setDepthAttachment(m_DepthBuffer);
             m_Framebuffer = GetDevice()->createFramebuffer(framebufferDesc);
+        }
 
+        // The render targets always have the same formats, so the pipelines stay compatible with the framebuffer
+        // when it is recreated for a new window size and are only created once
+        if (!m_GraphicsPipeline)
+        {
             nvrhi::GraphicsPipelineDesc pipelineDesc;
             pipelineDesc.VS = m_VertexShader;
             pipelineDesc.PS = m_PixelShader;
@@ -217,7 +730,11 @@ public:
             pipelineDesc.renderState.depthStencilState.depthFunc = nvrhi::ComparisonFunc::GreaterOrEqual;
             pipelineDesc.renderState.rasterState.frontCounterClockwise = true;
             pipelineDesc.renderState.rasterState.setCullBack();
-            m_GraphicsPipeline = GetDevice()->createGraphicsPipeline(pipelineDesc, m_Framebuffer);
+            m_GraphicsPipeline = m_PipelineCache->CreateGraphicsPipeline(pipelineDesc, m_Framebuffer);
+
+            pipelineDesc.VS = m_IndirectVertexShader;
+            pipelineDesc.inputLayout = m_IndirectInputLayout;
+            m_IndirectGraphicsPipeline = m_PipelineCache->CreateGraphicsPipeline(pipelineDesc, m_Framebuffer);
         }
 
         nvrhi::Viewport windowViewport(float(fbinfo.width), float(fbinfo.height));
@@ -227,6 +744,14 @@ public:
         
         m_CommandList->open();
 
+        // Only structural changes (nodes or meshes added or removed) invalidate the persistent draw list,
+        // transform updates go through the instance buffer.
+        const bool structureChanged = m_Scene->GetSceneGraph()->HasPendingStructureChanges();
+        m_Scene->Refresh(m_CommandList, GetFrameIndex());
+        if (structureChanged)
+            BuildIndirectDraws(m_CommandList);
+        UpdateBindingSets();
+
         m_CommandList->clearTextureFloat(m_ColorBuffer, nvrhi::AllSubresources, nvrhi::Color(0.f));
         m_CommandList->clearDepthStencilTexture(m_DepthBuffer, nvrhi::AllSubresources, true, 0.f, true, 0);
 
@@ -234,33 +759,64 @@ public:
         m_View.FillPlanarViewConstants(viewConstants);
         m_CommandList->writeBuffer(m_ViewConstants, &viewConstants, sizeof(viewConstants));
 
+        const bool cullDraws = m_UseIndirectDraws && m_EnableCulling && m_NumIndirectDraws > 0;
+        if (cullDraws)
+            CullDraws();
+
         nvrhi::GraphicsState state;
-        state.pipeline = m_GraphicsPipeline;
         state.framebuffer = m_Framebuffer;
         state.bindings = { m_BindingSet, m_DescriptorTableManager->GetDescriptorTable() };
         state.viewport = m_View.GetViewportState();
-        m_CommandList->setGraphicsState(state);
 
-        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        if (m_UseIndirectDraws)
         {
-            const auto& mesh = instance->GetMesh();
-
-            for (size_t i = 0; i < mesh->geometries.size(); i++)
+            if (m_NumIndirectDraws > 0)
             {
-                int2 constants = int2(instance->GetInstanceIndex(), int(i));
-                m_CommandList->setPushConstants(&constants, sizeof(constants));
+                state.pipeline = m_IndirectGraphicsPipeline;
+                state.vertexBuffers = { { m_DrawIndexBuffer, 0, 0 } };
+                state.indirectParams = cullDraws ? m_CulledArgsBuffer : m_IndirectArgsBuffer;
+                m_CommandList->setGraphicsState(state);
 
-                nvrhi::DrawArguments args;
-                args.instanceCount = 1;
-                args.vertexCount = mesh->geometries[i]->numIndices;
-                m_CommandList->draw(args);
+                m_CommandList->drawIndirect(0, m_NumIndirectDraws);
+            }
+        }
+        else
+        {
+            state.pipeline = m_GraphicsPipeline;
+            m_CommandList->setGraphicsState(state);
+
+            for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+            {
+                const auto& mesh = instance->GetMesh();
+
+                for (size_t i = 0; i < mesh->geometries.size(); i++)
+                {
+                    int2 constants = int2(instance->GetInstanceIndex(), int(i));
+                    m_CommandList->setPushConstants(&constants, sizeof(constants));
+
+                    nvrhi::DrawArguments args;
+                    args.instanceCount = 1;
+                    args.vertexCount = mesh->geometries[i]->numIndices;
+                    m_CommandList->draw(args);
+                }
             }
         }
         
+        if (cullDraws && m_EnableOcclusionCulling)
+            BuildHiZ();
+        else
+            m_HiZValid = false;
+
         m_CommonPasses->BlitTexture(m_CommandList, framebuffer, m_ColorBuffer, m_BindingCache.get());
 
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
+
+        if (cullDraws && m_CullingCheckRequested)
+        {
+            CheckCullingAgainstReference();
+            m_CullingCheckRequested = false;
+        }
     }
 };
 
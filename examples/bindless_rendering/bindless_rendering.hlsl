@@ -44,24 +44,26 @@ VK_PUSH_CONSTANT ConstantBuffer<InstanceConstants> g_Instance : register(b1);
 StructuredBuffer<InstanceData> t_InstanceData : register(t0);
 StructuredBuffer<GeometryData> t_GeometryData : register(t1);
 StructuredBuffer<MaterialConstants> t_MaterialConstants : register(t2);
+StructuredBuffer<InstanceConstants> t_DrawData : register(t3);
 SamplerState s_MaterialSampler : register(s0);
 
 VK_BINDING(0, 1) ByteAddressBuffer t_BindlessBuffers[] : register(t0, space1);
 VK_BINDING(1, 1) Texture2D t_BindlessTextures[] : register(t0, space2);
 
-void vs_main(
-    in uint i_vertexID : SV_VertexID,
-    out float4 o_position : SV_Position,
-    out float2 o_uv : TEXCOORD,
-    out uint o_material : MATERIAL)
+void TransformVertex(
+    InstanceConstants draw,
+    uint vertexID,
+    out float4 o_position,
+    out float2 o_uv,
+    out uint o_material)
 {
-    InstanceData instance = t_InstanceData[g_Instance.instance];
-    GeometryData geometry = t_GeometryData[instance.firstGeometryIndex + g_Instance.geometryInMesh];
+    InstanceData instance = t_InstanceData[draw.instance];
+    GeometryData geometry = t_GeometryData[instance.firstGeometryIndex + draw.geometryInMesh];
 
     ByteAddressBuffer indexBuffer = t_BindlessBuffers[geometry.indexBufferIndex];
     ByteAddressBuffer vertexBuffer = t_BindlessBuffers[geometry.vertexBufferIndex];
 
-    uint index = indexBuffer.Load(geometry.indexOffset + i_vertexID * 4);
+    uint index = indexBuffer.Load(geometry.indexOffset + vertexID * 4);
 
     float2 texcoord = geometry.texCoord1Offset == ~0u ? 0 : asfloat(vertexBuffer.Load2(geometry.texCoord1Offset + index * 8));
     float3 objectSpacePosition = asfloat(vertexBuffer.Load3(geometry.positionOffset + index * 12));;
@@ -74,6 +76,28 @@ void vs_main(
     o_material = geometry.materialIndex;
 }
 
+void vs_main(
+    in uint i_vertexID : SV_VertexID,
+    out float4 o_position : SV_Position,
+    out float2 o_uv : TEXCOORD,
+    out uint o_material : MATERIAL)
+{
+    TransformVertex(g_Instance, i_vertexID, o_position, o_uv, o_material);
+}
+
+// Vertex shader for the indirect draw path. The draw index comes from a per-instance vertex attribute:
+// every indirect draw record sets startInstanceLocation to its own index, which works the same way on all APIs,
+// unlike SV_InstanceID that ignores the start instance on D3D12.
+void vs_main_indirect(
+    in uint i_drawIndex : DRAW_INDEX,
+    in uint i_vertexID : SV_VertexID,
+    out float4 o_position : SV_Position,
+    out float2 o_uv : TEXCOORD,
+    out uint o_material : MATERIAL)
+{
+    TransformVertex(t_DrawData[i_drawIndex], i_vertexID, o_position, o_uv, o_material);
+}
+
 void ps_main(
     in float4 i_position : SV_Position,
     in float2 i_uv : TEXCOORD, 
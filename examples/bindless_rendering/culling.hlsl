@@ -0,0 +1,156 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/bindless.h>
+#include "culling_cb.h"
+
+// Tests the bounding box of every draw from the persistent draw list against the view frustum
+// and the hierarchical depth of the previous frame, and appends the survivors to u_DrawArguments.
+// The matching CPU implementation is in culling_reference.cpp, keep the two in sync.
+
+ConstantBuffer<CullingConstants> g_Culling : register(b0);
+StructuredBuffer<InstanceData> t_InstanceData : register(t0);
+StructuredBuffer<GeometryData> t_GeometryData : register(t1);
+StructuredBuffer<uint2> t_DrawData : register(t2);
+StructuredBuffer<DrawBounds> t_DrawBounds : register(t3);
+Texture2D<float> t_HiZ : register(t4);
+RWByteAddressBuffer u_DrawArguments : register(u0);
+RWByteAddressBuffer u_DrawCount : register(u1);
+
+float3 GetBoxCorner(DrawBounds bounds, uint corner)
+{
+    return float3(
+        (corner & 1) ? bounds.maximum.x : bounds.minimum.x,
+        (corner & 2) ? bounds.maximum.y : bounds.minimum.y,
+        (corner & 4) ? bounds.maximum.z : bounds.minimum.z);
+}
+
+// Returns true if all corners are outside of the same clip plane.
+// Reverse-Z with an infinite far plane: the near plane is z = w, and z >= 0 everywhere in front of the camera.
+bool IsOutsideFrustum(DrawBounds bounds, float3x4 transform)
+{
+    uint outsideAll = 0x3f;
+
+    for (uint corner = 0; corner < 8; corner++)
+    {
+        float3 worldPos = mul(transform, float4(GetBoxCorner(bounds, corner), 1.0));
+        float4 clipPos = mul(float4(worldPos, 1.0), g_Culling.matWorldToClip);
+
+        uint outside = 0;
+        outside |= (clipPos.x < -clipPos.w) ? 0x01 : 0;
+        outside |= (clipPos.x > clipPos.w) ? 0x02 : 0;
+        outside |= (clipPos.y < -clipPos.w) ? 0x04 : 0;
+        outside |= (clipPos.y > clipPos.w) ? 0x08 : 0;
+        outside |= (clipPos.z > clipPos.w) ? 0x10 : 0;
+        outside |= (clipPos.z < 0) ? 0x20 : 0;
+        outsideAll &= outside;
+    }
+
+    return outsideAll != 0;
+}
+
+float LoadHiZ(int2 texel, uint mip)
+{
+    return t_HiZ.Load(int3(texel, mip));
+}
+
+// Projects the box with the previous frame's matrices and compares its nearest depth against
+// the farthest depth in the HiZ texels covering its screen rectangle.
+bool IsOccluded(DrawBounds bounds, float3x4 transform)
+{
+    float3 ndcMin = 1.0;
+    float3 ndcMax = -1.0;
+
+    for (uint corner = 0; corner < 8; corner++)
+    {
+        float3 worldPos = mul(transform, float4(GetBoxCorner(bounds, corner), 1.0));
+        float4 clipPos = mul(float4(worldPos, 1.0), g_Culling.matPrevWorldToClip);
+
+        // The box crosses the camera plane, its projection is unbounded
+        if (clipPos.w <= 0)
+            return false;
+
+        float3 ndc = clipPos.xyz / clipPos.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    float2 pixelMin = saturate(float2(ndcMin.x, -ndcMax.y) * 0.5 + 0.5) * g_Culling.hizSize;
+    float2 pixelMax = saturate(float2(ndcMax.x, -ndcMin.y) * 0.5 + 0.5) * g_Culling.hizSize;
+    float2 extent = pixelMax - pixelMin;
+
+    // Pick the mip where the rectangle covers at most 2x2 texels
+    uint mip = uint(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+    mip = min(mip, g_Culling.hizMipLevels - 1);
+
+    int2 mipSize = max(int2(g_Culling.hizSize) >> mip, 1);
+    int2 texelMin = min(int2(pixelMin) >> mip, mipSize - 1);
+    int2 texelMax = min(int2(pixelMax) >> mip, mipSize - 1);
+
+    float farthestDepth = min(
+        min(LoadHiZ(texelMin, mip), LoadHiZ(int2(texelMax.x, texelMin.y), mip)),
+        min(LoadHiZ(int2(texelMin.x, texelMax.y), mip), LoadHiZ(texelMax, mip)));
+
+    return ndcMax.z < farthestDepth;
+}
+
+[numthreads(CULLING_GROUP_SIZE, 1, 1)]
+void cs_cull(uint drawIndex : SV_DispatchThreadID)
+{
+    // No early out here: all lanes have to take part in the wave operations below
+    bool visible = drawIndex < g_Culling.numDraws;
+    uint numIndices = 0;
+
+    if (visible)
+    {
+        uint2 draw = t_DrawData[drawIndex];
+        InstanceData instance = t_InstanceData[draw.x];
+        GeometryData geometry = t_GeometryData[instance.firstGeometryIndex + draw.y];
+        DrawBounds bounds = t_DrawBounds[drawIndex];
+
+        numIndices = geometry.numIndices;
+
+        if (g_Culling.enableFrustumCulling && IsOutsideFrustum(bounds, instance.transform))
+            visible = false;
+        else if (g_Culling.enableOcclusionCulling && IsOccluded(bounds, instance.transform))
+            visible = false;
+    }
+
+    // Compact the surviving draws with one atomic per wave
+    uint waveVisibleCount = WaveActiveCountBits(visible);
+    uint waveOffset = 0;
+    if (WaveIsFirstLane() && waveVisibleCount != 0)
+        u_DrawCount.InterlockedAdd(0, waveVisibleCount, waveOffset);
+    waveOffset = WaveReadLaneFirst(waveOffset);
+
+    if (visible)
+    {
+        uint slot = waveOffset + WavePrefixCountBits(visible);
+
+        // vertexCount, instanceCount, startVertexLocation, startInstanceLocation.
+        // The start instance carries the draw index to vs_main_indirect.
+        u_DrawArguments.Store4(slot * INDIRECT_ARGS_STRIDE, uint4(numIndices, 1, 0, drawIndex));
+    }
+}
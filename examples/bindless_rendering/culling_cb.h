@@ -0,0 +1,63 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef CULLING_CB_H
+#define CULLING_CB_H
+
+#define CULLING_GROUP_SIZE 64
+#define HIZ_GROUP_SIZE 8
+
+// Size of one record in the indirect argument buffers, see IndirectDrawArguments
+#define INDIRECT_ARGS_STRIDE 16
+
+struct CullingConstants
+{
+    float4x4 matWorldToClip;
+    float4x4 matPrevWorldToClip;
+
+    float2 hizSize;
+    uint hizMipLevels;
+    uint numDraws;
+
+    uint enableFrustumCulling;
+    uint enableOcclusionCulling;
+    uint2 padding;
+};
+
+// Object-space bounding box of one draw, i.e. of one geometry in a mesh
+struct DrawBounds
+{
+    float3 minimum;
+    uint padding0;
+    float3 maximum;
+    uint padding1;
+};
+
+struct HiZConstants
+{
+    uint2 sourceSize;
+    uint2 destSize;
+    uint scale;
+};
+
+#endif // CULLING_CB_H
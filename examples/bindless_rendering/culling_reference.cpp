@@ -0,0 +1,185 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "culling_reference.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace donut::math;
+
+HiZPyramid HiZPyramid::Build(const float* depth, uint2 size)
+{
+    HiZPyramid hiz;
+    hiz.mipSizes.push_back(size);
+    hiz.mips.emplace_back(depth, depth + size_t(size.x) * size.y);
+
+    while (hiz.mipSizes.back().x > 1 || hiz.mipSizes.back().y > 1)
+    {
+        const uint2 sourceSize = hiz.mipSizes.back();
+        const uint2 destSize = max(sourceSize / 2u, uint2(1u));
+        const std::vector<float>& source = hiz.mips.back();
+        std::vector<float> dest(size_t(destSize.x) * destSize.y);
+
+        for (uint32_t destY = 0; destY < destSize.y; destY++)
+        {
+            for (uint32_t destX = 0; destX < destSize.x; destX++)
+            {
+                // Same footprint as cs_build_hiz with scale = 2
+                const uint32_t lastX = (destX == destSize.x - 1) ? sourceSize.x - 1 : destX * 2 + 1;
+                const uint32_t lastY = (destY == destSize.y - 1) ? sourceSize.y - 1 : destY * 2 + 1;
+
+                float farthest = 1.f;
+                for (uint32_t y = destY * 2; y <= lastY; y++)
+                    for (uint32_t x = destX * 2; x <= lastX; x++)
+                        farthest = std::min(farthest, source[size_t(y) * sourceSize.x + x]);
+
+                dest[size_t(destY) * destSize.x + destX] = farthest;
+            }
+        }
+
+        hiz.mipSizes.push_back(destSize);
+        hiz.mips.push_back(std::move(dest));
+    }
+
+    return hiz;
+}
+
+float HiZPyramid::Load(int2 texel, uint32_t mip) const
+{
+    const uint2 size = mipSizes[mip];
+    return mips[mip][size_t(texel.y) * size.x + texel.x];
+}
+
+static float3 GetBoxCorner(const box3& bounds, uint32_t corner)
+{
+    return float3(
+        (corner & 1) ? bounds.m_maxs.x : bounds.m_mins.x,
+        (corner & 2) ? bounds.m_maxs.y : bounds.m_mins.y,
+        (corner & 4) ? bounds.m_maxs.z : bounds.m_mins.z);
+}
+
+static float4 TransformToClip(const CullingDraw& draw, uint32_t corner, const float4x4& worldToClip)
+{
+    const float3 worldPos = draw.transform.transformPoint(GetBoxCorner(draw.bounds, corner));
+    return float4(worldPos, 1.f) * worldToClip;
+}
+
+static bool IsOutsideFrustum(const CullingDraw& draw, const float4x4& worldToClip)
+{
+    uint32_t outsideAll = 0x3f;
+
+    for (uint32_t corner = 0; corner < 8; corner++)
+    {
+        const float4 clipPos = TransformToClip(draw, corner, worldToClip);
+
+        uint32_t outside = 0;
+        outside |= (clipPos.x < -clipPos.w) ? 0x01 : 0;
+        outside |= (clipPos.x > clipPos.w) ? 0x02 : 0;
+        outside |= (clipPos.y < -clipPos.w) ? 0x04 : 0;
+        outside |= (clipPos.y > clipPos.w) ? 0x08 : 0;
+        outside |= (clipPos.z > clipPos.w) ? 0x10 : 0;
+        outside |= (clipPos.z < 0.f) ? 0x20 : 0;
+        outsideAll &= outside;
+    }
+
+    return outsideAll != 0;
+}
+
+static int2 ShiftRight(int2 value, uint32_t shift)
+{
+    return int2(value.x >> shift, value.y >> shift);
+}
+
+static bool IsOccluded(const CullingDraw& draw, const float4x4& prevWorldToClip, const HiZPyramid& hiz)
+{
+    float3 ndcMin(1.f);
+    float3 ndcMax(-1.f);
+
+    for (uint32_t corner = 0; corner < 8; corner++)
+    {
+        const float4 clipPos = TransformToClip(draw, corner, prevWorldToClip);
+
+        if (clipPos.w <= 0.f)
+            return false;
+
+        const float3 ndc = clipPos.xyz() / clipPos.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    const float2 hizSize = float2(hiz.mipSizes[0]);
+    const float2 pixelMin = saturate(float2(ndcMin.x, -ndcMax.y) * 0.5f + 0.5f) * hizSize;
+    const float2 pixelMax = saturate(float2(ndcMax.x, -ndcMin.y) * 0.5f + 0.5f) * hizSize;
+    const float2 extent = pixelMax - pixelMin;
+
+    uint32_t mip = uint32_t(std::ceil(std::log2(std::max(std::max(extent.x, extent.y), 1.f))));
+    mip = std::min(mip, uint32_t(hiz.mips.size()) - 1);
+
+    const int2 mipSize = max(ShiftRight(int2(hiz.mipSizes[0]), mip), int2(1));
+    const int2 texelMin = min(ShiftRight(int2(pixelMin), mip), mipSize - 1);
+    const int2 texelMax = min(ShiftRight(int2(pixelMax), mip), mipSize - 1);
+
+    const float farthestDepth = std::min(
+        std::min(hiz.Load(texelMin, mip), hiz.Load(int2(texelMax.x, texelMin.y), mip)),
+        std::min(hiz.Load(int2(texelMin.x, texelMax.y), mip), hiz.Load(texelMax, mip)));
+
+    return ndcMax.z < farthestDepth;
+}
+
+std::vector<uint32_t> CullDrawsReference(
+    const std::vector<CullingDraw>& draws,
+    const float4x4& worldToClip,
+    const float4x4& prevWorldToClip,
+    const HiZPyramid* hiz,
+    CullingStatistics* statistics)
+{
+    CullingStatistics stats;
+    std::vector<uint32_t> visibleDraws;
+
+    for (uint32_t drawIndex = 0; drawIndex < uint32_t(draws.size()); drawIndex++)
+    {
+        const CullingDraw& draw = draws[drawIndex];
+        ++stats.tested;
+
+        if (IsOutsideFrustum(draw, worldToClip))
+        {
+            ++stats.frustumCulled;
+            continue;
+        }
+
+        if (hiz && !hiz->mips.empty() && IsOccluded(draw, prevWorldToClip, *hiz))
+        {
+            ++stats.occlusionCulled;
+            continue;
+        }
+
+        ++stats.visible;
+        visibleDraws.push_back(drawIndex);
+    }
+
+    if (statistics)
+        *statistics = stats;
+
+    return visibleDraws;
+}
@@ -0,0 +1,65 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <vector>
+
+// CPU implementation of the draw culling done by culling.hlsl and hiz.hlsl. It follows the shaders step by step,
+// so its results can be checked against the GPU, or tested on their own without a device.
+
+struct CullingDraw
+{
+    donut::math::affine3 transform;
+    donut::math::box3 bounds;
+};
+
+// Hierarchical depth buffer with the same layout as the one built by hiz.hlsl: mip 0 is a copy of the depth buffer,
+// every next mip stores the farthest (minimum, reverse-Z) depth of the texels it covers.
+struct HiZPyramid
+{
+    std::vector<donut::math::uint2> mipSizes;
+    std::vector<std::vector<float>> mips;
+
+    static HiZPyramid Build(const float* depth, donut::math::uint2 size);
+    [[nodiscard]] float Load(donut::math::int2 texel, uint32_t mip) const;
+};
+
+struct CullingStatistics
+{
+    uint32_t tested = 0;
+    uint32_t frustumCulled = 0;
+    uint32_t occlusionCulled = 0;
+    uint32_t visible = 0;
+};
+
+// Returns the indices of the draws that pass the frustum test against worldToClip and, if hiz is not null,
+// the occlusion test against hiz projected with prevWorldToClip. The indices are in draw order;
+// the GPU appends them in an arbitrary order, so compare the two as sets.
+std::vector<uint32_t> CullDrawsReference(
+    const std::vector<CullingDraw>& draws,
+    const donut::math::float4x4& worldToClip,
+    const donut::math::float4x4& prevWorldToClip,
+    const HiZPyramid* hiz,
+    CullingStatistics* statistics = nullptr);
@@ -0,0 +1,254 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+// Standalone check for the CPU culling reference in culling_reference.cpp, which is what the V key
+// compares the GPU culling against. The frustum test is checked on hand-placed boxes and against
+// the world space planes on random boxes, the depth pyramid against a brute force minimum, and the
+// occlusion test against a wall with known depth. Runs without a device.
+//
+// Usage: bindless_rendering_culling_test [-seed <n>] [-count <boxes>]
+
+#include "culling_reference.h"
+
+#include <donut/core/math/math.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace donut::math;
+
+namespace
+{
+    int g_FailureCount = 0;
+
+    void Check(bool condition, const char* description)
+    {
+        if (!condition)
+        {
+            printf("FAILED: %s\n", description);
+            ++g_FailureCount;
+        }
+    }
+
+    // Same projection as the example's views: reverse-Z, infinite far plane, looking down +Z from the origin
+    constexpr float c_ZNear = 0.1f;
+
+    float4x4 GetWorldToClip()
+    {
+        return perspProjD3DStyleReverse(radians(90.f), 1.f, c_ZNear);
+    }
+
+    bool IsVisible(const box3& bounds, const float4x4& worldToClip, const HiZPyramid* hiz = nullptr)
+    {
+        const std::vector<CullingDraw> draws = { { affine3::identity(), bounds } };
+        return !CullDrawsReference(draws, worldToClip, worldToClip, hiz).empty();
+    }
+
+    void TestFrustumCases()
+    {
+        const float4x4 worldToClip = GetWorldToClip();
+
+        Check(IsVisible(box3(float3(-1.f, -1.f, 9.f), float3(1.f, 1.f, 11.f)), worldToClip), "box in front of the camera is visible");
+        Check(!IsVisible(box3(float3(-1.f, -1.f, -11.f), float3(1.f, 1.f, -9.f)), worldToClip), "box behind the camera is culled");
+        Check(!IsVisible(box3(float3(-30.f, -1.f, 9.f), float3(-20.f, 1.f, 11.f)), worldToClip), "box left of the frustum is culled");
+        Check(!IsVisible(box3(float3(-1.f, 20.f, 9.f), float3(1.f, 30.f, 11.f)), worldToClip), "box above the frustum is culled");
+        Check(IsVisible(box3(float3(-15.f, -1.f, 9.f), float3(-5.f, 1.f, 11.f)), worldToClip), "box straddling the left plane is visible");
+        Check(IsVisible(box3(float3(-1.f, -1.f, -5.f), float3(1.f, 1.f, 5.f)), worldToClip), "box around the camera is visible");
+        Check(!IsVisible(box3(float3(-1.f, -1.f, 0.01f), float3(1.f, 1.f, 0.05f)), worldToClip), "box before the near plane is culled");
+        Check(IsVisible(box3(float3(-1.f, -1.f, 1e5f), float3(1.f, 1.f, 1e5f + 1.f)), worldToClip), "distant box is visible with an infinite far plane");
+
+        // The transform is applied before the test
+        const std::vector<CullingDraw> draws = {
+            { translation(float3(0.f, 0.f, 10.f)), box3(float3(-1.f), float3(1.f)) },
+            { translation(float3(0.f, 0.f, -10.f)), box3(float3(-1.f), float3(1.f)) }
+        };
+        CullingStatistics stats;
+        const std::vector<uint32_t> visible = CullDrawsReference(draws, worldToClip, worldToClip, nullptr, &stats);
+        Check(visible.size() == 1 && visible[0] == 0, "translated boxes are culled at their world position");
+        Check(stats.tested == 2 && stats.frustumCulled == 1 && stats.visible == 1, "statistics count the tested and culled draws");
+    }
+
+    // With a 90 degree field of view and a square aspect the side planes are x = +-z and y = +-z,
+    // so a box is outside when it lies entirely beyond one of them or before the near plane.
+    bool IsOutsideFrustumAnalytic(const box3& bounds)
+    {
+        return bounds.m_mins.x > bounds.m_maxs.z
+            || -bounds.m_maxs.x > bounds.m_maxs.z
+            || bounds.m_mins.y > bounds.m_maxs.z
+            || -bounds.m_maxs.y > bounds.m_maxs.z
+            || bounds.m_maxs.z < c_ZNear;
+    }
+
+    void TestFrustumRandom(uint32_t seed, int count)
+    {
+        const float4x4 worldToClip = GetWorldToClip();
+
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> position(-50.f, 50.f);
+        std::uniform_real_distribution<float> extent(0.1f, 5.f);
+
+        int compared = 0;
+        int visible = 0;
+        int differences = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const float3 center(position(rng), position(rng), position(rng));
+            const float3 halfSize(extent(rng), extent(rng), extent(rng));
+            const box3 bounds(center - halfSize, center + halfSize);
+
+            // Boxes within a small margin of a plane can go either way after rounding, skip them
+            const float3 margin(0.01f);
+            const bool grownOutside = IsOutsideFrustumAnalytic(box3(bounds.m_mins - margin, bounds.m_maxs + margin));
+            const bool shrunkOutside = IsOutsideFrustumAnalytic(box3(bounds.m_mins + margin, bounds.m_maxs - margin));
+            if (grownOutside != shrunkOutside)
+                continue;
+
+            ++compared;
+            visible += grownOutside ? 0 : 1;
+            if (IsVisible(bounds, worldToClip) == grownOutside)
+                ++differences;
+        }
+
+        printf("Frustum: %d of %d random boxes compared, %d visible, %d differ from the world space planes\n",
+            compared, count, visible, differences);
+        Check(differences == 0, "the clip space frustum test matches the world space planes");
+    }
+
+    void TestHiZPyramid(uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> depthValue(0.f, 1.f);
+
+        for (const uint2 size : { uint2(1, 1), uint2(7, 5), uint2(64, 64), uint2(33, 17), uint2(1, 9) })
+        {
+            std::vector<float> depth(size_t(size.x) * size.y);
+            for (float& value : depth)
+                value = depthValue(rng);
+
+            const HiZPyramid hiz = HiZPyramid::Build(depth.data(), size);
+            Check(all(hiz.mipSizes.back() == uint2(1u)), "the pyramid ends with a 1x1 mip");
+            Check(hiz.Load(int2(0), uint32_t(hiz.mips.size()) - 1) == *std::min_element(depth.begin(), depth.end()),
+                "the last mip holds the farthest depth");
+
+            for (uint32_t mip = 1; mip < hiz.mips.size(); mip++)
+            {
+                const uint2 mipSize = hiz.mipSizes[mip];
+                for (uint32_t y = 0; y < mipSize.y; y++)
+                {
+                    for (uint32_t x = 0; x < mipSize.x; x++)
+                    {
+                        // Walk the footprint down to mip 0; the last row and column also cover the odd texel left over
+                        uint2 first(x, y);
+                        uint2 last(x, y);
+                        for (uint32_t level = mip; level > 0; level--)
+                        {
+                            const uint2 levelSize = hiz.mipSizes[level];
+                            const uint2 finerSize = hiz.mipSizes[level - 1];
+                            last.x = (last.x == levelSize.x - 1) ? finerSize.x - 1 : last.x * 2 + 1;
+                            last.y = (last.y == levelSize.y - 1) ? finerSize.y - 1 : last.y * 2 + 1;
+                            first *= 2u;
+                        }
+
+                        float farthest = 1.f;
+                        for (uint32_t sy = first.y; sy <= last.y; sy++)
+                            for (uint32_t sx = first.x; sx <= last.x; sx++)
+                                farthest = std::min(farthest, depth[size_t(sy) * size.x + sx]);
+
+                        if (hiz.Load(int2(x, y), mip) != farthest)
+                        {
+                            printf("HiZ %ux%u mip %u texel (%u, %u): %f, expected %f\n", size.x, size.y, mip, x, y,
+                                hiz.Load(int2(x, y), mip), farthest);
+                            Check(false, "every HiZ texel holds the farthest depth of its footprint");
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void TestOcclusion()
+    {
+        const float4x4 worldToClip = GetWorldToClip();
+
+        // A wall at z = 10 covers the left half of the screen, the right half is empty (depth 0 with reverse-Z)
+        const uint2 size(64, 64);
+        const float wallDepth = c_ZNear / 10.f;
+        std::vector<float> depth(size_t(size.x) * size.y);
+        for (uint32_t y = 0; y < size.y; y++)
+            for (uint32_t x = 0; x < size.x; x++)
+                depth[size_t(y) * size.x + x] = (x < size.x / 2) ? wallDepth : 0.f;
+
+        const HiZPyramid hiz = HiZPyramid::Build(depth.data(), size);
+
+        Check(!IsVisible(box3(float3(-12.f, -2.f, 20.f), float3(-8.f, 2.f, 21.f)), worldToClip, &hiz), "box behind the wall is occluded");
+        Check(IsVisible(box3(float3(-3.f, -1.f, 5.f), float3(-2.f, 1.f, 6.f)), worldToClip, &hiz), "box in front of the wall is visible");
+        Check(IsVisible(box3(float3(8.f, -2.f, 20.f), float3(12.f, 2.f, 21.f)), worldToClip, &hiz), "box in the open half is visible");
+        Check(IsVisible(box3(float3(-4.f, -2.f, 20.f), float3(4.f, 2.f, 21.f)), worldToClip, &hiz), "box straddling the wall edge is visible");
+        Check(IsVisible(box3(float3(-1.f, -1.f, -1.f), float3(1.f, 1.f, 1.f)), worldToClip, &hiz), "box crossing the camera plane is never occluded");
+
+        CullingStatistics stats;
+        const std::vector<CullingDraw> draws = { { affine3::identity(), box3(float3(-12.f, -2.f, 20.f), float3(-8.f, 2.f, 21.f)) } };
+        CullDrawsReference(draws, worldToClip, worldToClip, &hiz, &stats);
+        Check(stats.occlusionCulled == 1 && stats.frustumCulled == 0, "occluded draws are counted separately");
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    uint32_t seed = 1;
+    int count = 100000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+        {
+            seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (!strcmp(argv[i], "-count") && i + 1 < argc)
+        {
+            count = std::max(1, std::atoi(argv[++i]));
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-seed <n>] [-count <boxes>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    TestFrustumCases();
+    TestFrustumRandom(seed, count);
+    TestHiZPyramid(seed);
+    TestOcclusion();
+
+    if (g_FailureCount != 0)
+    {
+        printf("%d checks failed\n", g_FailureCount);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/bindless.h>
+#include "culling_cb.h"
+
+#ifdef SPIRV
+#define VK_PUSH_CONSTANT [[vk::push_constant]]
+#else
+#define VK_PUSH_CONSTANT
+#endif
+
+// Builds one level of the hierarchical depth buffer. With scale = 1, copies the depth buffer into mip 0;
+// with scale = 2, reduces the previous mip. The last row and column also take in the leftover texels
+// of odd-sized sources, so every texel is conservative over the whole area it covers.
+// Depth is reverse-Z, so the farthest depth is the minimum.
+
+VK_PUSH_CONSTANT ConstantBuffer<HiZConstants> g_HiZ : register(b0);
+Texture2D<float> t_Source : register(t0);
+RWTexture2D<float> u_Dest : register(u0);
+
+[numthreads(HIZ_GROUP_SIZE, HIZ_GROUP_SIZE, 1)]
+void cs_build_hiz(uint2 destPos : SV_DispatchThreadID)
+{
+    if (any(destPos >= g_HiZ.destSize))
+        return;
+
+    uint2 first = destPos * g_HiZ.scale;
+    uint2 last = first + g_HiZ.scale - 1;
+    if (destPos.x == g_HiZ.destSize.x - 1)
+        last.x = g_HiZ.sourceSize.x - 1;
+    if (destPos.y == g_HiZ.destSize.y - 1)
+        last.y = g_HiZ.sourceSize.y - 1;
+
+    float depth = 1.0;
+    for (uint y = first.y; y <= last.y; y++)
+    {
+        for (uint x = first.x; x <= last.x; x++)
+        {
+            depth = min(depth, t_Source[uint2(x, y)]);
+        }
+    }
+
+    u_Dest[destPos] = depth;
+}
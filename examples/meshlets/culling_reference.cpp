@@ -0,0 +1,120 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "culling_reference.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace donut::math;
+
+enum class MeshletCullingResult
+{
+    Visible,
+    OutsideFrustum,
+    BackFacing,
+    TooSmall
+};
+
+static MeshletCullingResult CullMeshlet(const Meshlet& meshlet, const affine3& transform, const MeshletCullingView& view)
+{
+    // affine3 transforms row vectors, so the images of the object space axes are the rows of the linear part
+    const float3x3& linear = transform.m_linear;
+    const float3 scale = float3(length(linear.row0), length(linear.row1), length(linear.row2));
+    const float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+    const float minScale = std::min(scale.x, std::min(scale.y, scale.z));
+
+    const float3 center = transform.transformPoint(meshlet.center);
+    const float radius = meshlet.radius * maxScale;
+
+    if (view.enableFrustumCulling)
+    {
+        for (const float4& plane : view.frustumPlanes)
+        {
+            if (dot(plane.xyz(), center) - radius > plane.w)
+                return MeshletCullingResult::OutsideFrustum;
+        }
+    }
+
+    // Non-uniform scaling changes the angles between the normals, the cone no longer bounds them
+    if (view.enableConeCulling && meshlet.coneCutoff < 1.f && maxScale <= minScale * 1.01f)
+    {
+        // Mirroring transforms flip the winding and with it the front faces
+        const float determinant = dot(cross(linear.row0, linear.row1), linear.row2);
+        const float3 axis = normalize(transform.transformVector(meshlet.coneAxis)) * (determinant < 0.f ? -1.f : 1.f);
+
+        const float3 toCenter = center - view.viewOrigin;
+        if (dot(toCenter, axis) >= meshlet.coneCutoff * length(toCenter) + radius)
+            return MeshletCullingResult::BackFacing;
+    }
+
+    if (view.enableSmallMeshletCulling)
+    {
+        // Approximate size on screen, only for meshlets entirely in front of the camera
+        const float depth = dot(center - view.viewOrigin, view.viewDirection);
+        if (depth > radius && 2.f * radius * view.pixelScale < view.minPixelDiameter * depth)
+            return MeshletCullingResult::TooSmall;
+    }
+
+    return MeshletCullingResult::Visible;
+}
+
+std::vector<uint32_t> CullMeshletsReference(
+    const std::vector<Meshlet>& meshlets,
+    const std::vector<MeshletCullingDraw>& draws,
+    const MeshletCullingView& view,
+    MeshletCullingStatistics* statistics)
+{
+    MeshletCullingStatistics stats;
+    std::vector<uint32_t> visibleMeshlets;
+
+    for (const MeshletCullingDraw& draw : draws)
+    {
+        for (uint32_t meshletIndex = draw.firstMeshlet; meshletIndex < draw.firstMeshlet + draw.meshletCount; meshletIndex++)
+        {
+            ++stats.tested;
+
+            switch (CullMeshlet(meshlets[meshletIndex], draw.transform, view))
+            {
+            case MeshletCullingResult::OutsideFrustum:
+                ++stats.frustumCulled;
+                break;
+            case MeshletCullingResult::BackFacing:
+                ++stats.coneCulled;
+                break;
+            case MeshletCullingResult::TooSmall:
+                ++stats.smallCulled;
+                break;
+            case MeshletCullingResult::Visible:
+                ++stats.visible;
+                visibleMeshlets.push_back(meshletIndex);
+                break;
+            }
+        }
+    }
+
+    if (statistics)
+        *statistics = stats;
+
+    return visibleMeshlets;
+}
@@ -0,0 +1,71 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <vector>
+
+#include "meshlet_builder.h"
+
+// CPU implementation of the meshlet culling done by main_as in shaders.hlsl. It follows the shader step by step,
+// so culling efficiency can be measured for any view without a device that supports mesh shaders.
+
+struct MeshletCullingView
+{
+    // A point p is outside of a plane if dot(plane.xyz, p) > plane.w, like the planes of donut::math::frustum.
+    // Degenerate planes, such as the far plane of an infinite projection, are all zeros.
+    donut::math::float4 frustumPlanes[6];
+    donut::math::float3 viewOrigin = 0.f;
+    donut::math::float3 viewDirection = 0.f;
+    float pixelScale = 0.f;             // viewport height / (2 * tan(vertical fov / 2))
+    float minPixelDiameter = 0.f;       // meshlets that look smaller than this are culled
+
+    bool enableFrustumCulling = true;
+    bool enableConeCulling = true;
+    bool enableSmallMeshletCulling = true;
+};
+
+struct MeshletCullingDraw
+{
+    donut::math::affine3 transform;
+    uint32_t firstMeshlet = 0;
+    uint32_t meshletCount = 0;
+};
+
+// Every meshlet is counted in the first category that culls it
+struct MeshletCullingStatistics
+{
+    uint32_t tested = 0;
+    uint32_t frustumCulled = 0;
+    uint32_t coneCulled = 0;
+    uint32_t smallCulled = 0;
+    uint32_t visible = 0;
+};
+
+// Returns the indices into meshlets of the meshlets of all draws that pass the enabled tests, in draw order
+std::vector<uint32_t> CullMeshletsReference(
+    const std::vector<Meshlet>& meshlets,
+    const std::vector<MeshletCullingDraw>& draws,
+    const MeshletCullingView& view,
+    MeshletCullingStatistics* statistics = nullptr);
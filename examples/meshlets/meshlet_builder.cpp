@@ -0,0 +1,405 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "meshlet_builder.h"
+
+#include <donut/core/log.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+using namespace donut;
+using namespace donut::math;
+
+static const uint8_t c_NotInMeshlet = 0xff;
+static const uint32_t c_InvalidTriangle = ~0u;
+
+// Ritter's bounding sphere: start from two distant points and grow the sphere over the points outside of it
+static void ComputeBoundingSphere(const std::vector<float3>& points, float3& center, float& radius)
+{
+    const float3 first = points[0];
+    float3 a = first;
+    float maxDistance = 0.f;
+    for (const float3& point : points)
+    {
+        const float distance = lengthSquared(point - first);
+        if (distance > maxDistance)
+        {
+            maxDistance = distance;
+            a = point;
+        }
+    }
+
+    float3 b = a;
+    maxDistance = 0.f;
+    for (const float3& point : points)
+    {
+        const float distance = lengthSquared(point - a);
+        if (distance > maxDistance)
+        {
+            maxDistance = distance;
+            b = point;
+        }
+    }
+
+    center = (a + b) * 0.5f;
+    radius = length(b - a) * 0.5f;
+
+    for (const float3& point : points)
+    {
+        const float distance = length(point - center);
+        if (distance > radius)
+        {
+            const float newRadius = (radius + distance) * 0.5f;
+            center += (point - center) * ((newRadius - radius) / distance);
+            radius = newRadius;
+        }
+    }
+}
+
+static void ComputeMeshletBounds(const MeshletBuildInput& input, const MeshletGeometry& geometry, Meshlet& meshlet)
+{
+    std::vector<float3> points(meshlet.vertexCount);
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        points[i] = input.positions[geometry.vertices[meshlet.vertexOffset + i]];
+
+    ComputeBoundingSphere(points, meshlet.center, meshlet.radius);
+
+    // The normal cone is the average triangle normal, with its half angle set by the normal that deviates the most.
+    // Normals follow counter-clockwise front faces.
+    std::vector<float3> normals;
+    normals.reserve(meshlet.triangleCount);
+    float3 normalSum = 0.f;
+    for (uint32_t i = 0; i < meshlet.triangleCount; i++)
+    {
+        const uint32_t packed = geometry.triangles[meshlet.triangleOffset + i];
+        const float3 p0 = points[packed & 0xff];
+        const float3 p1 = points[(packed >> 8) & 0xff];
+        const float3 p2 = points[(packed >> 16) & 0xff];
+
+        const float3 normal = cross(p1 - p0, p2 - p0);
+        const float area = length(normal);
+        if (area <= 0.f)
+            continue;
+
+        normals.push_back(normal / area);
+        normalSum += normals.back();
+    }
+
+    meshlet.coneAxis = 0.f;
+    meshlet.coneCutoff = 1.f;
+
+    const float axisLength = length(normalSum);
+    if (normals.empty() || axisLength < 1e-6f)
+        return;
+
+    const float3 axis = normalSum / axisLength;
+    float minDot = 1.f;
+    for (const float3& normal : normals)
+        minDot = std::min(minDot, dot(axis, normal));
+
+    meshlet.coneAxis = axis;
+
+    // Cones wider than ~85 degrees almost never allow culling, leave them disabled
+    if (minDot > 0.1f)
+        meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+}
+
+MeshletGeometry BuildMeshlets(const MeshletBuildInput& input)
+{
+    MeshletGeometry geometry;
+
+    const uint32_t numTriangles = input.numIndices / 3;
+    if (numTriangles == 0 || input.numVertices == 0)
+        return geometry;
+
+    // Triangles that use each vertex, and the number of those that are not in a meshlet yet
+    std::vector<uint32_t> adjacencyOffsets(input.numVertices + 1, 0);
+    std::vector<uint32_t> liveTriangles(input.numVertices, 0);
+    std::vector<uint8_t> emitted(numTriangles, 0);
+    uint32_t numEmitted = 0;
+
+    for (uint32_t triangle = 0; triangle < numTriangles; triangle++)
+    {
+        const uint32_t* corners = input.indices + triangle * 3;
+        if (corners[0] >= input.numVertices || corners[1] >= input.numVertices || corners[2] >= input.numVertices)
+        {
+            // Skip triangles with invalid indices instead of reading outside of the vertex array
+            emitted[triangle] = 1;
+            ++numEmitted;
+            continue;
+        }
+
+        for (uint32_t corner = 0; corner < 3; corner++)
+            ++adjacencyOffsets[corners[corner] + 1];
+    }
+
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+
+    std::vector<uint32_t> adjacency(adjacencyOffsets.back());
+    std::vector<float3> centroids(numTriangles);
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (uint32_t triangle = 0; triangle < numTriangles; triangle++)
+        {
+            if (emitted[triangle])
+                continue;
+
+            const uint32_t* corners = input.indices + triangle * 3;
+            for (uint32_t corner = 0; corner < 3; corner++)
+            {
+                adjacency[fill[corners[corner]]++] = triangle;
+                ++liveTriangles[corners[corner]];
+            }
+
+            centroids[triangle] = (input.positions[corners[0]] + input.positions[corners[1]] + input.positions[corners[2]]) / 3.f;
+        }
+    }
+
+    std::vector<uint8_t> localIndex(input.numVertices, c_NotInMeshlet);
+    std::vector<uint32_t> candidateStamp(numTriangles, ~0u);
+    std::vector<uint32_t> candidates;
+
+    Meshlet meshlet;
+    float3 centroidSum = 0.f;
+    uint32_t nextInOrder = 0;
+
+    auto finishMeshlet = [&]()
+    {
+        if (meshlet.triangleCount == 0)
+            return;
+
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+            localIndex[geometry.vertices[meshlet.vertexOffset + i]] = c_NotInMeshlet;
+
+        ComputeMeshletBounds(input, geometry, meshlet);
+        geometry.meshlets.push_back(meshlet);
+
+        meshlet = Meshlet();
+        meshlet.vertexOffset = uint32_t(geometry.vertices.size());
+        meshlet.triangleOffset = uint32_t(geometry.triangles.size());
+        centroidSum = 0.f;
+    };
+
+    auto countNewVertices = [&](uint32_t triangle)
+    {
+        const uint32_t* corners = input.indices + triangle * 3;
+        return uint32_t(localIndex[corners[0]] == c_NotInMeshlet)
+            + uint32_t(localIndex[corners[1]] == c_NotInMeshlet)
+            + uint32_t(localIndex[corners[2]] == c_NotInMeshlet);
+    };
+
+    auto addTriangle = [&](uint32_t triangle)
+    {
+        const uint32_t* corners = input.indices + triangle * 3;
+        uint32_t packed = 0;
+
+        for (uint32_t corner = 0; corner < 3; corner++)
+        {
+            const uint32_t vertex = corners[corner];
+            if (localIndex[vertex] == c_NotInMeshlet)
+            {
+                localIndex[vertex] = uint8_t(meshlet.vertexCount++);
+                geometry.vertices.push_back(vertex);
+
+                // Triangles around a new vertex become candidates for growing the meshlet
+                for (uint32_t i = adjacencyOffsets[vertex]; i < adjacencyOffsets[vertex + 1]; i++)
+                {
+                    const uint32_t neighbor = adjacency[i];
+                    const uint32_t stamp = uint32_t(geometry.meshlets.size());
+                    if (!emitted[neighbor] && candidateStamp[neighbor] != stamp)
+                    {
+                        candidateStamp[neighbor] = stamp;
+                        candidates.push_back(neighbor);
+                    }
+                }
+            }
+
+            --liveTriangles[vertex];
+            packed |= uint32_t(localIndex[vertex]) << (corner * 8);
+        }
+
+        geometry.triangles.push_back(packed);
+        ++meshlet.triangleCount;
+        centroidSum += centroids[triangle];
+
+        emitted[triangle] = 1;
+        ++numEmitted;
+    };
+
+    while (numEmitted < numTriangles)
+    {
+        uint32_t best = c_InvalidTriangle;
+
+        if (meshlet.triangleCount > 0)
+        {
+            // Grow the meshlet with the adjacent triangle that adds the fewest vertices, then the closest one
+            const float3 center = centroidSum / float(meshlet.triangleCount);
+            uint32_t bestNewVertices = 4;
+            float bestDistance = std::numeric_limits<float>::max();
+
+            size_t kept = 0;
+            for (uint32_t candidate : candidates)
+            {
+                if (emitted[candidate])
+                    continue;
+                candidates[kept++] = candidate;
+
+                const uint32_t newVertices = countNewVertices(candidate);
+                if (meshlet.vertexCount + newVertices > c_MaxMeshletVertices)
+                    continue;
+
+                const float distance = lengthSquared(centroids[candidate] - center);
+                if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance))
+                {
+                    best = candidate;
+                    bestNewVertices = newVertices;
+                    bestDistance = distance;
+                }
+            }
+            candidates.resize(kept);
+
+            if (best == c_InvalidTriangle && candidates.empty())
+            {
+                // The connected piece of the mesh is used up, continue with the next triangle in index order
+                // if it fits, so that small disconnected pieces don't end up in nearly empty meshlets
+                while (emitted[nextInOrder])
+                    ++nextInOrder;
+
+                if (meshlet.vertexCount + countNewVertices(nextInOrder) <= c_MaxMeshletVertices)
+                    best = nextInOrder;
+            }
+        }
+
+        if (best == c_InvalidTriangle)
+        {
+            // Start a new meshlet. The seed is the remaining neighbor of the previous meshlet with the fewest live
+            // triangles around it, which continues along the border instead of leaving isolated triangles behind.
+            uint32_t seed = c_InvalidTriangle;
+            uint32_t seedLiveTriangles = ~0u;
+            for (uint32_t candidate : candidates)
+            {
+                if (emitted[candidate])
+                    continue;
+
+                const uint32_t* corners = input.indices + candidate * 3;
+                const uint32_t live = liveTriangles[corners[0]] + liveTriangles[corners[1]] + liveTriangles[corners[2]];
+                if (live < seedLiveTriangles)
+                {
+                    seed = candidate;
+                    seedLiveTriangles = live;
+                }
+            }
+
+            finishMeshlet();
+            candidates.clear();
+
+            if (seed == c_InvalidTriangle)
+            {
+                while (emitted[nextInOrder])
+                    ++nextInOrder;
+                seed = nextInOrder;
+            }
+
+            best = seed;
+        }
+
+        addTriangle(best);
+
+        if (meshlet.triangleCount == c_MaxMeshletTriangles)
+        {
+            finishMeshlet();
+            candidates.clear();
+        }
+    }
+
+    finishMeshlet();
+
+    return geometry;
+}
+
+std::vector<MeshletGeometry> BuildMeshletsParallel(const std::vector<MeshletBuildInput>& inputs, uint32_t numThreads,
+    MeshletBuildStatistics* statistics)
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::max(1u, std::min(numThreads, uint32_t(inputs.size())));
+
+    // Largest geometries first, so that one big mesh doesn't start last and keep a single thread busy at the end
+    std::vector<size_t> order(inputs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&inputs](size_t a, size_t b) { return inputs[a].numIndices > inputs[b].numIndices; });
+
+    std::vector<MeshletGeometry> results(inputs.size());
+    std::atomic<size_t> nextJob{ 0 };
+
+    auto worker = [&]()
+    {
+        for (size_t job = nextJob++; job < order.size(); job = nextJob++)
+            results[order[job]] = BuildMeshlets(inputs[order[job]]);
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < numThreads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    if (statistics)
+    {
+        *statistics = MeshletBuildStatistics();
+        statistics->numGeometries = inputs.size();
+        statistics->numThreads = numThreads;
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            statistics->numTriangles += inputs[i].numIndices / 3;
+            statistics->numMeshlets += results[i].meshlets.size();
+            statistics->numMeshletVertices += results[i].vertices.size();
+        }
+        statistics->buildTimeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    }
+
+    return results;
+}
+
+void LogMeshletStatistics(const MeshletBuildStatistics& statistics)
+{
+    const double numMeshlets = double(std::max<size_t>(statistics.numMeshlets, 1));
+    const double trianglesPerMeshlet = double(statistics.numTriangles) / numMeshlets;
+    const double verticesPerMeshlet = double(statistics.numMeshletVertices) / numMeshlets;
+
+    log::info("Built %zu meshlets for %zu geometries (%zu triangles) in %.2f ms on %u threads",
+        statistics.numMeshlets, statistics.numGeometries, statistics.numTriangles,
+        statistics.buildTimeSeconds * 1e3, statistics.numThreads);
+
+    log::info("Meshlet fill: %.1f triangles (%.0f%%) and %.1f vertices (%.0f%%) per meshlet on average",
+        trianglesPerMeshlet, 100.0 * trianglesPerMeshlet / c_MaxMeshletTriangles,
+        verticesPerMeshlet, 100.0 * verticesPerMeshlet / c_MaxMeshletVertices);
+}
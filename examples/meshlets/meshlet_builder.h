@@ -0,0 +1,81 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <vector>
+
+// Splits indexed triangle lists into meshlets of up to c_MaxMeshletVertices vertices and c_MaxMeshletTriangles triangles.
+// Meshlets are grown greedily from a seed triangle: the next triangle is the one that adds the fewest new vertices,
+// and among those the one closest to the meshlet's center, which keeps meshlets compact and their bounds tight.
+// Vertices are stored in the order they are first used by the triangles, so the vertex fetches of a meshlet are local.
+
+static const uint32_t c_MaxMeshletVertices = 64;
+static const uint32_t c_MaxMeshletTriangles = 124;
+
+struct Meshlet
+{
+    uint32_t vertexOffset = 0;      // first entry in MeshletGeometry::vertices
+    uint32_t triangleOffset = 0;    // first entry in MeshletGeometry::triangles
+    uint32_t vertexCount = 0;
+    uint32_t triangleCount = 0;
+
+    donut::math::float3 center = 0.f;   // bounding sphere
+    float radius = 0.f;
+    donut::math::float3 coneAxis = 0.f; // average normal of the triangles
+    float coneCutoff = 1.f;             // sine of the normal cone's half angle, 1 if the cone is too wide to be useful
+};
+
+struct MeshletGeometry
+{
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices;     // vertex index in the source geometry for every meshlet vertex
+    std::vector<uint32_t> triangles;    // three meshlet-local vertex indices per triangle, 8 bits each
+};
+
+struct MeshletBuildInput
+{
+    const donut::math::float3* positions = nullptr;
+    uint32_t numVertices = 0;
+    const uint32_t* indices = nullptr;  // relative to positions
+    uint32_t numIndices = 0;
+};
+
+struct MeshletBuildStatistics
+{
+    size_t numGeometries = 0;
+    size_t numTriangles = 0;
+    size_t numMeshlets = 0;
+    size_t numMeshletVertices = 0;      // vertices shared by several meshlets are counted once per meshlet
+    uint32_t numThreads = 0;
+    double buildTimeSeconds = 0.0;
+};
+
+MeshletGeometry BuildMeshlets(const MeshletBuildInput& input);
+
+// Builds the meshlets of many geometries, distributing them over numThreads threads, 0 meaning one per core
+std::vector<MeshletGeometry> BuildMeshletsParallel(const std::vector<MeshletBuildInput>& inputs, uint32_t numThreads,
+    MeshletBuildStatistics* statistics = nullptr);
+
+void LogMeshletStatistics(const MeshletBuildStatistics& statistics);
@@ -0,0 +1,69 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef MESHLET_CB_H
+#define MESHLET_CB_H
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// Each amplification shader thread handles one meshlet, each mesh shader thread one vertex and one triangle
+#define MESHLET_AS_GROUP_SIZE 32
+#define MESHLET_MS_GROUP_SIZE 128
+
+// GPU layout of Meshlet from meshlet_builder.h
+struct MeshletInfo
+{
+    uint vertexOffset;      // first entry in the meshlet vertex buffer
+    uint triangleOffset;    // first entry in the meshlet triangle buffer
+    uint vertexCount;
+    uint triangleCount;
+
+    float4 boundingSphere;  // object space center and radius
+    float4 normalCone;      // object space axis and cutoff, the sine of the cone's half angle. Cutoff 1 means no cone.
+};
+
+// Push constants of one dispatchMesh call, which covers the meshlets of one geometry of one instance
+struct MeshletDrawConstants
+{
+    uint instanceIndex;
+    uint firstMeshlet;
+    uint meshletCount;
+    uint colorMeshlets;     // tint every meshlet with its own color
+};
+
+// View parameters of the meshlet culling in main_as, see MeshletCullingView in culling_reference.h
+struct MeshletCullingConstants
+{
+    float4 frustumPlanes[6];    // world space normal and distance, a point is outside if dot(normal, p) > distance
+    float3 viewOrigin;
+    float pixelScale;           // viewport height / (2 * tan(vertical fov / 2))
+    float3 viewDirection;
+    float minPixelDiameter;
+    uint enableFrustumCulling;
+    uint enableConeCulling;
+    uint enableSmallMeshletCulling;
+    uint padding;
+};
+
+#endif // MESHLET_CB_H
@@ -20,99 +20,669 @@
 * DEALINGS IN THE SOFTWARE.
 */
 
+
 #include <donut/app/ApplicationBase.h>
+#include <donut/app/Camera.h>
 #include <donut/engine/ShaderFactory.h>
+#include <donut/engine/CommonRenderPasses.h>
+#include <donut/engine/TextureCache.h>
+#include <donut/engine/Scene.h>
+#include <donut/engine/BindingCache.h>
+#include <donut/engine/View.h>
 #include <donut/app/DeviceManager.h>
 #include <donut/core/log.h>
 #include <donut/core/vfs/VFS.h>
+#include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <unordered_map>
+
+#include "meshlet_builder.h"
+#include "culling_reference.h"
+#include "pipeline_cache.h"
 
 using namespace donut;
+using namespace donut::math;
+
+#include <donut/shaders/view_cb.h>
+#include "meshlet_cb.h"
 
 static const char* g_WindowTitle = "Donut Example: Meshlets";
 
-class MeshletExample : public app::IRenderPass
+static const float c_VerticalFov = dm::PI_f * 0.25f;
+
+// Meshlets whose bounding sphere looks smaller than this many pixels across are not drawn
+static const float c_MinPixelDiameter = 1.f;
+
+static_assert(c_MaxMeshletVertices == MESHLET_MAX_VERTICES, "meshlet_builder.h and meshlet_cb.h disagree on the meshlet size");
+static_assert(c_MaxMeshletTriangles == MESHLET_MAX_TRIANGLES, "meshlet_builder.h and meshlet_cb.h disagree on the meshlet size");
+static_assert(MESHLET_MS_GROUP_SIZE >= MESHLET_MAX_VERTICES && MESHLET_MS_GROUP_SIZE >= MESHLET_MAX_TRIANGLES, "main_ms writes one vertex and one triangle per thread");
+
+class MeshletExample : public app::ApplicationBase
 {
 private:
+    std::shared_ptr<vfs::RootFileSystem> m_RootFS;
+    std::shared_ptr<engine::ShaderFactory> m_ShaderFactory;
+    std::unique_ptr<engine::Scene> m_Scene;
+    std::unique_ptr<engine::BindingCache> m_BindingCache;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
+
     nvrhi::ShaderHandle m_AmplificationShader;
     nvrhi::ShaderHandle m_MeshShader;
     nvrhi::ShaderHandle m_PixelShader;
+    nvrhi::BindingLayoutHandle m_BindingLayout;
+    nvrhi::BindingSetHandle m_BindingSet;
     nvrhi::MeshletPipelineHandle m_Pipeline;
+    nvrhi::FramebufferInfo m_PipelineFramebufferInfo;
     nvrhi::CommandListHandle m_CommandList;
+    nvrhi::BufferHandle m_ViewConstants;
+    nvrhi::BufferHandle m_CullingConstants;
+
+    // Pipeline for a new framebuffer format that is being created on a worker thread.
+    // The current pipeline keeps rendering until the new one is ready and swapped in.
+    std::future<nvrhi::MeshletPipelineHandle> m_PendingPipeline;
+    nvrhi::FramebufferInfo m_PendingFramebufferInfo;
+    std::vector<std::future<nvrhi::MeshletPipelineHandle>> m_AbandonedPipelines;
+
+    // Meshlets of all scene geometries, see BuildSceneMeshlets
+    nvrhi::BufferHandle m_MeshletBuffer;
+    nvrhi::BufferHandle m_MeshletVertexBuffer;
+    nvrhi::BufferHandle m_MeshletTriangleBuffer;
+    nvrhi::BufferHandle m_PositionBuffer;
+    std::vector<Meshlet> m_CpuMeshlets;  // same order as m_MeshletBuffer, only the bounds are used by the culling reference
+    uint32_t m_NumMeshlets = 0;
+    bool m_ColorMeshlets = true;
+
+    bool m_EnableFrustumCulling = true;
+    bool m_EnableConeCulling = true;
+    bool m_EnableSmallMeshletCulling = true;
+
+    // Range of m_MeshletBuffer used by each geometry of a mesh, in mesh geometry order
+    struct MeshletRange
+    {
+        uint32_t firstMeshlet = 0;
+        uint32_t meshletCount = 0;
+    };
+    std::unordered_map<const engine::MeshInfo*, std::vector<MeshletRange>> m_MeshletRanges;
+
+    nvrhi::TextureHandle m_DepthBuffer;
+    nvrhi::TextureHandle m_ColorBuffer;
+    nvrhi::FramebufferHandle m_Framebuffer;
+
+    app::FirstPersonCamera m_Camera;
+    engine::PlanarView m_View;
+
+    // Pipelines only depend on the framebuffer formats, not on its size
+    static bool IsSameFramebufferFormat(const nvrhi::FramebufferInfo& a, const nvrhi::FramebufferInfo& b)
+    {
+        if (a.colorFormats.size() != b.colorFormats.size())
+            return false;
+
+        for (size_t i = 0; i < a.colorFormats.size(); i++)
+        {
+            if (a.colorFormats[i] != b.colorFormats[i])
+                return false;
+        }
+
+        return a.depthFormat == b.depthFormat && a.sampleCount == b.sampleCount && a.sampleQuality == b.sampleQuality;
+    }
+
+    void StartPipelineCreation(nvrhi::IFramebuffer* framebuffer)
+    {
+        nvrhi::MeshletPipelineDesc psoDesc;
+        psoDesc.AS = m_AmplificationShader;
+        psoDesc.MS = m_MeshShader;
+        psoDesc.PS = m_PixelShader;
+        psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
+        psoDesc.bindingLayouts = { m_BindingLayout };
+        psoDesc.renderState.depthStencilState.depthTestEnable = true;
+        psoDesc.renderState.depthStencilState.depthFunc = nvrhi::ComparisonFunc::GreaterOrEqual;
+        psoDesc.renderState.rasterState.frontCounterClockwise = true;
+        psoDesc.renderState.rasterState.setCullBack();
+
+        // The handle keeps the framebuffer alive until the worker is done with it. The pipeline cache is
+        // declared before the futures, so it outlives the workers.
+        ShaderPipelineCache* pipelineCache = m_PipelineCache.get();
+        nvrhi::FramebufferHandle framebufferHandle = framebuffer;
+
+        m_PendingFramebufferInfo = framebuffer->getFramebufferInfo();
+        m_PendingPipeline = std::async(std::launch::async, [pipelineCache, framebufferHandle, psoDesc]()
+        {
+            return pipelineCache->CreateMeshletPipeline(psoDesc, framebufferHandle);
+        });
+    }
+
+    void UpdatePipeline(nvrhi::IFramebuffer* framebuffer)
+    {
+        const nvrhi::FramebufferInfo& fbinfo = framebuffer->getFramebufferInfo();
+
+        const bool currentMatches = m_Pipeline && IsSameFramebufferFormat(m_PipelineFramebufferInfo, fbinfo);
+        const bool pendingMatches = m_PendingPipeline.valid() && IsSameFramebufferFormat(m_PendingFramebufferInfo, fbinfo);
+
+        if (!currentMatches && !pendingMatches)
+        {
+            // A build for a stale format is left to finish on its own, its result is dropped
+            if (m_PendingPipeline.valid())
+                m_AbandonedPipelines.push_back(std::move(m_PendingPipeline));
+
+            StartPipelineCreation(framebuffer);
+        }
+
+        m_AbandonedPipelines.erase(std::remove_if(m_AbandonedPipelines.begin(), m_AbandonedPipelines.end(),
+            [](const std::future<nvrhi::MeshletPipelineHandle>& pipeline) { return pipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }),
+            m_AbandonedPipelines.end());
+
+        if (m_PendingPipeline.valid() && m_PendingPipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            m_Pipeline = m_PendingPipeline.get();
+            m_PipelineFramebufferInfo = m_PendingFramebufferInfo;
+        }
+    }
+
+    void CreateRenderTargets(uint32_t width, uint32_t height)
+    {
+        nvrhi::TextureDesc textureDesc;
+        textureDesc.format = nvrhi::Format::SRGBA8_UNORM;
+        textureDesc.isRenderTarget = true;
+        textureDesc.initialState = nvrhi::ResourceStates::RenderTarget;
+        textureDesc.keepInitialState = true;
+        textureDesc.clearValue = nvrhi::Color(0.f);
+        textureDesc.useClearValue = true;
+        textureDesc.debugName = "ColorBuffer";
+        textureDesc.width = width;
+        textureDesc.height = height;
+        textureDesc.dimension = nvrhi::TextureDimension::Texture2D;
+        m_ColorBuffer = GetDevice()->createTexture(textureDesc);
+
+        textureDesc.format = nvrhi::Format::D32;
+        textureDesc.debugName = "DepthBuffer";
+        textureDesc.initialState = nvrhi::ResourceStates::DepthWrite;
+        m_DepthBuffer = GetDevice()->createTexture(textureDesc);
+
+        nvrhi::FramebufferDesc framebufferDesc;
+        framebufferDesc.addColorAttachment(m_ColorBuffer, nvrhi::AllSubresources);
+        framebufferDesc.setDepthAttachment(m_DepthBuffer);
+        m_Framebuffer = GetDevice()->createFramebuffer(framebufferDesc);
+    }
+
+    nvrhi::BufferHandle CreateMeshletDataBuffer(const void* data, size_t elementSize, size_t elementCount, const char* debugName, bool rawBuffer = false)
+    {
+        nvrhi::BufferDesc bufferDesc;
+        bufferDesc.byteSize = std::max<size_t>(elementSize * elementCount, elementSize);
+        bufferDesc.structStride = rawBuffer ? 0 : uint32_t(elementSize);
+        bufferDesc.canHaveRawViews = rawBuffer;
+        bufferDesc.debugName = debugName;
+        bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+        bufferDesc.keepInitialState = true;
+        nvrhi::BufferHandle buffer = GetDevice()->createBuffer(bufferDesc);
+
+        if (elementCount > 0)
+            m_CommandList->writeBuffer(buffer, data, elementSize * elementCount);
+
+        return buffer;
+    }
+
+    // Splits every geometry of the scene into meshlets on all CPU cores and uploads them.
+    // Meshlet vertices are indices into one position buffer that holds the vertices of all geometries.
+    void BuildSceneMeshlets()
+    {
+        std::vector<MeshletBuildInput> inputs;
+        std::vector<std::pair<const engine::MeshInfo*, size_t>> inputGeometries;
+
+        for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
+        {
+            // Skinned meshes are deformed on the GPU, their CPU positions are the bind pose or missing
+            if (!mesh->buffers || mesh->skinPrototype || mesh->buffers->hasAttribute(engine::VertexAttribute::JointWeights))
+                continue;
+
+            const auto& buffers = *mesh->buffers;
+            m_MeshletRanges[mesh.get()].resize(mesh->geometries.size());
+
+            for (size_t i = 0; i < mesh->geometries.size(); i++)
+            {
+                const auto& geometry = mesh->geometries[i];
+                const size_t indexOffset = size_t(mesh->indexOffset) + geometry->indexOffsetInMesh;
+                const size_t vertexOffset = size_t(mesh->vertexOffset) + geometry->vertexOffsetInMesh;
+
+                if (indexOffset + geometry->numIndices > buffers.indexData.size() || vertexOffset + geometry->numVertices > buffers.positionData.size())
+                {
+                    log::warning("Mesh '%s' has no CPU copy of its geometry, it will not be drawn", mesh->name.c_str());
+                    continue;
+                }
+
+                MeshletBuildInput input;
+                input.positions = buffers.positionData.data() + vertexOffset;
+                input.numVertices = geometry->numVertices;
+                input.indices = buffers.indexData.data() + indexOffset;
+                input.numIndices = geometry->numIndices;
+                inputs.push_back(input);
+                inputGeometries.push_back({ mesh.get(), i });
+            }
+        }
+
+        MeshletBuildStatistics stats;
+        std::vector<MeshletGeometry> results = BuildMeshletsParallel(inputs, 0, &stats);
+        LogMeshletStatistics(stats);
+
+        std::vector<MeshletInfo> meshlets;
+        std::vector<uint32_t> meshletVertices;
+        std::vector<uint32_t> meshletTriangles;
+        std::vector<float3> positions;
+
+        meshlets.reserve(stats.numMeshlets);
+        meshletVertices.reserve(stats.numMeshletVertices);
+        meshletTriangles.reserve(stats.numTriangles);
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const MeshletGeometry& result = results[i];
+            const uint32_t positionBase = uint32_t(positions.size());
+            const uint32_t vertexBase = uint32_t(meshletVertices.size());
+            const uint32_t triangleBase = uint32_t(meshletTriangles.size());
+
+            MeshletRange& range = m_MeshletRanges[inputGeometries[i].first][inputGeometries[i].second];
+            range.firstMeshlet = uint32_t(meshlets.size());
+            range.meshletCount = uint32_t(result.meshlets.size());
+
+            for (const Meshlet& meshlet : result.meshlets)
+            {
+                MeshletInfo info;
+                info.vertexOffset = vertexBase + meshlet.vertexOffset;
+                info.triangleOffset = triangleBase + meshlet.triangleOffset;
+                info.vertexCount = meshlet.vertexCount;
+                info.triangleCount = meshlet.triangleCount;
+                info.boundingSphere = float4(meshlet.center, meshlet.radius);
+                info.normalCone = float4(meshlet.coneAxis, meshlet.coneCutoff);
+                meshlets.push_back(info);
+
+                m_CpuMeshlets.push_back(meshlet);
+            }
+
+            for (uint32_t vertex : result.vertices)
+                meshletVertices.push_back(positionBase + vertex);
+
+            meshletTriangles.insert(meshletTriangles.end(), result.triangles.begin(), result.triangles.end());
+            positions.insert(positions.end(), inputs[i].positions, inputs[i].positions + inputs[i].numVertices);
+        }
+
+        m_NumMeshlets = uint32_t(meshlets.size());
+
+        m_CommandList->open();
+        m_MeshletBuffer = CreateMeshletDataBuffer(meshlets.data(), sizeof(MeshletInfo), meshlets.size(), "Meshlets");
+        m_MeshletVertexBuffer = CreateMeshletDataBuffer(meshletVertices.data(), sizeof(uint32_t), meshletVertices.size(), "MeshletVertices");
+        m_MeshletTriangleBuffer = CreateMeshletDataBuffer(meshletTriangles.data(), sizeof(uint32_t), meshletTriangles.size(), "MeshletTriangles");
+        m_PositionBuffer = CreateMeshletDataBuffer(positions.data(), sizeof(float3), positions.size(), "MeshletPositions", true);
+        m_CommandList->close();
+        GetDevice()->executeCommandList(m_CommandList);
+    }
+
+    MeshletCullingView GetCullingView() const
+    {
+        MeshletCullingView cullingView;
+
+        const frustum viewFrustum = m_View.GetViewFrustum();
+        for (size_t i = 0; i < std::size(cullingView.frustumPlanes); i++)
+        {
+            const plane& p = viewFrustum.planes[i];
+
+            // Skip degenerate planes, such as the far plane of an infinite projection
+            const bool degenerate = p.normal.x == 0.f && p.normal.y == 0.f && p.normal.z == 0.f;
+            cullingView.frustumPlanes[i] = degenerate ? float4(0.f) : float4(p.normal, p.distance);
+        }
+
+        cullingView.viewOrigin = m_View.GetViewOrigin();
+        cullingView.viewDirection = m_View.GetViewDirection();
+        cullingView.pixelScale = float(m_View.GetViewExtent().height()) * 0.5f / tanf(c_VerticalFov * 0.5f);
+        cullingView.minPixelDiameter = c_MinPixelDiameter;
+        cullingView.enableFrustumCulling = m_EnableFrustumCulling;
+        cullingView.enableConeCulling = m_EnableConeCulling;
+        cullingView.enableSmallMeshletCulling = m_EnableSmallMeshletCulling;
+        return cullingView;
+    }
+
+    // Runs the CPU implementation of the amplification shader culling on the current view and logs how many
+    // meshlets each test removes
+    void RunCullingReference()
+    {
+        std::vector<MeshletCullingDraw> draws;
+        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        {
+            auto ranges = m_MeshletRanges.find(instance->GetMesh().get());
+            if (ranges == m_MeshletRanges.end())
+                continue;
+
+            for (const MeshletRange& range : ranges->second)
+                draws.push_back({ instance->GetNode()->GetLocalToWorldTransformFloat(), range.firstMeshlet, range.meshletCount });
+        }
+
+        MeshletCullingStatistics stats;
+        CullMeshletsReference(m_CpuMeshlets, draws, GetCullingView(), &stats);
+
+        const double tested = double(std::max(stats.tested, 1u));
+        log::info("Meshlet culling reference: %u meshlets tested, %u outside the frustum (%.1f%%), %u back-facing (%.1f%%), "
+            "%u smaller than %.1f pixels (%.1f%%), %u visible (%.1f%%)",
+            stats.tested,
+            stats.frustumCulled, 100.0 * stats.frustumCulled / tested,
+            stats.coneCulled, 100.0 * stats.coneCulled / tested,
+            stats.smallCulled, c_MinPixelDiameter, 100.0 * stats.smallCulled / tested,
+            stats.visible, 100.0 * stats.visible / tested);
+    }
 
 public:
-    using IRenderPass::IRenderPass;
+    using ApplicationBase::ApplicationBase;
 
     bool Init()
     {
-        auto nativeFS = std::make_shared<vfs::NativeFileSystem>();
-
+        std::filesystem::path sceneFileName = app::GetDirectoryWithExecutable().parent_path() / "media/glTF-Sample-Models/2.0/Sponza/glTF/Sponza.gltf";
+        std::filesystem::path frameworkShaderPath = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
         std::filesystem::path appShaderPath = app::GetDirectoryWithExecutable() / "shaders/meshlets" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
 
-        engine::ShaderFactory shaderFactory(GetDevice(), nativeFS, appShaderPath);
-        m_AmplificationShader = shaderFactory.CreateShader("shaders.hlsl", "main_as", nullptr, nvrhi::ShaderType::Amplification);
-        m_MeshShader = shaderFactory.CreateShader("shaders.hlsl", "main_ms", nullptr, nvrhi::ShaderType::Mesh);
-        m_PixelShader = shaderFactory.CreateShader("shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
+        m_RootFS = std::make_shared<vfs::RootFileSystem>();
+        m_RootFS->mount("/shaders/donut", frameworkShaderPath);
+        m_RootFS->mount("/shaders/app", appShaderPath);
+
+        m_ShaderFactory = std::make_shared<engine::ShaderFactory>(GetDevice(), m_RootFS, "/shaders");
+        m_CommonPasses = std::make_shared<engine::CommonRenderPasses>(GetDevice(), m_ShaderFactory);
+        m_BindingCache = std::make_unique<engine::BindingCache>(GetDevice());
+
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
+        m_AmplificationShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/shaders.hlsl", "main_as", nullptr, nvrhi::ShaderType::Amplification);
+        m_MeshShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/shaders.hlsl", "main_ms", nullptr, nvrhi::ShaderType::Mesh);
+        m_PixelShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
 
         if (!m_AmplificationShader || !m_MeshShader || !m_PixelShader)
         {
             return false;
         }
-        
+
+        auto nativeFS = std::make_shared<vfs::NativeFileSystem>();
+        m_TextureCache = std::make_shared<engine::TextureCache>(GetDevice(), nativeFS, nullptr);
+
         m_CommandList = GetDevice()->createCommandList();
 
+        SetAsynchronousLoadingEnabled(false);
+        BeginLoadingScene(nativeFS, sceneFileName);
+
+        if (!m_Scene)
+            return false;
+
+        m_Scene->FinishedLoading(GetFrameIndex());
+
+        m_Camera.LookAt(float3(0.f, 1.8f, 0.f), float3(1.f, 1.8f, 0.f));
+        m_Camera.SetMoveSpeed(3.f);
+
+        BuildSceneMeshlets();
+
+        m_ViewConstants = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(PlanarViewConstants), "ViewConstants", engine::c_MaxRenderPassConstantBufferVersions));
+        m_CullingConstants = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(MeshletCullingConstants), "MeshletCullingConstants", engine::c_MaxRenderPassConstantBufferVersions));
+
+        nvrhi::BindingSetDesc bindingSetDesc;
+        bindingSetDesc.bindings = {
+            nvrhi::BindingSetItem::ConstantBuffer(0, m_ViewConstants),
+            nvrhi::BindingSetItem::PushConstants(1, sizeof(MeshletDrawConstants)),
+            nvrhi::BindingSetItem::ConstantBuffer(2, m_CullingConstants),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene->GetInstanceBuffer()),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_MeshletBuffer),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(2, m_MeshletVertexBuffer),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_MeshletTriangleBuffer),
+            nvrhi::BindingSetItem::RawBuffer_SRV(4, m_PositionBuffer)
+        };
+        nvrhi::utils::CreateBindingSetAndLayout(GetDevice(), nvrhi::ShaderType::All, 0, bindingSetDesc, m_BindingLayout, m_BindingSet);
+
+        // Start compiling the pipeline right away so that it overlaps the rest of the startup
+        const nvrhi::FramebufferInfo& fbinfo = GetDeviceManager()->GetCurrentFramebuffer()->getFramebufferInfo();
+        CreateRenderTargets(fbinfo.width, fbinfo.height);
+        StartPipelineCreation(m_Framebuffer);
+
+        GetDevice()->waitForIdle();
+
         return true;
     }
-    
+
+    bool LoadScene(std::shared_ptr<vfs::IFileSystem> fs, const std::filesystem::path& sceneFileName) override
+    {
+        engine::Scene* scene = new engine::Scene(GetDevice(), *m_ShaderFactory, fs, m_TextureCache, nullptr, nullptr);
+
+        if (scene->Load(sceneFileName))
+        {
+            m_Scene = std::unique_ptr<engine::Scene>(scene);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool KeyboardUpdate(int key, int scancode, int action, int mods) override
+    {
+        if (key == GLFW_KEY_M && action == GLFW_PRESS)
+        {
+            m_ColorMeshlets = !m_ColorMeshlets;
+            return true;
+        }
+
+        if (key == GLFW_KEY_F && action == GLFW_PRESS)
+        {
+            m_EnableFrustumCulling = !m_EnableFrustumCulling;
+            return true;
+        }
+
+        if (key == GLFW_KEY_B && action == GLFW_PRESS)
+        {
+            m_EnableConeCulling = !m_EnableConeCulling;
+            return true;
+        }
+
+        if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        {
+            m_EnableSmallMeshletCulling = !m_EnableSmallMeshletCulling;
+            return true;
+        }
+
+        if (key == GLFW_KEY_V && action == GLFW_PRESS)
+        {
+            RunCullingReference();
+            return true;
+        }
+
+        m_Camera.KeyboardUpdate(key, scancode, action, mods);
+        return true;
+    }
+
+    bool MousePosUpdate(double xpos, double ypos) override
+    {
+        m_Camera.MousePosUpdate(xpos, ypos);
+        return true;
+    }
+
+    bool MouseButtonUpdate(int button, int action, int mods) override
+    {
+        m_Camera.MouseButtonUpdate(button, action, mods);
+        return true;
+    }
+
     void Animate(float fElapsedTimeSeconds) override
     {
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+        m_Camera.Animate(fElapsedTimeSeconds);
+
+        std::string extraInfo = "- " + std::to_string(m_NumMeshlets) + " meshlets, culling:";
+        if (m_EnableFrustumCulling)
+            extraInfo += " frustum";
+        if (m_EnableConeCulling)
+            extraInfo += " cone";
+        if (m_EnableSmallMeshletCulling)
+            extraInfo += " small";
+        if (!m_EnableFrustumCulling && !m_EnableConeCulling && !m_EnableSmallMeshletCulling)
+            extraInfo += " off";
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo.c_str());
     }
 
     void BackBufferResizing() override
-    { 
-        m_Pipeline = nullptr;
+    {
+        // The pipeline is checked against the framebuffer format in Render
+        // and only rebuilt, in the background, when the format changes
+        m_DepthBuffer = nullptr;
+        m_ColorBuffer = nullptr;
+        m_Framebuffer = nullptr;
+        m_BindingCache->Clear();
     }
 
     void Render(nvrhi::IFramebuffer* framebuffer) override
     {
-        if (!m_Pipeline)
-        {
-            nvrhi::MeshletPipelineDesc psoDesc;
-            psoDesc.AS = m_AmplificationShader;
-            psoDesc.MS = m_MeshShader;
-            psoDesc.PS = m_PixelShader;
-            psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
-            psoDesc.renderState.depthStencilState.depthTestEnable = false;
+        const auto& fbinfo = framebuffer->getFramebufferInfo();
 
-            m_Pipeline = GetDevice()->createMeshletPipeline(psoDesc, framebuffer);
-        }
+        if (!m_Framebuffer)
+            CreateRenderTargets(fbinfo.width, fbinfo.height);
+
+        UpdatePipeline(m_Framebuffer);
+
+        nvrhi::Viewport windowViewport(float(fbinfo.width), float(fbinfo.height));
+        m_View.SetViewport(windowViewport);
+        m_View.SetMatrices(m_Camera.GetWorldToViewMatrix(), perspProjD3DStyleReverse(c_VerticalFov, windowViewport.width() / windowViewport.height(), 0.1f));
+        m_View.UpdateCache();
 
         m_CommandList->open();
 
-        nvrhi::utils::ClearColorAttachment(m_CommandList, framebuffer, 0, nvrhi::Color(0.f));
+        m_Scene->Refresh(m_CommandList, GetFrameIndex());
+
+        m_CommandList->clearTextureFloat(m_ColorBuffer, nvrhi::AllSubresources, nvrhi::Color(0.f));
+        m_CommandList->clearDepthStencilTexture(m_DepthBuffer, nvrhi::AllSubresources, true, 0.f, true, 0);
+
+        // Until a pipeline for the current format is ready the frame is only cleared, instead of blocking on the compilation
+        if (m_Pipeline && IsSameFramebufferFormat(m_PipelineFramebufferInfo, m_Framebuffer->getFramebufferInfo()))
+        {
+            PlanarViewConstants viewConstants;
+            m_View.FillPlanarViewConstants(viewConstants);
+            m_CommandList->writeBuffer(m_ViewConstants, &viewConstants, sizeof(viewConstants));
+
+            const MeshletCullingView cullingView = GetCullingView();
+            MeshletCullingConstants cullingConstants = {};
+            for (size_t i = 0; i < std::size(cullingConstants.frustumPlanes); i++)
+                cullingConstants.frustumPlanes[i] = cullingView.frustumPlanes[i];
+            cullingConstants.viewOrigin = cullingView.viewOrigin;
+            cullingConstants.pixelScale = cullingView.pixelScale;
+            cullingConstants.viewDirection = cullingView.viewDirection;
+            cullingConstants.minPixelDiameter = cullingView.minPixelDiameter;
+            cullingConstants.enableFrustumCulling = cullingView.enableFrustumCulling ? 1 : 0;
+            cullingConstants.enableConeCulling = cullingView.enableConeCulling ? 1 : 0;
+            cullingConstants.enableSmallMeshletCulling = cullingView.enableSmallMeshletCulling ? 1 : 0;
+            m_CommandList->writeBuffer(m_CullingConstants, &cullingConstants, sizeof(cullingConstants));
+
+            nvrhi::MeshletState state;
+            state.pipeline = m_Pipeline;
+            state.framebuffer = m_Framebuffer;
+            state.bindings = { m_BindingSet };
+            state.viewport = m_View.GetViewportState();
+            m_CommandList->setMeshletState(state);
 
-        nvrhi::MeshletState state;
-        state.pipeline = m_Pipeline;
-        state.framebuffer = framebuffer;
-        state.viewport.addViewportAndScissorRect(framebuffer->getFramebufferInfo().getViewport());
+            // One amplification shader group per MESHLET_AS_GROUP_SIZE meshlets of every geometry instance,
+            // main_as culls the meshlets and launches mesh shader groups for the visible ones
+            for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+            {
+                auto ranges = m_MeshletRanges.find(instance->GetMesh().get());
+                if (ranges == m_MeshletRanges.end())
+                    continue;
 
-        m_CommandList->setMeshletState(state);
-        
-        m_CommandList->dispatchMesh(1);
+                for (const MeshletRange& range : ranges->second)
+                {
+                    if (range.meshletCount == 0)
+                        continue;
+
+                    MeshletDrawConstants constants = {};
+                    constants.instanceIndex = uint32_t(instance->GetInstanceIndex());
+                    constants.firstMeshlet = range.firstMeshlet;
+                    constants.meshletCount = range.meshletCount;
+                    constants.colorMeshlets = m_ColorMeshlets ? 1 : 0;
+                    m_CommandList->setPushConstants(&constants, sizeof(constants));
+
+                    m_CommandList->dispatchMesh((range.meshletCount + MESHLET_AS_GROUP_SIZE - 1) / MESHLET_AS_GROUP_SIZE);
+                }
+            }
+        }
+
+        m_CommonPasses->BlitTexture(m_CommandList, framebuffer, m_ColorBuffer, m_BindingCache.get());
 
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
     }
-
 };
 
+// Builds meshlets for a set of procedural meshes on one thread and on all cores and logs both timings.
+// This runs before any graphics device is created, so it works on machines without mesh shader support.
+static void RunMeshletBenchmark()
+{
+    std::vector<std::vector<float3>> positions;
+    std::vector<std::vector<uint32_t>> indices;
+
+    // Spheres of increasing tessellation, from a few hundred to half a million triangles
+    for (uint32_t segments = 16; segments <= 512; segments += 16)
+    {
+        const uint32_t rings = segments / 2;
+        std::vector<float3>& spherePositions = positions.emplace_back();
+        std::vector<uint32_t>& sphereIndices = indices.emplace_back();
+
+        for (uint32_t ring = 0; ring <= rings; ring++)
+        {
+            const float theta = dm::PI_f * float(ring) / float(rings);
+            for (uint32_t segment = 0; segment <= segments; segment++)
+            {
+                const float phi = 2.f * dm::PI_f * float(segment) / float(segments);
+                spherePositions.push_back(float3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)));
+            }
+        }
+
+        for (uint32_t ring = 0; ring < rings; ring++)
+        {
+            for (uint32_t segment = 0; segment < segments; segment++)
+            {
+                const uint32_t a = ring * (segments + 1) + segment;
+                const uint32_t b = a + segments + 1;
+                sphereIndices.insert(sphereIndices.end(), { a, a + 1, b, b, a + 1, b + 1 });
+            }
+        }
+    }
+
+    std::vector<MeshletBuildInput> inputs;
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        MeshletBuildInput input;
+        input.positions = positions[i].data();
+        input.numVertices = uint32_t(positions[i].size());
+        input.indices = indices[i].data();
+        input.numIndices = uint32_t(indices[i].size());
+        inputs.push_back(input);
+    }
+
+    MeshletBuildStatistics singleThreaded;
+    BuildMeshletsParallel(inputs, 1, &singleThreaded);
+    LogMeshletStatistics(singleThreaded);
+
+    MeshletBuildStatistics multiThreaded;
+    BuildMeshletsParallel(inputs, 0, &multiThreaded);
+    LogMeshletStatistics(multiThreaded);
+
+    log::info("Meshlet benchmark: %.1f M triangles/s on 1 thread, %.1f M triangles/s on %u threads (%.2fx)",
+        double(singleThreaded.numTriangles) / singleThreaded.buildTimeSeconds * 1e-6,
+        double(multiThreaded.numTriangles) / multiThreaded.buildTimeSeconds * 1e-6,
+        multiThreaded.numThreads, singleThreaded.buildTimeSeconds / multiThreaded.buildTimeSeconds);
+}
+
 #ifdef WIN32
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 #else
 int main(int __argc, const char** __argv)
 #endif
 {
+    for (int i = 1; i < __argc; i++)
+    {
+        if (strcmp(__argv[i], "-benchmark") == 0)
+        {
+            RunMeshletBenchmark();
+            return 0;
+        }
+    }
+
     nvrhi::GraphicsAPI api = app::GetGraphicsAPIFromCommandLine(__argc, __argv);
     app::DeviceManager* deviceManager = app::DeviceManager::Create(api);
 
@@ -20,65 +20,171 @@
 * DEALINGS IN THE SOFTWARE.
 */
 
-#define MAX_PRIMS_PER_MESHLET 1
-#define MAX_VERTICES_PER_MESHLET 3
 
-static const float2 g_positions[] = {
-	float2(-0.5, -0.5),
-	float2(0, 0.5),
-	float2(0.5, -0.5)
-};
+#pragma pack_matrix(row_major)
 
-static const float3 g_colors[] = {
-	float3(1, 0, 0),
-	float3(0, 1, 0),
-	float3(0, 0, 1)	
-};
+#include <donut/shaders/bindless.h>
+#include <donut/shaders/view_cb.h>
+#include "meshlet_cb.h"
+
+#ifdef SPIRV
+#define VK_PUSH_CONSTANT [[vk::push_constant]]
+#else
+#define VK_PUSH_CONSTANT
+#endif
+
+ConstantBuffer<PlanarViewConstants> g_View : register(b0);
+VK_PUSH_CONSTANT ConstantBuffer<MeshletDrawConstants> g_Draw : register(b1);
+ConstantBuffer<MeshletCullingConstants> g_Culling : register(b2);
+StructuredBuffer<InstanceData> t_InstanceData : register(t0);
+StructuredBuffer<MeshletInfo> t_Meshlets : register(t1);
+StructuredBuffer<uint> t_MeshletVertices : register(t2);
+StructuredBuffer<uint> t_MeshletTriangles : register(t3);
+ByteAddressBuffer t_Positions : register(t4);
 
 struct Payload
 {
-	int dummy;
+    uint meshletIndices[MESHLET_AS_GROUP_SIZE];
 };
 
 struct Vertex
 {
-	float4 pos : SV_Position;
-	float3 color : COLOR;
+    float4 pos : SV_Position;
+    float3 worldPos : WORLD_POSITION;
+    float3 color : COLOR;
 };
 
 groupshared Payload s_payload;
+groupshared uint s_meshletCount;
+
+// Same tests as CullMeshlet in culling_reference.cpp
+bool IsMeshletVisible(MeshletInfo meshlet, InstanceData instance)
+{
+    // The transform works on column vectors, so the images of the object space axes are its columns
+    float3x3 linearPart = (float3x3)instance.transform;
+    float3 scale = float3(
+        length(float3(linearPart[0][0], linearPart[1][0], linearPart[2][0])),
+        length(float3(linearPart[0][1], linearPart[1][1], linearPart[2][1])),
+        length(float3(linearPart[0][2], linearPart[1][2], linearPart[2][2])));
+    float maxScale = max(scale.x, max(scale.y, scale.z));
+    float minScale = min(scale.x, min(scale.y, scale.z));
+
+    float3 center = mul(instance.transform, float4(meshlet.boundingSphere.xyz, 1.0)).xyz;
+    float radius = meshlet.boundingSphere.w * maxScale;
+
+    if (g_Culling.enableFrustumCulling)
+    {
+        [unroll]
+        for (uint i = 0; i < 6; i++)
+        {
+            float4 plane = g_Culling.frustumPlanes[i];
+            if (dot(plane.xyz, center) - radius > plane.w)
+                return false;
+        }
+    }
+
+    // Non-uniform scaling changes the angles between the normals, the cone no longer bounds them
+    float coneCutoff = meshlet.normalCone.w;
+    if (g_Culling.enableConeCulling && coneCutoff < 1.0 && maxScale <= minScale * 1.01)
+    {
+        // Mirroring transforms flip the winding and with it the front faces
+        float3 axis = normalize(mul(linearPart, meshlet.normalCone.xyz)) * (determinant(linearPart) < 0.0 ? -1.0 : 1.0);
+
+        float3 toCenter = center - g_Culling.viewOrigin;
+        if (dot(toCenter, axis) >= coneCutoff * length(toCenter) + radius)
+            return false;
+    }
+
+    if (g_Culling.enableSmallMeshletCulling)
+    {
+        // Approximate size on screen, only for meshlets entirely in front of the camera
+        float depth = dot(center - g_Culling.viewOrigin, g_Culling.viewDirection);
+        if (depth > radius && 2.0 * radius * g_Culling.pixelScale < g_Culling.minPixelDiameter * depth)
+            return false;
+    }
+
+    return true;
+}
 
-[numthreads(1, 1, 1)]
+// Every amplification shader thread tests one meshlet of the draw, the visible ones are compacted into the payload
+// and only those are launched as mesh shader groups
+[numthreads(MESHLET_AS_GROUP_SIZE, 1, 1)]
 void main_as(
-	uint globalIdx : SV_DispatchThreadID)
+    uint groupThreadId : SV_GroupThreadID,
+    uint globalIdx : SV_DispatchThreadID)
+{
+    if (groupThreadId == 0)
+        s_meshletCount = 0;
+
+    GroupMemoryBarrierWithGroupSync();
+
+    if (globalIdx < g_Draw.meshletCount)
+    {
+        uint meshletIndex = g_Draw.firstMeshlet + globalIdx;
+
+        if (IsMeshletVisible(t_Meshlets[meshletIndex], t_InstanceData[g_Draw.instanceIndex]))
+        {
+            uint slot;
+            InterlockedAdd(s_meshletCount, 1, slot);
+            s_payload.meshletIndices[slot] = meshletIndex;
+        }
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    DispatchMesh(s_meshletCount, 1, 1, s_payload);
+}
+
+float3 MeshletColor(uint meshletIndex)
 {
-	s_payload.dummy = 0;
-	DispatchMesh(1, 1, 1, s_payload);
+    uint hash = meshletIndex * 0x9e3779b9u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return float3(hash & 0xff, (hash >> 8) & 0xff, (hash >> 16) & 0xff) / 255.0 * 0.7 + 0.3;
 }
 
-[numthreads(1,1,1)]
+[numthreads(MESHLET_MS_GROUP_SIZE, 1, 1)]
 [outputtopology("triangle")]
 void main_ms(
     uint threadId : SV_GroupThreadID,
+    uint groupId : SV_GroupID,
     in payload Payload i_payload,
-    out indices uint3 o_tris[MAX_PRIMS_PER_MESHLET],
-    out vertices Vertex o_verts[MAX_VERTICES_PER_MESHLET])
+    out indices uint3 o_tris[MESHLET_MAX_TRIANGLES],
+    out vertices Vertex o_verts[MESHLET_MAX_VERTICES])
 {
-    SetMeshOutputCounts(3, 1);
-    o_tris[0] = uint3(0, 1, 2);
+    uint meshletIndex = i_payload.meshletIndices[groupId];
+    MeshletInfo meshlet = t_Meshlets[meshletIndex];
+    InstanceData instance = t_InstanceData[g_Draw.instanceIndex];
+
+    SetMeshOutputCounts(meshlet.vertexCount, meshlet.triangleCount);
 
-    for (uint i = 0; i < 3; i++)
+    if (threadId < meshlet.vertexCount)
     {
-    	o_verts[i].pos = float4(g_positions[i], 0, 1);
-    	o_verts[i].color = g_colors[i];
+        uint vertexIndex = t_MeshletVertices[meshlet.vertexOffset + threadId];
+        float3 objectSpacePosition = asfloat(t_Positions.Load3(vertexIndex * 12));
+        float3 worldSpacePosition = mul(instance.transform, float4(objectSpacePosition, 1.0)).xyz;
+
+        o_verts[threadId].pos = mul(float4(worldSpacePosition, 1.0), g_View.matWorldToClip);
+        o_verts[threadId].worldPos = worldSpacePosition;
+        o_verts[threadId].color = g_Draw.colorMeshlets ? MeshletColor(meshletIndex) : 0.8;
     }
-}
 
+    if (threadId < meshlet.triangleCount)
+    {
+        uint packed = t_MeshletTriangles[meshlet.triangleOffset + threadId];
+        o_tris[threadId] = uint3(packed & 0xff, (packed >> 8) & 0xff, (packed >> 16) & 0xff);
+    }
+}
 
 void main_ps(
-	in Vertex i_vertex,
-	out float4 o_color : SV_Target0
-)
+    in Vertex i_vertex,
+    out float4 o_color : SV_Target0)
 {
-	o_color = float4(i_vertex.color, 1);
+    // There are no normals in the meshlet vertex data, the face normal is enough to show the shape
+    float3 normal = normalize(cross(ddy(i_vertex.worldPos), ddx(i_vertex.worldPos)));
+    float3 lightDirection = normalize(float3(0.3, 1.0, 0.2));
+    float lighting = abs(dot(normal, lightDirection)) * 0.8 + 0.2;
+
+    o_color = float4(i_vertex.color * lighting, 1);
 }
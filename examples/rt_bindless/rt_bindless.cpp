@@ -33,14 +33,28 @@
 #include <donut/core/vfs/VFS.h>
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
 
 using namespace donut;
 using namespace donut::math;
 
 #include "lighting_cb.h"
+#include "blas_build_scheduler.h"
+#include "pipeline_cache.h"
+#include "shader_permutations.h"
 
 static const char* g_WindowTitle = "Donut Example: Bindless Ray Tracing";
 
+static const uint32_t c_MaxTlasUpdatesBetweenRebuilds = 256;
+
+// Skinned BLAS'es are refit in place, and rebuilt when they have been refit this many times...
+static const uint32_t c_MaxSkinnedBlasUpdatesBetweenRebuilds = 60;
+// ...or when the bounds of their joints have grown by this factor in surface area since the last rebuild.
+static const float c_MaxSkinnedBlasAreaGrowth = 1.5f;
+
 class BindlessRayTracing : public app::ApplicationBase
 {
 private:
@@ -58,9 +72,32 @@ private:
 
     nvrhi::rt::AccelStructHandle m_TopLevelAS;
 
+    // Persistent TLAS instance array, kept in the same order as SceneGraph::GetMeshInstances(), and its copy
+    // on the GPU that the TLAS is built from. m_DirtyTlasInstances lists the instances whose nodes moved,
+    // collected from the scene graph before it is refreshed; only those are rewritten and uploaded.
+    std::vector<nvrhi::rt::InstanceDesc> m_TlasInstances;
+    nvrhi::BufferHandle m_TlasInstanceBuffer;
+    std::vector<uint32_t> m_DirtyTlasInstances;
+    bool m_TlasStructureDirty = true;
+    uint32_t m_TlasUpdatesSinceRebuild = 0;
+    size_t m_TlasRewrittenInstances = 0;
+    const char* m_TlasBuildMode = "";
+
+    struct SkinnedBlasState
+    {
+        bool built = false;
+        uint32_t updatesSinceRebuild = 0;
+        float referenceArea = 0.f; // surface area of the joint bounds when the BLAS was last rebuilt
+    };
+
+    std::unordered_map<const engine::MeshInfo*, SkinnedBlasState> m_SkinnedBlasStates;
+    uint32_t m_SkinnedBlasRefits = 0;
+    uint32_t m_SkinnedBlasRebuilds = 0;
+
     nvrhi::BufferHandle m_ConstantBuffer;
 
     std::shared_ptr<engine::ShaderFactory> m_ShaderFactory;
+    std::unique_ptr<ShaderPermutationManager> m_ShaderPermutations;
     std::shared_ptr<engine::DescriptorTableManager> m_DescriptorTable;
     std::unique_ptr<engine::Scene> m_Scene;
     nvrhi::TextureHandle m_ColorBuffer;
@@ -68,6 +105,7 @@ private:
     engine::PlanarView m_View;
     std::shared_ptr<engine::DirectionalLight> m_SunLight;
     std::unique_ptr<engine::BindingCache> m_BindingCache;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
 
     bool m_EnableAnimations = true;
     float m_WallclockTime = 0.f;
@@ -75,7 +113,7 @@ private:
 public:
     using ApplicationBase::ApplicationBase;
 
-    bool Init(bool useRayQuery)
+    bool Init(bool useRayQuery, uint64_t blasScratchBudget)
     {
         std::filesystem::path sceneFileName = app::GetDirectoryWithExecutable().parent_path() / "media/sponza-plus.scene.json";
         std::filesystem::path frameworkShaderPath = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
@@ -88,6 +126,10 @@ public:
 		m_ShaderFactory = std::make_shared<engine::ShaderFactory>(GetDevice(), m_RootFS, "/shaders");
 		m_CommonPasses = std::make_shared<engine::CommonRenderPasses>(GetDevice(), m_ShaderFactory);
         m_BindingCache = std::make_unique<engine::BindingCache>(GetDevice());
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
+
+        m_ShaderPermutations = std::make_unique<ShaderPermutationManager>(m_ShaderFactory, "app/");
+        m_ShaderPermutations->LoadConfig(app::GetDirectoryWithExecutable().parent_path() / "examples/rt_bindless/shaders.cfg");
 
         nvrhi::BindlessLayoutDesc bindlessLayoutDesc;
         bindlessLayoutDesc.visibility = nvrhi::ShaderType::All;
@@ -137,25 +179,18 @@ public:
 
         if (useRayQuery)
         {
-            if (!CreateComputePipeline(*m_ShaderFactory))
+            if (!CreateComputePipeline(*m_ShaderPermutations))
                 return false;
         }
         else
         {
-            if (!CreateRayTracingPipeline(*m_ShaderFactory))
+            if (!CreateRayTracingPipeline(*m_ShaderPermutations))
                 return false;
         }
 
         m_CommandList = GetDevice()->createCommandList();
 
-        m_CommandList->open();
-
-        CreateAccelStructs(m_CommandList);
-
-        m_CommandList->close();
-        GetDevice()->executeCommandList(m_CommandList);
-
-        GetDevice()->waitForIdle();
+        CreateAccelStructs(blasScratchBudget);
 
         return true;
     }
@@ -223,14 +258,16 @@ public:
             }
         }
 
-        const char* extraInfo = (m_RayPipeline != nullptr) ? "- using RayPipeline" : "- using RayQuery";
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo);
+        std::stringstream extraInfo;
+        extraInfo << ((m_RayPipeline != nullptr) ? "- using RayPipeline" : "- using RayQuery");
+        extraInfo << " - TLAS " << m_TlasBuildMode << " (" << m_TlasRewrittenInstances << " / " << m_TlasInstances.size() << " instances written)";
+        extraInfo << " - skinned BLAS: " << m_SkinnedBlasRefits << " refit, " << m_SkinnedBlasRebuilds << " rebuilt";
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo.str().c_str());
     }
 
-    bool CreateRayTracingPipeline(engine::ShaderFactory& shaderFactory)
+    bool CreateRayTracingPipeline(ShaderPermutationManager& shaderPermutations)
     {
-        std::vector<engine::ShaderMacro> defines = { { "USE_RAY_QUERY", "0" } };
-        m_ShaderLibrary = shaderFactory.CreateShaderLibrary("app/rt_bindless.hlsl", &defines);
+        m_ShaderLibrary = shaderPermutations.GetShaderLibrary("rt_bindless.hlsl", { { "USE_RAY_QUERY", "0" } });
 
         if (!m_ShaderLibrary)
             return false;
@@ -253,7 +290,7 @@ public:
 
         pipelineDesc.maxPayloadSize = sizeof(float) * 6;
 
-        m_RayPipeline = GetDevice()->createRayTracingPipeline(pipelineDesc);
+        m_RayPipeline = m_PipelineCache->CreateRayTracingPipeline(pipelineDesc);
 
         if (!m_RayPipeline)
             return false;
@@ -270,10 +307,9 @@ public:
         return true;
     }
 
-    bool CreateComputePipeline(engine::ShaderFactory& shaderFactory)
+    bool CreateComputePipeline(ShaderPermutationManager& shaderPermutations)
     {
-        std::vector<engine::ShaderMacro> defines = { { "USE_RAY_QUERY", "1" } };
-        m_ComputeShader = shaderFactory.CreateShader("app/rt_bindless.hlsl", "main", &defines, nvrhi::ShaderType::Compute);
+        m_ComputeShader = shaderPermutations.GetShader("rt_bindless.hlsl", "main", nvrhi::ShaderType::Compute, { { "USE_RAY_QUERY", "1" } });
 
         if (!m_ComputeShader)
             return false;
@@ -291,6 +327,16 @@ public:
         return true;
     }
 
+    // Logs which shaders.cfg permutations were used and writes them out as a pruned config next to the compiled shaders
+    void SaveShaderUsage() const
+    {
+        if (!m_ShaderPermutations)
+            return;
+
+        m_ShaderPermutations->LogStatistics();
+        m_ShaderPermutations->WriteUsedPermutations(app::GetDirectoryWithExecutable() / "shaders/rt_bindless/shaders.used.cfg");
+    }
+
     void GetMeshBlasDesc(engine::MeshInfo& mesh, nvrhi::rt::AccelStructDesc& blasDesc) const
     {
         blasDesc.isTopLevel = false;
@@ -316,10 +362,10 @@ public:
             blasDesc.bottomLevelGeometries.push_back(geometryDesc);
         }
 
-        // don't compact acceleration structures that are built per frame
+        // don't compact acceleration structures that are updated per frame, but allow refitting them
         if (mesh.skinPrototype != nullptr)
         {
-            blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace;
+            blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace | nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
         }
         else
         {
@@ -327,8 +373,10 @@ public:
         }
     }
 
-    void CreateAccelStructs(nvrhi::ICommandList* commandList)
+    void CreateAccelStructs(uint64_t blasScratchBudget)
     {
+        BlasBuildScheduler blasScheduler(GetDevice(), blasScratchBudget);
+
         for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
         {
             if (mesh->buffers->hasAttribute(engine::VertexAttribute::JointWeights))
@@ -338,23 +386,178 @@ public:
 
             GetMeshBlasDesc(*mesh, blasDesc);
 
-            nvrhi::rt::AccelStructHandle as = GetDevice()->createAccelStruct(blasDesc);
-
-            if (!mesh->skinPrototype)
-                nvrhi::utils::BuildBottomLevelAccelStruct(commandList, as, blasDesc);
-
-            mesh->accelStruct = as;
+            // skinned BLAS'es are built every frame in BuildTLAS
+            if (mesh->skinPrototype)
+                mesh->accelStruct = GetDevice()->createAccelStruct(blasDesc);
+            else
+                mesh->accelStruct = blasScheduler.Enqueue(blasDesc);
         }
 
+        blasScheduler.Execute();
+        blasScheduler.LogStatistics();
 
+        CreateTLAS(m_Scene->GetSceneGraph()->GetMeshInstances().size());
+    }
+
+    void CreateTLAS(size_t maxInstances)
+    {
         nvrhi::rt::AccelStructDesc tlasDesc;
         tlasDesc.isTopLevel = true;
-        tlasDesc.topLevelMaxInstances = m_Scene->GetSceneGraph()->GetMeshInstances().size();
+        tlasDesc.topLevelMaxInstances = maxInstances;
+        tlasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace | nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
+        tlasDesc.debugName = "TopLevelAS";
         m_TopLevelAS = GetDevice()->createAccelStruct(tlasDesc);
+
+        nvrhi::BufferDesc instanceBufferDesc;
+        instanceBufferDesc.byteSize = sizeof(nvrhi::rt::InstanceDesc) * std::max<size_t>(maxInstances, 1);
+        instanceBufferDesc.isAccelStructBuildInput = true;
+        instanceBufferDesc.initialState = nvrhi::ResourceStates::AccelStructBuildInput;
+        instanceBufferDesc.keepInitialState = true;
+        instanceBufferDesc.debugName = "TlasInstances";
+        m_TlasInstanceBuffer = GetDevice()->createBuffer(instanceBufferDesc);
+
+        // The binding set references the TLAS, so it has to be recreated together with it.
+        // This also runs after the static BLAS'es were compacted into new memory, and the structure flag
+        // makes the next BuildTLAS write every instance with the new BLAS addresses and rebuild the TLAS.
+        m_BindingSet = nullptr;
+        m_TlasStructureDirty = true;
     }
 
-    void BuildTLAS(nvrhi::ICommandList* commandList, uint32_t frameIndex) const
+    // Collects the mesh instances whose world transforms are about to change, from the dirty flags that
+    // SceneGraph::Refresh clears. Only the subgraphs that contain transform changes are visited.
+    void CollectDirtyTlasInstances()
     {
+        m_DirtyTlasInstances.clear();
+
+        const auto& root = m_Scene->GetSceneGraph()->GetRootNode();
+        if (!root)
+            return;
+
+        const uint32_t localTransformFlag = uint32_t(engine::SceneGraphNode::DirtyFlags::LocalTransform);
+        const uint32_t subgraphTransformsFlag = uint32_t(engine::SceneGraphNode::DirtyFlags::SubgraphTransforms);
+
+        engine::SceneGraphWalker walker(root.get());
+        while (walker)
+        {
+            const uint32_t flags = uint32_t(walker->GetDirtyFlags());
+
+            if (flags & localTransformFlag)
+            {
+                // The node moved, and everything below it moves along
+                for (engine::SceneGraphWalker subgraph(walker.Get()); subgraph; subgraph.Next(true))
+                {
+                    if (const auto* meshInstance = dynamic_cast<const engine::MeshInstance*>(subgraph->GetLeaf().get()))
+                        m_DirtyTlasInstances.push_back(uint32_t(meshInstance->GetInstanceIndex()));
+                }
+
+                walker.Next(false);
+            }
+            else
+            {
+                walker.Next((flags & subgraphTransformsFlag) != 0);
+            }
+        }
+    }
+
+    // Brings the persistent instance array and its GPU copy up to date with the scene graph: every instance after
+    // a structure change, otherwise only the dirty ones, uploaded as contiguous ranges of the instance buffer.
+    // Returns the number of instance descs that had to be written.
+    size_t UpdateTlasInstances(nvrhi::ICommandList* commandList)
+    {
+        const auto& meshInstances = m_Scene->GetSceneGraph()->GetMeshInstances();
+
+        if (m_TlasInstances.size() != meshInstances.size())
+        {
+            m_TlasInstances.resize(meshInstances.size());
+            m_TlasStructureDirty = true;
+        }
+
+        if (m_TlasStructureDirty)
+        {
+            m_DirtyTlasInstances.resize(meshInstances.size());
+            std::iota(m_DirtyTlasInstances.begin(), m_DirtyTlasInstances.end(), 0u);
+        }
+        else
+        {
+            // An instance appears more than once when both it and one of its parents moved
+            std::sort(m_DirtyTlasInstances.begin(), m_DirtyTlasInstances.end());
+            m_DirtyTlasInstances.erase(std::unique(m_DirtyTlasInstances.begin(), m_DirtyTlasInstances.end()), m_DirtyTlasInstances.end());
+        }
+
+        for (uint32_t index : m_DirtyTlasInstances)
+        {
+            const auto& instance = meshInstances[index];
+            auto node = instance->GetNode();
+            assert(node);
+
+            // The TLAS is built from the buffer, which holds BLAS addresses instead of handles
+            const auto& blas = instance->GetMesh()->accelStruct;
+            assert(blas);
+
+            nvrhi::rt::InstanceDesc& instanceDesc = m_TlasInstances[index];
+            instanceDesc = nvrhi::rt::InstanceDesc();
+            instanceDesc.blasDeviceAddress = blas->getDeviceAddress();
+            instanceDesc.instanceMask = 1;
+            instanceDesc.instanceID = instance->GetInstanceIndex();
+            dm::affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
+        }
+
+        for (size_t rangeStart = 0; rangeStart < m_DirtyTlasInstances.size(); )
+        {
+            size_t rangeEnd = rangeStart + 1;
+            while (rangeEnd < m_DirtyTlasInstances.size() && m_DirtyTlasInstances[rangeEnd] == m_DirtyTlasInstances[rangeEnd - 1] + 1)
+                ++rangeEnd;
+
+            const uint32_t firstInstance = m_DirtyTlasInstances[rangeStart];
+            commandList->writeBuffer(m_TlasInstanceBuffer, &m_TlasInstances[firstInstance],
+                (rangeEnd - rangeStart) * sizeof(nvrhi::rt::InstanceDesc), firstInstance * sizeof(nvrhi::rt::InstanceDesc));
+
+            rangeStart = rangeEnd;
+        }
+
+        const size_t rewrittenInstances = m_DirtyTlasInstances.size();
+        m_DirtyTlasInstances.clear();
+        return rewrittenInstances;
+    }
+
+    // Returns the surface area of the bounding box of the skeleton joints in the object space of the skinned mesh,
+    // which is cheap to compute on the CPU and tracks how far the skinned vertices have moved.
+    static float GetJointBoundsArea(const engine::SkinnedMeshInstance& skinnedInstance)
+    {
+        const dm::affine3 worldToObject = inverse(skinnedInstance.GetNode()->GetLocalToWorldTransformFloat());
+
+        box3 bounds = box3::empty();
+        for (const auto& joint : skinnedInstance.joints)
+        {
+            if (joint.node)
+                bounds |= worldToObject.transformPoint(joint.node->GetLocalToWorldTransformFloat().m_translation);
+        }
+
+        if (bounds.isempty())
+            return 0.f;
+
+        const float3 size = bounds.diagonal();
+        return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // Decides whether a skinned BLAS can be refit, or has to be rebuilt to keep its BVH quality.
+    bool ShouldRebuildSkinnedBlas(const engine::SkinnedMeshInstance& skinnedInstance, SkinnedBlasState& state) const
+    {
+        if (!state.built || state.updatesSinceRebuild >= c_MaxSkinnedBlasUpdatesBetweenRebuilds)
+            return true;
+
+        // Refitting keeps the tree topology of the last rebuild, so the boxes get looser as the pose moves away from it
+        const float area = GetJointBoundsArea(skinnedInstance);
+        return area > state.referenceArea * c_MaxSkinnedBlasAreaGrowth;
+    }
+
+    void BuildTLAS(nvrhi::ICommandList* commandList, uint32_t frameIndex)
+    {
+        std::vector<nvrhi::rt::IAccelStruct*> updatedSkinnedBlas;
+        bool skinnedBlasRebuilt = false;
+        m_SkinnedBlasRefits = 0;
+        m_SkinnedBlasRebuilds = 0;
+
         commandList->beginMarker("Skinned BLAS Updates");
 
         // Transition all the buffers to their necessary states before building the BLAS'es to allow BLAS batching
@@ -374,36 +577,78 @@ public:
             if (skinnedInstance->GetLastUpdateFrameIndex() < frameIndex)
                 continue;
             
+            const auto& mesh = skinnedInstance->GetMesh();
             nvrhi::rt::AccelStructDesc blasDesc;
-            GetMeshBlasDesc(*skinnedInstance->GetMesh(), blasDesc);
-            
-            nvrhi::utils::BuildBottomLevelAccelStruct(commandList, skinnedInstance->GetMesh()->accelStruct, blasDesc);
-        }
-        commandList->endMarker();
+            GetMeshBlasDesc(*mesh, blasDesc);
 
-        std::vector<nvrhi::rt::InstanceDesc> instances;
+            SkinnedBlasState& state = m_SkinnedBlasStates[mesh.get()];
 
-        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
-        {
-            nvrhi::rt::InstanceDesc instanceDesc;
-            instanceDesc.bottomLevelAS = instance->GetMesh()->accelStruct;
-            assert(instanceDesc.bottomLevelAS);
-            instanceDesc.instanceMask = 1;
-            instanceDesc.instanceID = instance->GetInstanceIndex();
+            if (ShouldRebuildSkinnedBlas(*skinnedInstance, state))
+            {
+                nvrhi::utils::BuildBottomLevelAccelStruct(commandList, mesh->accelStruct, blasDesc);
 
-            auto node = instance->GetNode();
-            assert(node);
-            dm::affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
+                state.built = true;
+                state.updatesSinceRebuild = 0;
+                state.referenceArea = GetJointBoundsArea(*skinnedInstance);
+                ++m_SkinnedBlasRebuilds;
+                skinnedBlasRebuilt = true;
+            }
+            else
+            {
+                commandList->buildBottomLevelAccelStruct(mesh->accelStruct,
+                    blasDesc.bottomLevelGeometries.data(), blasDesc.bottomLevelGeometries.size(),
+                    blasDesc.buildFlags | nvrhi::rt::AccelStructBuildFlags::PerformUpdate);
+
+                ++state.updatesSinceRebuild;
+                ++m_SkinnedBlasRefits;
+            }
 
-            instances.push_back(instanceDesc);
+            updatedSkinnedBlas.push_back(mesh->accelStruct);
         }
 
-        // Compact acceleration structures that are tagged for compaction and have finished executing the original build
-        commandList->compactBottomLevelAccelStructs();
+        // The TLAS is built from a buffer of BLAS addresses, so nvrhi cannot see which BLAS'es it reads:
+        // make the BLAS writes above visible to the TLAS build explicitly
+        for (nvrhi::rt::IAccelStruct* blas : updatedSkinnedBlas)
+            commandList->setAccelStructState(blas, nvrhi::ResourceStates::AccelStructBuildBlas);
+        commandList->commitBarriers();
 
-        commandList->beginMarker("TLAS Update");
-        commandList->buildTopLevelAccelStruct(m_TopLevelAS, instances.data(), instances.size());
         commandList->endMarker();
+
+        if (m_Scene->GetSceneGraph()->GetMeshInstances().size() > m_TopLevelAS->getDesc().topLevelMaxInstances)
+            CreateTLAS(m_Scene->GetSceneGraph()->GetMeshInstances().size());
+
+        m_TlasRewrittenInstances = UpdateTlasInstances(commandList);
+
+        // A refit only moves the bounds of an existing tree, so any BLAS that was rebuilt or compacted
+        // (compaction sets m_TlasStructureDirty through CreateTLAS) needs a full TLAS build.
+        // Refits also degrade the BVH quality over time, so rebuild the TLAS from scratch every now and then.
+        const bool fullRebuild = m_TlasStructureDirty || skinnedBlasRebuilt || m_TlasUpdatesSinceRebuild >= c_MaxTlasUpdatesBetweenRebuilds;
+
+        if (fullRebuild)
+        {
+            commandList->beginMarker("TLAS Build");
+            commandList->buildTopLevelAccelStructFromBuffer(m_TopLevelAS, m_TlasInstanceBuffer, 0, m_TlasInstances.size());
+            commandList->endMarker();
+
+            m_TlasStructureDirty = false;
+            m_TlasUpdatesSinceRebuild = 0;
+            m_TlasBuildMode = "rebuild";
+        }
+        else if (m_TlasRewrittenInstances != 0 || !updatedSkinnedBlas.empty())
+        {
+            // Only transforms or skinned BLAS contents changed: refit the existing TLAS in place
+            commandList->beginMarker("TLAS Update");
+            commandList->buildTopLevelAccelStructFromBuffer(m_TopLevelAS, m_TlasInstanceBuffer, 0, m_TlasInstances.size(),
+                nvrhi::rt::AccelStructBuildFlags::PerformUpdate);
+            commandList->endMarker();
+
+            ++m_TlasUpdatesSinceRebuild;
+            m_TlasBuildMode = "refit";
+        }
+        else
+        {
+            m_TlasBuildMode = "unchanged";
+        }
     }
 
 
@@ -428,7 +673,27 @@ public:
             desc.initialState = nvrhi::ResourceStates::UnorderedAccess;
             desc.debugName = "ColorBuffer";
             m_ColorBuffer = GetDevice()->createTexture(desc);
+            m_BindingSet = nullptr;
+        }
 
+        nvrhi::Viewport windowViewport(float(fbinfo.width), float(fbinfo.height));
+        m_View.SetViewport(windowViewport);
+        m_View.SetMatrices(m_Camera.GetWorldToViewMatrix(), perspProjD3DStyleReverse(dm::PI_f * 0.25f, windowViewport.width() / windowViewport.height(), 0.1f));
+        m_View.UpdateCache();
+
+        m_CommandList->open();
+
+        // Structure changes and moved nodes are only visible until the scene graph is refreshed
+        if (m_Scene->GetSceneGraph()->HasPendingStructureChanges())
+            m_TlasStructureDirty = true;
+        else
+            CollectDirtyTlasInstances();
+
+        m_Scene->Refresh(m_CommandList, GetFrameIndex());
+        BuildTLAS(m_CommandList, GetFrameIndex());
+
+        if (!m_BindingSet)
+        {
             nvrhi::BindingSetDesc bindingSetDesc;
             bindingSetDesc.bindings = {
                 nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
@@ -442,16 +707,6 @@ public:
 
             m_BindingSet = GetDevice()->createBindingSet(bindingSetDesc, m_BindingLayout);
         }
-
-        nvrhi::Viewport windowViewport(float(fbinfo.width), float(fbinfo.height));
-        m_View.SetViewport(windowViewport);
-        m_View.SetMatrices(m_Camera.GetWorldToViewMatrix(), perspProjD3DStyleReverse(dm::PI_f * 0.25f, windowViewport.width() / windowViewport.height(), 0.1f));
-        m_View.UpdateCache();
-
-        m_CommandList->open();
-
-        m_Scene->Refresh(m_CommandList, GetFrameIndex());
-        BuildTLAS(m_CommandList, GetFrameIndex());
         
         LightingConstants constants = {};
         constants.ambientColor = float4(0.05f);
@@ -504,12 +759,18 @@ int main(int __argc, const char** __argv)
     deviceParams.enableRayTracingExtensions = true;
 
     bool useRayQuery = false;
+    uint64_t blasScratchBudget = c_DefaultBlasScratchBudget;
     for (int i = 1; i < __argc; i++)
     {
         if (strcmp(__argv[i], "-rayQuery") == 0)
         {
             useRayQuery = true;
         }
+        else if (strcmp(__argv[i], "-blasScratchBudget") == 0)
+        {
+            if (!ParseBlasScratchBudget(i + 1 < __argc ? __argv[++i] : nullptr, blasScratchBudget))
+                return 1;
+        }
         else if (strcmp(__argv[i], "-debug") == 0)
         {
             deviceParams.enableDebugRuntime = true;
@@ -537,12 +798,14 @@ int main(int __argc, const char** __argv)
 
     {
         BindlessRayTracing example(deviceManager);
-        if (example.Init(useRayQuery))
+        if (example.Init(useRayQuery, blasScratchBudget))
         {
             deviceManager->AddRenderPassToBack(&example);
             deviceManager->RunMessageLoop();
             deviceManager->RemoveRenderPass(&example);
         }
+
+        example.SaveShaderUsage();
     }
     
     deviceManager->Shutdown();
@@ -0,0 +1,389 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "shader_permutations.h"
+
+#include <donut/core/log.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
+using namespace donut;
+
+static const char* GetProfileForShaderType(nvrhi::ShaderType shaderType)
+{
+    switch (shaderType)
+    {
+    case nvrhi::ShaderType::Vertex: return "vs";
+    case nvrhi::ShaderType::Hull: return "hs";
+    case nvrhi::ShaderType::Domain: return "ds";
+    case nvrhi::ShaderType::Geometry: return "gs";
+    case nvrhi::ShaderType::Pixel: return "ps";
+    case nvrhi::ShaderType::Compute: return "cs";
+    case nvrhi::ShaderType::Amplification: return "as";
+    case nvrhi::ShaderType::Mesh: return "ms";
+    default: return nullptr;
+    }
+}
+
+static void SortDefines(std::vector<engine::ShaderMacro>& defines)
+{
+    std::sort(defines.begin(), defines.end(), [](const engine::ShaderMacro& a, const engine::ShaderMacro& b)
+    {
+        return a.name < b.name;
+    });
+}
+
+std::string ShaderPermutation::GetKey() const
+{
+    std::string key = fileName + "|" + profile + "|" + entryName;
+    for (const auto& define : defines)
+        key += "|" + define.name + "=" + define.definition;
+    return key;
+}
+
+std::string ShaderPermutation::ToConfigLine() const
+{
+    std::string line = fileName + " -T " + profile;
+    if (!entryName.empty() && !IsLibrary())
+        line += " -E " + entryName;
+    for (const auto& define : defines)
+        line += " -D " + define.name + "=" + define.definition;
+    return line;
+}
+
+bool ShaderPermutationManager::ParseConfigLine(const std::string& line, std::vector<ShaderPermutation>& permutations)
+{
+    std::string content = line.substr(0, line.find('#'));
+    const size_t commentPos = content.find("//");
+    if (commentPos != std::string::npos)
+        content.resize(commentPos);
+
+    std::istringstream stream(content);
+    std::string token;
+
+    ShaderPermutation base;
+    if (!(stream >> base.fileName))
+        return true;
+
+    // Each define is a name with one or more values, the permutations are the cartesian product of all values
+    std::vector<std::pair<std::string, std::vector<std::string>>> defineValues;
+
+    while (stream >> token)
+    {
+        auto readArgument = [&stream, &token](size_t optionLength, std::string& argument)
+        {
+            if (token.size() > optionLength)
+                argument = token.substr(optionLength);
+            else if (!(stream >> argument))
+                return false;
+            return true;
+        };
+
+        if (token.compare(0, 2, "-T") == 0)
+        {
+            if (!readArgument(2, base.profile))
+                return false;
+            // Accept full shader models as well, e.g. "cs_6_5"
+            base.profile = base.profile.substr(0, base.profile.find('_'));
+        }
+        else if (token.compare(0, 2, "-E") == 0)
+        {
+            if (!readArgument(2, base.entryName))
+                return false;
+        }
+        else if (token.compare(0, 2, "-D") == 0)
+        {
+            std::string define;
+            if (!readArgument(2, define))
+                return false;
+
+            const size_t equalsPos = define.find('=');
+            std::string name = define.substr(0, equalsPos);
+            std::string value = equalsPos == std::string::npos ? "1" : define.substr(equalsPos + 1);
+            if (name.empty())
+                return false;
+
+            std::vector<std::string> values;
+            if (value.size() >= 2 && value.front() == '{' && value.back() == '}')
+            {
+                std::istringstream valueStream(value.substr(1, value.size() - 2));
+                std::string item;
+                while (std::getline(valueStream, item, ','))
+                    values.push_back(item);
+                if (values.empty())
+                    return false;
+            }
+            else
+                values.push_back(value);
+
+            defineValues.emplace_back(std::move(name), std::move(values));
+        }
+        // Other compiler options don't select a permutation and are ignored here
+    }
+
+    if (base.profile.empty())
+        return false;
+
+    if (base.IsLibrary())
+        base.entryName.clear();
+    else if (base.entryName.empty())
+        base.entryName = "main";
+
+    size_t numPermutations = 1;
+    for (const auto& define : defineValues)
+        numPermutations *= define.second.size();
+
+    for (size_t index = 0; index < numPermutations; index++)
+    {
+        ShaderPermutation permutation = base;
+        size_t remainder = index;
+        for (const auto& define : defineValues)
+        {
+            permutation.defines.emplace_back(define.first, define.second[remainder % define.second.size()]);
+            remainder /= define.second.size();
+        }
+        SortDefines(permutation.defines);
+        permutations.push_back(std::move(permutation));
+    }
+
+    return true;
+}
+
+ShaderPermutationManager::ShaderPermutationManager(std::shared_ptr<engine::ShaderFactory> shaderFactory, std::string shaderPathPrefix)
+    : m_ShaderFactory(std::move(shaderFactory))
+    , m_ShaderPathPrefix(std::move(shaderPathPrefix))
+{
+}
+
+bool ShaderPermutationManager::LoadConfig(const std::filesystem::path& configFileName)
+{
+    std::ifstream file(configFileName);
+    if (!file.is_open())
+    {
+        log::warning("Cannot open shader config '%s', all shader permutations will be reported as unlisted",
+            configFileName.generic_string().c_str());
+        return false;
+    }
+
+    std::lock_guard lock(m_Mutex);
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNumber;
+
+        std::vector<ShaderPermutation> permutations;
+        if (!ParseConfigLine(line, permutations))
+        {
+            log::warning("%s(%d): cannot parse shader permutation '%s'", configFileName.generic_string().c_str(), lineNumber, line.c_str());
+            continue;
+        }
+
+        for (auto& permutation : permutations)
+        {
+            Entry& entry = FindOrAddEntry(std::move(permutation));
+            if (!entry.permutation.listed)
+            {
+                entry.permutation.listed = true;
+                ++m_Statistics.numListed;
+            }
+        }
+    }
+
+    return true;
+}
+
+ShaderPermutationManager::Entry& ShaderPermutationManager::FindOrAddEntry(ShaderPermutation&& permutation)
+{
+    std::string key = permutation.GetKey();
+
+    auto it = m_Entries.find(key);
+    if (it != m_Entries.end())
+        return it->second;
+
+    m_Order.push_back(key);
+    Entry& entry = m_Entries[std::move(key)];
+    entry.permutation = std::move(permutation);
+    return entry;
+}
+
+nvrhi::ShaderHandle ShaderPermutationManager::GetShader(const std::string& fileName, const std::string& entryName,
+    nvrhi::ShaderType shaderType, const std::vector<engine::ShaderMacro>& defines)
+{
+    const char* profile = GetProfileForShaderType(shaderType);
+    if (!profile)
+    {
+        log::error("Shader permutations of type %d are not supported, use GetShaderLibrary for ray tracing shaders", int(shaderType));
+        return nullptr;
+    }
+
+    ShaderPermutation permutation;
+    permutation.fileName = fileName;
+    permutation.profile = profile;
+    permutation.entryName = entryName;
+    permutation.defines = defines;
+    SortDefines(permutation.defines);
+
+    std::lock_guard lock(m_Mutex);
+
+    Entry& entry = FindOrAddEntry(std::move(permutation));
+    ++entry.permutation.useCount;
+    ++m_Statistics.numRequests;
+
+    if (entry.created)
+        return entry.shader;
+
+    if (!entry.permutation.listed)
+    {
+        ++m_Statistics.numUnlisted;
+        log::warning("Shader permutation '%s' is not listed in shaders.cfg", entry.permutation.ToConfigLine().c_str());
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    const std::string path = m_ShaderPathPrefix + fileName;
+    entry.shader = m_ShaderFactory->CreateShader(path.c_str(), entryName.c_str(), &entry.permutation.defines, shaderType);
+    m_Statistics.createTimeSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    // Failed permutations are not retried, they would fail the same way on every request
+    entry.created = true;
+    if (entry.shader)
+        ++m_Statistics.numCreated;
+    else
+        ++m_Statistics.numFailed;
+
+    return entry.shader;
+}
+
+nvrhi::ShaderLibraryHandle ShaderPermutationManager::GetShaderLibrary(const std::string& fileName,
+    const std::vector<engine::ShaderMacro>& defines)
+{
+    ShaderPermutation permutation;
+    permutation.fileName = fileName;
+    permutation.profile = "lib";
+    permutation.defines = defines;
+    SortDefines(permutation.defines);
+
+    std::lock_guard lock(m_Mutex);
+
+    Entry& entry = FindOrAddEntry(std::move(permutation));
+    ++entry.permutation.useCount;
+    ++m_Statistics.numRequests;
+
+    if (entry.created)
+        return entry.library;
+
+    if (!entry.permutation.listed)
+    {
+        ++m_Statistics.numUnlisted;
+        log::warning("Shader permutation '%s' is not listed in shaders.cfg", entry.permutation.ToConfigLine().c_str());
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    const std::string path = m_ShaderPathPrefix + fileName;
+    entry.library = m_ShaderFactory->CreateShaderLibrary(path.c_str(), &entry.permutation.defines);
+    m_Statistics.createTimeSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    entry.created = true;
+    if (entry.library)
+        ++m_Statistics.numCreated;
+    else
+        ++m_Statistics.numFailed;
+
+    return entry.library;
+}
+
+bool ShaderPermutationManager::WriteUsedPermutations(const std::filesystem::path& fileName) const
+{
+    std::lock_guard lock(m_Mutex);
+
+    // Keep the permutations recorded by earlier runs, which may have used other modes and therefore
+    // other permutations, so that the file covers every run since it was last deleted
+    std::vector<ShaderPermutation> previousPermutations;
+    std::ifstream previousFile(fileName);
+    std::string line;
+    while (std::getline(previousFile, line))
+        ParseConfigLine(line, previousPermutations);
+    previousFile.close();
+
+    std::unordered_set<std::string> previousKeys;
+    for (const ShaderPermutation& permutation : previousPermutations)
+        previousKeys.insert(permutation.GetKey());
+
+    std::ofstream file(fileName, std::ios::trunc);
+    if (!file.is_open())
+    {
+        log::warning("Cannot write the used shader permutations to '%s'", fileName.generic_string().c_str());
+        return false;
+    }
+
+    for (const std::string& key : m_Order)
+    {
+        const ShaderPermutation& permutation = m_Entries.at(key).permutation;
+        if (permutation.useCount > 0 || previousKeys.count(key))
+            file << permutation.ToConfigLine() << "\n";
+    }
+
+    // Permutations from earlier runs that are no longer in the config and were not requested in this run
+    std::unordered_set<std::string> writtenKeys;
+    for (const ShaderPermutation& permutation : previousPermutations)
+    {
+        const std::string key = permutation.GetKey();
+        if (m_Entries.find(key) == m_Entries.end() && writtenKeys.insert(key).second)
+            file << permutation.ToConfigLine() << "\n";
+    }
+
+    return bool(file);
+}
+
+ShaderPermutationStatistics ShaderPermutationManager::GetStatistics() const
+{
+    std::lock_guard lock(m_Mutex);
+    return m_Statistics;
+}
+
+void ShaderPermutationManager::LogStatistics() const
+{
+    std::lock_guard lock(m_Mutex);
+
+    size_t numUsedListed = 0;
+    for (const auto& [key, entry] : m_Entries)
+    {
+        if (entry.permutation.listed && entry.permutation.useCount > 0)
+            ++numUsedListed;
+    }
+
+    log::info("Shader permutations: %zu of %zu listed permutations used, %zu requests, %zu created in %.2f ms, %zu failed, %zu unlisted",
+        numUsedListed, m_Statistics.numListed, m_Statistics.numRequests, m_Statistics.numCreated,
+        m_Statistics.createTimeSeconds * 1e3, m_Statistics.numFailed, m_Statistics.numUnlisted);
+
+    for (const std::string& key : m_Order)
+    {
+        const ShaderPermutation& permutation = m_Entries.at(key).permutation;
+        if (permutation.listed && permutation.useCount == 0)
+            log::info("Unused shader permutation: %s", permutation.ToConfigLine().c_str());
+    }
+}
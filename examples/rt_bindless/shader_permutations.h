@@ -0,0 +1,107 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/engine/ShaderFactory.h>
+#include <nvrhi/nvrhi.h>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Creates shader permutations on demand from the list in shaders.cfg. The config is parsed at runtime with the same
+// syntax as the offline compiler uses (file, -T profile, -E entry, -D NAME=VALUE, with {a,b} value lists expanding
+// into several permutations). Shaders are created from the compiled binaries only when a permutation is first
+// requested, requests for permutations that are not in the config are reported, and the permutations that were
+// actually used, accumulated over runs, can be written back out as a pruned shaders.cfg.
+
+struct ShaderPermutation
+{
+    std::string fileName;
+    std::string profile;    // "vs", "ps", "cs", "lib", ...
+    std::string entryName;  // empty for libraries
+    std::vector<donut::engine::ShaderMacro> defines; // sorted by name
+
+    bool listed = false;     // present in shaders.cfg
+    uint32_t useCount = 0;   // number of requests in this run
+
+    [[nodiscard]] bool IsLibrary() const { return profile == "lib"; }
+    [[nodiscard]] std::string GetKey() const;
+    [[nodiscard]] std::string ToConfigLine() const;
+};
+
+struct ShaderPermutationStatistics
+{
+    size_t numListed = 0;    // permutations in shaders.cfg, after expansion
+    size_t numRequests = 0;
+    size_t numCreated = 0;   // shaders and libraries created from binaries
+    size_t numFailed = 0;
+    size_t numUnlisted = 0;  // requests for permutations missing from shaders.cfg
+    double createTimeSeconds = 0.0;
+};
+
+class ShaderPermutationManager
+{
+public:
+    // Shader file names in requests and in the config are relative to shaderPathPrefix in the shader factory
+    ShaderPermutationManager(std::shared_ptr<donut::engine::ShaderFactory> shaderFactory, std::string shaderPathPrefix);
+
+    bool LoadConfig(const std::filesystem::path& configFileName);
+
+    nvrhi::ShaderHandle GetShader(const std::string& fileName, const std::string& entryName, nvrhi::ShaderType shaderType,
+        const std::vector<donut::engine::ShaderMacro>& defines = {});
+
+    nvrhi::ShaderLibraryHandle GetShaderLibrary(const std::string& fileName,
+        const std::vector<donut::engine::ShaderMacro>& defines = {});
+
+    // Writes the permutations requested in this run in shaders.cfg syntax, merged with the ones already in the file
+    // from earlier runs, so that runs in different modes (e.g. with and without -rayQuery) add up
+    bool WriteUsedPermutations(const std::filesystem::path& fileName) const;
+
+    [[nodiscard]] ShaderPermutationStatistics GetStatistics() const;
+    void LogStatistics() const;
+
+    // Parses one shaders.cfg line into its permutations. Returns false for malformed lines, empty lines and comments yield nothing.
+    static bool ParseConfigLine(const std::string& line, std::vector<ShaderPermutation>& permutations);
+
+private:
+    struct Entry
+    {
+        ShaderPermutation permutation;
+        nvrhi::ShaderHandle shader;
+        nvrhi::ShaderLibraryHandle library;
+        bool created = false;
+    };
+
+    std::shared_ptr<donut::engine::ShaderFactory> m_ShaderFactory;
+    std::string m_ShaderPathPrefix;
+    std::unordered_map<std::string, Entry> m_Entries;
+    std::vector<std::string> m_Order; // keys in config order, then in request order
+    ShaderPermutationStatistics m_Statistics;
+    mutable std::mutex m_Mutex;
+
+    Entry& FindOrAddEntry(ShaderPermutation&& permutation);
+};
@@ -41,6 +41,8 @@ using namespace donut;
 using namespace donut::math;
 
 #include "lighting_cb.h"
+#include "blas_build_scheduler.h"
+#include "pipeline_cache.h"
 
 static const char* g_WindowTitle = "Donut Example: Ray Traced Shadows";
 
@@ -160,11 +162,12 @@ private:
     std::shared_ptr<engine::DirectionalLight> m_SunLight;
     std::unique_ptr<render::InstancedOpaqueDrawStrategy> m_OpaqueDrawStrategy;
     std::unique_ptr<engine::BindingCache> m_BindingCache;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
 
 public:
     using ApplicationBase::ApplicationBase;
 
-    bool Init()
+    bool Init(uint64_t blasScratchBudget)
     {
         std::filesystem::path sceneFileName = app::GetDirectoryWithExecutable().parent_path() / "media/glTF-Sample-Models/2.0/Sponza/glTF/Sponza.gltf";
         std::filesystem::path frameworkShaderPath = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
@@ -199,19 +202,13 @@ public:
 
         m_ConstantBuffer = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(LightingConstants), "LightingConstants", engine::c_MaxRenderPassConstantBufferVersions));
 
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
         if (!CreateRayTracingPipeline(*m_ShaderFactory))
             return false;
 
         m_CommandList = GetDevice()->createCommandList();
 
-        m_CommandList->open();
-
-        CreateAccelStruct(m_CommandList);
-
-        m_CommandList->close();
-        GetDevice()->executeCommandList(m_CommandList);
-
-        GetDevice()->waitForIdle();
+        CreateAccelStruct(blasScratchBudget);
 
         return true;
     }
@@ -255,7 +252,7 @@ public:
 
     bool CreateRayTracingPipeline(engine::ShaderFactory& shaderFactory)
     {
-        m_ShaderLibrary = shaderFactory.CreateShaderLibrary("app/rt_shadows.hlsl", nullptr);
+        m_ShaderLibrary = m_PipelineCache->CreateShaderLibrary(shaderFactory, "app/rt_shadows.hlsl", nullptr);
 
         if (!m_ShaderLibrary)
             return false;
@@ -293,7 +290,7 @@ public:
 
         pipelineDesc.maxPayloadSize = sizeof(dm::float4);
 
-        m_Pipeline = GetDevice()->createRayTracingPipeline(pipelineDesc);
+        m_Pipeline = m_PipelineCache->CreateRayTracingPipeline(pipelineDesc);
 
         m_ShaderTable = m_Pipeline->createShaderTable();
         m_ShaderTable->setRayGenerationShader("RayGen");
@@ -303,12 +300,15 @@ public:
         return true;
     }
 
-    void CreateAccelStruct(nvrhi::ICommandList* commandList)
+    void CreateAccelStruct(uint64_t blasScratchBudget)
     {
+        BlasBuildScheduler blasScheduler(GetDevice(), blasScratchBudget);
+
         for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
         {
             nvrhi::rt::AccelStructDesc blasDesc;
             blasDesc.isTopLevel = false;
+            blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace | nvrhi::rt::AccelStructBuildFlags::AllowCompaction;
 
             for (const auto& geometry : mesh->geometries)
             {
@@ -328,13 +328,15 @@ public:
                 blasDesc.bottomLevelGeometries.push_back(geometryDesc);
             }
 
-            nvrhi::rt::AccelStructHandle as = GetDevice()->createAccelStruct(blasDesc);
-            nvrhi::utils::BuildBottomLevelAccelStruct(commandList, as, blasDesc);
+            nvrhi::rt::AccelStructHandle as = blasScheduler.Enqueue(blasDesc);
 
             m_MeshAccelStructs[mesh] = as;
         }
 
 
+        blasScheduler.Execute();
+        blasScheduler.LogStatistics();
+
         nvrhi::rt::AccelStructDesc tlasDesc;
         tlasDesc.isTopLevel = true;
 
@@ -356,7 +358,12 @@ public:
         tlasDesc.topLevelMaxInstances = instances.size();
 
         m_TopLevelAS = GetDevice()->createAccelStruct(tlasDesc);
-        commandList->buildTopLevelAccelStruct(m_TopLevelAS, instances.data(), instances.size());
+        m_CommandList->open();
+        m_CommandList->buildTopLevelAccelStruct(m_TopLevelAS, instances.data(), instances.size());
+        m_CommandList->close();
+        GetDevice()->executeCommandList(m_CommandList);
+
+        GetDevice()->waitForIdle();
         
     }
 
@@ -452,6 +459,16 @@ int main(int __argc, const char** __argv)
     deviceParams.enableNvrhiValidationLayer = true;
 #endif
 
+    uint64_t blasScratchBudget = c_DefaultBlasScratchBudget;
+    for (int i = 1; i < __argc; i++)
+    {
+        if (strcmp(__argv[i], "-blasScratchBudget") == 0)
+        {
+            if (!ParseBlasScratchBudget(i + 1 < __argc ? __argv[++i] : nullptr, blasScratchBudget))
+                return 1;
+        }
+    }
+
     if (!deviceManager->CreateWindowDeviceAndSwapChain(deviceParams, g_WindowTitle))
     {
         log::fatal("Cannot initialize a graphics device with the requested parameters");
@@ -466,7 +483,7 @@ int main(int __argc, const char** __argv)
 
     {
         RayTracedShadows example(deviceManager);
-        if (example.Init())
+        if (example.Init(blasScratchBudget))
         {
             deviceManager->AddRenderPassToBack(&example);
             deviceManager->RunMessageLoop();
@@ -30,6 +30,7 @@
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
 
+#include "pipeline_cache.h"
 
 using namespace donut;
 using namespace donut::math;
@@ -50,6 +51,7 @@ private:
     nvrhi::TextureHandle m_RenderTarget;
     std::shared_ptr<engine::CommonRenderPasses> m_CommonPasses;
     std::unique_ptr<engine::BindingCache> m_BindingCache;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
 
 public:
     using IRenderPass::IRenderPass;
@@ -66,7 +68,8 @@ public:
 		rootFS->mount("/shaders/app", appShaderPath);
 
         std::shared_ptr<engine::ShaderFactory> shaderFactory = std::make_shared<engine::ShaderFactory>(GetDevice(), rootFS, "/shaders");
-        m_ShaderLibrary = shaderFactory->CreateShaderLibrary("app/rt_triangle.hlsl", nullptr);
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
+        m_ShaderLibrary = m_PipelineCache->CreateShaderLibrary(*shaderFactory, "app/rt_triangle.hlsl", nullptr);
 
         if (!m_ShaderLibrary)
         {
@@ -104,7 +107,7 @@ public:
 
         pipelineDesc.maxPayloadSize = sizeof(dm::float4);
 
-        m_Pipeline = GetDevice()->createRayTracingPipeline(pipelineDesc);
+        m_Pipeline = m_PipelineCache->CreateRayTracingPipeline(pipelineDesc);
 
         m_ShaderTable = m_Pipeline->createShaderTable();
         m_ShaderTable->setRayGenerationShader("RayGen");
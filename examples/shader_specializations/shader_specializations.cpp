@@ -26,9 +26,13 @@
 #include <donut/core/log.h>
 #include <donut/core/vfs/VFS.h>
 #include <nvrhi/utils.h>
+#include <sstream>
 
 using namespace donut;
 
+#include "pipeline_cache.h"
+#include "specialization_cache.h"
+
 static const char* g_WindowTitle = "Donut Example: Vulkan Shader Specializations";
 
 class ShaderSpecializations : public app::IRenderPass
@@ -36,7 +40,9 @@ class ShaderSpecializations : public app::IRenderPass
 private:
     nvrhi::ShaderHandle m_VertexShader;
     nvrhi::ShaderHandle m_PixelShader;
-    std::vector<nvrhi::GraphicsPipelineHandle> m_Pipelines;
+    std::unique_ptr<ShaderPipelineCache> m_ShaderCache;
+    std::unique_ptr<SpecializedPipelineCache> m_PipelineCache;
+    std::vector<SpecializationVariant> m_Variants;
     nvrhi::CommandListHandle m_CommandList;
 
 public:
@@ -49,8 +55,9 @@ public:
         std::filesystem::path appShaderPath = app::GetDirectoryWithExecutable() / "shaders/shader_specializations" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
 
         engine::ShaderFactory shaderFactory(GetDevice(), nativeFS, appShaderPath);
-        m_VertexShader = shaderFactory.CreateShader("shaders.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
-        m_PixelShader = shaderFactory.CreateShader("shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
+        m_ShaderCache = std::make_unique<ShaderPipelineCache>(GetDevice());
+        m_VertexShader = m_ShaderCache->CreateShader(shaderFactory, "shaders.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
+        m_PixelShader = m_ShaderCache->CreateShader(shaderFactory, "shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
 
         if (!m_VertexShader || !m_PixelShader)
         {
@@ -59,68 +66,59 @@ public:
         
         m_CommandList = GetDevice()->createCommandList();
 
+        nvrhi::GraphicsPipelineDesc psoDesc;
+        psoDesc.VS = m_VertexShader;
+        psoDesc.PS = m_PixelShader;
+        psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
+        psoDesc.renderState.depthStencilState.depthTestEnable = false;
+
+        m_PipelineCache = std::make_unique<SpecializedPipelineCache>(GetDevice(), psoDesc, 64);
+
+        // One variant per triangle: the vertex shader offset and the pixel shader color are specialization constants
+        uint32_t colors[4] = { 0x0000ff, 0x00ff00, 0xff0000, 0xff00ff };
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            SpecializationVariant variant;
+            variant.vertexConstants = { nvrhi::ShaderSpecialization::Float(0, float(i) * 0.5f - 0.75f) };
+            variant.pixelConstants = { nvrhi::ShaderSpecialization::UInt32(1, colors[i]) };
+            m_Variants.push_back(variant);
+        }
+
         return true;
     }
 
     void Animate(float fElapsedTimeSeconds) override
     {
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+        SpecializationCacheStatistics stats = m_PipelineCache->GetStatistics();
+
+        std::stringstream extraInfo;
+        extraInfo << "- pipeline cache: " << m_PipelineCache->GetSize() << " pipelines, "
+            << stats.hits << " hits, " << stats.misses << " misses, "
+            << stats.created << " created in " << int(stats.createTimeSeconds * 1e3) << " ms";
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo.str().c_str());
     }
 
     void BackBufferResizing() override
     { 
-        m_Pipelines.clear();
+        // Nothing to do: the cached pipelines are keyed by the framebuffer formats, which don't change on resize
     }
 
     void Render(nvrhi::IFramebuffer* framebuffer) override
     {
-        if (m_Pipelines.empty())
-        {
-            nvrhi::IDevice* device = GetDevice();
-
-            // Create pipelines with shader specializations.
-            // The specializations could be created ahead of time, but they're cheap and it doesn't really matter.
-
-            for (uint32_t i = 0; i < 4; i++)
-            {
-                // Vertex shader specialization
-                nvrhi::ShaderSpecialization vertexShaderSpecializations[] = {
-                    nvrhi::ShaderSpecialization::Float( 0, float(i) * 0.5f - 0.75f)
-                };
-                nvrhi::ShaderHandle vertexShader = device->createShaderSpecialization(m_VertexShader, 
-                    vertexShaderSpecializations, uint32_t(std::size(vertexShaderSpecializations)));
-                
-                // Pixel shader specialization
-                uint32_t colors[4] = { 0x0000ff, 0x00ff00, 0xff0000, 0xff00ff };
-                nvrhi::ShaderSpecialization pixelShaderSpecializations[] = {
-                    nvrhi::ShaderSpecialization::UInt32(1, colors[i])
-                };
-                nvrhi::ShaderHandle pixelShader = device->createShaderSpecialization(m_PixelShader, 
-                    pixelShaderSpecializations, uint32_t(std::size(pixelShaderSpecializations)));
-
-                // Pipeline
-                nvrhi::GraphicsPipelineDesc psoDesc;
-                psoDesc.VS = vertexShader;
-                psoDesc.PS = pixelShader;
-                psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
-                psoDesc.renderState.depthStencilState.depthTestEnable = false;
-
-                nvrhi::GraphicsPipelineHandle pipeline = device->createGraphicsPipeline(psoDesc, framebuffer);
-                assert(pipeline);
-
-                m_Pipelines.push_back(pipeline);
-            }
-        }
-
         m_CommandList->open();
 
         nvrhi::utils::ClearColorAttachment(m_CommandList, framebuffer, 0, nvrhi::Color(0.f));
 
         // Render triangles, one with each pipeline.
         // Expected output: 4 triangles side-by-side; red, green, blue, cyan.
+        // Variants whose pipelines are still being created on the cache's worker thread are skipped for now.
 
-        for (const auto& pipeline : m_Pipelines)
+        for (const auto& variant : m_Variants)
         {
+            nvrhi::GraphicsPipelineHandle pipeline = m_PipelineCache->GetPipeline(variant, framebuffer);
+            if (!pipeline)
+                continue;
+
             nvrhi::GraphicsState state;
             state.pipeline = pipeline;
             state.framebuffer = framebuffer;
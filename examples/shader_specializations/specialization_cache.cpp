@@ -0,0 +1,235 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "specialization_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string_view>
+
+SpecializedPipelineCache::SpecializedPipelineCache(nvrhi::IDevice* device, const nvrhi::GraphicsPipelineDesc& baseDesc, size_t capacity)
+    : m_Device(device)
+    , m_BaseDesc(baseDesc)
+    , m_Capacity(std::max<size_t>(capacity, 1))
+{
+    m_Worker = std::thread(&SpecializedPipelineCache::WorkerThread, this);
+}
+
+SpecializedPipelineCache::~SpecializedPipelineCache()
+{
+    {
+        std::lock_guard lock(m_Mutex);
+        m_Terminate = true;
+        m_Jobs.clear();
+    }
+    m_JobAdded.notify_all();
+
+    if (m_Worker.joinable())
+        m_Worker.join();
+}
+
+size_t SpecializedPipelineCache::KeyHash::operator()(const Key& key) const
+{
+    return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(key.data()), key.size() * sizeof(uint32_t)));
+}
+
+SpecializedPipelineCache::Key SpecializedPipelineCache::MakeKey(const SpecializationVariant& variant, const nvrhi::FramebufferInfo& framebufferInfo) const
+{
+    Key key;
+    key.reserve(16 + 2 * (variant.vertexConstants.size() + variant.pixelConstants.size()));
+
+    auto addPointer = [&key](const void* pointer)
+    {
+        const uint64_t value = uint64_t(reinterpret_cast<uintptr_t>(pointer));
+        key.push_back(uint32_t(value));
+        key.push_back(uint32_t(value >> 32));
+    };
+
+    auto addConstants = [&key](const std::vector<nvrhi::ShaderSpecialization>& constants)
+    {
+        key.push_back(uint32_t(constants.size()));
+        for (const auto& constant : constants)
+        {
+            key.push_back(constant.constantID);
+            key.push_back(constant.value.u);
+        }
+    };
+
+    addPointer(m_BaseDesc.VS.Get());
+    addPointer(m_BaseDesc.PS.Get());
+    addConstants(variant.vertexConstants);
+    addConstants(variant.pixelConstants);
+
+    // Pipelines only depend on the framebuffer formats, not on its size
+    key.push_back(uint32_t(framebufferInfo.colorFormats.size()));
+    for (nvrhi::Format format : framebufferInfo.colorFormats)
+        key.push_back(uint32_t(format));
+    key.push_back(uint32_t(framebufferInfo.depthFormat));
+    key.push_back(framebufferInfo.sampleCount);
+    key.push_back(framebufferInfo.sampleQuality);
+
+    return key;
+}
+
+nvrhi::GraphicsPipelineHandle SpecializedPipelineCache::GetPipeline(const SpecializationVariant& variant, nvrhi::IFramebuffer* framebuffer)
+{
+    Key key = MakeKey(variant, framebuffer->getFramebufferInfo());
+
+    std::unique_lock lock(m_Mutex);
+
+    auto it = m_Entries.find(key);
+    if (it != m_Entries.end())
+    {
+        Entry& entry = it->second;
+        m_LruList.splice(m_LruList.begin(), m_LruList, entry.lruPosition);
+
+        if (entry.ready)
+            ++m_Statistics.hits;
+        else
+            ++m_Statistics.pending;
+
+        return entry.pipeline;
+    }
+
+    ++m_Statistics.misses;
+
+    m_LruList.push_front(key);
+    Entry& entry = m_Entries[key];
+    entry.lruPosition = m_LruList.begin();
+
+    m_Jobs.push_back(Job{ std::move(key), variant, framebuffer });
+    lock.unlock();
+
+    m_JobAdded.notify_one();
+    return nullptr;
+}
+
+void SpecializedPipelineCache::WaitForPendingPipelines()
+{
+    std::unique_lock lock(m_Mutex);
+    m_JobFinished.wait(lock, [this]() { return m_Jobs.empty() && m_ActiveJobs == 0; });
+}
+
+void SpecializedPipelineCache::Clear()
+{
+    std::lock_guard lock(m_Mutex);
+
+    // Jobs that are already running finish normally, their results are dropped because the entry is gone
+    m_Jobs.clear();
+    m_Entries.clear();
+    m_LruList.clear();
+    m_JobFinished.notify_all();
+}
+
+SpecializationCacheStatistics SpecializedPipelineCache::GetStatistics() const
+{
+    std::lock_guard lock(m_Mutex);
+    return m_Statistics;
+}
+
+size_t SpecializedPipelineCache::GetSize() const
+{
+    std::lock_guard lock(m_Mutex);
+    return m_Entries.size();
+}
+
+nvrhi::GraphicsPipelineHandle SpecializedPipelineCache::CreatePipeline(const Job& job)
+{
+    nvrhi::GraphicsPipelineDesc desc = m_BaseDesc;
+
+    if (!job.variant.vertexConstants.empty())
+    {
+        desc.VS = m_Device->createShaderSpecialization(m_BaseDesc.VS,
+            job.variant.vertexConstants.data(), uint32_t(job.variant.vertexConstants.size()));
+    }
+
+    if (!job.variant.pixelConstants.empty())
+    {
+        desc.PS = m_Device->createShaderSpecialization(m_BaseDesc.PS,
+            job.variant.pixelConstants.data(), uint32_t(job.variant.pixelConstants.size()));
+    }
+
+    if (!desc.VS || !desc.PS)
+        return nullptr;
+
+    return m_Device->createGraphicsPipeline(desc, job.framebuffer);
+}
+
+void SpecializedPipelineCache::EvictLeastRecentlyUsed()
+{
+    // Pipelines that are still referenced by command lists in flight stay alive through their handles,
+    // so evicting an entry only drops the cache's reference. Pending entries are never evicted.
+    auto it = m_LruList.end();
+    while (m_Entries.size() > m_Capacity && it != m_LruList.begin())
+    {
+        --it;
+        auto entry = m_Entries.find(*it);
+        if (entry == m_Entries.end() || !entry->second.ready)
+            continue;
+
+        m_Entries.erase(entry);
+        it = m_LruList.erase(it);
+        ++m_Statistics.evicted;
+    }
+}
+
+void SpecializedPipelineCache::WorkerThread()
+{
+    std::unique_lock lock(m_Mutex);
+
+    while (true)
+    {
+        m_JobAdded.wait(lock, [this]() { return m_Terminate || !m_Jobs.empty(); });
+        if (m_Terminate)
+            return;
+
+        Job job = std::move(m_Jobs.front());
+        m_Jobs.pop_front();
+        ++m_ActiveJobs;
+        lock.unlock();
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        nvrhi::GraphicsPipelineHandle pipeline = CreatePipeline(job);
+        const double createTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        lock.lock();
+        --m_ActiveJobs;
+        m_Statistics.createTimeSeconds += createTime;
+
+        if (pipeline)
+            ++m_Statistics.created;
+        else
+            ++m_Statistics.failed;
+
+        auto it = m_Entries.find(job.key);
+        if (it != m_Entries.end())
+        {
+            // A failed variant stays in the cache as ready with a null pipeline, so it is not retried every frame
+            it->second.pipeline = pipeline;
+            it->second.ready = true;
+            EvictLeastRecentlyUsed();
+        }
+
+        m_JobFinished.notify_all();
+    }
+}
@@ -0,0 +1,118 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Caches graphics pipelines that differ only in the values of their specialization constants.
+// Pipelines are keyed by the base shaders, the constant values and the framebuffer formats, so a window resize
+// that keeps the formats reuses them. Missing pipelines are created on a worker thread: GetPipeline returns null
+// until the variant is ready, and the caller skips or substitutes the draw instead of waiting for the compiler.
+// The least recently used pipelines are released when the cache grows past its capacity.
+
+struct SpecializationVariant
+{
+    std::vector<nvrhi::ShaderSpecialization> vertexConstants;
+    std::vector<nvrhi::ShaderSpecialization> pixelConstants;
+};
+
+struct SpecializationCacheStatistics
+{
+    uint64_t hits = 0;      // requests for a ready pipeline
+    uint64_t misses = 0;    // requests that started a background creation
+    uint64_t pending = 0;   // requests for a pipeline that was still being created
+    uint64_t created = 0;
+    uint64_t failed = 0;
+    uint64_t evicted = 0;
+    double createTimeSeconds = 0.0; // worker thread time spent creating specializations and pipelines
+};
+
+class SpecializedPipelineCache
+{
+public:
+    // The VS and PS of baseDesc are the shaders that get specialized, the rest of the desc is shared by all variants
+    SpecializedPipelineCache(nvrhi::IDevice* device, const nvrhi::GraphicsPipelineDesc& baseDesc, size_t capacity);
+    ~SpecializedPipelineCache();
+
+    // Returns the pipeline for the variant and framebuffer format, or null while it is being created in the background
+    nvrhi::GraphicsPipelineHandle GetPipeline(const SpecializationVariant& variant, nvrhi::IFramebuffer* framebuffer);
+
+    // Blocks until all background creations have finished
+    void WaitForPendingPipelines();
+
+    void Clear();
+
+    [[nodiscard]] SpecializationCacheStatistics GetStatistics() const;
+    [[nodiscard]] size_t GetSize() const;
+
+private:
+    using Key = std::vector<uint32_t>;
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+        nvrhi::GraphicsPipelineHandle pipeline;
+        bool ready = false;
+        std::list<Key>::iterator lruPosition;
+    };
+
+    struct Job
+    {
+        Key key;
+        SpecializationVariant variant;
+        nvrhi::FramebufferHandle framebuffer;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    nvrhi::GraphicsPipelineDesc m_BaseDesc;
+    size_t m_Capacity;
+
+    std::unordered_map<Key, Entry, KeyHash> m_Entries;
+    std::list<Key> m_LruList; // most recently used first
+    std::deque<Job> m_Jobs;
+    size_t m_ActiveJobs = 0;
+    SpecializationCacheStatistics m_Statistics;
+
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_JobAdded;
+    std::condition_variable m_JobFinished;
+    std::thread m_Worker;
+    bool m_Terminate = false;
+
+    Key MakeKey(const SpecializationVariant& variant, const nvrhi::FramebufferInfo& framebufferInfo) const;
+    nvrhi::GraphicsPipelineHandle CreatePipeline(const Job& job);
+    void EvictLeastRecentlyUsed();
+    void WorkerThread();
+};
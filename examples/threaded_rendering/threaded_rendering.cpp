@@ -36,6 +36,8 @@
 #include <donut/core/math/math.h>
 #include <taskflow/taskflow.hpp>
 
+#include "scene_cache.h"
+
 using namespace donut;
 
 static const char* g_WindowTitle = "Donut Example: Threaded Rendering";
@@ -138,9 +140,9 @@ public:
 
     bool LoadScene(std::shared_ptr<vfs::IFileSystem> fs, const std::filesystem::path& sceneFileName) override 
     {
-        engine::Scene* scene = new engine::Scene(GetDevice(), *m_ShaderFactory, fs, m_TextureCache, nullptr, nullptr);
+        CachedScene* scene = new CachedScene(GetDevice(), *m_ShaderFactory, fs, m_TextureCache, nullptr, nullptr);
 
-        if (scene->LoadWithExecutor(sceneFileName, m_Executor.get()))
+        if (scene->LoadWithCache(sceneFileName, app::GetDirectoryWithExecutable() / "scene_cache", nullptr, m_Executor.get()))
         {
             m_Scene = std::unique_ptr<engine::Scene>(scene);
             return true;
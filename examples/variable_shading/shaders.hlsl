@@ -20,47 +20,85 @@
 * DEALINGS IN THE SOFTWARE.
 */
 
-// Shading rate enum values copied from D3D12 header
-/*
-    {
-        D3D12_SHADING_RATE_1X1	= 0,
-        D3D12_SHADING_RATE_1X2	= 0x1,
-        D3D12_SHADING_RATE_2X1	= 0x4,
-        D3D12_SHADING_RATE_2X2	= 0x5,
-        D3D12_SHADING_RATE_2X4	= 0x6,
-        D3D12_SHADING_RATE_4X2	= 0x9,
-        D3D12_SHADING_RATE_4X4	= 0xa
-    } 	D3D12_SHADING_RATE;
-*/
+#include "shading_rate_cb.h"
+
+#ifdef SPIRV
+#define VK_PUSH_CONSTANT [[vk::push_constant]]
+#else
+#define VK_PUSH_CONSTANT
+#endif
+
+VK_PUSH_CONSTANT ConstantBuffer<ShadingRateConstants> g_Constants : register(b0);
 RWTexture2D<uint> shadingRateSurface : register(u0);
 Texture2D<float2> motionVectors : register(t0);
 Texture2D<float4> prevFrameColors : register(t1);
 
-#define TILE_SIZE 16
+#define GROUP_THREADS (SHADING_RATE_GROUP_SIZE * SHADING_RATE_GROUP_SIZE)
 
-[numthreads(1, 1, 1)]
-void main_cs(uint3 DispatchThreadID : SV_DispatchThreadID)
+// Sum of the compressed luminance, its square, the motion vector length and the pixel count
+groupshared float4 s_sums[GROUP_THREADS];
+
+// The same steps are done on the CPU by GenerateShadingRateReference in shading_rate_reference.cpp, in the same order,
+// so that both produce the same sums
+[numthreads(SHADING_RATE_GROUP_SIZE, SHADING_RATE_GROUP_SIZE, 1)]
+void main_cs(
+    uint3 groupId : SV_GroupID,
+    uint3 groupThreadId : SV_GroupThreadID,
+    uint groupIndex : SV_GroupIndex)
 {
-    // This is a fairly nonsensical algorithm, reads the average color for the tile in the previous frame
-    // and sets the shading rate to 4X4 if green channel is bigger than red channel, 1X1 otherwise
-    // really just intended to make the VRS difference very noticeable to confirm that it is working
-    float2 motionVector = motionVectors.Load(int3(TILE_SIZE * DispatchThreadID.xy, 0));
-    uint2 oldTexel = uint2(float2(DispatchThreadID.xy * TILE_SIZE) + motionVector);
-    float4 averageColor = 0;
-    for (int i = 0; i < TILE_SIZE; i++)
+    int2 tileOrigin = int2(groupId.xy * g_Constants.tileSize);
+    int2 textureSize = int2(g_Constants.textureSize);
+
+    // Every thread accumulates a strided subset of the tile's pixels
+    float4 sums = 0;
+    for (uint y = groupThreadId.y; y < g_Constants.tileSize; y += SHADING_RATE_GROUP_SIZE)
     {
-        for (int j = 0; j < TILE_SIZE; j++)
+        for (uint x = groupThreadId.x; x < g_Constants.tileSize; x += SHADING_RATE_GROUP_SIZE)
         {
-            averageColor += prevFrameColors.Load(int3(oldTexel + uint2(i, j), 0));
+            int2 pixel = tileOrigin + int2(x, y);
+            if (any(pixel >= textureSize))
+                continue;
+
+            // The colors are from the previous frame, fetch them where this pixel was.
+            // Disoccluded pixels that come from outside of the screen use the nearest edge pixel.
+            float2 motionVector = motionVectors[pixel];
+            int2 prevPixel = clamp(int2(floor(float2(pixel) + 0.5 + motionVector)), 0, textureSize - 1);
+            float3 color = prevFrameColors[prevPixel].rgb;
+
+            float luminance = max(dot(color, float3(0.2126, 0.7152, 0.0722)), 0);
+            luminance = luminance / (1.0 + luminance);
+
+            sums += float4(luminance, luminance * luminance, length(motionVector), 1);
         }
     }
-    averageColor /= (TILE_SIZE * TILE_SIZE);
-    if (averageColor.g > averageColor.r)
-    {
-        shadingRateSurface[DispatchThreadID.xy] = 0xa;
-    }
-    else
+
+    s_sums[groupIndex] = sums;
+    GroupMemoryBarrierWithGroupSync();
+
+    [unroll]
+    for (uint stride = GROUP_THREADS / 2; stride > 0; stride >>= 1)
     {
-        shadingRateSurface[DispatchThreadID.xy] = 0x0;
+        if (groupIndex < stride)
+            s_sums[groupIndex] += s_sums[groupIndex + stride];
+
+        GroupMemoryBarrierWithGroupSync();
     }
-}
\ No newline at end of file
+
+    if (groupIndex != 0)
+        return;
+
+    float4 total = s_sums[0];
+    float count = max(total.w, 1);
+    float mean = total.x / count;
+    float contrast = sqrt(max(total.y / count - mean * mean, 0));
+    float motion = total.z / count;
+
+    // The coarser of the rates allowed by contrast and by motion wins
+    uint rate = SHADING_RATE_1X1;
+    if (contrast < g_Constants.contrastThreshold4x4 || motion > g_Constants.motionThreshold4x4)
+        rate = SHADING_RATE_4X4;
+    else if (contrast < g_Constants.contrastThreshold2x2 || motion > g_Constants.motionThreshold2x2)
+        rate = SHADING_RATE_2X2;
+
+    shadingRateSurface[groupId.xy] = rate;
+}
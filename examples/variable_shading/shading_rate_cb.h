@@ -0,0 +1,52 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef SHADING_RATE_CB_H
+#define SHADING_RATE_CB_H
+
+// main_cs runs one group per shading rate tile. Tiles larger than the group are covered by looping over the pixels.
+#define SHADING_RATE_GROUP_SIZE 16
+
+// Shading rate values, the same in D3D12_SHADING_RATE and in the Vulkan fragment shading rate attachment:
+// log2 of the coarse pixel width in bits 2-3 and log2 of its height in bits 0-1
+#define SHADING_RATE_1X1 0x0
+#define SHADING_RATE_2X2 0x5
+#define SHADING_RATE_4X4 0xa
+
+struct ShadingRateConstants
+{
+    uint2 textureSize;          // size of the color and motion vector inputs in pixels
+    uint tileSize;              // pixels per shading rate surface texel in each direction
+    uint padding;
+
+    // Luminance is compressed with L / (1 + L) before taking its standard deviation over the tile.
+    // Tiles with less contrast than a threshold are shaded at that rate.
+    float contrastThreshold2x2;
+    float contrastThreshold4x4;
+
+    // Tiles whose average motion is faster than a threshold, in pixels per frame, are shaded at that rate
+    float motionThreshold2x2;
+    float motionThreshold4x4;
+};
+
+#endif // SHADING_RATE_CB_H
@@ -0,0 +1,150 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "shading_rate_reference.h"
+
+#include <donut/core/log.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace donut;
+using namespace donut::math;
+
+#include "shading_rate_cb.h"
+
+static const uint32_t c_GroupThreads = SHADING_RATE_GROUP_SIZE * SHADING_RATE_GROUP_SIZE;
+
+static uint8_t ClassifyTile(const float4& total, const ShadingRateThresholds& thresholds)
+{
+    const float count = std::max(total.w, 1.f);
+    const float mean = total.x / count;
+    const float contrast = std::sqrt(std::max(total.y / count - mean * mean, 0.f));
+    const float motion = total.z / count;
+
+    if (contrast < thresholds.contrast4x4 || motion > thresholds.motion4x4)
+        return SHADING_RATE_4X4;
+    if (contrast < thresholds.contrast2x2 || motion > thresholds.motion2x2)
+        return SHADING_RATE_2X2;
+    return SHADING_RATE_1X1;
+}
+
+std::vector<uint8_t> GenerateShadingRateReference(
+    const float4* prevFrameColors,
+    const float2* motionVectors,
+    uint2 size,
+    uint32_t tileSize,
+    const ShadingRateThresholds& thresholds)
+{
+    const uint2 tiles = (size + tileSize - 1) / tileSize;
+    std::vector<uint8_t> rates(size_t(tiles.x) * tiles.y);
+
+    const int2 textureSize = int2(size);
+    float4 sums[c_GroupThreads];
+
+    for (uint32_t tileY = 0; tileY < tiles.y; tileY++)
+    {
+        for (uint32_t tileX = 0; tileX < tiles.x; tileX++)
+        {
+            const int2 tileOrigin = int2(tileX * tileSize, tileY * tileSize);
+
+            for (uint32_t threadY = 0; threadY < SHADING_RATE_GROUP_SIZE; threadY++)
+            {
+                for (uint32_t threadX = 0; threadX < SHADING_RATE_GROUP_SIZE; threadX++)
+                {
+                    float4 threadSums = 0.f;
+                    for (uint32_t y = threadY; y < tileSize; y += SHADING_RATE_GROUP_SIZE)
+                    {
+                        for (uint32_t x = threadX; x < tileSize; x += SHADING_RATE_GROUP_SIZE)
+                        {
+                            const int2 pixel = tileOrigin + int2(x, y);
+                            if (pixel.x >= textureSize.x || pixel.y >= textureSize.y)
+                                continue;
+
+                            const float2 motionVector = motionVectors[size_t(pixel.y) * size.x + pixel.x];
+                            const int2 prevPixel = clamp(int2(floor(float2(pixel) + 0.5f + motionVector)), int2(0), textureSize - 1);
+                            const float3 color = prevFrameColors[size_t(prevPixel.y) * size.x + prevPixel.x].xyz();
+
+                            float luminance = std::max(dot(color, float3(0.2126f, 0.7152f, 0.0722f)), 0.f);
+                            luminance = luminance / (1.f + luminance);
+
+                            threadSums += float4(luminance, luminance * luminance, length(motionVector), 1.f);
+                        }
+                    }
+                    sums[threadY * SHADING_RATE_GROUP_SIZE + threadX] = threadSums;
+                }
+            }
+
+            // Same tree as the groupshared reduction in main_cs
+            for (uint32_t stride = c_GroupThreads / 2; stride > 0; stride >>= 1)
+            {
+                for (uint32_t i = 0; i < stride; i++)
+                    sums[i] += sums[i + stride];
+            }
+
+            rates[size_t(tileY) * tiles.x + tileX] = ClassifyTile(sums[0], thresholds);
+        }
+    }
+
+    return rates;
+}
+
+ShadingRateStatistics ComputeShadingRateStatistics(const uint8_t* rates, size_t rowPitch, uint2 size, uint32_t tileSize)
+{
+    ShadingRateStatistics stats;
+    const uint2 tiles = (size + tileSize - 1) / tileSize;
+
+    for (uint32_t tileY = 0; tileY < tiles.y; tileY++)
+    {
+        for (uint32_t tileX = 0; tileX < tiles.x; tileX++)
+        {
+            const uint8_t rate = rates[tileY * rowPitch + tileX];
+            switch (rate)
+            {
+            case SHADING_RATE_1X1: ++stats.tiles1x1; break;
+            case SHADING_RATE_2X2: ++stats.tiles2x2; break;
+            case SHADING_RATE_4X4: ++stats.tiles4x4; break;
+            default: break;
+            }
+
+            const uint32_t width = std::min(tileSize, size.x - tileX * tileSize);
+            const uint32_t height = std::min(tileSize, size.y - tileY * tileSize);
+            const uint32_t coarseWidth = 1u << ((rate >> 2) & 3);
+            const uint32_t coarseHeight = 1u << (rate & 3);
+
+            stats.pixels += uint64_t(width) * height;
+            stats.shadedPixels += uint64_t((width + coarseWidth - 1) / coarseWidth) * ((height + coarseHeight - 1) / coarseHeight);
+        }
+    }
+
+    return stats;
+}
+
+void LogShadingRateStatistics(const char* source, const ShadingRateStatistics& statistics)
+{
+    const double tiles = double(std::max(statistics.tiles1x1 + statistics.tiles2x2 + statistics.tiles4x4, 1u));
+    const double savings = statistics.pixels ? 1.0 - double(statistics.shadedPixels) / double(statistics.pixels) : 0.0;
+
+    log::info("%s: %.1f%% of tiles at 1x1, %.1f%% at 2x2, %.1f%% at 4x4, %.1f%% fewer pixel shader invocations",
+        source, 100.0 * statistics.tiles1x1 / tiles, 100.0 * statistics.tiles2x2 / tiles, 100.0 * statistics.tiles4x4 / tiles,
+        100.0 * savings);
+}
@@ -0,0 +1,63 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <vector>
+
+// CPU implementation of the shading rate generator in main_cs. It sums the tile values in the same order as the
+// shader's parallel reduction, so the rate maps can be compared tile by tile, or produced offline without a device.
+
+struct ShadingRateThresholds
+{
+    // See ShadingRateConstants in shading_rate_cb.h
+    float contrast2x2 = 0.04f;
+    float contrast4x4 = 0.01f;
+    float motion2x2 = 4.f;
+    float motion4x4 = 12.f;
+};
+
+struct ShadingRateStatistics
+{
+    uint32_t tiles1x1 = 0;
+    uint32_t tiles2x2 = 0;
+    uint32_t tiles4x4 = 0;
+    uint64_t pixels = 0;
+    uint64_t shadedPixels = 0;  // pixel shader invocations of a full screen of geometry at these rates
+};
+
+// Returns one shading rate per tile, row by row. The inputs hold size.x * size.y values, row by row:
+// the previous frame's colors, and the motion vectors in pixels from the current to the previous frame.
+std::vector<uint8_t> GenerateShadingRateReference(
+    const donut::math::float4* prevFrameColors,
+    const donut::math::float2* motionVectors,
+    donut::math::uint2 size,
+    uint32_t tileSize,
+    const ShadingRateThresholds& thresholds);
+
+// Rate histogram of a rate map and the number of pixel shader invocations it leaves, tiles at the right and bottom
+// edges only count their pixels on screen. rowPitch is the distance between rows of the rate map in bytes.
+ShadingRateStatistics ComputeShadingRateStatistics(const uint8_t* rates, size_t rowPitch, donut::math::uint2 size, uint32_t tileSize);
+
+void LogShadingRateStatistics(const char* source, const ShadingRateStatistics& statistics);
@@ -37,18 +37,54 @@
 #include <donut/core/vfs/VFS.h>
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
 
+#include "pipeline_cache.h"
+#include "shading_rate_reference.h"
 
 using namespace donut;
 using namespace donut::math;
 
 #include "lighting_cb.h"
+#include "shading_rate_cb.h"
 
 static const char* g_WindowTitle = "Donut Example: Variable Rate Shading";
 
+// Number of frames between generating a shading rate surface and reading its histogram on the CPU
+static const uint32_t c_NumRateReadbacks = 3;
+
 // NVIDIA Variable Rate Shading (VRS) sample application
 // Relevant sample code is in the Render() function, marked with comments
 
+static float HalfToFloat(uint16_t value)
+{
+    const uint32_t sign = uint32_t(value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1f;
+    const uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else
+    {
+        // Denormal half, becomes a normal float
+        const float magnitude = float(mantissa) * (1.f / 16777216.f);
+        std::memcpy(&bits, &magnitude, sizeof(bits));
+        bits |= sign;
+    }
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
 class RenderTargets
 {
 public:
@@ -167,6 +203,7 @@ private:
     std::unique_ptr<render::InstancedOpaqueDrawStrategy> m_OpaqueDrawStrategy;
     std::unique_ptr<render::TransparentDrawStrategy> m_TransparentDrawStrategy;
     std::unique_ptr<engine::BindingCache> m_BindingCache;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
 
     nvrhi::ShaderHandle m_shadingRateSurfaceShader;
     nvrhi::ComputePipelineHandle m_Pipeline;
@@ -174,18 +211,140 @@ private:
     nvrhi::BindingSetHandle m_bindingSet;
     nvrhi::TextureHandle m_shadingRateSurface;
     uint m_vrsTileSize;
+    ShadingRateThresholds m_ShadingRateThresholds;
+
+    // Copies of the shading rate generator inputs and output for comparing against the CPU reference
+    nvrhi::StagingTextureHandle m_ValidationColors;
+    nvrhi::StagingTextureHandle m_ValidationMotionVectors;
+    nvrhi::StagingTextureHandle m_ValidationRates;
+    bool m_ValidateShadingRate = false;
+
+    // Copies of recent shading rate surfaces for the per-frame rate histogram
+    std::array<nvrhi::StagingTextureHandle, c_NumRateReadbacks> m_RateReadback;
+    uint32_t m_RateReadbackFrames = 0;
+    ShadingRateStatistics m_RateStatistics;
+    bool m_RateStatisticsValid = false;
 
     engine::PlanarView m_ViewPrevious;
     bool m_PreviousViewsValid = false;
 
     bool m_UseRawD3D12 = false;
 
+    nvrhi::StagingTextureHandle CreateReadbackTexture(nvrhi::ITexture* texture)
+    {
+        nvrhi::TextureDesc desc = texture->getDesc();
+        desc.isRenderTarget = false;
+        desc.isUAV = false;
+        desc.isShadingRateSurface = false;
+        desc.isTypeless = false;
+        desc.initialState = nvrhi::ResourceStates::CopyDest;
+        return GetDevice()->createStagingTexture(desc, nvrhi::CpuAccessMode::Read);
+    }
+
+    // Copies what the shading rate generator read and wrote this frame into staging textures
+    void CaptureShadingRateInputs()
+    {
+        auto createStagingCopy = [this](nvrhi::ITexture* texture)
+        {
+            nvrhi::StagingTextureHandle staging = CreateReadbackTexture(texture);
+            m_CommandList->copyTexture(staging, nvrhi::TextureSlice(), texture, nvrhi::TextureSlice());
+            return staging;
+        };
+
+        m_ValidationColors = createStagingCopy(m_RenderTargets->m_HdrColor);
+        m_ValidationMotionVectors = createStagingCopy(m_RenderTargets->m_MotionVectors);
+        m_ValidationRates = createStagingCopy(m_shadingRateSurface);
+    }
+
+    // Picks up the histogram of the shading rate surface copied a few frames ago, that copy is complete by now,
+    // and queues a copy of this frame's surface. Works the same with the nvrhi and the raw D3D12 paths.
+    void UpdateRateStatistics()
+    {
+        const uint32_t readbackIndex = m_RateReadbackFrames % c_NumRateReadbacks;
+        nvrhi::StagingTextureHandle& readback = m_RateReadback[readbackIndex];
+
+        if (m_RateReadbackFrames >= c_NumRateReadbacks && readback)
+        {
+            size_t rowPitch = 0;
+            const uint8_t* rates = static_cast<const uint8_t*>(GetDevice()->mapStagingTexture(readback, nvrhi::TextureSlice(), nvrhi::CpuAccessMode::Read, &rowPitch));
+            if (rates)
+            {
+                m_RateStatistics = ComputeShadingRateStatistics(rates, rowPitch, uint2(m_RenderTargets->GetSize()), m_vrsTileSize);
+                m_RateStatisticsValid = true;
+                GetDevice()->unmapStagingTexture(readback);
+            }
+        }
+
+        if (!readback)
+            readback = CreateReadbackTexture(m_shadingRateSurface);
+
+        m_CommandList->copyTexture(readback, nvrhi::TextureSlice(), m_shadingRateSurface, nvrhi::TextureSlice());
+        ++m_RateReadbackFrames;
+    }
+
+    // Runs the CPU reference on the captured inputs and compares its rate map with the one from main_cs.
+    // The device has to be idle.
+    void ValidateShadingRate()
+    {
+        const uint2 size = uint2(m_RenderTargets->GetSize());
+        const uint2 tiles = (size + m_vrsTileSize - 1) / m_vrsTileSize;
+
+        std::vector<float4> colors(size_t(size.x) * size.y);
+        std::vector<float2> motionVectors(size_t(size.x) * size.y);
+
+        size_t rowPitch = 0;
+        const uint8_t* data = static_cast<const uint8_t*>(GetDevice()->mapStagingTexture(m_ValidationColors, nvrhi::TextureSlice(), nvrhi::CpuAccessMode::Read, &rowPitch));
+        for (uint32_t y = 0; y < size.y; y++)
+        {
+            const uint16_t* row = reinterpret_cast<const uint16_t*>(data + y * rowPitch);
+            for (uint32_t x = 0; x < size.x; x++)
+                colors[y * size.x + x] = float4(HalfToFloat(row[x * 4 + 0]), HalfToFloat(row[x * 4 + 1]), HalfToFloat(row[x * 4 + 2]), HalfToFloat(row[x * 4 + 3]));
+        }
+        GetDevice()->unmapStagingTexture(m_ValidationColors);
+
+        data = static_cast<const uint8_t*>(GetDevice()->mapStagingTexture(m_ValidationMotionVectors, nvrhi::TextureSlice(), nvrhi::CpuAccessMode::Read, &rowPitch));
+        for (uint32_t y = 0; y < size.y; y++)
+        {
+            const uint16_t* row = reinterpret_cast<const uint16_t*>(data + y * rowPitch);
+            for (uint32_t x = 0; x < size.x; x++)
+                motionVectors[y * size.x + x] = float2(HalfToFloat(row[x * 2 + 0]), HalfToFloat(row[x * 2 + 1]));
+        }
+        GetDevice()->unmapStagingTexture(m_ValidationMotionVectors);
+
+        const std::vector<uint8_t> referenceRates = GenerateShadingRateReference(colors.data(), motionVectors.data(), size, m_vrsTileSize, m_ShadingRateThresholds);
+
+        data = static_cast<const uint8_t*>(GetDevice()->mapStagingTexture(m_ValidationRates, nvrhi::TextureSlice(), nvrhi::CpuAccessMode::Read, &rowPitch));
+
+        uint32_t mismatches = 0;
+        for (uint32_t y = 0; y < tiles.y; y++)
+        {
+            for (uint32_t x = 0; x < tiles.x; x++)
+            {
+                if (data[y * rowPitch + x] != referenceRates[y * tiles.x + x])
+                    ++mismatches;
+            }
+        }
+
+        LogShadingRateStatistics("Shading rate (GPU)", ComputeShadingRateStatistics(data, rowPitch, size, m_vrsTileSize));
+        GetDevice()->unmapStagingTexture(m_ValidationRates);
+
+        LogShadingRateStatistics("Shading rate (CPU reference)", ComputeShadingRateStatistics(referenceRates.data(), tiles.x, size, m_vrsTileSize));
+
+        // Values right at a threshold may land on either side because of floating point differences
+        log::info("Shading rate validation: %u of %u tiles differ from the CPU reference", mismatches, tiles.x * tiles.y);
+
+        m_ValidationColors = nullptr;
+        m_ValidationMotionVectors = nullptr;
+        m_ValidationRates = nullptr;
+    }
+
 public:
     using ApplicationBase::ApplicationBase;
 
-    bool Init(bool useRawD3D12)
+    bool Init(bool useRawD3D12, const ShadingRateThresholds& shadingRateThresholds)
     {
         m_UseRawD3D12 = useRawD3D12;
+        m_ShadingRateThresholds = shadingRateThresholds;
 
         std::filesystem::path sceneFileName = app::GetDirectoryWithExecutable().parent_path() / "media/glTF-Sample-Models/2.0/Sponza/glTF/Sponza.gltf";
         std::filesystem::path frameworkShaderPath = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
@@ -199,7 +358,8 @@ public:
         m_CommonPasses = std::make_shared<engine::CommonRenderPasses>(GetDevice(), m_ShaderFactory);
         m_BindingCache = std::make_unique<engine::BindingCache>(GetDevice());
 
-        m_shadingRateSurfaceShader = m_ShaderFactory->CreateShader("/shaders/app/shaders.hlsl", "main_cs", nullptr, nvrhi::ShaderType::Compute);
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
+        m_shadingRateSurfaceShader = m_PipelineCache->CreateShader(*m_ShaderFactory, "/shaders/app/shaders.hlsl", "main_cs", nullptr, nvrhi::ShaderType::Compute);
         if (!m_shadingRateSurfaceShader)
         {
             return false;
@@ -247,6 +407,14 @@ public:
             m_vrsTileSize = info.shadingRateImageTileSize;
         }
 
+        // On Vulkan this is the fragment shading rate attachment texel size, devices that only support
+        // per-draw or per-primitive rates report no attachment tiles
+        if (m_vrsTileSize == 0)
+        {
+            log::error("The device does not support shading rate images");
+            return false;
+        }
+
         GetDevice()->waitForIdle();
 
         return true;
@@ -267,6 +435,12 @@ public:
 
     bool KeyboardUpdate(int key, int scancode, int action, int mods) override
     {
+        if (key == GLFW_KEY_V && action == GLFW_PRESS)
+        {
+            m_ValidateShadingRate = true;
+            return true;
+        }
+
         m_Camera.KeyboardUpdate(key, scancode, action, mods);
         return true;
     }
@@ -286,17 +460,37 @@ public:
     void Animate(float fElapsedTimeSeconds) override
     {
         m_Camera.Animate(fElapsedTimeSeconds);
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+
+        std::string extraInfo = m_UseRawD3D12 ? "- raw D3D12" : "- NVRHI";
+        if (m_RateStatisticsValid)
+        {
+            const ShadingRateStatistics& stats = m_RateStatistics;
+            const double tiles = double(std::max(stats.tiles1x1 + stats.tiles2x2 + stats.tiles4x4, 1u));
+            const double savings = stats.pixels ? 1.0 - double(stats.shadedPixels) / double(stats.pixels) : 0.0;
+
+            char text[128];
+            snprintf(text, sizeof(text), ", tiles: %.0f%% 1x1, %.0f%% 2x2, %.0f%% 4x4, %.0f%% fewer pixel shader invocations",
+                100.0 * stats.tiles1x1 / tiles, 100.0 * stats.tiles2x2 / tiles, 100.0 * stats.tiles4x4 / tiles, 100.0 * savings);
+            extraInfo += text;
+        }
+
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo.c_str());
     }
 
     void BackBufferResizing() override
     {
+        // Only the size-dependent resources are released here. The forward pass and the VRS pipeline do not depend on
+        // the window size and keep their pipelines, so a resize doesn't have to wait for pipeline compilation.
         m_RenderTargets = nullptr;
         m_BindingCache->Clear();
-        m_ForwardPass = nullptr;
         m_shadingRateSurface = nullptr;
         m_temporalPass = nullptr;
-        m_Pipeline = nullptr;
+        m_bindingSet = nullptr;
+
+        // The readbacks have the size of the old surface
+        for (auto& readback : m_RateReadback)
+            readback = nullptr;
+        m_RateReadbackFrames = 0;
     }
 
     void Render(nvrhi::IFramebuffer* framebuffer) override
@@ -334,6 +528,11 @@ public:
             desc.format = nvrhi::Format::R8_UINT;
 
             m_shadingRateSurface = GetDevice()->createTexture(desc);
+
+            if (!m_UseRawD3D12)
+            {
+                m_RenderTargets->m_HdrFramebufferDepth->ShadingRateSurface = m_shadingRateSurface;
+            }
         }
 
         if (!m_ForwardPass)
@@ -341,10 +540,6 @@ public:
             m_ForwardPass = std::make_unique<render::ForwardShadingPass>(GetDevice(), m_CommonPasses);
 
             render::ForwardShadingPass::CreateParameters forwardParams;
-            if (!m_UseRawD3D12)
-            {
-                m_RenderTargets->m_HdrFramebufferDepth->ShadingRateSurface = m_shadingRateSurface;
-            }
             m_ForwardPass->Init(*m_ShaderFactory, forwardParams);
         }
 
@@ -369,25 +564,31 @@ public:
             nvrhi::BindingLayoutDesc layoutDesc;
             layoutDesc.visibility = nvrhi::ShaderType::Compute;
             layoutDesc.bindings = {
+                nvrhi::BindingLayoutItem::PushConstants(0, sizeof(ShadingRateConstants)),
                 nvrhi::BindingLayoutItem::Texture_UAV(0),
                 nvrhi::BindingLayoutItem::Texture_SRV(0),
                 nvrhi::BindingLayoutItem::Texture_SRV(1)
             };
             m_bindingLayout = GetDevice()->createBindingLayout(layoutDesc);
 
+            nvrhi::ComputePipelineDesc psoDesc = {};
+            psoDesc.CS = m_shadingRateSurfaceShader;
+            psoDesc.bindingLayouts = { m_bindingLayout };
+
+            m_Pipeline = GetDevice()->createComputePipeline(psoDesc);
+        }
+
+        // The binding set references the size-dependent textures and is recreated after a resize
+        if (!m_bindingSet)
+        {
             nvrhi::BindingSetDesc bindingSetDesc;
             bindingSetDesc.bindings = {
+                nvrhi::BindingSetItem::PushConstants(0, sizeof(ShadingRateConstants)),
                 nvrhi::BindingSetItem::Texture_UAV(0, m_shadingRateSurface, nvrhi::Format::R8_UINT),
                 nvrhi::BindingSetItem::Texture_SRV(0, m_RenderTargets->m_MotionVectors, nvrhi::Format::RG16_FLOAT),
                 nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_HdrColor, nvrhi::Format::RGBA16_FLOAT)
             };
             m_bindingSet = GetDevice()->createBindingSet(bindingSetDesc, m_bindingLayout);
-
-            nvrhi::ComputePipelineDesc psoDesc = {};
-            psoDesc.CS = m_shadingRateSurfaceShader;
-            psoDesc.bindingLayouts = { m_bindingLayout };
-
-            m_Pipeline = GetDevice()->createComputePipeline(psoDesc);
         }
 
         m_CommandList->open();
@@ -402,9 +603,25 @@ public:
         state.bindings = { m_bindingSet };
         m_CommandList->setComputeState(state);
 
-        // Dispatch call to generate the VRS surface
+        ShadingRateConstants shadingRateConstants = {};
+        shadingRateConstants.textureSize = uint2(fbinfo.width, fbinfo.height);
+        shadingRateConstants.tileSize = m_vrsTileSize;
+        shadingRateConstants.contrastThreshold2x2 = m_ShadingRateThresholds.contrast2x2;
+        shadingRateConstants.contrastThreshold4x4 = m_ShadingRateThresholds.contrast4x4;
+        shadingRateConstants.motionThreshold2x2 = m_ShadingRateThresholds.motion2x2;
+        shadingRateConstants.motionThreshold4x4 = m_ShadingRateThresholds.motion4x4;
+        m_CommandList->setPushConstants(&shadingRateConstants, sizeof(shadingRateConstants));
+
+        // Dispatch call to generate the VRS surface, one thread group per tile
         m_CommandList->dispatch(surfaceDimensions.x, surfaceDimensions.y, 1);
 
+        UpdateRateStatistics();
+
+        const bool validateShadingRate = m_ValidateShadingRate;
+        m_ValidateShadingRate = false;
+        if (validateShadingRate)
+            CaptureShadingRateInputs();
+
         m_RenderTargets->Clear(m_CommandList);
 
         LightingConstants constants = {};
@@ -494,6 +711,12 @@ public:
 
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
+
+        if (validateShadingRate)
+        {
+            GetDevice()->waitForIdle();
+            ValidateShadingRate();
+        }
     }
 
 };
@@ -511,17 +734,35 @@ int main(int __argc, const char** __argv)
         return 1;
     }
 
-    // if d3d12 is selected and -raw flag is on, use raw d3d12 API path
+    ShadingRateThresholds shadingRateThresholds;
+    for (int i = 1; i < __argc; i++)
+    {
+        if (strcmp(__argv[i], "-vrsContrast") == 0 && i + 2 < __argc)
+        {
+            shadingRateThresholds.contrast2x2 = float(atof(__argv[++i]));
+            shadingRateThresholds.contrast4x4 = float(atof(__argv[++i]));
+        }
+        else if (strcmp(__argv[i], "-vrsMotion") == 0 && i + 2 < __argc)
+        {
+            shadingRateThresholds.motion2x2 = float(atof(__argv[++i]));
+            shadingRateThresholds.motion4x4 = float(atof(__argv[++i]));
+        }
+    }
+
+    // if d3d12 is selected and -raw flag is on, use raw d3d12 API path.
+    // The default path goes through NVRHI and works the same on D3D12 and Vulkan.
     bool rawD3D12 = false;
-#ifdef DONUT_WITH_DX12
     for (int i = 1; i < __argc; i++)
     {
         if (!strcmp(__argv[i], "-raw"))
         {
+#ifdef DONUT_WITH_DX12
             rawD3D12 = (api == nvrhi::GraphicsAPI::D3D12);
+#endif
+            if (!rawD3D12)
+                log::warning("The -raw option is only available with D3D12, using the NVRHI path.");
         }
     }
-#endif
 
     app::DeviceManager* deviceManager = app::DeviceManager::Create(api);
 
@@ -545,7 +786,7 @@ int main(int __argc, const char** __argv)
 
     {
         VariableRateShading example(deviceManager);
-        if (example.Init(rawD3D12))
+        if (example.Init(rawD3D12, shadingRateThresholds))
         {
             deviceManager->AddRenderPassToBack(&example);
             deviceManager->RunMessageLoop();
@@ -29,6 +29,8 @@
 #include <donut/core/vfs/VFS.h>
 #include <nvrhi/utils.h>
 
+#include "pipeline_cache.h"
+
 using namespace donut;
 
 static const char* g_WindowTitle = "Donut Example: Vertex Buffer";
@@ -103,6 +105,7 @@ private:
     nvrhi::BindingSetHandle m_BindingSets[c_NumViews];
     nvrhi::GraphicsPipelineHandle m_Pipeline;
     nvrhi::CommandListHandle m_CommandList;
+    std::unique_ptr<ShaderPipelineCache> m_PipelineCache;
     float m_Rotation = 0.f;
 
 public:
@@ -131,8 +134,9 @@ public:
 		rootFS->mount("/shaders/app", appShaderPath);
 
         std::shared_ptr<engine::ShaderFactory> shaderFactory = std::make_shared<engine::ShaderFactory>(GetDevice(), rootFS, "/shaders");
-        m_VertexShader = shaderFactory->CreateShader("app/shaders.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
-        m_PixelShader = shaderFactory->CreateShader("app/shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
+        m_PipelineCache = std::make_unique<ShaderPipelineCache>(GetDevice());
+        m_VertexShader = m_PipelineCache->CreateShader(*shaderFactory, "app/shaders.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
+        m_PixelShader = m_PipelineCache->CreateShader(*shaderFactory, "app/shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
 
         if (!m_VertexShader || !m_PixelShader)
         {
@@ -247,7 +251,7 @@ public:
             psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
             psoDesc.renderState.depthStencilState.depthTestEnable = false;
 
-            m_Pipeline = GetDevice()->createGraphicsPipeline(psoDesc, framebuffer);
+            m_Pipeline = m_PipelineCache->CreateGraphicsPipeline(psoDesc, framebuffer);
         }
 
         m_CommandList->open();
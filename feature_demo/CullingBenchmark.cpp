@@ -0,0 +1,222 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+// Micro-benchmark for the frustum culling kernels in SceneCulling.cpp.
+// The baseline tests one box3 at a time with frustum::intersectsWith, which is what the scene graph walk
+// in the donut draw strategies does for every node. The kernels must produce the same visibility bits
+// as the scalar kernel; small differences against the baseline come from the different plane arithmetic.
+// A second set of rows compares culling six views one at a time against a single multi-view pass.
+//
+// Usage: culling_benchmark [-count <instances>] [-iterations <n>]
+
+#include "SceneCulling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+using namespace donut::math;
+
+namespace
+{
+    template<typename Func>
+    double MeasureBestMilliseconds(int iterations, Func&& func)
+    {
+        double best = 0.0;
+        for (int iteration = 0; iteration < iterations; iteration++)
+        {
+            const auto start = std::chrono::high_resolution_clock::now();
+            func();
+            const auto end = std::chrono::high_resolution_clock::now();
+
+            const double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+            if (iteration == 0 || milliseconds < best)
+                best = milliseconds;
+        }
+        return best;
+    }
+
+    size_t CountDifferentBits(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b)
+    {
+        size_t differences = 0;
+        for (size_t word = 0; word < a.size(); word++)
+        {
+            uint64_t bits = a[word] ^ b[word];
+            for (; bits; bits &= bits - 1)
+                ++differences;
+        }
+        return differences;
+    }
+
+    size_t CountSetBits(const std::vector<uint64_t>& visibility)
+    {
+        size_t count = 0;
+        for (uint64_t bits : visibility)
+        {
+            for (; bits; bits &= bits - 1)
+                ++count;
+        }
+        return count;
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    std::vector<size_t> instanceCounts = { 100000, 250000, 500000, 1000000 };
+    int iterations = 50;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-count") && i + 1 < argc)
+        {
+            instanceCounts = { size_t(std::strtoull(argv[++i], nullptr, 10)) };
+        }
+        else if (!strcmp(argv[i], "-iterations") && i + 1 < argc)
+        {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-count <instances>] [-iterations <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Camera at the origin looking down +Z into a field of randomly placed boxes, about 5% of them are visible
+    const float4x4 viewToClip = perspProjD3DStyleReverse(PI_f * 0.25f, 16.f / 9.f, 0.1f);
+    const frustum viewFrustum(viewToClip, true);
+
+    // Six views of different widths stand in for four shadow cascades and two stereo eyes
+    std::vector<frustum> multiViewFrusta;
+    for (int view = 0; view < 6; view++)
+        multiViewFrusta.push_back(frustum(perspProjD3DStyleReverse(PI_f * (0.15f + 0.1f * float(view)), 16.f / 9.f, 0.1f), true));
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> positionDistribution(-500.f, 500.f);
+    std::uniform_real_distribution<float> sizeDistribution(0.5f, 5.f);
+
+    const CullingKernel kernels[] = { CullingKernel::Scalar, CullingKernel::SSE, CullingKernel::AVX2 };
+    bool kernelMismatch = false;
+
+    printf("%-10s %-12s %12s %12s %10s %10s\n", "Instances", "Method", "Best (ms)", "ns/instance", "Speedup", "Visible");
+
+    for (size_t instanceCount : instanceCounts)
+    {
+        std::vector<box3> boxes(instanceCount);
+        BoundingBoxesSoA boxesSoA;
+        boxesSoA.Resize(instanceCount);
+
+        for (size_t i = 0; i < instanceCount; i++)
+        {
+            const float3 center(positionDistribution(random), positionDistribution(random), positionDistribution(random));
+            const float3 halfSize(sizeDistribution(random), sizeDistribution(random), sizeDistribution(random));
+            boxes[i] = box3(center - halfSize, center + halfSize);
+            boxesSoA.Set(i, boxes[i]);
+        }
+
+        const size_t numWords = (instanceCount + 63) / 64;
+        std::vector<uint64_t> baselineVisibility(numWords);
+
+        const double baselineTime = MeasureBestMilliseconds(iterations, [&]()
+        {
+            std::fill(baselineVisibility.begin(), baselineVisibility.end(), 0);
+            for (size_t i = 0; i < instanceCount; i++)
+            {
+                if (viewFrustum.intersectsWith(boxes[i]))
+                    baselineVisibility[i / 64] |= uint64_t(1) << (i % 64);
+            }
+        });
+
+        printf("%-10zu %-12s %12.3f %12.2f %9.2fx %10zu\n", instanceCount, "box3 AoS", baselineTime,
+            baselineTime * 1e6 / double(instanceCount), 1.0, CountSetBits(baselineVisibility));
+
+        std::vector<uint64_t> scalarVisibility;
+
+        for (CullingKernel kernel : kernels)
+        {
+            if (!IsCullingKernelSupported(kernel))
+                continue;
+
+            std::vector<uint64_t> visibility(numWords);
+            const double kernelTime = MeasureBestMilliseconds(iterations, [&]()
+            {
+                CullBoundingBoxes(boxesSoA, viewFrustum, visibility.data(), kernel);
+            });
+
+            printf("%-10zu %-12s %12.3f %12.2f %9.2fx %10zu\n", instanceCount, GetCullingKernelName(kernel), kernelTime,
+                kernelTime * 1e6 / double(instanceCount), baselineTime / kernelTime, CountSetBits(visibility));
+
+            if (kernel == CullingKernel::Scalar)
+            {
+                scalarVisibility = visibility;
+
+                const size_t differences = CountDifferentBits(visibility, baselineVisibility);
+                if (differences)
+                    printf("    %zu instances differ from the box3 baseline (plane arithmetic rounding)\n", differences);
+            }
+            else if (visibility != scalarVisibility)
+            {
+                printf("    ERROR: %zu instances differ from the scalar kernel\n", CountDifferentBits(visibility, scalarVisibility));
+                kernelMismatch = true;
+            }
+        }
+
+        // Multi-view culling: one view per culling pass versus all views in one pass over the boxes
+        const CullingKernel bestKernel = GetBestCullingKernel();
+        std::vector<std::vector<uint64_t>> separateVisibility(multiViewFrusta.size(), std::vector<uint64_t>(numWords));
+        std::vector<std::vector<uint64_t>> sharedVisibility(multiViewFrusta.size(), std::vector<uint64_t>(numWords));
+        std::vector<uint64_t*> sharedVisibilityPointers;
+        for (auto& visibility : sharedVisibility)
+            sharedVisibilityPointers.push_back(visibility.data());
+
+        const double separateTime = MeasureBestMilliseconds(iterations, [&]()
+        {
+            for (size_t view = 0; view < multiViewFrusta.size(); view++)
+                CullBoundingBoxes(boxesSoA, multiViewFrusta[view], separateVisibility[view].data(), bestKernel);
+        });
+
+        const double sharedTime = MeasureBestMilliseconds(iterations, [&]()
+        {
+            CullBoundingBoxesMultiView(boxesSoA, multiViewFrusta.data(), multiViewFrusta.size(), sharedVisibilityPointers.data(), bestKernel);
+        });
+
+        const std::string separateName = std::to_string(multiViewFrusta.size()) + "x single";
+        const std::string sharedName = std::to_string(multiViewFrusta.size()) + "-view pass";
+        printf("%-10zu %-12s %12.3f %12.2f %9.2fx\n", instanceCount, separateName.c_str(), separateTime,
+            separateTime * 1e6 / double(instanceCount), 1.0);
+        printf("%-10zu %-12s %12.3f %12.2f %9.2fx\n", instanceCount, sharedName.c_str(), sharedTime,
+            sharedTime * 1e6 / double(instanceCount), separateTime / sharedTime);
+
+        if (sharedVisibility != separateVisibility)
+        {
+            printf("    ERROR: the multi-view pass differs from culling the views one by one\n");
+            kernelMismatch = true;
+        }
+    }
+
+    return kernelMismatch ? 1 : 0;
+}
@@ -24,6 +24,17 @@
 #include <vector>
 #include <memory>
 #include <chrono>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 
 #include <donut/core/vfs/VFS.h>
 #include <donut/core/log.h>
@@ -63,6 +74,11 @@
 #include <taskflow/taskflow.hpp>
 #endif
 
+#include "MappedFileSystem.h"
+#include "scene_cache.h"
+#include "SceneCulling.h"
+#include "TextureStreamer.h"
+
 using namespace donut;
 using namespace donut::math;
 using namespace donut::app;
@@ -72,6 +88,346 @@ using namespace donut::render;
 
 static bool g_PrintSceneGraph = false;
 static bool g_PrintFormats = false;
+static bool g_Headless = false;
+static uint32_t g_BenchmarkFrames = 0;
+static std::string g_BenchmarkOutput = "benchmark.json";
+static std::string g_LoadReportOutput;
+static bool g_TextureStreaming = false;
+static uint64_t g_TextureStreamingBudget = c_DefaultTextureStreamingBudget;
+
+static const int c_NumShadowCascades = 4;
+
+// Number of frames rendered before the benchmark starts recording, to keep pass creation out of the statistics
+static const uint32_t c_BenchmarkWarmupFrames = 10;
+
+// Time the headless benchmark waits for the scene to load before giving up
+static const double c_HeadlessLoadTimeoutSeconds = 600.0;
+
+// Escapes quotes, backslashes and control characters for use inside a JSON string literal
+static std::string EscapeJsonString(const std::string& value)
+{
+    std::string result;
+    result.reserve(value.size());
+
+    for (char c : value)
+    {
+        switch (c)
+        {
+        case '"': result += "\\\""; break;
+        case '\\': result += "\\\\"; break;
+        case '\b': result += "\\b"; break;
+        case '\f': result += "\\f"; break;
+        case '\n': result += "\\n"; break;
+        case '\r': result += "\\r"; break;
+        case '\t': result += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char code[8];
+                snprintf(code, std::size(code), "\\u%04x", static_cast<unsigned char>(c));
+                result += code;
+            }
+            else
+                result += c;
+            break;
+        }
+    }
+
+    return result;
+}
+
+// Collects CPU command encoding times of the individual passes in RenderScene
+class PassTimings
+{
+public:
+    class Scope
+    {
+    private:
+        PassTimings* m_Timings;
+        const char* m_Name;
+        std::chrono::high_resolution_clock::time_point m_StartTime;
+
+    public:
+        Scope(PassTimings* timings, const char* name)
+            : m_Timings(timings)
+            , m_Name(name)
+        {
+            if (m_Timings)
+                m_StartTime = std::chrono::high_resolution_clock::now();
+        }
+
+        ~Scope()
+        {
+            if (m_Timings)
+            {
+                auto endTime = std::chrono::high_resolution_clock::now();
+                m_Timings->AddSample(m_Name, std::chrono::duration<double, std::milli>(endTime - m_StartTime).count());
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    struct Statistics
+    {
+        std::string name;
+        size_t samples = 0;
+        double minMs = 0.0;
+        double avgMs = 0.0;
+        double p99Ms = 0.0;
+    };
+
+    bool Enabled = false;
+
+    // Returns a scope that records its lifetime under the given pass name, or does nothing when timing is disabled
+    [[nodiscard]] Scope Measure(const char* name)
+    {
+        return Scope(Enabled ? this : nullptr, name);
+    }
+
+    void AddSample(const char* name, double milliseconds)
+    {
+        // Samples can come from several recording threads at once
+        std::lock_guard<std::mutex> lockGuard(m_Mutex);
+
+        auto it = m_Samples.find(name);
+        if (it == m_Samples.end())
+        {
+            m_PassOrder.push_back(name);
+            it = m_Samples.emplace(name, std::vector<double>()).first;
+        }
+        it->second.push_back(milliseconds);
+    }
+
+    [[nodiscard]] std::vector<Statistics> GetStatistics() const
+    {
+        std::vector<Statistics> result;
+
+        for (const std::string& name : m_PassOrder)
+        {
+            std::vector<double> samples = m_Samples.at(name);
+            std::sort(samples.begin(), samples.end());
+
+            Statistics stats;
+            stats.name = name;
+            stats.samples = samples.size();
+            stats.minMs = samples.front();
+            for (double sample : samples)
+                stats.avgMs += sample;
+            stats.avgMs /= double(samples.size());
+            size_t p99Index = size_t(std::ceil(0.99 * double(samples.size()))) - 1;
+            stats.p99Ms = samples[std::min(p99Index, samples.size() - 1)];
+
+            result.push_back(stats);
+        }
+
+        return result;
+    }
+
+    // Writes a JSON report, or a CSV report when the file name ends with ".csv"
+    bool WriteReport(const std::string& fileName, const std::string& sceneName, uint32_t frames, uint2 resolution) const
+    {
+        std::ofstream file(fileName);
+        if (!file.is_open())
+        {
+            log::error("Cannot open benchmark report file '%s'", fileName.c_str());
+            return false;
+        }
+
+        char line[512];
+        const std::vector<Statistics> statistics = GetStatistics();
+
+        if (string_utils::ends_with(fileName, ".csv"))
+        {
+            file << "pass,samples,min_ms,avg_ms,p99_ms\n";
+            for (const Statistics& stats : statistics)
+            {
+                snprintf(line, std::size(line), "%s,%zu,%.4f,%.4f,%.4f\n",
+                    stats.name.c_str(), stats.samples, stats.minMs, stats.avgMs, stats.p99Ms);
+                file << line;
+            }
+        }
+        else
+        {
+            file << "{\n";
+            file << "  \"scene\": \"" << EscapeJsonString(sceneName) << "\",\n";
+            file << "  \"frames\": " << frames << ",\n";
+            file << "  \"width\": " << resolution.x << ",\n";
+            file << "  \"height\": " << resolution.y << ",\n";
+            file << "  \"passes\": [\n";
+            for (size_t i = 0; i < statistics.size(); i++)
+            {
+                const Statistics& stats = statistics[i];
+                snprintf(line, std::size(line), "    { \"name\": \"%s\", \"samples\": %zu, \"min_ms\": %.4f, \"avg_ms\": %.4f, \"p99_ms\": %.4f }%s\n",
+                    EscapeJsonString(stats.name).c_str(), stats.samples, stats.minMs, stats.avgMs, stats.p99Ms, (i + 1 < statistics.size()) ? "," : "");
+                file << line;
+            }
+            file << "  ]\n";
+            file << "}\n";
+        }
+
+        return true;
+    }
+
+private:
+    std::mutex m_Mutex;
+    std::vector<std::string> m_PassOrder;
+    std::unordered_map<std::string, std::vector<double>> m_Samples;
+};
+
+// Records when the stages of a scene load start and end, relative to the start of the load.
+// The stages overlap: textures are decoded on the executor while the scene is still being parsed,
+// and uploaded by the render thread as soon as they are decoded.
+class LoadTimings
+{
+public:
+    struct Stage
+    {
+        std::string name;
+        double startMs = -1.0;
+        double endMs = -1.0;
+
+        [[nodiscard]] double GetDurationMs() const { return endMs - startMs; }
+    };
+
+    void Begin(const std::string& sceneName)
+    {
+        std::lock_guard<std::mutex> lockGuard(m_Mutex);
+
+        m_SceneName = sceneName;
+        m_Stages.clear();
+        m_StartTime = std::chrono::high_resolution_clock::now();
+        m_Active = true;
+    }
+
+    // Only the first call for every stage has an effect, so that stages can be polled from several places
+    void BeginStage(const char* name)
+    {
+        std::lock_guard<std::mutex> lockGuard(m_Mutex);
+
+        if (m_Active)
+        {
+            Stage& stage = FindOrAddStage(name);
+            if (stage.startMs < 0.0)
+                stage.startMs = GetElapsedMs();
+        }
+    }
+
+    void EndStage(const char* name)
+    {
+        std::lock_guard<std::mutex> lockGuard(m_Mutex);
+
+        if (m_Active)
+        {
+            Stage& stage = FindOrAddStage(name);
+            if (stage.startMs < 0.0)
+                stage.startMs = GetElapsedMs();
+            if (stage.endMs < 0.0)
+                stage.endMs = GetElapsedMs();
+        }
+    }
+
+    [[nodiscard]] bool IsStageFinished(const char* name)
+    {
+        std::lock_guard<std::mutex> lockGuard(m_Mutex);
+
+        return m_Active && FindOrAddStage(name).endMs >= 0.0;
+    }
+
+    [[nodiscard]] bool IsActive() const { return m_Active; }
+
+    // Closes all open stages, adds the total and returns the stages in the order they were started
+    std::vector<Stage> Finish()
+    {
+        std::lock_guard<std::mutex> lockGuard(m_Mutex);
+
+        const double totalMs = GetElapsedMs();
+        for (Stage& stage : m_Stages)
+        {
+            if (stage.endMs < 0.0)
+                stage.endMs = totalMs;
+        }
+
+        std::vector<Stage> stages = m_Stages;
+        std::stable_sort(stages.begin(), stages.end(), [](const Stage& a, const Stage& b) { return a.startMs < b.startMs; });
+
+        Stage total;
+        total.name = "Total";
+        total.startMs = 0.0;
+        total.endMs = totalMs;
+        stages.push_back(total);
+
+        m_Active = false;
+        return stages;
+    }
+
+    // Writes a JSON report, or a CSV report when the file name ends with ".csv"
+    bool WriteReport(const std::string& fileName, const std::vector<Stage>& stages) const
+    {
+        std::ofstream file(fileName);
+        if (!file.is_open())
+        {
+            log::error("Cannot open load report file '%s'", fileName.c_str());
+            return false;
+        }
+
+        char line[512];
+
+        if (string_utils::ends_with(fileName, ".csv"))
+        {
+            file << "stage,start_ms,end_ms,duration_ms\n";
+            for (const Stage& stage : stages)
+            {
+                snprintf(line, std::size(line), "%s,%.3f,%.3f,%.3f\n",
+                    stage.name.c_str(), stage.startMs, stage.endMs, stage.GetDurationMs());
+                file << line;
+            }
+        }
+        else
+        {
+            file << "{\n";
+            file << "  \"scene\": \"" << EscapeJsonString(m_SceneName) << "\",\n";
+            file << "  \"stages\": [\n";
+            for (size_t i = 0; i < stages.size(); i++)
+            {
+                const Stage& stage = stages[i];
+                snprintf(line, std::size(line), "    { \"name\": \"%s\", \"start_ms\": %.3f, \"end_ms\": %.3f, \"duration_ms\": %.3f }%s\n",
+                    EscapeJsonString(stage.name).c_str(), stage.startMs, stage.endMs, stage.GetDurationMs(), (i + 1 < stages.size()) ? "," : "");
+                file << line;
+            }
+            file << "  ]\n";
+            file << "}\n";
+        }
+
+        return true;
+    }
+
+private:
+    std::mutex m_Mutex;
+    std::string m_SceneName;
+    std::vector<Stage> m_Stages;
+    std::chrono::high_resolution_clock::time_point m_StartTime;
+    std::atomic<bool> m_Active { false };
+
+    [[nodiscard]] double GetElapsedMs() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_StartTime).count();
+    }
+
+    Stage& FindOrAddStage(const char* name)
+    {
+        for (Stage& stage : m_Stages)
+        {
+            if (stage.name == name)
+                return stage;
+        }
+
+        Stage& stage = m_Stages.emplace_back();
+        stage.name = name;
+        return stage;
+    }
+};
 
 class RenderTargets : public GBufferRenderTargets
 {
@@ -248,6 +604,9 @@ struct UIData
     enum AntiAliasingMode               AntiAliasingMode = AntiAliasingMode::TEMPORAL;
     enum TemporalAntiAliasingJitter     TemporalAntiAliasingJitter = TemporalAntiAliasingJitter::MSAA;
     bool                                EnableVsync = true;
+    bool                                EnableParallelRecording = true;
+    bool                                UseSimdCulling = true;
+    bool                                UseMultiViewCulling = true;
     bool                                ShaderReoladRequested = false;
     bool                                EnableProceduralSky = true;
     bool                                EnableBloom = true;
@@ -277,6 +636,9 @@ private:
     typedef ApplicationBase Super;
 
     std::shared_ptr<RootFileSystem>     m_RootFs;
+    std::shared_ptr<MappedFileSystem>   m_MappedFs;
+    std::unique_ptr<TextureStreamer>    m_TextureStreamer;
+    std::filesystem::path               m_MediaPath;
 	std::vector<std::string>            m_SceneFilesAvailable;
     std::string                         m_CurrentSceneName;
 	std::shared_ptr<Scene>				m_Scene;
@@ -287,6 +649,10 @@ private:
     std::shared_ptr<DepthPass>          m_ShadowDepthPass;
     std::shared_ptr<InstancedOpaqueDrawStrategy> m_OpaqueDrawStrategy;
     std::shared_ptr<TransparentDrawStrategy> m_TransparentDrawStrategy;
+    SceneCulling                        m_SceneCulling;
+    MultiViewVisibility                 m_SharedVisibility;
+    std::shared_ptr<CulledDrawStrategy> m_CulledOpaqueDrawStrategy;
+    std::shared_ptr<CulledDrawStrategy> m_CulledTransparentDrawStrategy;
     std::unique_ptr<RenderTargets>      m_RenderTargets;
     std::shared_ptr<ForwardShadingPass> m_ForwardPass;
     std::unique_ptr<GBufferFillPass>    m_GBufferPass;
@@ -305,6 +671,15 @@ private:
     std::shared_ptr<IView>              m_ViewPrevious;
     
     nvrhi::CommandListHandle            m_CommandList;
+#ifdef DONUT_WITH_TASKFLOW
+    std::unique_ptr<tf::Executor>       m_Executor;
+    std::array<nvrhi::CommandListHandle, c_NumShadowCascades> m_ShadowCommandLists;
+    std::array<std::shared_ptr<DepthPass>, c_NumShadowCascades> m_CascadeDepthPasses;
+    nvrhi::CommandListHandle            m_OpaqueCommandList;
+    nvrhi::CommandListHandle            m_LightingCommandList;
+    nvrhi::CommandListHandle            m_TransparentCommandList;
+    nvrhi::CommandListHandle            m_PostProcessingCommandList;
+#endif
     bool                                m_PreviousViewsValid = false;
     FirstPersonCamera                   m_FirstPersonCamera;
     ThirdPersonCamera                   m_ThirdPersonCamera;
@@ -321,7 +696,14 @@ private:
     nvrhi::TextureHandle                m_LightProbeSpecularTexture;
 
     float                               m_WallclockTime = 0.f;
-    
+
+    PassTimings                         m_PassTimings;
+    LoadTimings                         m_LoadTimings;
+    uint32_t                            m_BenchmarkFrame = 0;
+    bool                                m_BenchmarkFinished = false;
+    uint32_t                            m_HeadlessFrameIndex = 0;
+    std::atomic<bool>                   m_SceneLoadFailed = false;
+
     UIData&                             m_ui;
 
 public:
@@ -331,15 +713,22 @@ public:
         , m_ui(ui)
         , m_BindingCache(deviceManager->GetDevice())
     { 
-        std::shared_ptr<NativeFileSystem> nativeFS = std::make_shared<NativeFileSystem>();
+        m_MappedFs = std::make_shared<MappedFileSystem>();
+
+        if (g_TextureStreaming)
+        {
+            m_MappedFs->SetStreamingTailSize(c_TextureStreamingTailSize);
+            m_TextureStreamer = std::make_unique<TextureStreamer>(GetDevice(), m_MappedFs, g_TextureStreamingBudget * 1024 * 1024);
+        }
 
         std::filesystem::path mediaPath = app::GetDirectoryWithExecutable().parent_path() / "media";
+        m_MediaPath = mediaPath;
         std::filesystem::path frameworkShaderPath = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
         
         m_RootFs = std::make_shared<RootFileSystem>();
-        m_RootFs->mount("/media", mediaPath);
+        m_RootFs->mount("/media", std::make_shared<RelativeFileSystem>(m_MappedFs, mediaPath));
         m_RootFs->mount("/shaders/donut", frameworkShaderPath);
-        m_RootFs->mount("/native", nativeFS);
+        m_RootFs->mount("/native", m_MappedFs);
 
         std::filesystem::path scenePath = "/media/glTF-Sample-Models/2.0";
         m_SceneFilesAvailable = FindScenes(*m_RootFs, scenePath);
@@ -357,6 +746,10 @@ public:
 
         m_OpaqueDrawStrategy = std::make_shared<InstancedOpaqueDrawStrategy>();
         m_TransparentDrawStrategy = std::make_shared<TransparentDrawStrategy>();
+        m_CulledOpaqueDrawStrategy = std::make_shared<CulledDrawStrategy>(m_SceneCulling, CulledDrawStrategy::Mode::Opaque);
+        m_CulledTransparentDrawStrategy = std::make_shared<CulledDrawStrategy>(m_SceneCulling, CulledDrawStrategy::Mode::Transparent);
+        m_CulledOpaqueDrawStrategy->SetSharedVisibility(&m_SharedVisibility);
+        m_CulledTransparentDrawStrategy->SetSharedVisibility(&m_SharedVisibility);
 
 
         const nvrhi::Format shadowMapFormats[] = {
@@ -372,7 +765,7 @@ public:
         
         nvrhi::Format shadowMapFormat = nvrhi::utils::ChooseFormat(GetDevice(), shadowMapFeatures, shadowMapFormats, std::size(shadowMapFormats));
         
-        m_ShadowMap = std::make_shared<CascadedShadowMap>(GetDevice(), 2048, 4, 0, shadowMapFormat);
+        m_ShadowMap = std::make_shared<CascadedShadowMap>(GetDevice(), 2048, c_NumShadowCascades, 0, shadowMapFormat);
         m_ShadowMap->SetupProxyViews();
         
         m_ShadowFramebuffer = std::make_shared<FramebufferFactory>(GetDevice());
@@ -386,6 +779,31 @@ public:
 
         m_CommandList = GetDevice()->createCommandList();
 
+#ifdef DONUT_WITH_TASKFLOW
+        m_Executor = std::make_unique<tf::Executor>();
+
+        // Parallel recording relies on deferred command lists, which the D3D11 backend does not handle well
+        if (GetDevice()->getGraphicsAPI() != nvrhi::GraphicsAPI::D3D11)
+        {
+            auto commandListParams = nvrhi::CommandListParameters()
+                .setEnableImmediateExecution(false);
+
+            for (auto& commandList : m_ShadowCommandLists)
+                commandList = GetDevice()->createCommandList(commandListParams);
+
+            // Passes cache their binding sets without locking, so every cascade that is recorded in parallel has its own
+            for (auto& depthPass : m_CascadeDepthPasses)
+            {
+                depthPass = std::make_shared<DepthPass>(GetDevice(), m_CommonPasses);
+                depthPass->Init(*m_ShaderFactory, shadowDepthParams);
+            }
+            m_OpaqueCommandList = GetDevice()->createCommandList(commandListParams);
+            m_LightingCommandList = GetDevice()->createCommandList(commandListParams);
+            m_TransparentCommandList = GetDevice()->createCommandList(commandListParams);
+            m_PostProcessingCommandList = GetDevice()->createCommandList(commandListParams);
+        }
+#endif
+
         m_FirstPersonCamera.SetMoveSpeed(3.0f);
         m_ThirdPersonCamera.SetMoveSpeed(3.0f);
         
@@ -419,6 +837,72 @@ public:
         return m_CurrentSceneName;
     }
 
+    bool IsBenchmarking() const
+    {
+        return g_BenchmarkFrames > 0;
+    }
+
+    bool IsBenchmarkFinished() const
+    {
+        return m_BenchmarkFinished;
+    }
+
+    bool IsSceneLoadFailed() const
+    {
+        return m_SceneLoadFailed;
+    }
+
+    // The headless benchmark calls Animate and Render without the device manager's message loop,
+    // so the frame index of the device manager never advances. Use this instead of IRenderPass::GetFrameIndex
+    // for all per-frame scene work in this class, which keeps that work from repeating in headless mode.
+    uint32_t GetRenderFrameIndex() const
+    {
+        return g_Headless ? m_HeadlessFrameIndex : Super::GetFrameIndex();
+    }
+
+    void AdvanceHeadlessFrame()
+    {
+        m_HeadlessFrameIndex++;
+    }
+
+    // Moves the camera along a fixed orbit around the scene so that benchmark runs are repeatable
+    void AnimateBenchmarkCamera()
+    {
+        m_ui.ActiveSceneCamera = nullptr;
+        m_ui.UseThirdPersonCamera = false;
+
+        box3 sceneBounds = m_Scene->GetSceneGraph()->GetRootNode()->GetGlobalBoundingBox();
+        float3 center = sceneBounds.center();
+        float radius = length(sceneBounds.diagonal()) * 0.25f;
+
+        uint32_t measuredFrame = m_BenchmarkFrame > c_BenchmarkWarmupFrames ? m_BenchmarkFrame - c_BenchmarkWarmupFrames : 0;
+        float angle = 2.f * dm::PI_f * float(measuredFrame) / float(g_BenchmarkFrames);
+        float3 cameraPos = center + float3(cosf(angle) * radius, 0.f, sinf(angle) * radius);
+
+        m_FirstPersonCamera.LookAt(cameraPos, center);
+    }
+
+    void AdvanceBenchmark()
+    {
+        m_BenchmarkFrame++;
+
+        if (m_BenchmarkFrame < c_BenchmarkWarmupFrames + g_BenchmarkFrames)
+            return;
+
+        m_BenchmarkFinished = true;
+        m_PassTimings.Enabled = false;
+
+        uint2 resolution = m_RenderTargets ? m_RenderTargets->GetSize() : uint2(0u);
+        if (m_PassTimings.WriteReport(g_BenchmarkOutput, m_CurrentSceneName, g_BenchmarkFrames, resolution))
+            log::info("Benchmark report written to '%s'", g_BenchmarkOutput.c_str());
+
+        for (const auto& stats : m_PassTimings.GetStatistics())
+            log::info("%-24s min %.3f ms, avg %.3f ms, p99 %.3f ms", stats.name.c_str(), stats.minMs, stats.avgMs, stats.p99Ms);
+
+        if (GetDeviceManager()->GetWindow())
+            glfwSetWindowShouldClose(GetDeviceManager()->GetWindow(), GLFW_TRUE);
+    }
+
     void SetCurrentSceneName(const std::string& sceneName)
     {
         if (m_CurrentSceneName == sceneName)
@@ -513,7 +997,12 @@ public:
     }
 
     virtual void Animate(float fElapsedTimeSeconds) override
-    { 
+    {
+        UpdateLoadTimings();
+
+        if (IsBenchmarking() && IsSceneLoaded() && !m_BenchmarkFinished)
+            AnimateBenchmarkCamera();
+
         if (!m_ui.ActiveSceneCamera)
             GetActiveCamera().Animate(fElapsedTimeSeconds);
 
@@ -537,11 +1026,13 @@ public:
 
     virtual void SceneUnloading() override
     {
+        if (m_TextureStreamer) m_TextureStreamer->Clear();
         if (m_ForwardPass) m_ForwardPass->ResetBindingCache();
         if (m_DeferredLightingPass) m_DeferredLightingPass->ResetBindingCache();
         if (m_GBufferPass) m_GBufferPass->ResetBindingCache();
         if (m_LightProbePass) m_LightProbePass->ResetCaches();
         if (m_ShadowDepthPass) m_ShadowDepthPass->ResetBindingCache();
+        ResetCascadeDepthPasses();
         m_BindingCache.Clear();
         m_SunLight.reset();
         m_ui.SelectedMaterial = nullptr;
@@ -555,31 +1046,111 @@ public:
 
     virtual bool LoadScene(std::shared_ptr<IFileSystem> fs, const std::filesystem::path& fileName) override
     {
-        using namespace std::chrono;
+        m_SceneLoadFailed = false;
 
-        Scene* scene = new Scene(GetDevice(), *m_ShaderFactory, fs, m_TextureCache, nullptr, nullptr);
+        CachedScene* scene = new CachedScene(GetDevice(), *m_ShaderFactory, fs, m_TextureCache, nullptr, nullptr);
 
-        auto startTime = high_resolution_clock::now();
+        m_LoadTimings.Begin(fileName.generic_string());
 
-        if (scene->Load(fileName))
-        {
-            m_Scene = std::unique_ptr<Scene>(scene);
+        // Reading the files, parsing the scene and building the mesh buffers happen inside Scene::Load,
+        // or are replaced by reading the scene cache when it is up to date.
+        // Texture decoding starts there too, and runs on the executor when one is available.
+        m_LoadTimings.BeginStage("Parse+Geometry");
+        m_LoadTimings.BeginStage("TextureDecode");
 
-            auto endTime = high_resolution_clock::now();
-            auto duration = duration_cast<milliseconds>(endTime - startTime).count();
-            log::info("Scene loading time: %llu ms", duration);
+        const std::filesystem::path cacheDirectory = app::GetDirectoryWithExecutable() / "scene_cache";
+        const auto getNativeFileName = [this](const std::filesystem::path& name) { return GetNativeFileName(name); };
+#ifdef DONUT_WITH_TASKFLOW
+        bool loaded = scene->LoadWithCache(fileName, cacheDirectory, getNativeFileName, m_Executor.get());
+#else
+        bool loaded = scene->LoadWithCache(fileName, cacheDirectory, getNativeFileName);
+#endif
 
+        m_LoadTimings.EndStage("Parse+Geometry");
+
+        if (loaded)
+        {
+            m_Scene = std::unique_ptr<Scene>(scene);
             return true;
         }
         
+        m_LoadTimings.Finish();
+        m_SceneLoadFailed = true;
         return false;
     }
+
+    // Maps a path in the root file system to the file on the disk, for the scene cache and the texture streaming.
+    // Returns an empty path for files that are not on the disk, which are then loaded without the cache.
+    std::filesystem::path GetNativeFileName(const std::filesystem::path& fileName) const
+    {
+        const std::string name = fileName.generic_string();
+
+        if (name.rfind("/media/", 0) == 0)
+            return m_MediaPath / name.substr(strlen("/media/"));
+
+        if (name.rfind("/native/", 0) == 0)
+            return name.substr(strlen("/native/"));
+
+        return std::filesystem::path();
+    }
+
+    // Tracks the texture decode and upload stages of the scene being loaded, which complete asynchronously
+    void UpdateLoadTimings()
+    {
+        if (!m_LoadTimings.IsActive() || !m_TextureCache)
+            return;
+
+        // The number of requested textures is final once the scene has been parsed
+        const bool sceneParsed = m_LoadTimings.IsStageFinished("Parse+Geometry");
+        const uint32_t requested = m_TextureCache->GetNumberOfRequestedTextures();
+
+        if (m_TextureCache->GetNumberOfFinalizedTextures() > 0)
+            m_LoadTimings.BeginStage("TextureUpload");
+
+        if (sceneParsed && m_TextureCache->GetNumberOfLoadedTextures() >= requested)
+            m_LoadTimings.EndStage("TextureDecode");
+
+        if (sceneParsed && m_TextureCache->GetNumberOfFinalizedTextures() >= requested)
+            m_LoadTimings.EndStage("TextureUpload");
+    }
+
+    void FinishLoadTimings()
+    {
+        if (!m_LoadTimings.IsActive())
+            return;
+
+        const std::vector<LoadTimings::Stage> stages = m_LoadTimings.Finish();
+
+        log::info("Scene loading times for '%s':", m_CurrentSceneName.c_str());
+        for (const auto& stage : stages)
+        {
+            log::info("    %-16s %9.1f ms   (%.1f - %.1f ms)", stage.name.c_str(), stage.GetDurationMs(), stage.startMs, stage.endMs);
+        }
+
+        const MappedFileSystem::Statistics& fsStats = m_MappedFs->GetStatistics();
+        log::info("Files mapped: %u (%.1f MB), images using converted DDS textures: %u, images decoded: %u",
+            fsStats.filesMapped.load(), double(fsStats.bytesMapped.load()) / (1024.0 * 1024.0),
+            fsStats.imagesRedirected.load(), fsStats.imagesDecoded.load());
+
+        if (!g_LoadReportOutput.empty() && m_LoadTimings.WriteReport(g_LoadReportOutput, stages))
+            log::info("Load report written to '%s'", g_LoadReportOutput.c_str());
+    }
     
     virtual void SceneLoaded() override
     {
         Super::SceneLoaded();
         
-        m_Scene->FinishedLoading(GetFrameIndex());
+        // All textures are decoded and uploaded by the time the scene is reported as loaded
+        UpdateLoadTimings();
+        m_LoadTimings.EndStage("TextureDecode");
+        m_LoadTimings.EndStage("TextureUpload");
+
+        m_LoadTimings.BeginStage("SceneBuffers");
+        m_Scene->FinishedLoading(GetRenderFrameIndex());
+        m_LoadTimings.EndStage("SceneBuffers");
+
+        // FinishedLoading refreshed the scene graph, so its structure change is never seen by CollectDirtyInstances
+        m_SceneCulling.Invalidate();
 
         m_WallclockTime = 0.f;
         m_PreviousViewsValid = false;
@@ -631,6 +1202,16 @@ public:
 
         if (g_PrintSceneGraph)
             PrintSceneGraph(m_Scene->GetSceneGraph()->GetRootNode());
+
+        if (m_TextureStreamer)
+        {
+            m_TextureStreamer->Register(*m_Scene->GetSceneGraph(), [this](const std::filesystem::path& fileName)
+            {
+                return GetNativeFileName(fileName);
+            });
+        }
+
+        FinishLoadTimings();
     }
 
     void PointThirdPersonCameraAt(const std::shared_ptr<SceneGraphNode>& node)
@@ -653,6 +1234,11 @@ public:
         return m_TextureCache;
     }
 
+    TextureStreamer* GetTextureStreamer()
+    {
+        return m_TextureStreamer.get();
+    }
+
     std::shared_ptr<Scene> GetScene()
     {
         return m_Scene;
@@ -832,12 +1418,32 @@ public:
 
     virtual void RenderScene(nvrhi::IFramebuffer* framebuffer) override
     {
-        int windowWidth, windowHeight;
-        GetDeviceManager()->GetWindowDimensions(windowWidth, windowHeight);
+        // Use the framebuffer size rather than the window size so that offscreen (headless) rendering works
+        const nvrhi::FramebufferInfo& fbinfo = framebuffer->getFramebufferInfo();
+        int windowWidth = int(fbinfo.width);
+        int windowHeight = int(fbinfo.height);
         nvrhi::Viewport windowViewport = nvrhi::Viewport(float(windowWidth), float(windowHeight));
         nvrhi::Viewport renderViewport = windowViewport;
 
-        m_Scene->RefreshSceneGraph(GetFrameIndex());
+        if (IsBenchmarking())
+            m_PassTimings.Enabled = !m_BenchmarkFinished && m_BenchmarkFrame >= c_BenchmarkWarmupFrames;
+
+        std::optional<PassTimings::Scope> frameTimer;
+        frameTimer.emplace(m_PassTimings.Enabled ? &m_PassTimings : nullptr, "Frame");
+
+        {
+            auto timer = m_PassTimings.Measure("RefreshSceneGraph");
+
+            // Also while the SIMD culling is off, so that it starts from current bounds when it is enabled
+            m_SceneCulling.CollectDirtyInstances(*m_Scene->GetSceneGraph());
+            m_Scene->RefreshSceneGraph(GetRenderFrameIndex());
+        }
+
+        if (m_ui.UseSimdCulling)
+        {
+            auto timer = m_PassTimings.Measure("SceneCulling");
+            m_SceneCulling.Update(*m_Scene->GetSceneGraph());
+        }
 
         bool exposureResetRequired = false;
         
@@ -885,46 +1491,8 @@ public:
             m_ui.ShaderReoladRequested = false;
         }
 
-        m_CommandList->open();
-
-        m_Scene->RefreshBuffers(m_CommandList, GetFrameIndex());
-
-        nvrhi::ITexture* framebufferTexture = framebuffer->getDesc().colorAttachments[0].texture;
-        m_CommandList->clearTextureFloat(framebufferTexture, nvrhi::AllSubresources, nvrhi::Color(0.f));
-        
         m_AmbientTop = m_ui.AmbientIntensity * m_ui.SkyParams.skyColor * m_ui.SkyParams.brightness;
         m_AmbientBottom = m_ui.AmbientIntensity * m_ui.SkyParams.groundColor * m_ui.SkyParams.brightness;
-        if (m_ui.EnableShadows)
-        {
-            m_SunLight->shadowMap = m_ShadowMap;
-            box3 sceneBounds = m_Scene->GetSceneGraph()->GetRootNode()->GetGlobalBoundingBox();
-
-            frustum projectionFrustum = m_View->GetProjectionFrustum();
-            const float maxShadowDistance = 100.f;
-
-            dm::affine3 viewMatrixInv = m_View->GetChildView(ViewType::PLANAR, 0)->GetInverseViewMatrix();
-
-            float zRange = length(sceneBounds.diagonal()) * 0.5f;
-            m_ShadowMap->SetupForPlanarViewStable(*m_SunLight, projectionFrustum, viewMatrixInv, maxShadowDistance, zRange, zRange, m_ui.CsmExponent);
-
-            m_ShadowMap->Clear(m_CommandList);
-
-            DepthPass::Context context;
-
-            RenderCompositeView(m_CommandList, 
-                &m_ShadowMap->GetView(), nullptr, 
-                *m_ShadowFramebuffer,
-                m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_OpaqueDrawStrategy, 
-                *m_ShadowDepthPass,
-                context,
-                "ShadowMap",
-                m_ui.EnableMaterialEvents);
-        }
-        else
-        {
-            m_SunLight->shadowMap = nullptr;
-        }
 
         std::vector<std::shared_ptr<LightProbe>> lightProbes;
         if (m_ui.EnableLightProbe)
@@ -940,39 +1508,321 @@ public:
             }
         }
 
-        m_RenderTargets->Clear(m_CommandList);
+        if (m_TextureStreamer)
+        {
+            auto timer = m_PassTimings.Measure("TextureStreaming");
+            StreamTextures();
+        }
+
+        SetupShadowMap();
+        CullAllViews();
+
+#ifdef DONUT_WITH_TASKFLOW
+        if (m_ui.EnableParallelRecording && m_OpaqueCommandList)
+        {
+            RenderSceneParallel(framebuffer, lightProbes, exposureResetRequired, windowViewport);
+        }
+        else
+#endif
+        {
+            m_CommandList->open();
+
+            RenderPrologue(m_CommandList, framebuffer, exposureResetRequired);
+
+            if (m_ui.EnableShadows)
+            {
+                auto timer = m_PassTimings.Measure("ShadowMap");
+
+                DepthPass::Context context;
+
+                RenderCompositeView(m_CommandList, 
+                    &m_ShadowMap->GetView(), nullptr, 
+                    *m_ShadowFramebuffer,
+                    m_Scene->GetSceneGraph()->GetRootNode(),
+                    GetOpaqueDrawStrategy(),
+                    *m_ShadowDepthPass,
+                    context,
+                    "ShadowMap",
+                    m_ui.EnableMaterialEvents);
+            }
+
+            ForwardShadingPass::Context forwardContext;
+
+            if (!m_ui.UseDeferredShading || m_ui.EnableTranslucency)
+            {
+                m_ForwardPass->PrepareLights(forwardContext, m_CommandList, m_Scene->GetSceneGraph()->GetLights(), m_AmbientTop, m_AmbientBottom, lightProbes);
+            }
+
+            RenderOpaqueGeometry(m_CommandList, GetOpaqueDrawStrategy(), forwardContext);
+
+            RenderLightingAndSky(m_CommandList, GetOpaqueDrawStrategy(), GetTransparentDrawStrategy());
+
+            if (m_ui.EnableTranslucency)
+            {
+                RenderTransparentGeometry(m_CommandList, GetTransparentDrawStrategy(), forwardContext);
+            }
+
+            RenderPostProcessing(m_CommandList, framebuffer, exposureResetRequired, windowViewport);
+
+            m_CommandList->close();
+
+            {
+                auto timer = m_PassTimings.Measure("Submit");
+                GetDevice()->executeCommandList(m_CommandList);
+            }
+        }
+
+        frameTimer.reset();
+
+        if (!m_ui.ScreenshotFileName.empty())
+        {
+            nvrhi::ITexture* framebufferTexture = framebuffer->getDesc().colorAttachments[0].texture;
+            SaveTextureToFile(GetDevice(), m_CommonPasses.get(), framebufferTexture, nvrhi::ResourceStates::RenderTarget, m_ui.ScreenshotFileName.c_str());
+            m_ui.ScreenshotFileName = "";
+        }
+
+        if (m_Pick)
+        {
+            m_Pick = false;
+            uint4 pixelValue = m_PixelReadbackPass->ReadUInts();
+            m_ui.SelectedMaterial = nullptr;
+            m_ui.SelectedNode = nullptr;
+
+            for (const auto& material : m_Scene->GetSceneGraph()->GetMaterials())
+            {
+                if (material->materialID == int(pixelValue.x))
+                {
+                    m_ui.SelectedMaterial = material;
+                    break;
+                }
+            }
+
+            for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+            {
+                if (instance->GetInstanceIndex() == int(pixelValue.y))
+                {
+                    m_ui.SelectedNode = instance->GetNodeSharedPtr();
+                    break;
+                }
+            }
+
+            if (m_ui.SelectedNode)
+            {
+                log::info("Picked node: %s", m_ui.SelectedNode->GetPath().generic_string().c_str());
+                PointThirdPersonCameraAt(m_ui.SelectedNode);
+            }
+            else
+            {
+                PointThirdPersonCameraAt(m_Scene->GetSceneGraph()->GetRootNode());
+            }
+        }
+
+        m_TemporalAntiAliasingPass->AdvanceFrame();
+        std::swap(m_View, m_ViewPrevious);
+
+        GetDeviceManager()->SetVsyncEnabled(m_ui.EnableVsync);
+
+        if (IsBenchmarking() && !m_BenchmarkFinished)
+            AdvanceBenchmark();
+    }
+
+    // Requests the texture levels needed for the current view and uploads the ones that have been read.
+    // Replaced textures invalidate the material binding sets, so this runs before any pass records its draws.
+    void StreamTextures()
+    {
+        m_TextureStreamer->Update(*m_View->GetChildView(ViewType::PLANAR, 0), GetRenderFrameIndex());
+
+        if (!m_TextureStreamer->HasPendingUploads())
+            return;
+
+        m_CommandList->open();
+        const bool texturesReplaced = m_TextureStreamer->ProcessUploads(m_CommandList);
+        m_CommandList->close();
+        GetDevice()->executeCommandList(m_CommandList);
+
+        if (texturesReplaced)
+        {
+            if (m_ForwardPass) m_ForwardPass->ResetBindingCache();
+            if (m_GBufferPass) m_GBufferPass->ResetBindingCache();
+            if (m_ShadowDepthPass) m_ShadowDepthPass->ResetBindingCache();
+            ResetCascadeDepthPasses();
+            if (m_MaterialIDPass) m_MaterialIDPass->ResetBindingCache();
+        }
+    }
+
+    void ResetCascadeDepthPasses()
+    {
+#ifdef DONUT_WITH_TASKFLOW
+        for (auto& depthPass : m_CascadeDepthPasses)
+        {
+            if (depthPass) depthPass->ResetBindingCache();
+        }
+#endif
+    }
+
+    // Records the per-frame work that all other passes depend on: scene buffer updates, render target clears and the shadow map setup
+    void RenderPrologue(nvrhi::ICommandList* commandList, nvrhi::IFramebuffer* framebuffer, bool exposureResetRequired)
+    {
+        {
+            auto timer = m_PassTimings.Measure("RefreshBuffers");
+            m_Scene->RefreshBuffers(commandList, GetRenderFrameIndex());
+        }
+
+        nvrhi::ITexture* framebufferTexture = framebuffer->getDesc().colorAttachments[0].texture;
+        commandList->clearTextureFloat(framebufferTexture, nvrhi::AllSubresources, nvrhi::Color(0.f));
+
+        if (m_ui.EnableShadows)
+        {
+            m_ShadowMap->Clear(commandList);
+        }
+
+        m_RenderTargets->Clear(commandList);
 
         if (exposureResetRequired)
-            m_ToneMappingPass->ResetExposure(m_CommandList, 0.5f);
+            m_ToneMappingPass->ResetExposure(commandList, 0.5f);
+    }
 
-        ForwardShadingPass::Context forwardContext;
+    // Fits the shadow cascades to the current view. Runs before any recording so that the cascade views
+    // are final when the scene is culled for all views at once.
+    void SetupShadowMap()
+    {
+        if (!m_ui.EnableShadows)
+        {
+            m_SunLight->shadowMap = nullptr;
+            return;
+        }
+
+        m_SunLight->shadowMap = m_ShadowMap;
+        box3 sceneBounds = m_Scene->GetSceneGraph()->GetRootNode()->GetGlobalBoundingBox();
+
+        frustum projectionFrustum = m_View->GetProjectionFrustum();
+        const float maxShadowDistance = 100.f;
+
+        dm::affine3 viewMatrixInv = m_View->GetChildView(ViewType::PLANAR, 0)->GetInverseViewMatrix();
+
+        float zRange = length(sceneBounds.diagonal()) * 0.5f;
+        m_ShadowMap->SetupForPlanarViewStable(*m_SunLight, projectionFrustum, viewMatrixInv, maxShadowDistance, zRange, zRange, m_ui.CsmExponent);
+    }
+
+    // Culls the scene once for every view rendered this frame: the shadow cascades and the main view or both stereo eyes.
+    // The culled draw strategies then look their views up in m_SharedVisibility instead of culling them again.
+    void CullAllViews()
+    {
+        if (!m_ui.UseSimdCulling || !m_ui.UseMultiViewCulling)
+        {
+            m_SharedVisibility.Clear();
+            return;
+        }
+
+        auto timer = m_PassTimings.Measure("MultiViewCulling");
 
-        if (!m_ui.UseDeferredShading || m_ui.EnableTranslucency)
+        std::vector<const IView*> views;
+
+        if (m_ui.EnableShadows)
+        {
+            for (int cascade = 0; cascade < c_NumShadowCascades; cascade++)
+                views.push_back(m_ShadowMap->GetView().GetChildView(ViewType::PLANAR, cascade));
+        }
+
+        const uint32_t numMainViews = m_View->GetNumChildViews(ViewType::PLANAR);
+        for (uint32_t viewIndex = 0; viewIndex < numMainViews; viewIndex++)
+            views.push_back(m_View->GetChildView(ViewType::PLANAR, viewIndex));
+
+        m_SceneCulling.CullViews(views, m_SharedVisibility);
+    }
+
+    IDrawStrategy& GetOpaqueDrawStrategy()
+    {
+        if (m_ui.UseSimdCulling)
+            return *m_CulledOpaqueDrawStrategy;
+
+        return *m_OpaqueDrawStrategy;
+    }
+
+    IDrawStrategy& GetTransparentDrawStrategy()
+    {
+        if (m_ui.UseSimdCulling)
+            return *m_CulledTransparentDrawStrategy;
+
+        return *m_TransparentDrawStrategy;
+    }
+
+    // Draw strategies keep per-view state, so every recording thread needs its own
+    std::unique_ptr<IDrawStrategy> CreateOpaqueDrawStrategy() const
+    {
+        if (m_ui.UseSimdCulling)
+        {
+            auto drawStrategy = std::make_unique<CulledDrawStrategy>(m_SceneCulling, CulledDrawStrategy::Mode::Opaque);
+            drawStrategy->SetSharedVisibility(&m_SharedVisibility);
+            return drawStrategy;
+        }
+
+        return std::make_unique<InstancedOpaqueDrawStrategy>();
+    }
+
+    std::unique_ptr<IDrawStrategy> CreateTransparentDrawStrategy() const
+    {
+        if (m_ui.UseSimdCulling)
         {
-            m_ForwardPass->PrepareLights(forwardContext, m_CommandList, m_Scene->GetSceneGraph()->GetLights(), m_AmbientTop, m_AmbientBottom, lightProbes);
+            auto drawStrategy = std::make_unique<CulledDrawStrategy>(m_SceneCulling, CulledDrawStrategy::Mode::Transparent);
+            drawStrategy->SetSharedVisibility(&m_SharedVisibility);
+            return drawStrategy;
         }
 
+        return std::make_unique<TransparentDrawStrategy>();
+    }
+
+    // Records the opaque scene geometry, either into the G-buffer or through the forward shading pass
+    void RenderOpaqueGeometry(nvrhi::ICommandList* commandList, IDrawStrategy& drawStrategy, ForwardShadingPass::Context& forwardContext)
+    {
         if (m_ui.UseDeferredShading)
         {
+            auto timer = m_PassTimings.Measure("GBufferFill");
+
             GBufferFillPass::Context gbufferContext;
 
-            RenderCompositeView(m_CommandList,
+            RenderCompositeView(commandList,
                 m_View.get(), m_ViewPrevious.get(), 
                 *m_RenderTargets->GBufferFramebuffer, 
                 m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_OpaqueDrawStrategy,
+                drawStrategy,
                 *m_GBufferPass,
                 gbufferContext,
                 "GBufferFill",
                 m_ui.EnableMaterialEvents);
+        }
+        else
+        {
+            auto timer = m_PassTimings.Measure("ForwardOpaque");
+
+            RenderCompositeView(commandList,
+                m_View.get(), m_ViewPrevious.get(),
+                *m_RenderTargets->ForwardFramebuffer,
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                drawStrategy,
+                *m_ForwardPass,
+                forwardContext,
+                "ForwardOpaque",
+                m_ui.EnableMaterialEvents);
+        }
+    }
 
+    // Records SSAO and deferred lighting (when deferred shading is used), the material ID pass for picking, and the sky
+    void RenderLightingAndSky(nvrhi::ICommandList* commandList, IDrawStrategy& opaqueDrawStrategy, IDrawStrategy& transparentDrawStrategy)
+    {
+        if (m_ui.UseDeferredShading)
+        {
             nvrhi::ITexture* ambientOcclusionTarget = nullptr;
             if (m_ui.EnableSsao && m_SsaoPass)
             {
-                m_SsaoPass->Render(m_CommandList, m_ui.SsaoParams, *m_View);
+                auto timer = m_PassTimings.Measure("SSAO");
+
+                m_SsaoPass->Render(commandList, m_ui.SsaoParams, *m_View);
                 ambientOcclusionTarget = m_RenderTargets->AmbientOcclusion;
             }
 
+            auto timer = m_PassTimings.Measure("DeferredLighting");
+
             DeferredLightingPass::Inputs deferredInputs;
             deferredInputs.SetGBuffer(*m_RenderTargets);
             deferredInputs.ambientOcclusion = m_ui.EnableSsao ? m_RenderTargets->AmbientOcclusion : nullptr;
@@ -982,83 +1832,87 @@ public:
             deferredInputs.lightProbes = m_ui.EnableLightProbe ? &m_LightProbes : nullptr;
             deferredInputs.output = m_RenderTargets->HdrColor;
 
-            m_DeferredLightingPass->Render(m_CommandList, *m_View, deferredInputs);
-        }
-        else
-        {
-            RenderCompositeView(m_CommandList,
-                m_View.get(), m_ViewPrevious.get(),
-                *m_RenderTargets->ForwardFramebuffer,
-                m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_OpaqueDrawStrategy,
-                *m_ForwardPass,
-                forwardContext,
-                "ForwardOpaque",
-                m_ui.EnableMaterialEvents);
+            m_DeferredLightingPass->Render(commandList, *m_View, deferredInputs);
         }
 
         if(m_Pick)
         {
-            m_CommandList->clearTextureUInt(m_RenderTargets->MaterialIDs, nvrhi::AllSubresources, 0xffff);
+            auto timer = m_PassTimings.Measure("MaterialID");
+
+            commandList->clearTextureUInt(m_RenderTargets->MaterialIDs, nvrhi::AllSubresources, 0xffff);
 
             MaterialIDPass::Context materialIdContext;
 
-            RenderCompositeView(m_CommandList, 
+            RenderCompositeView(commandList, 
                 m_View.get(), m_ViewPrevious.get(),
                 *m_RenderTargets->MaterialIDFramebuffer,
                 m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_OpaqueDrawStrategy,
+                opaqueDrawStrategy,
                 *m_MaterialIDPass,
                 materialIdContext,
                 "MaterialID");
             
             if (m_ui.EnableTranslucency)
             {
-                RenderCompositeView(m_CommandList,
+                RenderCompositeView(commandList,
                     m_View.get(), m_ViewPrevious.get(),
                     *m_RenderTargets->MaterialIDFramebuffer,
                     m_Scene->GetSceneGraph()->GetRootNode(),
-                    *m_TransparentDrawStrategy,
+                    transparentDrawStrategy,
                     *m_MaterialIDPass,
                     materialIdContext,
                     "MaterialID - Translucent");
             }
 
-            m_PixelReadbackPass->Capture(m_CommandList, m_PickPosition);
+            m_PixelReadbackPass->Capture(commandList, m_PickPosition);
         }
 
         if (m_ui.EnableProceduralSky)
-            m_SkyPass->Render(m_CommandList, *m_View, *m_SunLight, m_ui.SkyParams);
-
-        if (m_ui.EnableTranslucency)
         {
-            RenderCompositeView(m_CommandList,
-                m_View.get(), m_ViewPrevious.get(),
-                *m_RenderTargets->ForwardFramebuffer,
-                m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_TransparentDrawStrategy,
-                *m_ForwardPass,
-                forwardContext,
-                "ForwardTransparent",
-                m_ui.EnableMaterialEvents);
+            auto timer = m_PassTimings.Measure("Sky");
+            m_SkyPass->Render(commandList, *m_View, *m_SunLight, m_ui.SkyParams);
         }
+    }
 
+    void RenderTransparentGeometry(nvrhi::ICommandList* commandList, IDrawStrategy& drawStrategy, ForwardShadingPass::Context& forwardContext)
+    {
+        auto timer = m_PassTimings.Measure("ForwardTransparent");
+
+        RenderCompositeView(commandList,
+            m_View.get(), m_ViewPrevious.get(),
+            *m_RenderTargets->ForwardFramebuffer,
+            m_Scene->GetSceneGraph()->GetRootNode(),
+            drawStrategy,
+            *m_ForwardPass,
+            forwardContext,
+            "ForwardTransparent",
+            m_ui.EnableMaterialEvents);
+    }
+
+    // Records TAA or MSAA resolve, bloom, tone mapping, and the final blit into the output framebuffer
+    void RenderPostProcessing(nvrhi::ICommandList* commandList, nvrhi::IFramebuffer* framebuffer, bool exposureResetRequired, const nvrhi::Viewport& windowViewport)
+    {
         nvrhi::ITexture* finalHdrColor = m_RenderTargets->HdrColor;
 
         if (m_ui.AntiAliasingMode == AntiAliasingMode::TEMPORAL)
         {
-            if (m_PreviousViewsValid)
             {
-                m_TemporalAntiAliasingPass->RenderMotionVectors(m_CommandList, *m_View, *m_ViewPrevious);
-            }
+                auto timer = m_PassTimings.Measure("TAA");
 
-            m_TemporalAntiAliasingPass->TemporalResolve(m_CommandList, m_ui.TemporalAntiAliasingParams, m_PreviousViewsValid, *m_View, *m_View);
+                if (m_PreviousViewsValid)
+                {
+                    m_TemporalAntiAliasingPass->RenderMotionVectors(commandList, *m_View, *m_ViewPrevious);
+                }
+
+                m_TemporalAntiAliasingPass->TemporalResolve(commandList, m_ui.TemporalAntiAliasingParams, m_PreviousViewsValid, *m_View, *m_View);
+            }
 
             finalHdrColor = m_RenderTargets->ResolvedColor;
             
             if (m_ui.EnableBloom)
             {
-                m_BloomPass->Render(m_CommandList, m_RenderTargets->ResolvedFramebuffer, *m_View, m_RenderTargets->ResolvedColor, m_ui.BloomSigma, m_ui.BloomAlpha);
+                auto timer = m_PassTimings.Measure("Bloom");
+                m_BloomPass->Render(commandList, m_RenderTargets->ResolvedFramebuffer, *m_View, m_RenderTargets->ResolvedColor, m_ui.BloomSigma, m_ui.BloomAlpha);
             }
             m_PreviousViewsValid = true;
         }
@@ -1069,14 +1923,15 @@ public:
             if (m_RenderTargets->GetSampleCount() > 1)
             {
                 auto subresources = nvrhi::TextureSubresourceSet(0, 1, 0, 1);
-                m_CommandList->resolveTexture(m_RenderTargets->ResolvedColor, subresources, m_RenderTargets->HdrColor, subresources);
+                commandList->resolveTexture(m_RenderTargets->ResolvedColor, subresources, m_RenderTargets->HdrColor, subresources);
                 finalHdrColor = m_RenderTargets->ResolvedColor;
                 finalHdrFramebuffer = m_RenderTargets->ResolvedFramebuffer;
             }
 
             if (m_ui.EnableBloom)
             {
-                m_BloomPass->Render(m_CommandList, finalHdrFramebuffer, *m_View, finalHdrColor, m_ui.BloomSigma, m_ui.BloomAlpha);
+                auto timer = m_PassTimings.Measure("Bloom");
+                m_BloomPass->Render(commandList, finalHdrFramebuffer, *m_View, finalHdrColor, m_ui.BloomSigma, m_ui.BloomAlpha);
             }
 
             m_PreviousViewsValid = false;
@@ -1088,19 +1943,22 @@ public:
             toneMappingParams.eyeAdaptationSpeedUp = 0.f;
             toneMappingParams.eyeAdaptationSpeedDown = 0.f;
         }
-        m_ToneMappingPass->SimpleRender(m_CommandList, toneMappingParams, *m_View, finalHdrColor);
-        
-        m_CommonPasses->BlitTexture(m_CommandList, framebuffer, m_RenderTargets->LdrColor, &m_BindingCache);
+
+        {
+            auto timer = m_PassTimings.Measure("ToneMapping");
+            m_ToneMappingPass->SimpleRender(commandList, toneMappingParams, *m_View, finalHdrColor);
+            m_CommonPasses->BlitTexture(commandList, framebuffer, m_RenderTargets->LdrColor, &m_BindingCache);
+        }
 
         if (m_ui.TestMipMapGen)
         {
-            m_MipMapGenPass->Dispatch(m_CommandList);
-            m_MipMapGenPass->Display(m_CommonPasses, m_CommandList, framebuffer);
+            m_MipMapGenPass->Dispatch(commandList);
+            m_MipMapGenPass->Display(m_CommonPasses, commandList, framebuffer);
         }
 
         if (m_ui.DisplayShadowMap)
         {
-            for (int cascade = 0; cascade < 4; cascade++)
+            for (int cascade = 0; cascade < c_NumShadowCascades; cascade++)
             {
                 nvrhi::Viewport viewport = nvrhi::Viewport(
                     10.f + 266.f * cascade,
@@ -1114,60 +1972,159 @@ public:
                 blitParams.targetViewport = viewport;
                 blitParams.sourceTexture = m_ShadowMap->GetTexture();
                 blitParams.sourceArraySlice = cascade;
-                m_CommonPasses->BlitTexture(m_CommandList, blitParams, &m_BindingCache);
+                m_CommonPasses->BlitTexture(commandList, blitParams, &m_BindingCache);
             }
         }
+    }
 
-        m_CommandList->close();
-        GetDevice()->executeCommandList(m_CommandList);
+#ifdef DONUT_WITH_TASKFLOW
+    // Records each shadow cascade, the opaque geometry, the lighting, the transparent geometry and the post-processing
+    // into separate command lists on the executor, then submits them in rendering order.
+    // Every recording task uses its own draw strategy because the strategies keep per-view traversal state,
+    // and every shadow cascade its own depth pass. Passes and binding caches are not thread-safe, so tasks
+    // that share one are ordered: opaque and transparent geometry both go through m_ForwardPass, and the
+    // post-processing task, the user of m_BindingCache, is recorded after them.
+    void RenderSceneParallel(nvrhi::IFramebuffer* framebuffer, const std::vector<std::shared_ptr<LightProbe>>& lightProbes,
+        bool exposureResetRequired, const nvrhi::Viewport& windowViewport)
+    {
+        tf::Taskflow taskFlow;
 
-        if (!m_ui.ScreenshotFileName.empty())
+        // The prologue sets up the shadow cascades and refreshes the scene buffers, so every other task depends on it
+        tf::Task prologueTask = taskFlow.emplace([this, framebuffer, exposureResetRequired]()
         {
-            SaveTextureToFile(GetDevice(), m_CommonPasses.get(), framebufferTexture, nvrhi::ResourceStates::RenderTarget, m_ui.ScreenshotFileName.c_str());
-            m_ui.ScreenshotFileName = "";
+            m_CommandList->open();
+            RenderPrologue(m_CommandList, framebuffer, exposureResetRequired);
+            m_CommandList->close();
+        });
+
+        const int numShadowCascades = m_ui.EnableShadows ? c_NumShadowCascades : 0;
+        std::vector<std::chrono::high_resolution_clock::time_point> cascadeStartTimes(numShadowCascades);
+        std::vector<std::chrono::high_resolution_clock::time_point> cascadeEndTimes(numShadowCascades);
+
+        for (int cascade = 0; cascade < numShadowCascades; cascade++)
+        {
+            tf::Task cascadeTask = taskFlow.emplace([this, cascade, &cascadeStartTimes, &cascadeEndTimes]()
+            {
+                cascadeStartTimes[cascade] = std::chrono::high_resolution_clock::now();
+
+                const IView* cascadeView = m_ShadowMap->GetView().GetChildView(ViewType::PLANAR, cascade);
+
+                nvrhi::ICommandList* commandList = m_ShadowCommandLists[cascade];
+                commandList->open();
+
+                commandList->setEnableAutomaticBarriers(false);
+                commandList->setResourceStatesForFramebuffer(m_ShadowFramebuffer->GetFramebuffer(*cascadeView));
+                commandList->commitBarriers();
+
+                std::unique_ptr<IDrawStrategy> drawStrategy = CreateOpaqueDrawStrategy();
+                DepthPass::Context context;
+
+                RenderCompositeView(commandList,
+                    cascadeView, nullptr,
+                    *m_ShadowFramebuffer,
+                    m_Scene->GetSceneGraph()->GetRootNode(),
+                    *drawStrategy,
+                    *m_CascadeDepthPasses[cascade],
+                    context,
+                    "ShadowMap",
+                    m_ui.EnableMaterialEvents);
+
+                commandList->setEnableAutomaticBarriers(true);
+                commandList->close();
+
+                cascadeEndTimes[cascade] = std::chrono::high_resolution_clock::now();
+            });
+
+            prologueTask.precede(cascadeTask);
         }
 
-        if (m_Pick)
+        tf::Task opaqueTask = taskFlow.emplace([this, &lightProbes]()
         {
-            m_Pick = false;
-            uint4 pixelValue = m_PixelReadbackPass->ReadUInts();
-            m_ui.SelectedMaterial = nullptr;
-            m_ui.SelectedNode = nullptr;
+            nvrhi::ICommandList* commandList = m_OpaqueCommandList;
+            commandList->open();
 
-            for (const auto& material : m_Scene->GetSceneGraph()->GetMaterials())
-            {
-                if (material->materialID == int(pixelValue.x))
-                {
-                    m_ui.SelectedMaterial = material;
-                    break;
-                }
-            }
+            std::unique_ptr<IDrawStrategy> drawStrategy = CreateOpaqueDrawStrategy();
+            ForwardShadingPass::Context forwardContext;
 
-            for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+            if (!m_ui.UseDeferredShading)
             {
-                if (instance->GetInstanceIndex() == int(pixelValue.y))
-                {
-                    m_ui.SelectedNode = instance->GetNodeSharedPtr();
-                    break;
-                }
+                m_ForwardPass->PrepareLights(forwardContext, commandList, m_Scene->GetSceneGraph()->GetLights(), m_AmbientTop, m_AmbientBottom, lightProbes);
             }
 
-            if (m_ui.SelectedNode)
-            {
-                log::info("Picked node: %s", m_ui.SelectedNode->GetPath().generic_string().c_str());
-                PointThirdPersonCameraAt(m_ui.SelectedNode);
-            }
-            else
+            RenderOpaqueGeometry(commandList, *drawStrategy, forwardContext);
+
+            commandList->close();
+        });
+
+        tf::Task lightingTask = taskFlow.emplace([this]()
+        {
+            nvrhi::ICommandList* commandList = m_LightingCommandList;
+            commandList->open();
+
+            std::unique_ptr<IDrawStrategy> opaqueDrawStrategy = CreateOpaqueDrawStrategy();
+            std::unique_ptr<IDrawStrategy> transparentDrawStrategy = CreateTransparentDrawStrategy();
+
+            RenderLightingAndSky(commandList, *opaqueDrawStrategy, *transparentDrawStrategy);
+
+            commandList->close();
+        });
+
+        tf::Task transparentTask = taskFlow.emplace([this, &lightProbes]()
+        {
+            nvrhi::ICommandList* commandList = m_TransparentCommandList;
+            commandList->open();
+
+            if (m_ui.EnableTranslucency)
             {
-                PointThirdPersonCameraAt(m_Scene->GetSceneGraph()->GetRootNode());
+                std::unique_ptr<IDrawStrategy> drawStrategy = CreateTransparentDrawStrategy();
+                ForwardShadingPass::Context forwardContext;
+
+                m_ForwardPass->PrepareLights(forwardContext, commandList, m_Scene->GetSceneGraph()->GetLights(), m_AmbientTop, m_AmbientBottom, lightProbes);
+
+                RenderTransparentGeometry(commandList, *drawStrategy, forwardContext);
             }
-        }
 
-        m_TemporalAntiAliasingPass->AdvanceFrame();
-        std::swap(m_View, m_ViewPrevious);
+            commandList->close();
+        });
 
-        GetDeviceManager()->SetVsyncEnabled(m_ui.EnableVsync);
+        tf::Task postProcessingTask = taskFlow.emplace([this, framebuffer, exposureResetRequired, &windowViewport]()
+        {
+            nvrhi::ICommandList* commandList = m_PostProcessingCommandList;
+            commandList->open();
+
+            RenderPostProcessing(commandList, framebuffer, exposureResetRequired, windowViewport);
+
+            commandList->close();
+        });
+
+        prologueTask.precede(opaqueTask, lightingTask, transparentTask, postProcessingTask);
+        opaqueTask.precede(transparentTask);
+        transparentTask.precede(postProcessingTask);
+
+        m_Executor->run(taskFlow).wait();
+
+        // The serial path records all cascades as one "ShadowMap" sample. The cascades overlap here, so the stage is
+        // timed as one sample too, from the first cascade starting to the last one finishing.
+        if (m_PassTimings.Enabled && numShadowCascades > 0)
+        {
+            const auto stageStart = *std::min_element(cascadeStartTimes.begin(), cascadeStartTimes.end());
+            const auto stageEnd = *std::max_element(cascadeEndTimes.begin(), cascadeEndTimes.end());
+            m_PassTimings.AddSample("ShadowMap", std::chrono::duration<double, std::milli>(stageEnd - stageStart).count());
+        }
+
+        // The submission order defines the GPU execution order, independent of the order in which the lists were recorded
+        std::vector<nvrhi::ICommandList*> commandLists = { m_CommandList };
+        for (int cascade = 0; cascade < numShadowCascades; cascade++)
+            commandLists.push_back(m_ShadowCommandLists[cascade]);
+        commandLists.push_back(m_OpaqueCommandList);
+        commandLists.push_back(m_LightingCommandList);
+        commandLists.push_back(m_TransparentCommandList);
+        commandLists.push_back(m_PostProcessingCommandList);
+
+        auto timer = m_PassTimings.Measure("Submit");
+        GetDevice()->executeCommandLists(commandLists.data(), commandLists.size());
     }
+#endif
 
     std::shared_ptr<ShaderFactory> GetShaderFactory()
     {
@@ -1456,7 +2413,28 @@ protected:
         if (ImGui::Button("Reload Shaders"))
             m_ui.ShaderReoladRequested = true;
 
+        if (TextureStreamer* textureStreamer = m_app->GetTextureStreamer())
+        {
+            const TextureStreamer::Statistics stats = textureStreamer->GetStatistics();
+            ImGui::Text("Streaming: %u/%u textures at full resolution, %u reading", stats.fullyResidentTextures, stats.streamedTextures, stats.pendingReads);
+            ImGui::Text("Texture memory: %.0f / %.0f MB (%.0f MB at full resolution), %u evictions",
+                double(stats.residentBytes) / (1024.0 * 1024.0), double(stats.budgetBytes) / (1024.0 * 1024.0),
+                double(stats.fullResolutionBytes) / (1024.0 * 1024.0), stats.evictions);
+        }
+
         ImGui::Checkbox("VSync", &m_ui.EnableVsync);
+#ifdef DONUT_WITH_TASKFLOW
+        ImGui::Checkbox("Parallel Command Lists", &m_ui.EnableParallelRecording);
+#endif
+        ImGui::Checkbox("SIMD Culling", &m_ui.UseSimdCulling);
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Cull the scene with the %s kernel over a flat array of bounding boxes instead of walking the scene graph", GetCullingKernelName(GetBestCullingKernel()));
+        if (m_ui.UseSimdCulling)
+        {
+            ImGui::Checkbox("Multi-View Culling", &m_ui.UseMultiViewCulling);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Cull the shadow cascades and the main views together in a single pass");
+        }
         ImGui::Checkbox("Deferred Shading", &m_ui.UseDeferredShading);
         if (m_ui.AntiAliasingMode >= AntiAliasingMode::MSAA_2X)
             m_ui.UseDeferredShading = false; // Deferred shading doesn't work with MSAA
@@ -1596,6 +2574,22 @@ protected:
     }
 };
 
+// Parses a positive integer argument, std::stoi would throw on values that are not numbers
+static bool ParsePositiveInt(const char* option, const char* value, int& result)
+{
+    char* end = nullptr;
+    errno = 0;
+    const long parsed = std::strtol(value, &end, 10);
+    if (end == value || *end != 0 || errno == ERANGE || parsed < 1 || parsed > INT_MAX)
+    {
+        log::error("Invalid value '%s' for %s, expected a positive integer.", value, option);
+        return false;
+    }
+
+    result = int(parsed);
+    return true;
+}
+
 bool ProcessCommandLine(int argc, const char* const* argv, DeviceCreationParameters& deviceParams, std::string& sceneName)
 {
     for (int i = 1; i < argc; i++)
@@ -1629,12 +2623,107 @@ bool ProcessCommandLine(int argc, const char* const* argv, DeviceCreationParamet
         {
             g_PrintFormats = true;
         }
+        else if (!strcmp(argv[i], "-headless"))
+        {
+            g_Headless = true;
+        }
+        else if (!strcmp(argv[i], "-benchmark") && i + 1 < argc)
+        {
+            int frames;
+            if (!ParsePositiveInt(argv[i], argv[i + 1], frames))
+                return false;
+            ++i;
+
+            g_BenchmarkFrames = uint32_t(frames);
+            deviceParams.vsyncEnabled = false;
+        }
+        else if (!strcmp(argv[i], "-benchmark-output") && i + 1 < argc)
+        {
+            g_BenchmarkOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-load-report") && i + 1 < argc)
+        {
+            g_LoadReportOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-texture-streaming"))
+        {
+            g_TextureStreaming = true;
+        }
+        else if (!strcmp(argv[i], "-texture-budget") && i + 1 < argc)
+        {
+            int budget;
+            if (!ParsePositiveInt(argv[i], argv[i + 1], budget))
+                return false;
+            ++i;
+
+            g_TextureStreamingBudget = uint64_t(budget);
+        }
         else if (argv[i][0] != '-')
         {
             sceneName = argv[i];
         }
     }
 
+    if (g_Headless && g_BenchmarkFrames == 0)
+    {
+        log::error("The -headless mode requires -benchmark <frames>.");
+        return false;
+    }
+
+    return true;
+}
+
+// Renders the benchmark into an offscreen framebuffer, without a window or a swap chain
+bool RunHeadlessBenchmark(DeviceManager* deviceManager, FeatureDemo& demo, const DeviceCreationParameters& deviceParams)
+{
+    nvrhi::IDevice* device = deviceManager->GetDevice();
+
+    auto textureDesc = nvrhi::TextureDesc()
+        .setDimension(nvrhi::TextureDimension::Texture2D)
+        .setWidth(deviceParams.backBufferWidth)
+        .setHeight(deviceParams.backBufferHeight)
+        .setFormat(nvrhi::Format::SRGBA8_UNORM)
+        .setIsRenderTarget(true)
+        .setInitialState(nvrhi::ResourceStates::RenderTarget)
+        .setKeepInitialState(true)
+        .setDebugName("OffscreenColor");
+    nvrhi::TextureHandle colorTexture = device->createTexture(textureDesc);
+
+    nvrhi::FramebufferHandle framebuffer = device->createFramebuffer(nvrhi::FramebufferDesc().addColorAttachment(colorTexture));
+
+    // Use a fixed time step so that the camera path does not depend on the speed of the device
+    const float frameTimeSeconds = 1.f / 60.f;
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    while (!demo.IsBenchmarkFinished())
+    {
+        if (demo.IsSceneLoadFailed())
+        {
+            log::error("The benchmark scene '%s' could not be loaded.", demo.GetCurrentSceneName().c_str());
+            return false;
+        }
+
+        if (!demo.IsSceneLoaded())
+        {
+            const double waitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            if (waitSeconds > c_HeadlessLoadTimeoutSeconds)
+            {
+                log::error("The benchmark scene '%s' did not finish loading within %.0f seconds.",
+                    demo.GetCurrentSceneName().c_str(), c_HeadlessLoadTimeoutSeconds);
+                return false;
+            }
+        }
+
+        demo.Animate(frameTimeSeconds);
+        demo.Render(framebuffer);
+
+        device->waitForIdle();
+        device->runGarbageCollection();
+
+        demo.AdvanceHeadlessFrame();
+    }
+
     return true;
 }
 
@@ -1658,6 +2747,7 @@ int main(int __argc, const char* const* __argv)
     deviceParams.startFullscreen = false;
     deviceParams.vsyncEnabled = true;
 
+    int exitCode = 0;
     std::string sceneName;
     if (!ProcessCommandLine(__argc, __argv, deviceParams, sceneName))
     {
@@ -1670,7 +2760,15 @@ int main(int __argc, const char* const* __argv)
 
     std::string windowTitle = "Donut Feature Demo (" + std::string(apiString) + ")";
 
-    if (!deviceManager->CreateWindowDeviceAndSwapChain(deviceParams, windowTitle.c_str()))
+    if (g_Headless)
+    {
+        if (!deviceManager->CreateHeadlessDevice(deviceParams))
+        {
+            log::error("Cannot initialize a headless %s graphics device with the requested parameters", apiString);
+            return 1;
+        }
+    }
+    else if (!deviceManager->CreateWindowDeviceAndSwapChain(deviceParams, windowTitle.c_str()))
 	{
         log::error("Cannot initialize a %s graphics device with the requested parameters", apiString);
 		return 1;
@@ -1702,8 +2800,20 @@ int main(int __argc, const char* const* __argv)
         }
     }
 
+    if (g_Headless)
+    {
+        UIData uiData;
+        uiData.ShowUI = false;
+        uiData.EnableVsync = false;
+
+        std::shared_ptr<FeatureDemo> demo = std::make_shared<FeatureDemo>(deviceManager, uiData, sceneName);
+        if (!RunHeadlessBenchmark(deviceManager, *demo, deviceParams))
+            exitCode = 1;
+    }
+    else
     {
         UIData uiData;
+        uiData.EnableVsync = deviceParams.vsyncEnabled;
 
         std::shared_ptr<FeatureDemo> demo = std::make_shared<FeatureDemo>(deviceManager, uiData, sceneName);
         std::shared_ptr<UIRenderer> gui = std::make_shared<UIRenderer>(deviceManager, demo, uiData);
@@ -1722,5 +2832,5 @@ int main(int __argc, const char* const* __argv)
 #endif
     delete deviceManager;
 	
-	return 0;
+	return exitCode;
 }
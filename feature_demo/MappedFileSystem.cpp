@@ -0,0 +1,474 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "MappedFileSystem.h"
+
+#include <donut/core/log.h>
+#include <json/json.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace donut;
+
+// Smaller files are cheaper to read than to map
+static const uint64_t c_MinMappedFileSize = 64 * 1024;
+
+namespace
+{
+    // Read-only view of a whole file, unmapped when the last reference to the blob goes away
+    class MappedBlob : public vfs::IBlob
+    {
+    public:
+        static std::shared_ptr<MappedBlob> Map(const std::filesystem::path& name)
+        {
+            auto blob = std::shared_ptr<MappedBlob>(new MappedBlob());
+
+#ifdef _WIN32
+            HANDLE file = CreateFileW(name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return nullptr;
+
+            LARGE_INTEGER fileSize{};
+            HANDLE mapping = nullptr;
+            if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+                mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(file);
+
+            if (!mapping)
+                return nullptr;
+
+            // The view keeps the mapping alive after its handle is closed
+            blob->m_Data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+
+            if (!blob->m_Data)
+                return nullptr;
+
+            blob->m_Size = size_t(fileSize.QuadPart);
+#else
+            int file = open(name.c_str(), O_RDONLY);
+            if (file < 0)
+                return nullptr;
+
+            struct stat fileStat{};
+            void* data = MAP_FAILED;
+            if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+                data = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+            close(file);
+
+            if (data == MAP_FAILED)
+                return nullptr;
+
+            // Texture uploads walk the file front to back
+            madvise(data, size_t(fileStat.st_size), MADV_SEQUENTIAL);
+
+            blob->m_Data = data;
+            blob->m_Size = size_t(fileStat.st_size);
+#endif
+
+            return blob;
+        }
+
+        ~MappedBlob() override
+        {
+            if (!m_Data)
+                return;
+
+#ifdef _WIN32
+            UnmapViewOfFile(m_Data);
+#else
+            munmap(m_Data, m_Size);
+#endif
+        }
+
+        [[nodiscard]] const void* data() const override { return m_Data; }
+        [[nodiscard]] size_t size() const override { return m_Size; }
+
+    private:
+        void* m_Data = nullptr;
+        size_t m_Size = 0;
+
+        MappedBlob() = default;
+    };
+
+    // Layout of the beginning of a DDS file, see the DDS_HEADER and DDS_HEADER_DXT10 structures
+    struct DdsFileHeader
+    {
+        uint32_t magic;
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitchOrLinearSize;
+        uint32_t depth;
+        uint32_t mipMapCount;
+        uint32_t reserved1[11];
+        uint32_t pixelFormatSize;
+        uint32_t pixelFormatFlags;
+        uint32_t fourCC;
+        uint32_t rgbBitCount;
+        uint32_t bitMasks[4];
+        uint32_t caps[4];
+        uint32_t reserved2;
+        uint32_t dxgiFormat; // only valid when fourCC is "DX10"
+    };
+
+    // Rest of the DDS_HEADER_DXT10 structure that follows DdsFileHeader::dxgiFormat
+    struct DdsHeaderDxt10Tail
+    {
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+
+    constexpr size_t c_DdsDxt10HeaderSize = sizeof(DdsFileHeader) + sizeof(DdsHeaderDxt10Tail);
+    constexpr uint32_t c_DdsCaps2Cubemap = 0x200;
+    constexpr uint32_t c_DdsResourceMiscTextureCube = 0x4;
+
+    constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+    {
+        return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+    }
+
+    // Returns the size of a 4x4 block for the BC formats, 0 for other formats
+    uint32_t GetFourCCBlockSize(uint32_t fourCC)
+    {
+        switch (fourCC)
+        {
+        case MakeFourCC('D', 'X', 'T', '1'):
+        case MakeFourCC('A', 'T', 'I', '1'):
+        case MakeFourCC('B', 'C', '4', 'U'):
+        case MakeFourCC('B', 'C', '4', 'S'):
+            return 8;
+        case MakeFourCC('D', 'X', 'T', '3'):
+        case MakeFourCC('D', 'X', 'T', '5'):
+        case MakeFourCC('A', 'T', 'I', '2'):
+        case MakeFourCC('B', 'C', '5', 'U'):
+        case MakeFourCC('B', 'C', '5', 'S'):
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    uint32_t GetDxgiFormatBlockSize(uint32_t format)
+    {
+        // DXGI_FORMAT_BC1_TYPELESS .. DXGI_FORMAT_BC1_UNORM_SRGB, DXGI_FORMAT_BC4_TYPELESS .. DXGI_FORMAT_BC4_SNORM
+        if ((format >= 70 && format <= 72) || (format >= 79 && format <= 81))
+            return 8;
+
+        // DXGI_FORMAT_BC2_TYPELESS .. DXGI_FORMAT_BC3_UNORM_SRGB, DXGI_FORMAT_BC5_TYPELESS .. DXGI_FORMAT_BC5_SNORM,
+        // DXGI_FORMAT_BC6H_TYPELESS .. DXGI_FORMAT_BC7_UNORM_SRGB
+        if ((format >= 73 && format <= 78) || (format >= 82 && format <= 84) || (format >= 94 && format <= 99))
+            return 16;
+
+        return 0;
+    }
+
+    bool IsRemoteUri(const std::string& uri)
+    {
+        return uri.rfind("data:", 0) == 0 || uri.find("://") != std::string::npos;
+    }
+
+    int GetHexDigitValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // glTF image URIs are percent-encoded, e.g. "my%20texture.png", the files on disk are not
+    std::string DecodeUri(const std::string& uri)
+    {
+        std::string result;
+        result.reserve(uri.size());
+
+        for (size_t i = 0; i < uri.size(); i++)
+        {
+            if (uri[i] == '%' && i + 2 < uri.size())
+            {
+                const int high = GetHexDigitValue(uri[i + 1]);
+                const int low = GetHexDigitValue(uri[i + 2]);
+                if (high >= 0 && low >= 0)
+                {
+                    result += char((high << 4) | low);
+                    i += 2;
+                    continue;
+                }
+            }
+
+            result += uri[i];
+        }
+
+        return result;
+    }
+
+    // Replaces the extension of the last path segment of a URI, keeping the rest of it encoded as it is
+    std::string ReplaceUriExtension(const std::string& uri, const char* extension)
+    {
+        const size_t segmentStart = uri.find_last_of('/') + 1; // npos + 1 == 0
+        const size_t dot = uri.find_last_of('.');
+        const size_t stemEnd = (dot != std::string::npos && dot > segmentStart) ? dot : uri.size();
+        return uri.substr(0, stemEnd) + extension;
+    }
+}
+
+size_t ConvertedTextureInfo::GetLevelRowPitch(uint32_t level) const
+{
+    return size_t((GetLevelWidth(level) + 3) / 4) * bytesPerBlock;
+}
+
+size_t ConvertedTextureInfo::GetLevelSize(uint32_t level) const
+{
+    return GetLevelRowPitch(level) * ((GetLevelHeight(level) + 3) / 4);
+}
+
+size_t ConvertedTextureInfo::GetLevelOffset(uint32_t level) const
+{
+    size_t offset = headerSize;
+    for (uint32_t previous = 0; previous < level; previous++)
+        offset += GetLevelSize(previous);
+    return offset;
+}
+
+bool ConvertedTextureInfo::CanStartAtLevel(uint32_t level) const
+{
+    return level == 0 || (GetLevelWidth(level) % 4 == 0 && GetLevelHeight(level) % 4 == 0);
+}
+
+bool MappedFileSystem::ParseConvertedTexture(const void* data, size_t size, ConvertedTextureInfo& info)
+{
+    DdsFileHeader header{};
+    if (size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != MakeFourCC('D', 'D', 'S', ' ') || header.size != 124 || header.depth > 1)
+        return false;
+
+    // Cubemaps and texture arrays are not converted textures, their levels are not laid out as a single mip chain
+    if (header.caps[1] & c_DdsCaps2Cubemap)
+        return false;
+
+    const bool dx10 = header.fourCC == MakeFourCC('D', 'X', '1', '0');
+    if (dx10)
+    {
+        DdsHeaderDxt10Tail dx10Header{};
+        if (size < c_DdsDxt10HeaderSize)
+            return false;
+
+        memcpy(&dx10Header, static_cast<const uint8_t*>(data) + sizeof(DdsFileHeader), sizeof(dx10Header));
+        if (dx10Header.arraySize != 1 || (dx10Header.miscFlag & c_DdsResourceMiscTextureCube))
+            return false;
+    }
+
+    info.width = header.width;
+    info.height = header.height;
+    info.mipLevels = std::max(header.mipMapCount, 1u);
+    info.bytesPerBlock = dx10 ? GetDxgiFormatBlockSize(header.dxgiFormat) : GetFourCCBlockSize(header.fourCC);
+    info.headerSize = dx10 ? c_DdsDxt10HeaderSize : offsetof(DdsFileHeader, dxgiFormat);
+
+    const uint32_t fullMipChain = uint32_t(std::floor(std::log2(double(std::max(std::max(info.width, info.height), 1u))))) + 1;
+
+    return info.bytesPerBlock != 0 && info.width != 0 && info.height != 0 && info.mipLevels >= fullMipChain;
+}
+
+uint32_t MappedFileSystem::GetStreamingTailLevel(const ConvertedTextureInfo& info, uint32_t tailSize)
+{
+    for (uint32_t level = 0; level < info.mipLevels; level++)
+    {
+        if (std::max(info.GetLevelWidth(level), info.GetLevelHeight(level)) <= tailSize)
+            return level;
+
+        // Stop at the smallest level that can be the top of a texture, the rest is too small to stream
+        if (!info.CanStartAtLevel(level + 1))
+            return level;
+    }
+
+    return 0;
+}
+
+bool MappedFileSystem::IsConvertedTexture(const std::filesystem::path& name)
+{
+    std::ifstream file(name, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    // Large enough for the DX10 header, files with the legacy header may be shorter
+    char header[c_DdsDxt10HeaderSize];
+    file.read(header, sizeof(header));
+
+    ConvertedTextureInfo info;
+    return ParseConvertedTexture(header, size_t(file.gcount()), info);
+}
+
+std::shared_ptr<vfs::IBlob> MappedFileSystem::MapFile(const std::filesystem::path& name)
+{
+    return MappedBlob::Map(name);
+}
+
+std::shared_ptr<vfs::IBlob> MappedFileSystem::MapFileForRead(const std::filesystem::path& name)
+{
+    std::shared_ptr<vfs::IBlob> blob = MapFile(name);
+    if (!blob)
+        return nullptr;
+
+    ++m_Statistics.filesMapped;
+    m_Statistics.bytesMapped += blob->size();
+    return blob;
+}
+
+std::shared_ptr<vfs::IBlob> MappedFileSystem::readFile(const std::filesystem::path& name)
+{
+    if (name.extension() == ".gltf")
+        return ReadGltfFile(name);
+
+    if (m_StreamingTailSize != 0 && name.extension() == ".dds")
+    {
+        if (auto file = MapFileForRead(name))
+            return ReadTextureTail(file);
+    }
+
+    std::error_code error;
+    const uint64_t fileSize = std::filesystem::file_size(name, error);
+
+    if (!error && fileSize >= c_MinMappedFileSize)
+    {
+        if (auto blob = MapFileForRead(name))
+            return blob;
+    }
+
+    return NativeFileSystem::readFile(name);
+}
+
+std::shared_ptr<vfs::IBlob> MappedFileSystem::ReadTextureTail(const std::shared_ptr<vfs::IBlob>& file)
+{
+    ConvertedTextureInfo info;
+    if (!ParseConvertedTexture(file->data(), file->size(), info) || file->size() < info.GetLevelOffset(info.mipLevels))
+        return file;
+
+    const uint32_t tailLevel = GetStreamingTailLevel(info, m_StreamingTailSize);
+    if (tailLevel == 0)
+        return file;
+
+    // Same header with the dimensions and level count of the tail, followed by the tail levels as they are in the file.
+    // The mapping is read-only and the tail is a few kilobytes, so both are copied into a heap blob
+    // and the mapping is released when this function returns.
+    const size_t tailOffset = info.GetLevelOffset(tailLevel);
+    const size_t tailSize = info.GetLevelOffset(info.mipLevels) - tailOffset;
+
+    uint8_t* data = static_cast<uint8_t*>(malloc(info.headerSize + tailSize));
+    memcpy(data, file->data(), info.headerSize);
+    memcpy(data + info.headerSize, static_cast<const uint8_t*>(file->data()) + tailOffset, tailSize);
+
+    DdsFileHeader header;
+    memcpy(&header, data, offsetof(DdsFileHeader, dxgiFormat));
+    header.width = info.GetLevelWidth(tailLevel);
+    header.height = info.GetLevelHeight(tailLevel);
+    header.mipMapCount = info.mipLevels - tailLevel;
+    header.pitchOrLinearSize = uint32_t(info.GetLevelSize(tailLevel));
+    memcpy(data, &header, offsetof(DdsFileHeader, dxgiFormat));
+
+    ++m_Statistics.texturesTruncated;
+    return std::make_shared<vfs::Blob>(data, info.headerSize + tailSize);
+}
+
+std::shared_ptr<vfs::IBlob> MappedFileSystem::ReadGltfFile(const std::filesystem::path& name)
+{
+    std::shared_ptr<vfs::IBlob> source = NativeFileSystem::readFile(name);
+    if (!source)
+        return nullptr;
+
+    const char* text = static_cast<const char*>(source->data());
+
+    Json::Value root;
+    Json::CharReaderBuilder readerBuilder;
+    std::unique_ptr<Json::CharReader> reader(readerBuilder.newCharReader());
+    if (!reader->parse(text, text + source->size(), &root, nullptr))
+        return source; // let the importer report the error
+
+    Json::Value& images = root["images"];
+    if (!images.isArray())
+        return source;
+
+    const std::filesystem::path directory = name.parent_path();
+    uint32_t redirected = 0;
+
+    for (Json::Value& image : images)
+    {
+        if (!image.isMember("uri"))
+            continue; // embedded in a buffer
+
+        const std::string uri = image["uri"].asString();
+        if (IsRemoteUri(uri))
+            continue;
+
+        const std::string convertedUri = ReplaceUriExtension(uri, ".dds");
+
+        if (convertedUri == uri || !IsConvertedTexture(directory / std::filesystem::u8path(DecodeUri(convertedUri))))
+        {
+            ++m_Statistics.imagesDecoded;
+            continue;
+        }
+
+        image["uri"] = convertedUri;
+        if (image.isMember("mimeType"))
+            image["mimeType"] = "image/vnd-ms.dds";
+        ++redirected;
+    }
+
+    if (redirected == 0)
+        return source;
+
+    m_Statistics.imagesRedirected += redirected;
+
+    Json::StreamWriterBuilder writerBuilder;
+    writerBuilder["indentation"] = "";
+    const std::string rewritten = Json::writeString(writerBuilder, root);
+
+    void* data = malloc(rewritten.size());
+    memcpy(data, rewritten.data(), rewritten.size());
+    return std::make_shared<vfs::Blob>(data, rewritten.size());
+}
@@ -0,0 +1,100 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/core/vfs/VFS.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+
+// Layout of a converted texture: a BC-compressed 2D texture with one array slice, its mip levels stored one after another
+struct ConvertedTextureInfo
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 0;
+    uint32_t bytesPerBlock = 0;
+    size_t headerSize = 0;
+
+    [[nodiscard]] uint32_t GetLevelWidth(uint32_t level) const { return std::max(width >> level, 1u); }
+    [[nodiscard]] uint32_t GetLevelHeight(uint32_t level) const { return std::max(height >> level, 1u); }
+    [[nodiscard]] size_t GetLevelRowPitch(uint32_t level) const;
+    [[nodiscard]] size_t GetLevelSize(uint32_t level) const;
+    // Offset of the level from the beginning of the file, GetLevelOffset(mipLevels) is the file size
+    [[nodiscard]] size_t GetLevelOffset(uint32_t level) const;
+    // Block-compressed textures need a top level with dimensions that are multiples of 4
+    [[nodiscard]] bool CanStartAtLevel(uint32_t level) const;
+};
+
+// Native file system that memory-maps large files instead of reading them into heap copies, and that redirects
+// the images of .gltf files to pre-converted DDS textures when they exist.
+//
+// A converted texture is a file next to the original image with the same name and the .dds extension, which holds
+// a BC-compressed texture with a full mip chain. The redirection rewrites the image URIs of the .gltf file as it is
+// read, so the importer requests the DDS file from the TextureCache, which uploads its mip levels straight from the
+// mapped file. Images without a usable converted file keep going through the regular decoder.
+//
+// With a streaming tail size set, converted textures are served with the levels that fit into that size only,
+// and TextureStreamer loads the larger levels later.
+class MappedFileSystem : public donut::vfs::NativeFileSystem
+{
+public:
+    struct Statistics
+    {
+        std::atomic<uint32_t> filesMapped { 0 };
+        std::atomic<uint64_t> bytesMapped { 0 };
+        std::atomic<uint32_t> imagesRedirected { 0 };
+        std::atomic<uint32_t> imagesDecoded { 0 };
+        std::atomic<uint32_t> texturesTruncated { 0 };
+    };
+
+    std::shared_ptr<donut::vfs::IBlob> readFile(const std::filesystem::path& name) override;
+
+    // Maps the whole file regardless of its size and type, returns nullptr if it cannot be mapped
+    // Not counted in the statistics, which only cover the files served by readFile
+    std::shared_ptr<donut::vfs::IBlob> MapFile(const std::filesystem::path& name);
+
+    // Largest width or height of the converted textures returned by readFile, 0 returns them complete
+    void SetStreamingTailSize(uint32_t size) { m_StreamingTailSize = size; }
+    [[nodiscard]] uint32_t GetStreamingTailSize() const { return m_StreamingTailSize; }
+
+    [[nodiscard]] const Statistics& GetStatistics() const { return m_Statistics; }
+
+    // Returns true if the file is a DDS texture with a BC format and a full mip chain
+    static bool IsConvertedTexture(const std::filesystem::path& name);
+
+    // Reads the layout of a converted texture from the beginning of a DDS file
+    static bool ParseConvertedTexture(const void* data, size_t size, ConvertedTextureInfo& info);
+
+    // Returns the first level that the texture is served with when streaming, or 0 if it is served complete
+    static uint32_t GetStreamingTailLevel(const ConvertedTextureInfo& info, uint32_t tailSize);
+
+private:
+    Statistics m_Statistics;
+    uint32_t m_StreamingTailSize = 0;
+
+    std::shared_ptr<donut::vfs::IBlob> MapFileForRead(const std::filesystem::path& name);
+    std::shared_ptr<donut::vfs::IBlob> ReadGltfFile(const std::filesystem::path& name);
+    std::shared_ptr<donut::vfs::IBlob> ReadTextureTail(const std::shared_ptr<donut::vfs::IBlob>& file);
+};
@@ -0,0 +1,610 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "SceneCulling.h"
+
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/View.h>
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_WITH_SSE 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define CULLING_TARGET_AVX2
+#else
+#define CULLING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define CULLING_WITH_SSE 0
+#endif
+
+using namespace donut::math;
+using namespace donut::engine;
+using namespace donut::render;
+
+namespace
+{
+    // Frustum plane prepared for the center/extent test: a box is outside the plane
+    // if dot(normal, center) - dot(abs(normal), extent) > distance.
+    struct CullingPlane
+    {
+        float normalX, normalY, normalZ;
+        float absNormalX, absNormalY, absNormalZ;
+        float distance;
+    };
+
+    size_t PrepareCullingPlanes(const frustum& frustum, CullingPlane* planes)
+    {
+        size_t numPlanes = 0;
+        for (const plane& p : frustum.planes)
+        {
+            if (numPlanes == c_MaxCullingPlanes)
+                break;
+
+            // Skip degenerate planes, such as the far plane of an infinite projection
+            if (p.normal.x == 0.f && p.normal.y == 0.f && p.normal.z == 0.f)
+                continue;
+
+            CullingPlane& dest = planes[numPlanes++];
+            dest.normalX = p.normal.x;
+            dest.normalY = p.normal.y;
+            dest.normalZ = p.normal.z;
+            dest.absNormalX = std::abs(p.normal.x);
+            dest.absNormalY = std::abs(p.normal.y);
+            dest.absNormalZ = std::abs(p.normal.z);
+            dest.distance = p.distance;
+        }
+        return numPlanes;
+    }
+
+    uint64_t GetTailMask(size_t count, size_t base)
+    {
+        const size_t remaining = count - base;
+        return (remaining >= 64) ? ~uint64_t(0) : (uint64_t(1) << remaining) - 1;
+    }
+
+    uint32_t CountTrailingZeros(uint64_t value)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return uint32_t(index);
+#else
+        return uint32_t(__builtin_ctzll(value));
+#endif
+    }
+
+    // Prepared planes of one view
+    struct CullingView
+    {
+        CullingPlane planes[c_MaxCullingPlanes];
+        size_t numPlanes = 0;
+    };
+
+    // The kernels below walk the boxes once and test every loaded batch against all views,
+    // writing one visibility bitmask per view.
+
+    void CullScalar(const BoundingBoxesSoA& boxes, const CullingView* views, size_t numViews, uint64_t* const* visibility)
+    {
+        for (size_t base = 0; base < boxes.count; base += 64)
+        {
+            const size_t end = std::min(base + 64, boxes.count);
+            uint64_t words[c_MaxCullingViews] = {};
+
+            for (size_t i = base; i < end; i++)
+            {
+                for (size_t v = 0; v < numViews; v++)
+                {
+                    const CullingView& view = views[v];
+
+                    bool inside = true;
+                    for (size_t p = 0; p < view.numPlanes && inside; p++)
+                    {
+                        const CullingPlane& plane = view.planes[p];
+                        const float distance =
+                            (plane.normalX * boxes.centerX[i] + plane.normalY * boxes.centerY[i] + plane.normalZ * boxes.centerZ[i]) -
+                            (plane.absNormalX * boxes.extentX[i] + plane.absNormalY * boxes.extentY[i] + plane.absNormalZ * boxes.extentZ[i]);
+                        inside = !(distance > plane.distance);
+                    }
+
+                    words[v] |= uint64_t(inside) << (i - base);
+                }
+            }
+
+            for (size_t v = 0; v < numViews; v++)
+                visibility[v][base / 64] = words[v];
+        }
+    }
+
+#if CULLING_WITH_SSE
+    void CullSSE(const BoundingBoxesSoA& boxes, const CullingView* views, size_t numViews, uint64_t* const* visibility)
+    {
+        const size_t paddedCount = boxes.centerX.size();
+
+        for (size_t base = 0; base < boxes.count; base += 64)
+        {
+            const size_t end = std::min(base + 64, paddedCount);
+            uint64_t words[c_MaxCullingViews] = {};
+
+            for (size_t i = base; i < end; i += 4)
+            {
+                const __m128 centerX = _mm_loadu_ps(&boxes.centerX[i]);
+                const __m128 centerY = _mm_loadu_ps(&boxes.centerY[i]);
+                const __m128 centerZ = _mm_loadu_ps(&boxes.centerZ[i]);
+                const __m128 extentX = _mm_loadu_ps(&boxes.extentX[i]);
+                const __m128 extentY = _mm_loadu_ps(&boxes.extentY[i]);
+                const __m128 extentZ = _mm_loadu_ps(&boxes.extentZ[i]);
+
+                for (size_t v = 0; v < numViews; v++)
+                {
+                    const CullingView& view = views[v];
+
+                    __m128 outside = _mm_setzero_ps();
+                    for (size_t p = 0; p < view.numPlanes; p++)
+                    {
+                        const CullingPlane& plane = view.planes[p];
+                        const __m128 centerDistance = _mm_add_ps(_mm_add_ps(
+                            _mm_mul_ps(centerX, _mm_set1_ps(plane.normalX)),
+                            _mm_mul_ps(centerY, _mm_set1_ps(plane.normalY))),
+                            _mm_mul_ps(centerZ, _mm_set1_ps(plane.normalZ)));
+                        const __m128 radius = _mm_add_ps(_mm_add_ps(
+                            _mm_mul_ps(extentX, _mm_set1_ps(plane.absNormalX)),
+                            _mm_mul_ps(extentY, _mm_set1_ps(plane.absNormalY))),
+                            _mm_mul_ps(extentZ, _mm_set1_ps(plane.absNormalZ)));
+                        const __m128 distance = _mm_sub_ps(centerDistance, radius);
+                        outside = _mm_or_ps(outside, _mm_cmpgt_ps(distance, _mm_set1_ps(plane.distance)));
+                    }
+
+                    const uint64_t inside = uint64_t(~_mm_movemask_ps(outside) & 0xf);
+                    words[v] |= inside << (i - base);
+                }
+            }
+
+            const uint64_t tailMask = GetTailMask(boxes.count, base);
+            for (size_t v = 0; v < numViews; v++)
+                visibility[v][base / 64] = words[v] & tailMask;
+        }
+    }
+
+    CULLING_TARGET_AVX2
+    void CullAVX2(const BoundingBoxesSoA& boxes, const CullingView* views, size_t numViews, uint64_t* const* visibility)
+    {
+        const size_t paddedCount = boxes.centerX.size();
+
+        // Broadcast the planes once, they are reused for every batch
+        __m256 planeData[c_MaxCullingViews][c_MaxCullingPlanes][7];
+        for (size_t v = 0; v < numViews; v++)
+        {
+            for (size_t p = 0; p < views[v].numPlanes; p++)
+            {
+                const CullingPlane& plane = views[v].planes[p];
+                planeData[v][p][0] = _mm256_set1_ps(plane.normalX);
+                planeData[v][p][1] = _mm256_set1_ps(plane.normalY);
+                planeData[v][p][2] = _mm256_set1_ps(plane.normalZ);
+                planeData[v][p][3] = _mm256_set1_ps(plane.absNormalX);
+                planeData[v][p][4] = _mm256_set1_ps(plane.absNormalY);
+                planeData[v][p][5] = _mm256_set1_ps(plane.absNormalZ);
+                planeData[v][p][6] = _mm256_set1_ps(plane.distance);
+            }
+        }
+
+        for (size_t base = 0; base < boxes.count; base += 64)
+        {
+            const size_t end = std::min(base + 64, paddedCount);
+            uint64_t words[c_MaxCullingViews] = {};
+
+            for (size_t i = base; i < end; i += c_CullingBatchSize)
+            {
+                const __m256 centerX = _mm256_loadu_ps(&boxes.centerX[i]);
+                const __m256 centerY = _mm256_loadu_ps(&boxes.centerY[i]);
+                const __m256 centerZ = _mm256_loadu_ps(&boxes.centerZ[i]);
+                const __m256 extentX = _mm256_loadu_ps(&boxes.extentX[i]);
+                const __m256 extentY = _mm256_loadu_ps(&boxes.extentY[i]);
+                const __m256 extentZ = _mm256_loadu_ps(&boxes.extentZ[i]);
+
+                for (size_t v = 0; v < numViews; v++)
+                {
+                    __m256 outside = _mm256_setzero_ps();
+                    for (size_t p = 0; p < views[v].numPlanes; p++)
+                    {
+                        const __m256* plane = planeData[v][p];
+                        const __m256 centerDistance = _mm256_add_ps(_mm256_add_ps(
+                            _mm256_mul_ps(centerX, plane[0]),
+                            _mm256_mul_ps(centerY, plane[1])),
+                            _mm256_mul_ps(centerZ, plane[2]));
+                        const __m256 radius = _mm256_add_ps(_mm256_add_ps(
+                            _mm256_mul_ps(extentX, plane[3]),
+                            _mm256_mul_ps(extentY, plane[4])),
+                            _mm256_mul_ps(extentZ, plane[5]));
+                        const __m256 distance = _mm256_sub_ps(centerDistance, radius);
+                        outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, plane[6], _CMP_GT_OQ));
+                    }
+
+                    const uint64_t inside = uint64_t(~_mm256_movemask_ps(outside) & 0xff);
+                    words[v] |= inside << (i - base);
+                }
+            }
+
+            const uint64_t tailMask = GetTailMask(boxes.count, base);
+            for (size_t v = 0; v < numViews; v++)
+                visibility[v][base / 64] = words[v] & tailMask;
+        }
+    }
+
+    bool CpuSupportsAVX2()
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        // AVX needs OS support for saving the YMM registers
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif // CULLING_WITH_SSE
+
+    bool IsTransparentDomain(MaterialDomain domain)
+    {
+        return domain != MaterialDomain::Opaque && domain != MaterialDomain::AlphaTested;
+    }
+}
+
+void BoundingBoxesSoA::Resize(size_t newCount)
+{
+    const size_t paddedCount = (newCount + c_CullingBatchSize - 1) / c_CullingBatchSize * c_CullingBatchSize;
+
+    for (std::vector<float>* array : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+        array->resize(paddedCount, 0.f);
+
+    count = newCount;
+}
+
+void BoundingBoxesSoA::Set(size_t index, const box3& box)
+{
+    if (box.isempty())
+    {
+        // Make empty boxes fail every plane test
+        centerX[index] = centerY[index] = centerZ[index] = 0.f;
+        extentX[index] = extentY[index] = extentZ[index] = -FLT_MAX;
+        return;
+    }
+
+    const float3 center = box.center();
+    const float3 extent = box.diagonal() * 0.5f;
+    centerX[index] = center.x;
+    centerY[index] = center.y;
+    centerZ[index] = center.z;
+    extentX[index] = extent.x;
+    extentY[index] = extent.y;
+    extentZ[index] = extent.z;
+}
+
+CullingKernel GetBestCullingKernel()
+{
+#if CULLING_WITH_SSE
+    static const bool avx2 = CpuSupportsAVX2();
+    return avx2 ? CullingKernel::AVX2 : CullingKernel::SSE;
+#else
+    return CullingKernel::Scalar;
+#endif
+}
+
+const char* GetCullingKernelName(CullingKernel kernel)
+{
+    switch (kernel)
+    {
+    case CullingKernel::Scalar: return "Scalar";
+    case CullingKernel::SSE: return "SSE";
+    case CullingKernel::AVX2: return "AVX2";
+    default: return "Unknown";
+    }
+}
+
+bool IsCullingKernelSupported(CullingKernel kernel)
+{
+    switch (kernel)
+    {
+    case CullingKernel::Scalar: return true;
+#if CULLING_WITH_SSE
+    case CullingKernel::SSE: return true;
+    case CullingKernel::AVX2: return GetBestCullingKernel() == CullingKernel::AVX2;
+#endif
+    default: return false;
+    }
+}
+
+void CullBoundingBoxes(const BoundingBoxesSoA& boxes, const frustum& frustum, uint64_t* visibility, CullingKernel kernel)
+{
+    CullBoundingBoxesMultiView(boxes, &frustum, 1, &visibility, kernel);
+}
+
+void CullBoundingBoxesMultiView(const BoundingBoxesSoA& boxes, const frustum* frustums, size_t numViews, uint64_t* const* visibility, CullingKernel kernel)
+{
+    assert(numViews <= c_MaxCullingViews);
+
+    CullingView views[c_MaxCullingViews];
+    for (size_t v = 0; v < numViews; v++)
+        views[v].numPlanes = PrepareCullingPlanes(frustums[v], views[v].planes);
+
+    if (!IsCullingKernelSupported(kernel))
+        kernel = CullingKernel::Scalar;
+
+    switch (kernel)
+    {
+#if CULLING_WITH_SSE
+    case CullingKernel::AVX2:
+        CullAVX2(boxes, views, numViews, visibility);
+        break;
+    case CullingKernel::SSE:
+        CullSSE(boxes, views, numViews, visibility);
+        break;
+#endif
+    default:
+        CullScalar(boxes, views, numViews, visibility);
+        break;
+    }
+}
+
+int MultiViewVisibility::FindView(const IView* view) const
+{
+    for (size_t index = 0; index < m_Views.size(); index++)
+    {
+        if (m_Views[index] == view)
+            return int(index);
+    }
+    return -1;
+}
+
+uint32_t MultiViewVisibility::GetInstanceViewMask(size_t instanceIndex) const
+{
+    uint32_t mask = 0;
+    for (size_t view = 0; view < m_Views.size(); view++)
+    {
+        if (m_ViewBits[view][instanceIndex / 64] & (uint64_t(1) << (instanceIndex % 64)))
+            mask |= 1u << view;
+    }
+    return mask;
+}
+
+void MultiViewVisibility::Clear()
+{
+    m_Views.clear();
+}
+
+void SceneCulling::CollectDirtyInstances(const SceneGraph& sceneGraph)
+{
+    if (m_FullUpdateRequired)
+        return;
+
+    // Instance indices are reassigned on structure changes, so those need a full update anyway
+    const auto& root = sceneGraph.GetRootNode();
+    if (!root || sceneGraph.HasPendingStructureChanges())
+    {
+        Invalidate();
+        return;
+    }
+
+    const uint32_t localTransformFlag = uint32_t(SceneGraphNode::DirtyFlags::LocalTransform);
+    const uint32_t subgraphTransformsFlag = uint32_t(SceneGraphNode::DirtyFlags::SubgraphTransforms);
+
+    // Only the subgraphs that contain transform changes are visited
+    SceneGraphWalker walker(root.get());
+    while (walker)
+    {
+        const uint32_t flags = uint32_t(walker->GetDirtyFlags());
+
+        if (flags & localTransformFlag)
+        {
+            // The node moved, and everything below it moves along
+            for (SceneGraphWalker subgraph(walker.Get()); subgraph; subgraph.Next(true))
+            {
+                if (const auto* meshInstance = dynamic_cast<const MeshInstance*>(subgraph->GetLeaf().get()))
+                    m_DirtyInstances.push_back(uint32_t(meshInstance->GetInstanceIndex()));
+            }
+
+            walker.Next(false);
+        }
+        else
+        {
+            walker.Next((flags & subgraphTransformsFlag) != 0);
+        }
+    }
+
+    // Recomputing everything is cheaper than a list longer than the scene, which happens when
+    // the dirty instances accumulate over many frames without an Update
+    if (m_DirtyInstances.size() > m_Instances.size())
+        Invalidate();
+}
+
+void SceneCulling::Invalidate()
+{
+    m_FullUpdateRequired = true;
+    m_DirtyInstances.clear();
+}
+
+void SceneCulling::Update(const SceneGraph& sceneGraph)
+{
+    const auto& meshInstances = sceneGraph.GetMeshInstances();
+
+    if (m_FullUpdateRequired || m_Instances.size() != meshInstances.size())
+    {
+        m_Instances.resize(meshInstances.size());
+        m_Bounds.Resize(meshInstances.size());
+
+        for (size_t index = 0; index < meshInstances.size(); index++)
+        {
+            m_Instances[index] = meshInstances[index].get();
+            UpdateInstanceBounds(index);
+        }
+
+        m_FullUpdateRequired = false;
+    }
+    else
+    {
+        for (uint32_t index : m_DirtyInstances)
+        {
+            if (index < m_Instances.size())
+                UpdateInstanceBounds(index);
+        }
+    }
+
+    m_DirtyInstances.clear();
+}
+
+void SceneCulling::UpdateInstanceBounds(size_t index)
+{
+    const MeshInstance* instance = m_Instances[index];
+    const box3 worldBounds = instance->GetMesh()->objectSpaceBounds * instance->GetNode()->GetLocalToWorldTransformFloat();
+    m_Bounds.Set(index, worldBounds);
+}
+
+void SceneCulling::CullView(const frustum& frustum, std::vector<uint64_t>& visibility) const
+{
+    visibility.resize((m_Bounds.count + 63) / 64);
+    CullBoundingBoxes(m_Bounds, frustum, visibility.data(), Kernel);
+}
+
+void SceneCulling::CullViews(const std::vector<const IView*>& views, MultiViewVisibility& result) const
+{
+    const size_t numViews = std::min(views.size(), c_MaxCullingViews);
+
+    result.m_Views.assign(views.begin(), views.begin() + numViews);
+    result.m_ViewBits.resize(numViews);
+
+    std::vector<frustum> frustums;
+    frustums.reserve(numViews);
+    uint64_t* visibility[c_MaxCullingViews] = {};
+    for (size_t v = 0; v < numViews; v++)
+    {
+        frustums.push_back(views[v]->GetViewFrustum());
+        result.m_ViewBits[v].resize((m_Bounds.count + 63) / 64);
+        visibility[v] = result.m_ViewBits[v].data();
+    }
+
+    CullBoundingBoxesMultiView(m_Bounds, frustums.data(), numViews, visibility, Kernel);
+}
+
+CulledDrawStrategy::CulledDrawStrategy(const SceneCulling& culling, Mode mode)
+    : m_Culling(culling)
+    , m_Mode(mode)
+{
+}
+
+void CulledDrawStrategy::PrepareForView(const std::shared_ptr<SceneGraphNode>& /* rootNode */, const IView& view)
+{
+    // Views that were culled together ahead of time only need their bits looked up
+    const int sharedViewIndex = m_SharedVisibility ? m_SharedVisibility->FindView(&view) : -1;
+    if (sharedViewIndex >= 0)
+    {
+        AppendVisibleItems(m_SharedVisibility->GetViewBits(size_t(sharedViewIndex)), view);
+        return;
+    }
+
+    m_Culling.CullView(view.GetViewFrustum(), m_Visibility);
+    AppendVisibleItems(m_Visibility, view);
+}
+
+void CulledDrawStrategy::AppendVisibleItems(const std::vector<uint64_t>& visibility, const IView& view)
+{
+    m_Items.clear();
+    m_ReadPosition = 0;
+
+    const std::vector<MeshInstance*>& instances = m_Culling.GetInstances();
+    const BoundingBoxesSoA& bounds = m_Culling.GetBounds();
+    const float3 viewOrigin = view.GetViewOrigin();
+
+    for (size_t word = 0; word < visibility.size(); word++)
+    {
+        uint64_t bits = visibility[word];
+        while (bits)
+        {
+            const size_t index = word * 64 + CountTrailingZeros(bits);
+            bits &= bits - 1;
+
+            const MeshInstance* instance = instances[index];
+            const MeshInfo* mesh = instance->GetMesh().get();
+            const float3 center = float3(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]);
+            const float distanceToCamera = length(center - viewOrigin);
+
+            for (const auto& geometry : mesh->geometries)
+            {
+                const Material* material = geometry->material.get();
+                const bool transparent = material && IsTransparentDomain(material->domain);
+                if (transparent != (m_Mode == Mode::Transparent))
+                    continue;
+
+                DrawItem item;
+                item.instance = instance;
+                item.mesh = mesh;
+                item.geometry = geometry.get();
+                item.material = material;
+                item.buffers = mesh->buffers.get();
+                item.distanceToCamera = distanceToCamera;
+                item.cullMode = (material && material->doubleSided) ? nvrhi::RasterCullMode::None : nvrhi::RasterCullMode::Back;
+                m_Items.push_back(item);
+            }
+        }
+    }
+
+    if (m_Mode == Mode::Opaque)
+    {
+        std::sort(m_Items.begin(), m_Items.end(), [](const DrawItem& a, const DrawItem& b)
+        {
+            if (a.material != b.material)
+                return a.material < b.material;
+            if (a.buffers != b.buffers)
+                return a.buffers < b.buffers;
+            return a.mesh < b.mesh;
+        });
+    }
+    else
+    {
+        std::sort(m_Items.begin(), m_Items.end(), [](const DrawItem& a, const DrawItem& b)
+        {
+            return a.distanceToCamera > b.distanceToCamera;
+        });
+    }
+}
+
+const DrawItem* CulledDrawStrategy::GetNextItem()
+{
+    if (m_ReadPosition < m_Items.size())
+        return &m_Items[m_ReadPosition++];
+
+    return nullptr;
+}
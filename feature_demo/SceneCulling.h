@@ -0,0 +1,175 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <donut/render/DrawStrategy.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace donut::engine
+{
+    class MeshInstance;
+    class SceneGraph;
+}
+
+// Number of boxes processed per iteration of the culling kernels. The AVX2 kernel tests one batch at a time,
+// the SSE kernel tests it in two halves.
+static constexpr size_t c_CullingBatchSize = 8;
+
+// Upper bound on the number of planes in donut::math::frustum
+static constexpr size_t c_MaxCullingPlanes = 6;
+
+// Upper bound on the number of views culled in one pass: four shadow cascades and two stereo eyes fit
+static constexpr size_t c_MaxCullingViews = 8;
+
+// World-space bounding boxes stored as a structure of arrays in center/extent form.
+// The arrays are padded to a multiple of c_CullingBatchSize so that the kernels never need a tail loop.
+struct BoundingBoxesSoA
+{
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> extentX;
+    std::vector<float> extentY;
+    std::vector<float> extentZ;
+    size_t count = 0;
+
+    void Resize(size_t newCount);
+    void Set(size_t index, const donut::math::box3& box);
+};
+
+enum class CullingKernel
+{
+    Scalar,
+    SSE,
+    AVX2
+};
+
+// Returns the widest kernel that the CPU running the application supports
+CullingKernel GetBestCullingKernel();
+const char* GetCullingKernelName(CullingKernel kernel);
+bool IsCullingKernelSupported(CullingKernel kernel);
+
+// Tests every box against all planes of the frustum and writes one bit per box into visibility,
+// which must hold at least (boxes.count + 63) / 64 words. A set bit means the box is at least partially inside.
+void CullBoundingBoxes(const BoundingBoxesSoA& boxes, const donut::math::frustum& frustum, uint64_t* visibility, CullingKernel kernel);
+
+// Same as CullBoundingBoxes for up to c_MaxCullingViews frusta at once. Every batch of boxes is loaded once
+// and tested against all views; visibility[v] receives the bitmask for frustums[v].
+void CullBoundingBoxesMultiView(const BoundingBoxesSoA& boxes, const donut::math::frustum* frustums, size_t numViews,
+    uint64_t* const* visibility, CullingKernel kernel);
+
+// Visibility of every instance in a set of views, produced by SceneCulling::CullViews in a single pass.
+// Bit v of GetInstanceViewMask(i) is set when instance i is visible in view v.
+// Views are identified by address, so the result is only valid for the frame it was computed in.
+class MultiViewVisibility
+{
+public:
+    [[nodiscard]] int FindView(const donut::engine::IView* view) const;
+    [[nodiscard]] size_t GetNumViews() const { return m_Views.size(); }
+    [[nodiscard]] const std::vector<uint64_t>& GetViewBits(size_t viewIndex) const { return m_ViewBits[viewIndex]; }
+    [[nodiscard]] uint32_t GetInstanceViewMask(size_t instanceIndex) const;
+
+    void Clear();
+
+private:
+    friend class SceneCulling;
+
+    std::vector<const donut::engine::IView*> m_Views;
+    std::vector<std::vector<uint64_t>> m_ViewBits;
+};
+
+// Flat copy of the scene's mesh instances and their world-space bounds. Call CollectDirtyInstances before
+// and Update after Scene::RefreshSceneGraph once per frame; every view can then be culled with the SIMD kernels
+// instead of walking the scene graph through its nodes.
+class SceneCulling
+{
+public:
+    CullingKernel Kernel = GetBestCullingKernel();
+
+    // Records the instances whose world transforms are about to change, from the dirty flags that
+    // SceneGraph::Refresh clears. The instances accumulate until the next Update.
+    void CollectDirtyInstances(const donut::engine::SceneGraph& sceneGraph);
+
+    // Makes the next Update recompute all bounds, for changes that CollectDirtyInstances did not see
+    void Invalidate();
+
+    // Recomputes the bounds of the collected instances, or of all instances after a structure change
+    void Update(const donut::engine::SceneGraph& sceneGraph);
+
+    [[nodiscard]] const std::vector<donut::engine::MeshInstance*>& GetInstances() const { return m_Instances; }
+    [[nodiscard]] const BoundingBoxesSoA& GetBounds() const { return m_Bounds; }
+
+    // Resizes visibility to one bit per instance and fills it for the given frustum
+    void CullView(const donut::math::frustum& frustum, std::vector<uint64_t>& visibility) const;
+
+    // Culls all given planar views in one pass over the bounds, at most c_MaxCullingViews of them
+    void CullViews(const std::vector<const donut::engine::IView*>& views, MultiViewVisibility& result) const;
+
+private:
+    std::vector<donut::engine::MeshInstance*> m_Instances;
+    BoundingBoxesSoA m_Bounds;
+    std::vector<uint32_t> m_DirtyInstances;
+    bool m_FullUpdateRequired = true;
+
+    void UpdateInstanceBounds(size_t index);
+};
+
+// Draw strategy that takes its visible instances from SceneCulling instead of walking the scene graph.
+// The opaque mode keeps identical geometries next to each other for instancing, like InstancedOpaqueDrawStrategy;
+// the transparent mode sorts back to front, like TransparentDrawStrategy.
+// The rootNode argument of PrepareForView is ignored, the whole scene known to SceneCulling is considered.
+// Views found in the shared MultiViewVisibility reuse its bits, other views are culled on demand.
+// Instances are stateful, use one per thread.
+class CulledDrawStrategy : public donut::render::IDrawStrategy
+{
+public:
+    enum class Mode
+    {
+        Opaque,
+        Transparent
+    };
+
+    CulledDrawStrategy(const SceneCulling& culling, Mode mode);
+
+    void PrepareForView(
+        const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+        const donut::engine::IView& view) override;
+
+    const donut::render::DrawItem* GetNextItem() override;
+
+    void SetSharedVisibility(const MultiViewVisibility* visibility) { m_SharedVisibility = visibility; }
+
+protected:
+    void AppendVisibleItems(const std::vector<uint64_t>& visibility, const donut::engine::IView& view);
+
+    const SceneCulling& m_Culling;
+    const MultiViewVisibility* m_SharedVisibility = nullptr;
+    Mode m_Mode;
+    std::vector<uint64_t> m_Visibility;
+    std::vector<donut::render::DrawItem> m_Items;
+    size_t m_ReadPosition = 0;
+};
@@ -0,0 +1,422 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+// Offline converter that replaces the images of glTF scenes with BC-compressed DDS textures.
+// Every .gltf file under the input folder is scanned for the material slots its images are used in, and each
+// external image is converted into a file next to it with the same name and the .dds extension:
+//
+//   base color, diffuse         BC7 sRGB
+//   emissive                    BC1 sRGB
+//   specular-glossiness         BC3 sRGB
+//   normal                      BC5
+//   metal-rough, occlusion,
+//   transmission                BC1
+//
+// Images used in slots with different formats get BC7. The Feature Demo loads the DDS files instead of the
+// original images when they exist, see MappedFileSystem.h. Files that are newer than their source are skipped.
+//
+// Usage: texture_bake [-input <folder>] [-threads <n>] [-force] [-scalar]
+
+#include "TextureCompression.h"
+
+#include <json/json.h>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    enum class MaterialSlot
+    {
+        BaseColor,
+        Emissive,
+        SpecularGlossiness,
+        Normal,
+        MetalRough,
+        Occlusion,
+        Transmission
+    };
+
+    struct SlotEncoding
+    {
+        BlockFormat format;
+        bool srgb;
+    };
+
+    SlotEncoding GetSlotEncoding(MaterialSlot slot)
+    {
+        switch (slot)
+        {
+        case MaterialSlot::BaseColor: return { BlockFormat::BC7, true };
+        case MaterialSlot::Emissive: return { BlockFormat::BC1, true };
+        case MaterialSlot::SpecularGlossiness: return { BlockFormat::BC3, true };
+        case MaterialSlot::Normal: return { BlockFormat::BC5, false };
+        default: return { BlockFormat::BC1, false };
+        }
+    }
+
+    struct ConversionJob
+    {
+        fs::path source;
+        fs::path destination;
+        BlockFormat format = BlockFormat::BC7;
+        bool srgb = false;
+        bool normalMap = false;
+        bool initialized = false;
+
+        void AddUsage(MaterialSlot slot)
+        {
+            const SlotEncoding encoding = GetSlotEncoding(slot);
+            const bool isNormal = slot == MaterialSlot::Normal;
+
+            if (!initialized)
+            {
+                format = encoding.format;
+                srgb = encoding.srgb;
+                normalMap = isNormal;
+                initialized = true;
+                return;
+            }
+
+            if (format != encoding.format || normalMap != isNormal)
+            {
+                format = BlockFormat::BC7;
+                normalMap = false;
+            }
+            srgb = srgb || encoding.srgb;
+        }
+    };
+
+    std::string DecodeUri(const std::string& uri)
+    {
+        std::string result;
+        for (size_t i = 0; i < uri.size(); i++)
+        {
+            if (uri[i] == '%' && i + 2 < uri.size())
+            {
+                result += char(std::strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16));
+                i += 2;
+            }
+            else
+                result += uri[i];
+        }
+        return result;
+    }
+
+    bool IsConvertibleImage(const fs::path& path)
+    {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return char(std::tolower(c)); });
+        return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp";
+    }
+
+    // Adds the images of one .gltf file to the jobs, keyed by the source image path
+    bool CollectImages(const fs::path& gltfFile, std::map<fs::path, ConversionJob>& jobs)
+    {
+        std::ifstream file(gltfFile);
+        if (!file.is_open())
+            return false;
+
+        Json::Value root;
+        Json::CharReaderBuilder builder;
+        std::string errors;
+        if (!Json::parseFromStream(builder, file, &root, &errors))
+        {
+            fprintf(stderr, "Cannot parse '%s': %s\n", gltfFile.generic_string().c_str(), errors.c_str());
+            return false;
+        }
+
+        const Json::Value& textures = root["textures"];
+        const Json::Value& images = root["images"];
+
+        auto addTexture = [&](const Json::Value& textureInfo, MaterialSlot slot)
+        {
+            if (!textureInfo.isObject() || !textureInfo["index"].isInt())
+                return;
+
+            const Json::Value& texture = textures[textureInfo["index"].asInt()];
+            if (!texture["source"].isInt())
+                return;
+
+            const Json::Value& image = images[texture["source"].asInt()];
+            if (!image["uri"].isString())
+                return; // stored in a buffer view
+
+            const std::string uri = image["uri"].asString();
+            if (uri.rfind("data:", 0) == 0 || uri.find("://") != std::string::npos)
+                return;
+
+            const fs::path source = (gltfFile.parent_path() / fs::u8path(DecodeUri(uri))).lexically_normal();
+            if (!IsConvertibleImage(source))
+                return;
+
+            ConversionJob& job = jobs[source];
+            job.source = source;
+            job.destination = fs::path(source).replace_extension(".dds");
+            job.AddUsage(slot);
+        };
+
+        for (const Json::Value& material : root["materials"])
+        {
+            const Json::Value& pbr = material["pbrMetallicRoughness"];
+            addTexture(pbr["baseColorTexture"], MaterialSlot::BaseColor);
+            addTexture(pbr["metallicRoughnessTexture"], MaterialSlot::MetalRough);
+            addTexture(material["normalTexture"], MaterialSlot::Normal);
+            addTexture(material["occlusionTexture"], MaterialSlot::Occlusion);
+            addTexture(material["emissiveTexture"], MaterialSlot::Emissive);
+
+            const Json::Value& extensions = material["extensions"];
+            const Json::Value& specularGlossiness = extensions["KHR_materials_pbrSpecularGlossiness"];
+            addTexture(specularGlossiness["diffuseTexture"], MaterialSlot::BaseColor);
+            addTexture(specularGlossiness["specularGlossinessTexture"], MaterialSlot::SpecularGlossiness);
+            addTexture(extensions["KHR_materials_transmission"]["transmissionTexture"], MaterialSlot::Transmission);
+        }
+
+        return true;
+    }
+
+    bool IsUpToDate(const ConversionJob& job)
+    {
+        std::error_code error;
+        const auto destinationTime = fs::last_write_time(job.destination, error);
+        if (error)
+            return false;
+
+        const auto sourceTime = fs::last_write_time(job.source, error);
+        return !error && destinationTime >= sourceTime;
+    }
+
+    struct ConversionResult
+    {
+        bool success = false;
+        uint64_t sourceBytes = 0;
+        uint64_t outputBytes = 0;
+        uint64_t pixels = 0;
+        double mipMilliseconds = 0.0;
+        double compressMilliseconds = 0.0;
+        std::string message;
+    };
+
+    ConversionResult ConvertImage(const ConversionJob& job, BlockEncoderKernel kernel)
+    {
+        using clock = std::chrono::high_resolution_clock;
+        ConversionResult result;
+
+        int width = 0, height = 0, components = 0;
+        stbi_uc* pixels = stbi_load(job.source.string().c_str(), &width, &height, &components, STBI_rgb_alpha);
+        if (!pixels)
+        {
+            result.message = std::string("cannot decode: ") + stbi_failure_reason();
+            return result;
+        }
+
+        ImageLevel baseLevel;
+        baseLevel.width = uint32_t(width);
+        baseLevel.height = uint32_t(height);
+        baseLevel.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+        stbi_image_free(pixels);
+
+        const auto mipStart = clock::now();
+        const std::vector<ImageLevel> levels = GenerateMipChain(std::move(baseLevel), job.srgb, job.normalMap);
+        const auto compressStart = clock::now();
+
+        std::vector<std::vector<uint8_t>> compressedLevels;
+        for (const ImageLevel& level : levels)
+        {
+            compressedLevels.push_back(CompressLevel(level, job.format, kernel));
+            result.outputBytes += compressedLevels.back().size();
+            result.pixels += uint64_t(level.width) * level.height;
+        }
+        const auto compressEnd = clock::now();
+
+        result.mipMilliseconds = std::chrono::duration<double, std::milli>(compressStart - mipStart).count();
+        result.compressMilliseconds = std::chrono::duration<double, std::milli>(compressEnd - compressStart).count();
+
+        if (!WriteDdsFile(job.destination, job.format, job.srgb, uint32_t(width), uint32_t(height), compressedLevels))
+        {
+            result.message = "cannot write " + job.destination.generic_string();
+            return result;
+        }
+
+        std::error_code error;
+        result.sourceBytes = fs::file_size(job.source, error);
+
+        std::stringstream ss;
+        ss << width << "x" << height << " " << GetBlockFormatName(job.format) << (job.srgb ? " sRGB" : "")
+            << ", " << levels.size() << " mips";
+        result.message = ss.str();
+        result.success = true;
+        return result;
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    fs::path inputPath = fs::absolute(argv[0]).parent_path().parent_path() / "media" / "glTF-Sample-Models";
+    unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    bool force = false;
+    BlockEncoderKernel kernel = GetBestBlockEncoderKernel();
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-input") && i + 1 < argc)
+        {
+            inputPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            threadCount = unsigned(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (!strcmp(argv[i], "-force"))
+        {
+            force = true;
+        }
+        else if (!strcmp(argv[i], "-scalar"))
+        {
+            kernel = BlockEncoderKernel::Scalar;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-input <folder>] [-threads <n>] [-force] [-scalar]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    inputPath = fs::absolute(inputPath).lexically_normal();
+
+    std::error_code error;
+    if (!fs::is_directory(inputPath, error))
+    {
+        fprintf(stderr, "Input folder '%s' does not exist\n", inputPath.generic_string().c_str());
+        return 1;
+    }
+
+    std::map<fs::path, ConversionJob> jobMap;
+    size_t sceneCount = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(inputPath, fs::directory_options::skip_permission_denied, error))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".gltf" && CollectImages(entry.path(), jobMap))
+            ++sceneCount;
+    }
+
+    std::vector<ConversionJob> jobs;
+    size_t upToDateCount = 0;
+    for (auto& [source, job] : jobMap)
+    {
+        if (!fs::exists(source, error))
+            continue;
+
+        if (!force && IsUpToDate(job))
+        {
+            ++upToDateCount;
+            continue;
+        }
+
+        jobs.push_back(job);
+    }
+
+    // Start with the largest images so that a big texture does not end up alone on one thread at the end
+    std::sort(jobs.begin(), jobs.end(), [](const ConversionJob& a, const ConversionJob& b)
+    {
+        std::error_code sizeError;
+        return fs::file_size(a.source, sizeError) > fs::file_size(b.source, sizeError);
+    });
+
+    printf("Found %zu images in %zu scenes, %zu up to date, converting %zu on %u threads with the %s block encoder\n",
+        jobMap.size(), sceneCount, upToDateCount, jobs.size(), threadCount, GetBlockEncoderKernelName(kernel));
+
+    std::atomic<size_t> nextJob = 0;
+    std::atomic<size_t> completedJobs = 0;
+    std::mutex resultMutex;
+    size_t failedCount = 0;
+    uint64_t totalSourceBytes = 0;
+    uint64_t totalOutputBytes = 0;
+    uint64_t totalPixels = 0;
+    double totalCompressMilliseconds = 0.0;
+
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    auto worker = [&]()
+    {
+        for (size_t index = nextJob++; index < jobs.size(); index = nextJob++)
+        {
+            const ConversionJob& job = jobs[index];
+            const ConversionResult result = ConvertImage(job, kernel);
+
+            std::lock_guard<std::mutex> lock(resultMutex);
+            const size_t completed = ++completedJobs;
+            const std::string relativePath = job.source.lexically_relative(inputPath).generic_string();
+
+            if (result.success)
+            {
+                totalSourceBytes += result.sourceBytes;
+                totalOutputBytes += result.outputBytes;
+                totalPixels += result.pixels;
+                totalCompressMilliseconds += result.compressMilliseconds;
+
+                printf("[%zu/%zu] %s: %s, mips %.1f ms, compression %.1f ms\n", completed, jobs.size(), relativePath.c_str(),
+                    result.message.c_str(), result.mipMilliseconds, result.compressMilliseconds);
+            }
+            else
+            {
+                ++failedCount;
+                fprintf(stderr, "[%zu/%zu] %s: %s\n", completed, jobs.size(), relativePath.c_str(), result.message.c_str());
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int thread = 1; thread < std::min(threadCount, unsigned(std::max<size_t>(jobs.size(), 1))); thread++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    const double elapsedSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    printf("Converted %zu images in %.2f s, %zu failed. Source files: %.1f MB, DDS files: %.1f MB.\n",
+        jobs.size() - failedCount, elapsedSeconds, failedCount,
+        double(totalSourceBytes) / (1024.0 * 1024.0), double(totalOutputBytes) / (1024.0 * 1024.0));
+
+    if (totalCompressMilliseconds > 0.0)
+    {
+        printf("Block encoder throughput: %.1f Mpixels/s per thread\n", double(totalPixels) / (totalCompressMilliseconds * 1000.0));
+    }
+
+    return failedCount ? 1 : 0;
+}
@@ -0,0 +1,818 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "TextureCompression.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#if !defined(TEXTURE_COMPRESSION_WITH_SSE)
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_COMPRESSION_WITH_SSE 1
+#else
+#define TEXTURE_COMPRESSION_WITH_SSE 0
+#endif
+#endif
+
+#if TEXTURE_COMPRESSION_WITH_SSE
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Pixels of one 4x4 block as a structure of arrays: R, G, B and A for the 16 pixels in row-major order, in 0-255
+    struct BlockPixels
+    {
+        float channels[4][16];
+    };
+
+    void LoadBlockPixels(const uint8_t* rgba, BlockPixels& block)
+    {
+        for (int pixel = 0; pixel < 16; pixel++)
+        {
+            for (int channel = 0; channel < 4; channel++)
+                block.channels[channel][pixel] = float(rgba[pixel * 4 + channel]);
+        }
+    }
+
+    // Picks the closest palette entry for every pixel, measured as the squared distance over the channels
+    // with a non-zero weight, and returns the total error of the block.
+    float SelectIndicesScalar(const BlockPixels& block, const float (*palette)[4], int paletteSize, const float* weights, uint8_t* indices)
+    {
+        float totalError = 0.f;
+
+        for (int pixel = 0; pixel < 16; pixel++)
+        {
+            float bestError = FLT_MAX;
+            int bestIndex = 0;
+
+            for (int entry = 0; entry < paletteSize; entry++)
+            {
+                const float d0 = block.channels[0][pixel] - palette[entry][0];
+                const float d1 = block.channels[1][pixel] - palette[entry][1];
+                const float d2 = block.channels[2][pixel] - palette[entry][2];
+                const float d3 = block.channels[3][pixel] - palette[entry][3];
+                const float error = weights[0] * (d0 * d0) + weights[1] * (d1 * d1) + weights[2] * (d2 * d2) + weights[3] * (d3 * d3);
+
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestIndex = entry;
+                }
+            }
+
+            indices[pixel] = uint8_t(bestIndex);
+            totalError += bestError;
+        }
+
+        return totalError;
+    }
+
+#if TEXTURE_COMPRESSION_WITH_SSE
+    float SelectIndicesSSE(const BlockPixels& block, const float (*palette)[4], int paletteSize, const float* weights, uint8_t* indices)
+    {
+        const __m128 weight0 = _mm_set1_ps(weights[0]);
+        const __m128 weight1 = _mm_set1_ps(weights[1]);
+        const __m128 weight2 = _mm_set1_ps(weights[2]);
+        const __m128 weight3 = _mm_set1_ps(weights[3]);
+
+        alignas(16) float pixelErrors[16];
+        alignas(16) int32_t pixelIndices[16];
+
+        for (int pixel = 0; pixel < 16; pixel += 4)
+        {
+            const __m128 channel0 = _mm_loadu_ps(&block.channels[0][pixel]);
+            const __m128 channel1 = _mm_loadu_ps(&block.channels[1][pixel]);
+            const __m128 channel2 = _mm_loadu_ps(&block.channels[2][pixel]);
+            const __m128 channel3 = _mm_loadu_ps(&block.channels[3][pixel]);
+
+            __m128 bestError = _mm_set1_ps(FLT_MAX);
+            __m128i bestIndex = _mm_setzero_si128();
+
+            for (int entry = 0; entry < paletteSize; entry++)
+            {
+                const __m128 d0 = _mm_sub_ps(channel0, _mm_set1_ps(palette[entry][0]));
+                const __m128 d1 = _mm_sub_ps(channel1, _mm_set1_ps(palette[entry][1]));
+                const __m128 d2 = _mm_sub_ps(channel2, _mm_set1_ps(palette[entry][2]));
+                const __m128 d3 = _mm_sub_ps(channel3, _mm_set1_ps(palette[entry][3]));
+                const __m128 error = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(weight0, _mm_mul_ps(d0, d0)),
+                    _mm_mul_ps(weight1, _mm_mul_ps(d1, d1))),
+                    _mm_mul_ps(weight2, _mm_mul_ps(d2, d2))),
+                    _mm_mul_ps(weight3, _mm_mul_ps(d3, d3)));
+
+                // Strictly smaller errors win, so ties keep the lower index like the scalar kernel
+                const __m128i better = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+                bestError = _mm_min_ps(error, bestError);
+                bestIndex = _mm_or_si128(_mm_and_si128(better, _mm_set1_epi32(entry)), _mm_andnot_si128(better, bestIndex));
+            }
+
+            _mm_store_ps(&pixelErrors[pixel], bestError);
+            _mm_store_si128(reinterpret_cast<__m128i*>(&pixelIndices[pixel]), bestIndex);
+        }
+
+        float totalError = 0.f;
+        for (int pixel = 0; pixel < 16; pixel++)
+        {
+            indices[pixel] = uint8_t(pixelIndices[pixel]);
+            totalError += pixelErrors[pixel];
+        }
+
+        return totalError;
+    }
+#endif
+
+    float SelectIndices(BlockEncoderKernel kernel, const BlockPixels& block, const float (*palette)[4], int paletteSize, const float* weights, uint8_t* indices)
+    {
+#if TEXTURE_COMPRESSION_WITH_SSE
+        if (kernel == BlockEncoderKernel::SSE)
+            return SelectIndicesSSE(block, palette, paletteSize, weights, indices);
+#endif
+        return SelectIndicesScalar(block, palette, paletteSize, weights, indices);
+    }
+
+    // Endpoints along the principal axis of the pixels in the channels with a non-zero weight,
+    // found with a few power iterations on their covariance matrix.
+    void FindPrincipalEndpoints(const BlockPixels& block, const float* weights, float* endpoint0, float* endpoint1)
+    {
+        float mean[4] = {};
+        for (int channel = 0; channel < 4; channel++)
+        {
+            if (weights[channel] == 0.f)
+                continue;
+
+            for (int pixel = 0; pixel < 16; pixel++)
+                mean[channel] += block.channels[channel][pixel];
+            mean[channel] /= 16.f;
+        }
+
+        float covariance[4][4] = {};
+        for (int pixel = 0; pixel < 16; pixel++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                if (weights[row] == 0.f)
+                    continue;
+
+                const float rowValue = block.channels[row][pixel] - mean[row];
+                for (int column = 0; column < 4; column++)
+                {
+                    if (weights[column] != 0.f)
+                        covariance[row][column] += rowValue * (block.channels[column][pixel] - mean[column]);
+                }
+            }
+        }
+
+        float axis[4];
+        for (int channel = 0; channel < 4; channel++)
+            axis[channel] = weights[channel] != 0.f ? 1.f : 0.f;
+
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {};
+            float length = 0.f;
+            for (int row = 0; row < 4; row++)
+            {
+                for (int column = 0; column < 4; column++)
+                    next[row] += covariance[row][column] * axis[column];
+                length = std::max(length, std::abs(next[row]));
+            }
+
+            // A block of identical pixels has no principal axis, keep the diagonal
+            if (length < 1e-6f)
+                break;
+
+            for (int channel = 0; channel < 4; channel++)
+                axis[channel] = next[channel] / length;
+        }
+
+        float axisLengthSquared = 0.f;
+        for (int channel = 0; channel < 4; channel++)
+            axisLengthSquared += axis[channel] * axis[channel];
+
+        float minProjection = 0.f;
+        float maxProjection = 0.f;
+        for (int pixel = 0; pixel < 16; pixel++)
+        {
+            float projection = 0.f;
+            for (int channel = 0; channel < 4; channel++)
+                projection += (block.channels[channel][pixel] - mean[channel]) * axis[channel];
+            projection /= axisLengthSquared;
+
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+
+        for (int channel = 0; channel < 4; channel++)
+        {
+            endpoint0[channel] = std::clamp(mean[channel] + axis[channel] * minProjection, 0.f, 255.f);
+            endpoint1[channel] = std::clamp(mean[channel] + axis[channel] * maxProjection, 0.f, 255.f);
+        }
+    }
+
+    // Least squares fit of the two endpoints to the pixels, given the palette entry chosen for every pixel
+    // and the position of each palette entry between endpoint 0 (0.0) and endpoint 1 (1.0).
+    bool FitEndpoints(const BlockPixels& block, const float* weights, const uint8_t* indices, const float* entryPositions,
+        float* endpoint0, float* endpoint1)
+    {
+        float a = 0.f, b = 0.f, c = 0.f;
+        for (int pixel = 0; pixel < 16; pixel++)
+        {
+            const float t = entryPositions[indices[pixel]];
+            a += (1.f - t) * (1.f - t);
+            b += (1.f - t) * t;
+            c += t * t;
+        }
+
+        const float determinant = a * c - b * b;
+        if (std::abs(determinant) < 1e-6f)
+            return false;
+
+        for (int channel = 0; channel < 4; channel++)
+        {
+            if (weights[channel] == 0.f)
+                continue;
+
+            float sum0 = 0.f, sum1 = 0.f;
+            for (int pixel = 0; pixel < 16; pixel++)
+            {
+                const float t = entryPositions[indices[pixel]];
+                sum0 += (1.f - t) * block.channels[channel][pixel];
+                sum1 += t * block.channels[channel][pixel];
+            }
+
+            endpoint0[channel] = std::clamp((c * sum0 - b * sum1) / determinant, 0.f, 255.f);
+            endpoint1[channel] = std::clamp((a * sum1 - b * sum0) / determinant, 0.f, 255.f);
+        }
+
+        return true;
+    }
+
+    // Packs fields of up to 32 bits into a 128-bit block, least significant bit first
+    class BlockWriter
+    {
+    public:
+        explicit BlockWriter(uint8_t* output, size_t size)
+            : m_Output(output)
+        {
+            memset(output, 0, size);
+        }
+
+        void Write(uint32_t value, int bits)
+        {
+            for (int bit = 0; bit < bits; bit++, m_Position++)
+            {
+                if (value & (1u << bit))
+                    m_Output[m_Position / 8] |= uint8_t(1u << (m_Position % 8));
+            }
+        }
+
+    private:
+        uint8_t* m_Output;
+        int m_Position = 0;
+    };
+
+    uint16_t PackColor565(const float* color)
+    {
+        const uint32_t r = uint32_t(std::lround(color[0] * 31.f / 255.f));
+        const uint32_t g = uint32_t(std::lround(color[1] * 63.f / 255.f));
+        const uint32_t b = uint32_t(std::lround(color[2] * 31.f / 255.f));
+        return uint16_t((r << 11) | (g << 5) | b);
+    }
+
+    void UnpackColor565(uint16_t packed, float* color)
+    {
+        const uint32_t r = (packed >> 11) & 31;
+        const uint32_t g = (packed >> 5) & 63;
+        const uint32_t b = packed & 31;
+        color[0] = float((r << 3) | (r >> 2));
+        color[1] = float((g << 2) | (g >> 4));
+        color[2] = float((b << 3) | (b >> 2));
+        color[3] = 0.f;
+    }
+
+    // BC1 color block in the four-color mode, which BC3 also uses for its color part
+    void EncodeColorBlock(const BlockPixels& block, BlockEncoderKernel kernel, uint8_t* output)
+    {
+        static const float weights[4] = { 1.f, 1.f, 1.f, 0.f };
+        static const float entryPositions[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+
+        float endpoint0[4], endpoint1[4];
+        FindPrincipalEndpoints(block, weights, endpoint0, endpoint1);
+
+        float bestError = FLT_MAX;
+        uint16_t bestColor0 = 0, bestColor1 = 0;
+        uint8_t bestIndices[16] = {};
+
+        for (int iteration = 0; iteration < 2; iteration++)
+        {
+            const uint16_t color0 = PackColor565(endpoint0);
+            const uint16_t color1 = PackColor565(endpoint1);
+
+            float palette[4][4];
+            UnpackColor565(color0, palette[0]);
+            UnpackColor565(color1, palette[1]);
+            for (int channel = 0; channel < 4; channel++)
+            {
+                palette[2][channel] = (2.f * palette[0][channel] + palette[1][channel]) / 3.f;
+                palette[3][channel] = (palette[0][channel] + 2.f * palette[1][channel]) / 3.f;
+            }
+
+            uint8_t indices[16];
+            const float error = SelectIndices(kernel, block, palette, color0 == color1 ? 1 : 4, weights, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                bestColor0 = color0;
+                bestColor1 = color1;
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+
+            if (color0 == color1 || !FitEndpoints(block, weights, indices, entryPositions, endpoint0, endpoint1))
+                break;
+        }
+
+        // The four-color mode requires color0 > color1, swapping the endpoints swaps the palette entries pairwise
+        if (bestColor0 < bestColor1)
+        {
+            std::swap(bestColor0, bestColor1);
+            for (uint8_t& index : bestIndices)
+                index ^= 1;
+        }
+
+        uint32_t packedIndices = 0;
+        for (int pixel = 0; pixel < 16; pixel++)
+            packedIndices |= uint32_t(bestIndices[pixel]) << (pixel * 2);
+
+        BlockWriter writer(output, 8);
+        writer.Write(bestColor0, 16);
+        writer.Write(bestColor1, 16);
+        writer.Write(packedIndices, 32);
+    }
+
+    // BC4 block for one channel in the eight-value mode, used for the BC3 alpha and both BC5 channels
+    void EncodeSingleChannelBlock(const BlockPixels& block, int channel, BlockEncoderKernel kernel, uint8_t* output)
+    {
+        static const float entryPositions[8] = { 0.f, 1.f, 1.f / 7.f, 2.f / 7.f, 3.f / 7.f, 4.f / 7.f, 5.f / 7.f, 6.f / 7.f };
+
+        float weights[4] = {};
+        weights[channel] = 1.f;
+
+        float endpoint0[4] = {}, endpoint1[4] = {};
+        endpoint0[channel] = *std::max_element(block.channels[channel], block.channels[channel] + 16);
+        endpoint1[channel] = *std::min_element(block.channels[channel], block.channels[channel] + 16);
+
+        float bestError = FLT_MAX;
+        uint32_t bestValue0 = 0, bestValue1 = 0;
+        uint8_t bestIndices[16] = {};
+
+        for (int iteration = 0; iteration < 2; iteration++)
+        {
+            uint32_t value0 = uint32_t(std::lround(endpoint0[channel]));
+            uint32_t value1 = uint32_t(std::lround(endpoint1[channel]));
+            if (value0 < value1)
+                std::swap(value0, value1);
+
+            float palette[8][4] = {};
+            palette[0][channel] = float(value0);
+            palette[1][channel] = float(value1);
+            for (int entry = 2; entry < 8; entry++)
+                palette[entry][channel] = (float(8 - entry) * float(value0) + float(entry - 1) * float(value1)) / 7.f;
+
+            uint8_t indices[16];
+            const float error = SelectIndices(kernel, block, palette, value0 == value1 ? 1 : 8, weights, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                bestValue0 = value0;
+                bestValue1 = value1;
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+
+            endpoint0[channel] = float(value0);
+            endpoint1[channel] = float(value1);
+            if (value0 == value1 || !FitEndpoints(block, weights, indices, entryPositions, endpoint0, endpoint1))
+                break;
+        }
+
+        BlockWriter writer(output, 8);
+        writer.Write(bestValue0, 8);
+        writer.Write(bestValue1, 8);
+        for (int pixel = 0; pixel < 16; pixel++)
+            writer.Write(bestIndices[pixel], 3);
+    }
+
+    // BC7 mode 6: one subset, 7-bit RGBA endpoints with a shared low bit per endpoint, and 4-bit indices
+    void EncodeBC7Mode6(const BlockPixels& block, BlockEncoderKernel kernel, uint8_t* output)
+    {
+        static const float weights[4] = { 1.f, 1.f, 1.f, 1.f };
+        static const uint32_t interpolationWeights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        float entryPositions[16];
+        for (int entry = 0; entry < 16; entry++)
+            entryPositions[entry] = float(interpolationWeights[entry]) / 64.f;
+
+        float endpoint0[4], endpoint1[4];
+        FindPrincipalEndpoints(block, weights, endpoint0, endpoint1);
+
+        float bestError = FLT_MAX;
+        uint32_t bestEndpoints[2][4] = {};
+        uint32_t bestPBits[2] = {};
+        uint8_t bestIndices[16] = {};
+
+        for (int iteration = 0; iteration < 2; iteration++)
+        {
+            uint8_t iterationIndices[16] = {};
+            float iterationError = FLT_MAX;
+
+            // Try every combination of the low bits, they are shared by all channels of an endpoint
+            for (uint32_t pBits = 0; pBits < 4; pBits++)
+            {
+                const uint32_t pBit0 = pBits & 1;
+                const uint32_t pBit1 = pBits >> 1;
+
+                uint32_t quantized[2][4];
+                uint32_t expanded[2][4];
+                for (int channel = 0; channel < 4; channel++)
+                {
+                    quantized[0][channel] = uint32_t(std::clamp(std::lround((endpoint0[channel] - float(pBit0)) * 0.5f), 0l, 127l));
+                    quantized[1][channel] = uint32_t(std::clamp(std::lround((endpoint1[channel] - float(pBit1)) * 0.5f), 0l, 127l));
+                    expanded[0][channel] = (quantized[0][channel] << 1) | pBit0;
+                    expanded[1][channel] = (quantized[1][channel] << 1) | pBit1;
+                }
+
+                float palette[16][4];
+                for (int entry = 0; entry < 16; entry++)
+                {
+                    for (int channel = 0; channel < 4; channel++)
+                    {
+                        palette[entry][channel] = float(((64 - interpolationWeights[entry]) * expanded[0][channel]
+                            + interpolationWeights[entry] * expanded[1][channel] + 32) >> 6);
+                    }
+                }
+
+                uint8_t indices[16];
+                const float error = SelectIndices(kernel, block, palette, 16, weights, indices);
+
+                if (error < iterationError)
+                {
+                    iterationError = error;
+                    memcpy(iterationIndices, indices, sizeof(indices));
+                }
+
+                if (error < bestError)
+                {
+                    bestError = error;
+                    memcpy(bestEndpoints, quantized, sizeof(quantized));
+                    bestPBits[0] = pBit0;
+                    bestPBits[1] = pBit1;
+                    memcpy(bestIndices, indices, sizeof(indices));
+                }
+            }
+
+            if (!FitEndpoints(block, weights, iterationIndices, entryPositions, endpoint0, endpoint1))
+                break;
+        }
+
+        // The most significant bit of the first index is implied to be zero, swap the endpoints to make it so
+        if (bestIndices[0] & 8)
+        {
+            for (int channel = 0; channel < 4; channel++)
+                std::swap(bestEndpoints[0][channel], bestEndpoints[1][channel]);
+            std::swap(bestPBits[0], bestPBits[1]);
+            for (uint8_t& index : bestIndices)
+                index = uint8_t(15 - index);
+        }
+
+        BlockWriter writer(output, 16);
+        writer.Write(1u << 6, 7);
+        for (int channel = 0; channel < 4; channel++)
+        {
+            writer.Write(bestEndpoints[0][channel], 7);
+            writer.Write(bestEndpoints[1][channel], 7);
+        }
+        writer.Write(bestPBits[0], 1);
+        writer.Write(bestPBits[1], 1);
+        writer.Write(bestIndices[0], 3);
+        for (int pixel = 1; pixel < 16; pixel++)
+            writer.Write(bestIndices[pixel], 4);
+    }
+
+    float SrgbToLinear(float value)
+    {
+        return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    float LinearToSrgb(float value)
+    {
+        return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+    }
+
+    uint8_t ToUnorm8(float value)
+    {
+        return uint8_t(std::lround(std::clamp(value, 0.f, 1.f) * 255.f));
+    }
+}
+
+const char* GetBlockFormatName(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1: return "BC1";
+    case BlockFormat::BC3: return "BC3";
+    case BlockFormat::BC5: return "BC5";
+    case BlockFormat::BC7: return "BC7";
+    default: return "<INVALID>";
+    }
+}
+
+size_t GetBlockFormatBytesPerBlock(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+uint32_t GetBlockFormatDxgiFormat(BlockFormat format, bool srgb)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1: return srgb ? 72 : 71; // DXGI_FORMAT_BC1_UNORM_SRGB, DXGI_FORMAT_BC1_UNORM
+    case BlockFormat::BC3: return srgb ? 78 : 77; // DXGI_FORMAT_BC3_UNORM_SRGB, DXGI_FORMAT_BC3_UNORM
+    case BlockFormat::BC5: return 83;             // DXGI_FORMAT_BC5_UNORM
+    case BlockFormat::BC7: return srgb ? 99 : 98; // DXGI_FORMAT_BC7_UNORM_SRGB, DXGI_FORMAT_BC7_UNORM
+    default: return 0;
+    }
+}
+
+BlockEncoderKernel GetBestBlockEncoderKernel()
+{
+#if TEXTURE_COMPRESSION_WITH_SSE
+    return BlockEncoderKernel::SSE;
+#else
+    return BlockEncoderKernel::Scalar;
+#endif
+}
+
+const char* GetBlockEncoderKernelName(BlockEncoderKernel kernel)
+{
+    switch (kernel)
+    {
+    case BlockEncoderKernel::Scalar: return "Scalar";
+    case BlockEncoderKernel::SSE: return "SSE";
+    default: return "<INVALID>";
+    }
+}
+
+std::vector<ImageLevel> GenerateMipChain(ImageLevel baseLevel, bool srgb, bool normalMap)
+{
+    std::vector<ImageLevel> levels;
+
+    // Filter from a float copy of the previous level so that the rounding errors do not accumulate down the chain
+    uint32_t width = baseLevel.width;
+    uint32_t height = baseLevel.height;
+    std::vector<float> current(size_t(width) * height * 4);
+
+    float srgbToLinear[256];
+    for (int value = 0; value < 256; value++)
+        srgbToLinear[value] = SrgbToLinear(float(value) / 255.f);
+
+    for (size_t pixel = 0; pixel < size_t(width) * height; pixel++)
+    {
+        for (int channel = 0; channel < 4; channel++)
+        {
+            const uint8_t value = baseLevel.pixels[pixel * 4 + channel];
+            float& result = current[pixel * 4 + channel];
+
+            if (normalMap && channel < 3)
+                result = float(value) / 127.5f - 1.f;
+            else if (srgb && channel < 3)
+                result = srgbToLinear[value];
+            else
+                result = float(value) / 255.f;
+        }
+    }
+
+    levels.push_back(std::move(baseLevel));
+
+    while (width > 1 || height > 1)
+    {
+        const uint32_t nextWidth = std::max(width / 2, 1u);
+        const uint32_t nextHeight = std::max(height / 2, 1u);
+        std::vector<float> next(size_t(nextWidth) * nextHeight * 4);
+
+        for (uint32_t y = 0; y < nextHeight; y++)
+        {
+            const uint32_t y0 = std::min(y * 2, height - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+
+            for (uint32_t x = 0; x < nextWidth; x++)
+            {
+                const uint32_t x0 = std::min(x * 2, width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+
+                float* result = &next[(size_t(y) * nextWidth + x) * 4];
+                for (int channel = 0; channel < 4; channel++)
+                {
+                    result[channel] = 0.25f * (
+                        current[(size_t(y0) * width + x0) * 4 + channel] + current[(size_t(y0) * width + x1) * 4 + channel] +
+                        current[(size_t(y1) * width + x0) * 4 + channel] + current[(size_t(y1) * width + x1) * 4 + channel]);
+                }
+
+                if (normalMap)
+                {
+                    const float length = std::sqrt(result[0] * result[0] + result[1] * result[1] + result[2] * result[2]);
+                    if (length > 1e-6f)
+                    {
+                        result[0] /= length;
+                        result[1] /= length;
+                        result[2] /= length;
+                    }
+                }
+            }
+        }
+
+        ImageLevel level;
+        level.width = nextWidth;
+        level.height = nextHeight;
+        level.pixels.resize(next.size());
+
+        for (size_t pixel = 0; pixel < size_t(nextWidth) * nextHeight; pixel++)
+        {
+            for (int channel = 0; channel < 4; channel++)
+            {
+                const float value = next[pixel * 4 + channel];
+                uint8_t& result = level.pixels[pixel * 4 + channel];
+
+                if (normalMap && channel < 3)
+                    result = ToUnorm8(value * 0.5f + 0.5f);
+                else if (srgb && channel < 3)
+                    result = ToUnorm8(LinearToSrgb(value));
+                else
+                    result = ToUnorm8(value);
+            }
+        }
+
+        levels.push_back(std::move(level));
+        current = std::move(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+
+    return levels;
+}
+
+void CompressBlock(const uint8_t* blockPixels, BlockFormat format, BlockEncoderKernel kernel, uint8_t* output)
+{
+    BlockPixels block;
+    LoadBlockPixels(blockPixels, block);
+
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        EncodeColorBlock(block, kernel, output);
+        break;
+    case BlockFormat::BC3:
+        EncodeSingleChannelBlock(block, 3, kernel, output);
+        EncodeColorBlock(block, kernel, output + 8);
+        break;
+    case BlockFormat::BC5:
+        EncodeSingleChannelBlock(block, 0, kernel, output);
+        EncodeSingleChannelBlock(block, 1, kernel, output + 8);
+        break;
+    case BlockFormat::BC7:
+        EncodeBC7Mode6(block, kernel, output);
+        break;
+    }
+}
+
+std::vector<uint8_t> CompressLevel(const ImageLevel& level, BlockFormat format, BlockEncoderKernel kernel)
+{
+    const uint32_t blocksX = (level.width + 3) / 4;
+    const uint32_t blocksY = (level.height + 3) / 4;
+    const size_t bytesPerBlock = GetBlockFormatBytesPerBlock(format);
+
+    std::vector<uint8_t> result(size_t(blocksX) * blocksY * bytesPerBlock);
+
+    for (uint32_t blockY = 0; blockY < blocksY; blockY++)
+    {
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+        {
+            uint8_t blockPixels[16 * 4];
+            for (uint32_t y = 0; y < 4; y++)
+            {
+                const uint32_t sourceY = std::min(blockY * 4 + y, level.height - 1);
+                for (uint32_t x = 0; x < 4; x++)
+                {
+                    const uint32_t sourceX = std::min(blockX * 4 + x, level.width - 1);
+                    memcpy(&blockPixels[(y * 4 + x) * 4], &level.pixels[(size_t(sourceY) * level.width + sourceX) * 4], 4);
+                }
+            }
+
+            CompressBlock(blockPixels, format, kernel, &result[(size_t(blockY) * blocksX + blockX) * bytesPerBlock]);
+        }
+    }
+
+    return result;
+}
+
+bool WriteDdsFile(const std::filesystem::path& fileName, BlockFormat format, bool srgb, uint32_t width, uint32_t height,
+    const std::vector<std::vector<uint8_t>>& levels)
+{
+    // DDS_HEADER followed by DDS_HEADER_DXT10, see the DirectX documentation
+    struct DdsHeader
+    {
+        uint32_t magic;
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitchOrLinearSize;
+        uint32_t depth;
+        uint32_t mipMapCount;
+        uint32_t reserved1[11];
+        uint32_t pixelFormatSize;
+        uint32_t pixelFormatFlags;
+        uint32_t fourCC;
+        uint32_t rgbBitCount;
+        uint32_t bitMasks[4];
+        uint32_t caps[4];
+        uint32_t reserved2;
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+    static_assert(sizeof(DdsHeader) == 4 + 124 + 20);
+
+    DdsHeader header{};
+    header.magic = 0x20534444; // "DDS "
+    header.size = 124;
+    header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT | LINEARSIZE
+    header.height = height;
+    header.width = width;
+    header.pitchOrLinearSize = levels.empty() ? 0 : uint32_t(levels[0].size());
+    header.mipMapCount = uint32_t(levels.size());
+    header.pixelFormatSize = 32;
+    header.pixelFormatFlags = 0x4; // DDPF_FOURCC
+    header.fourCC = 0x30315844; // "DX10"
+    header.caps[0] = 0x1000 | 0x400000 | 0x8; // TEXTURE | MIPMAP | COMPLEX
+    header.dxgiFormat = GetBlockFormatDxgiFormat(format, srgb);
+    header.resourceDimension = 3; // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+    header.arraySize = 1;
+
+    // Write to a temporary file first so that an interrupted run never leaves a truncated texture behind
+    std::filesystem::path temporaryFileName = fileName;
+    temporaryFileName += ".tmp";
+
+    {
+        std::ofstream file(temporaryFileName, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& level : levels)
+            file.write(reinterpret_cast<const char*>(level.data()), std::streamsize(level.size()));
+
+        if (!file.good())
+        {
+            file.close();
+            std::error_code error;
+            std::filesystem::remove(temporaryFileName, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryFileName, fileName, error);
+    if (error)
+    {
+        std::filesystem::remove(temporaryFileName, error);
+        return false;
+    }
+
+    return true;
+}
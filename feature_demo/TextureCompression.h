@@ -0,0 +1,73 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Block-compressed formats written by the texture_bake tool
+enum class BlockFormat
+{
+    BC1, // RGB, 4 bits per pixel
+    BC3, // RGB + interpolated alpha, 8 bits per pixel
+    BC5, // two independent channels for normal maps, 8 bits per pixel
+    BC7  // RGBA, encoded in mode 6 only, 8 bits per pixel
+};
+
+const char* GetBlockFormatName(BlockFormat format);
+size_t GetBlockFormatBytesPerBlock(BlockFormat format);
+uint32_t GetBlockFormatDxgiFormat(BlockFormat format, bool srgb);
+
+enum class BlockEncoderKernel
+{
+    Scalar,
+    SSE
+};
+
+// The SSE kernel matches every 4 pixels of a block against all palette entries at once
+BlockEncoderKernel GetBestBlockEncoderKernel();
+const char* GetBlockEncoderKernelName(BlockEncoderKernel kernel);
+
+// One mip level of an RGBA8 image, rows are tightly packed
+struct ImageLevel
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// Returns the base level followed by every smaller level down to 1x1, each one box-filtered from the previous level.
+// Filtering happens in linear space for sRGB images; normal maps are filtered as unit vectors and renormalized.
+std::vector<ImageLevel> GenerateMipChain(ImageLevel baseLevel, bool srgb, bool normalMap);
+
+// Encodes a 4x4 block of RGBA8 pixels into GetBlockFormatBytesPerBlock(format) bytes
+void CompressBlock(const uint8_t* blockPixels, BlockFormat format, BlockEncoderKernel kernel, uint8_t* output);
+
+// Encodes a whole level, replicating the edge pixels into the blocks that stick out of it
+std::vector<uint8_t> CompressLevel(const ImageLevel& level, BlockFormat format, BlockEncoderKernel kernel);
+
+// Writes a DDS file with a DX10 header holding the given compressed levels, the largest one first
+bool WriteDdsFile(const std::filesystem::path& fileName, BlockFormat format, bool srgb, uint32_t width, uint32_t height,
+    const std::vector<std::vector<uint8_t>>& levels);
@@ -0,0 +1,480 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "TextureStreamer.h"
+
+#include <donut/core/log.h>
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/SceneTypes.h>
+#include <donut/engine/View.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <unordered_map>
+
+using namespace donut;
+using namespace donut::math;
+using namespace donut::engine;
+
+// Limit on the texture data uploaded in one frame, to keep the streaming from causing frame time spikes
+static const uint64_t c_MaxUploadBytesPerFrame = 32 * 1024 * 1024;
+
+// Enough to read any DDS header, including the DX10 extension
+static const size_t c_MaxDdsHeaderSize = 148;
+
+TextureStreamer::TextureStreamer(nvrhi::IDevice* device, std::shared_ptr<MappedFileSystem> fileSystem, uint64_t budgetBytes)
+    : m_Device(device)
+    , m_FileSystem(std::move(fileSystem))
+    , m_BudgetBytes(budgetBytes)
+{
+    m_Thread = std::thread(&TextureStreamer::WorkerThread, this);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Terminate = true;
+    }
+    m_Condition.notify_all();
+    m_Thread.join();
+}
+
+void TextureStreamer::Register(const SceneGraph& sceneGraph,
+    const std::function<std::filesystem::path(const std::filesystem::path&)>& getNativeFileName)
+{
+    Clear();
+
+    const size_t notStreamed = ~size_t(0);
+    std::unordered_map<const LoadedTexture*, size_t> textureIndices;
+
+    auto findTexture = [&](const std::shared_ptr<LoadedTexture>& loadedTexture)
+    {
+        if (!loadedTexture || !loadedTexture->texture)
+            return notStreamed;
+
+        auto it = textureIndices.find(loadedTexture.get());
+        if (it != textureIndices.end())
+            return it->second;
+
+        size_t index = notStreamed;
+        const std::filesystem::path fileName = getNativeFileName(loadedTexture->path);
+
+        std::ifstream file(fileName, std::ios::binary);
+        char header[c_MaxDdsHeaderSize];
+        file.read(header, sizeof(header));
+
+        ConvertedTextureInfo info;
+        if (fileName.extension() == ".dds" && MappedFileSystem::ParseConvertedTexture(header, size_t(file.gcount()), info))
+        {
+            // Only the textures that MappedFileSystem served with their tail levels are streamed
+            const nvrhi::TextureDesc& desc = loadedTexture->texture->getDesc();
+            const uint32_t tailLevel = info.mipLevels - std::min(desc.mipLevels, info.mipLevels);
+
+            if (tailLevel > 0 && desc.width == info.GetLevelWidth(tailLevel) && desc.height == info.GetLevelHeight(tailLevel))
+            {
+                StreamedTexture texture;
+                texture.texture = loadedTexture;
+                texture.fileName = fileName;
+                texture.info = info;
+                texture.tailLevel = tailLevel;
+                texture.residentLevel = tailLevel;
+                texture.desiredLevel = tailLevel;
+
+                m_ResidentBytes += GetResidentSize(texture, tailLevel);
+                index = m_Textures.size();
+                m_Textures.push_back(std::move(texture));
+            }
+        }
+
+        textureIndices[loadedTexture.get()] = index;
+        return index;
+    };
+
+    for (const auto& instance : sceneGraph.GetMeshInstances())
+    {
+        InstanceTextures entry;
+        entry.instance = instance.get();
+
+        for (const auto& geometry : instance->GetMesh()->geometries)
+        {
+            const Material* material = geometry->material.get();
+            if (!material)
+                continue;
+
+            for (const auto* texture : { &material->baseOrDiffuseTexture, &material->metalRoughOrSpecularTexture, &material->normalTexture,
+                &material->emissiveTexture, &material->occlusionTexture, &material->transmissionTexture })
+            {
+                const size_t index = findTexture(*texture);
+                if (index != notStreamed && std::find(entry.textures.begin(), entry.textures.end(), index) == entry.textures.end())
+                    entry.textures.push_back(index);
+            }
+        }
+
+        if (!entry.textures.empty())
+            m_Instances.push_back(std::move(entry));
+    }
+
+    if (!m_Textures.empty())
+    {
+        log::info("Streaming %zu textures, %.1f MB loaded with the scene", m_Textures.size(), double(m_ResidentBytes) / (1024.0 * 1024.0));
+    }
+}
+
+void TextureStreamer::Clear()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Queue.clear();
+        m_Completed.clear();
+        ++m_Generation;
+    }
+
+    m_Textures.clear();
+    m_Instances.clear();
+    m_PendingEvictions.clear();
+    m_ResidentBytes = 0;
+    m_ReservedBytes = 0;
+}
+
+uint64_t TextureStreamer::GetResidentSize(const StreamedTexture& texture, uint32_t firstLevel) const
+{
+    return texture.info.GetLevelOffset(texture.info.mipLevels) - texture.info.GetLevelOffset(firstLevel);
+}
+
+void TextureStreamer::Update(const IView& view, uint32_t frameIndex)
+{
+    if (m_Textures.empty())
+        return;
+
+    // Take back the reads that the worker has not started yet, they are prioritized again below
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (const ReadRequest& request : m_Queue)
+        {
+            m_Textures[request.textureIndex].readPending = false;
+            m_ReservedBytes -= request.reservedBytes;
+        }
+        m_Queue.clear();
+    }
+
+    const float3 viewOrigin = view.GetViewOrigin();
+    const frustum viewFrustum = view.GetViewFrustum();
+    const float projectionScale = view.GetProjectionMatrix(false).row1.y;
+    const float viewportHeight = float(view.GetViewExtent().height());
+
+    for (StreamedTexture& texture : m_Textures)
+        texture.projectedSize = 0.f;
+
+    for (const InstanceTextures& entry : m_Instances)
+    {
+        const box3 bounds = entry.instance->GetNode()->GetGlobalBoundingBox();
+        if (bounds.isempty() || !viewFrustum.intersectsWith(bounds))
+            continue;
+
+        // Size of the bounding sphere on the screen, instances around the camera need the full resolution
+        const float radius = length(bounds.diagonal()) * 0.5f;
+        const float distance = length(bounds.center() - viewOrigin) - radius;
+        const float projectedSize = distance > 0.f ? radius * projectionScale * viewportHeight / distance : FLT_MAX;
+
+        for (size_t index : entry.textures)
+        {
+            StreamedTexture& texture = m_Textures[index];
+            texture.lastVisibleFrame = frameIndex;
+            texture.projectedSize = std::max(texture.projectedSize, projectedSize);
+        }
+    }
+
+    // Assume that the texture covers the instance once, so it needs about one texel per pixel of the projected size
+    for (StreamedTexture& texture : m_Textures)
+    {
+        texture.desiredLevel = texture.tailLevel;
+        if (texture.projectedSize <= 0.f)
+            continue;
+
+        const float textureSize = float(std::max(texture.info.width, texture.info.height));
+        uint32_t level = texture.projectedSize >= textureSize ? 0 : uint32_t(std::log2(textureSize / texture.projectedSize));
+        level = std::min(level, texture.tailLevel);
+        while (level > 0 && !texture.info.CanStartAtLevel(level))
+            --level;
+
+        texture.desiredLevel = level;
+    }
+
+    std::vector<size_t> candidates;
+    for (size_t index = 0; index < m_Textures.size(); index++)
+    {
+        const StreamedTexture& texture = m_Textures[index];
+        if (texture.desiredLevel < texture.residentLevel && !texture.readPending)
+            candidates.push_back(index);
+    }
+
+    uint64_t projectedBytes = m_ResidentBytes + m_ReservedBytes;
+    uint64_t wantedBytes = 0;
+    for (size_t index : candidates)
+    {
+        const StreamedTexture& texture = m_Textures[index];
+        wantedBytes += GetResidentSize(texture, texture.desiredLevel) - GetResidentSize(texture, texture.residentLevel);
+    }
+
+    // Make room for the visible textures by dropping the least recently visible ones back to their tail levels
+    m_PendingEvictions.clear();
+    if (projectedBytes + wantedBytes > m_BudgetBytes)
+    {
+        std::vector<size_t> evictionCandidates;
+        for (size_t index = 0; index < m_Textures.size(); index++)
+        {
+            const StreamedTexture& texture = m_Textures[index];
+            if (texture.residentLevel < texture.tailLevel && texture.lastVisibleFrame != frameIndex)
+                evictionCandidates.push_back(index);
+        }
+
+        std::sort(evictionCandidates.begin(), evictionCandidates.end(), [this](size_t a, size_t b)
+        {
+            return m_Textures[a].lastVisibleFrame < m_Textures[b].lastVisibleFrame;
+        });
+
+        for (size_t index : evictionCandidates)
+        {
+            if (projectedBytes + wantedBytes <= m_BudgetBytes)
+                break;
+
+            const StreamedTexture& texture = m_Textures[index];
+            projectedBytes -= GetResidentSize(texture, texture.residentLevel) - GetResidentSize(texture, texture.tailLevel);
+            m_PendingEvictions.push_back(index);
+        }
+    }
+
+    // Read the missing levels of the largest textures on the screen first.
+    // Textures that do not fit into the budget get the largest level that does.
+    std::sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b)
+    {
+        return m_Textures[a].projectedSize > m_Textures[b].projectedSize;
+    });
+
+    std::vector<ReadRequest> requests;
+    for (size_t index : candidates)
+    {
+        StreamedTexture& texture = m_Textures[index];
+
+        uint32_t level = texture.desiredLevel;
+        while (level < texture.residentLevel && projectedBytes + GetResidentSize(texture, level) - GetResidentSize(texture, texture.residentLevel) > m_BudgetBytes)
+        {
+            do
+                ++level;
+            while (level < texture.residentLevel && !texture.info.CanStartAtLevel(level));
+        }
+
+        if (level >= texture.residentLevel)
+            continue;
+
+        const uint64_t additionalBytes = GetResidentSize(texture, level) - GetResidentSize(texture, texture.residentLevel);
+        projectedBytes += additionalBytes;
+        m_ReservedBytes += additionalBytes;
+        texture.readPending = true;
+
+        ReadRequest request;
+        request.textureIndex = index;
+        request.firstLevel = level;
+        request.endLevel = texture.residentLevel;
+        request.fileName = texture.fileName;
+        request.info = texture.info;
+        request.reservedBytes = additionalBytes;
+        requests.push_back(std::move(request));
+    }
+
+    if (!requests.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            for (ReadRequest& request : requests)
+            {
+                request.generation = m_Generation;
+                m_Queue.push_back(std::move(request));
+            }
+        }
+        m_Condition.notify_one();
+    }
+}
+
+bool TextureStreamer::HasPendingUploads() const
+{
+    if (!m_PendingEvictions.empty())
+        return true;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return !m_Completed.empty();
+}
+
+bool TextureStreamer::ProcessUploads(nvrhi::ICommandList* commandList)
+{
+    bool texturesReplaced = false;
+
+    for (size_t index : m_PendingEvictions)
+    {
+        StreamedTexture& texture = m_Textures[index];
+        if (texture.residentLevel < texture.tailLevel)
+        {
+            ReplaceTexture(commandList, texture, texture.tailLevel, nullptr);
+            ++m_Evictions;
+            texturesReplaced = true;
+        }
+    }
+    m_PendingEvictions.clear();
+
+    std::vector<CompletedRead> completed;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        generation = m_Generation;
+
+        uint64_t uploadBytes = 0;
+        size_t count = 0;
+        while (count < m_Completed.size() && (count == 0 || uploadBytes + m_Completed[count].data.size() <= c_MaxUploadBytesPerFrame))
+            uploadBytes += m_Completed[count++].data.size();
+
+        completed.assign(std::make_move_iterator(m_Completed.begin()), std::make_move_iterator(m_Completed.begin() + ptrdiff_t(count)));
+        m_Completed.erase(m_Completed.begin(), m_Completed.begin() + ptrdiff_t(count));
+    }
+
+    for (const CompletedRead& read : completed)
+    {
+        if (read.request.generation != generation)
+            continue;
+
+        StreamedTexture& texture = m_Textures[read.request.textureIndex];
+        texture.readPending = false;
+        m_ReservedBytes -= read.request.reservedBytes;
+
+        // Keep the texture at its current levels when the file cannot be read, instead of trying again every frame
+        if (read.data.empty())
+        {
+            log::warning("Cannot stream the texture '%s'", read.request.fileName.generic_string().c_str());
+            texture.tailLevel = texture.residentLevel;
+            continue;
+        }
+
+        // The texture may have been evicted while its levels were being read
+        if (read.request.endLevel != texture.residentLevel)
+            continue;
+
+        ReplaceTexture(commandList, texture, read.request.firstLevel, &read);
+        m_UploadedBytes += read.data.size();
+        texturesReplaced = true;
+    }
+
+    return texturesReplaced;
+}
+
+void TextureStreamer::ReplaceTexture(nvrhi::ICommandList* commandList, StreamedTexture& texture, uint32_t newLevel, const CompletedRead* read)
+{
+    const ConvertedTextureInfo& info = texture.info;
+    nvrhi::ITexture* oldTexture = texture.texture->texture;
+
+    nvrhi::TextureDesc desc = oldTexture->getDesc();
+    desc.width = info.GetLevelWidth(newLevel);
+    desc.height = info.GetLevelHeight(newLevel);
+    desc.mipLevels = info.mipLevels - newLevel;
+    desc.initialState = nvrhi::ResourceStates::ShaderResource;
+    desc.keepInitialState = true;
+
+    nvrhi::TextureHandle newTexture = m_Device->createTexture(desc);
+
+    for (uint32_t level = newLevel; level < info.mipLevels; level++)
+    {
+        if (level < texture.residentLevel)
+        {
+            // New levels come from the file
+            const size_t offset = info.GetLevelOffset(level) - info.GetLevelOffset(read->request.firstLevel);
+            commandList->writeTexture(newTexture, 0, level - newLevel, read->data.data() + offset, info.GetLevelRowPitch(level));
+        }
+        else
+        {
+            // Levels that are already on the GPU are copied from the old texture
+            commandList->copyTexture(
+                newTexture, nvrhi::TextureSlice().setMipLevel(level - newLevel),
+                oldTexture, nvrhi::TextureSlice().setMipLevel(level - texture.residentLevel));
+        }
+    }
+
+    m_ResidentBytes -= GetResidentSize(texture, texture.residentLevel);
+    m_ResidentBytes += GetResidentSize(texture, newLevel);
+
+    texture.texture->texture = newTexture;
+    texture.residentLevel = newLevel;
+}
+
+TextureStreamer::Statistics TextureStreamer::GetStatistics() const
+{
+    Statistics statistics;
+    statistics.streamedTextures = uint32_t(m_Textures.size());
+    statistics.residentBytes = m_ResidentBytes;
+    statistics.budgetBytes = m_BudgetBytes;
+    statistics.uploadedBytes = m_UploadedBytes;
+    statistics.evictions = m_Evictions;
+
+    for (const StreamedTexture& texture : m_Textures)
+    {
+        if (texture.residentLevel == 0)
+            ++statistics.fullyResidentTextures;
+        if (texture.readPending)
+            ++statistics.pendingReads;
+        statistics.fullResolutionBytes += GetResidentSize(texture, 0);
+    }
+
+    return statistics;
+}
+
+void TextureStreamer::WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+
+    while (true)
+    {
+        m_Condition.wait(lock, [this]() { return m_Terminate || !m_Queue.empty(); });
+        if (m_Terminate)
+            return;
+
+        CompletedRead read;
+        read.request = std::move(m_Queue.front());
+        m_Queue.erase(m_Queue.begin());
+        lock.unlock();
+
+        // Copying the levels out of the mapping faults the pages in here instead of on the render thread
+        const ConvertedTextureInfo& info = read.request.info;
+        const size_t begin = info.GetLevelOffset(read.request.firstLevel);
+        const size_t end = info.GetLevelOffset(read.request.endLevel);
+
+        if (auto file = m_FileSystem->MapFile(read.request.fileName))
+        {
+            const uint8_t* data = static_cast<const uint8_t*>(file->data());
+            if (file->size() >= end)
+                read.data.assign(data + begin, data + end);
+        }
+
+        lock.lock();
+        if (read.request.generation == m_Generation)
+            m_Completed.push_back(std::move(read));
+    }
+}
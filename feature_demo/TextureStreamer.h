@@ -0,0 +1,154 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "MappedFileSystem.h"
+
+#include <nvrhi/nvrhi.h>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace donut::engine
+{
+    struct LoadedTexture;
+    class IView;
+    class MeshInstance;
+    class SceneGraph;
+}
+
+// Default limit on the memory taken by the streamed textures, in megabytes
+static constexpr uint64_t c_DefaultTextureStreamingBudget = 1024;
+
+// Largest width or height of the texture levels that MappedFileSystem serves at load time
+static constexpr uint32_t c_TextureStreamingTailSize = 64;
+
+// Streams the larger mip levels of converted DDS textures after the scene has loaded.
+// MappedFileSystem serves these textures with their tail levels only, so the scene is renderable right away.
+// Every frame, Update estimates the level that each texture needs from the projected size of the visible instances
+// using it, and a worker thread reads the missing levels from the mapped files, largest on-screen textures first.
+// ProcessUploads then replaces the texture objects with larger ones, limited to a number of bytes per frame.
+// When the textures exceed the memory budget, the least recently visible ones are dropped back to their tail levels.
+class TextureStreamer
+{
+public:
+    struct Statistics
+    {
+        uint32_t streamedTextures = 0;
+        uint32_t fullyResidentTextures = 0;
+        uint32_t pendingReads = 0;
+        uint64_t residentBytes = 0;
+        uint64_t fullResolutionBytes = 0;
+        uint64_t budgetBytes = 0;
+        uint64_t uploadedBytes = 0;
+        uint32_t evictions = 0;
+    };
+
+    TextureStreamer(nvrhi::IDevice* device, std::shared_ptr<MappedFileSystem> fileSystem, uint64_t budgetBytes);
+    ~TextureStreamer();
+
+    // Finds the textures of the scene that were loaded with their tail levels only.
+    // getNativeFileName maps the paths of the textures in the root file system to the files on the disk.
+    void Register(const donut::engine::SceneGraph& sceneGraph,
+        const std::function<std::filesystem::path(const std::filesystem::path&)>& getNativeFileName);
+
+    // Forgets all textures and drops the outstanding reads, call before the scene is unloaded
+    void Clear();
+
+    void Update(const donut::engine::IView& view, uint32_t frameIndex);
+
+    [[nodiscard]] bool HasPendingUploads() const;
+
+    // Records the uploads and evictions into the command list. Returns true when any texture object was replaced,
+    // the binding sets that reference the scene textures must then be recreated.
+    bool ProcessUploads(nvrhi::ICommandList* commandList);
+
+    [[nodiscard]] Statistics GetStatistics() const;
+
+private:
+    struct StreamedTexture
+    {
+        std::shared_ptr<donut::engine::LoadedTexture> texture;
+        std::filesystem::path fileName;
+        ConvertedTextureInfo info;
+        uint32_t tailLevel = 0;      // level the texture was loaded with, never evicted
+        uint32_t residentLevel = 0;  // first level in the current texture object
+        uint32_t desiredLevel = 0;
+        float projectedSize = 0.f;   // largest size in pixels of the visible instances using the texture this frame
+        uint32_t lastVisibleFrame = 0;
+        bool readPending = false;
+    };
+
+    struct ReadRequest
+    {
+        size_t textureIndex = 0;
+        uint32_t firstLevel = 0;
+        uint32_t endLevel = 0;
+        std::filesystem::path fileName;
+        ConvertedTextureInfo info;
+        uint64_t reservedBytes = 0;
+        uint64_t generation = 0;
+    };
+
+    struct CompletedRead
+    {
+        ReadRequest request;
+        std::vector<uint8_t> data; // levels firstLevel to endLevel - 1, empty if the file could not be read
+    };
+
+    struct InstanceTextures
+    {
+        donut::engine::MeshInstance* instance = nullptr;
+        std::vector<size_t> textures;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    std::shared_ptr<MappedFileSystem> m_FileSystem;
+    uint64_t m_BudgetBytes;
+
+    std::vector<StreamedTexture> m_Textures;
+    std::vector<InstanceTextures> m_Instances;
+    std::vector<size_t> m_PendingEvictions;
+    uint64_t m_ResidentBytes = 0;
+    uint64_t m_ReservedBytes = 0;  // size of the levels being read
+    uint64_t m_UploadedBytes = 0;
+    uint32_t m_Evictions = 0;
+
+    // Shared with the worker thread
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    std::vector<ReadRequest> m_Queue;  // sorted by priority, the next read first
+    std::vector<CompletedRead> m_Completed;
+    uint64_t m_Generation = 0;
+    bool m_Terminate = false;
+    std::thread m_Thread;
+
+    [[nodiscard]] uint64_t GetResidentSize(const StreamedTexture& texture, uint32_t firstLevel) const;
+    void ReplaceTexture(nvrhi::ICommandList* commandList, StreamedTexture& texture, uint32_t newLevel, const CompletedRead* read);
+    void WorkerThread();
+};